@@ -5,10 +5,14 @@
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
 #include "include/buffer.h"
+#include "include/crc32c.h"
 #include "xxHash/xxhash.h"
 
 class Checksummer {
 public:
+  /// max number of csum blocks hashed together by the batch interface
+  static const unsigned BATCH = 16;
+
   struct crc32c {
     typedef __le32 value_t;
 
@@ -26,6 +30,20 @@ public:
       ) {
       return p.crc32c(len, -1);
     }
+
+    static void calc_batch(
+      state_t state,
+      size_t len,
+      unsigned n,
+      const unsigned char **bufs,
+      value_t *vals
+      ) {
+      uint32_t crcs[BATCH];
+      ceph_crc32c_multi(-1, bufs, n, len, crcs);
+      for (unsigned i = 0; i < n; ++i) {
+	vals[i] = crcs[i];
+      }
+    }
   };
 
   struct crc32c_16 {
@@ -45,6 +63,20 @@ public:
       ) {
       return p.crc32c(len, -1) & 0xffff;
     }
+
+    static void calc_batch(
+      state_t state,
+      size_t len,
+      unsigned n,
+      const unsigned char **bufs,
+      value_t *vals
+      ) {
+      uint32_t crcs[BATCH];
+      ceph_crc32c_multi(-1, bufs, n, len, crcs);
+      for (unsigned i = 0; i < n; ++i) {
+	vals[i] = crcs[i] & 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -64,6 +96,20 @@ public:
       ) {
       return p.crc32c(len, -1) & 0xff;
     }
+
+    static void calc_batch(
+      state_t state,
+      size_t len,
+      unsigned n,
+      const unsigned char **bufs,
+      value_t *vals
+      ) {
+      uint32_t crcs[BATCH];
+      ceph_crc32c_multi(-1, bufs, n, len, crcs);
+      for (unsigned i = 0; i < n; ++i) {
+	vals[i] = crcs[i] & 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -91,6 +137,18 @@ public:
       }
       return XXH32_digest(state);
     }
+
+    static void calc_batch(
+      state_t state,
+      size_t len,
+      unsigned n,
+      const unsigned char **bufs,
+      value_t *vals
+      ) {
+      for (unsigned i = 0; i < n; ++i) {
+	vals[i] = XXH32(bufs[i], len, -1);
+      }
+    }
   };
 
   struct xxhash64 {
@@ -118,6 +176,18 @@ public:
       }
       return XXH64_digest(state);
     }
+
+    static void calc_batch(
+      state_t state,
+      size_t len,
+      unsigned n,
+      const unsigned char **bufs,
+      value_t *vals
+      ) {
+      for (unsigned i = 0; i < n; ++i) {
+	vals[i] = XXH64(bufs[i], len, -1);
+      }
+    }
   };
 
   template<class Alg>
@@ -181,6 +251,111 @@ public:
     Alg::fini(&state);
     return -1;  // no errors
   }
+
+  /**
+   * calculate values for up to BATCH csum blocks at once
+   *
+   * Blocks that are contiguous in memory are gathered and handed to
+   * Alg::calc_batch so that they can be hashed together.  A block that
+   * straddles a buffer boundary ends the batch and, if it is first, is
+   * hashed on its own with Alg::calc.
+   *
+   * @returns number of values written to vals
+   */
+  template<class Alg>
+  static unsigned _calc_blocks(
+    typename Alg::state_t state,
+    size_t csum_block_size,
+    size_t blocks,
+    bufferlist::const_iterator& p,
+    typename Alg::value_t *vals
+    ) {
+    const unsigned char *bufs[BATCH];
+    unsigned n = 0;
+    while (n < blocks && n < BATCH) {
+      const char *data;
+      size_t l = p.get_ptr_and_advance(csum_block_size, &data);
+      if (l < csum_block_size) {
+	p.advance(-(ssize_t)l);
+	break;
+      }
+      bufs[n++] = reinterpret_cast<const unsigned char*>(data);
+    }
+    if (n == 0) {
+      vals[0] = Alg::calc(state, csum_block_size, p);
+      return 1;
+    }
+    Alg::calc_batch(state, csum_block_size, n, bufs, vals);
+    return n;
+  }
+
+  template<class Alg>
+  static int calculate_batch(
+    size_t csum_block_size,
+    size_t offset,
+    size_t length,
+    const bufferlist &bl,
+    bufferptr* csum_data
+    ) {
+    assert(length % csum_block_size == 0);
+    size_t blocks = length / csum_block_size;
+    bufferlist::const_iterator p = bl.begin();
+    assert(bl.length() >= length);
+
+    typename Alg::state_t state;
+    Alg::init(&state);
+
+    assert(csum_data->length() >= (offset + length) / csum_block_size *
+	   sizeof(typename Alg::value_t));
+
+    typename Alg::value_t *pv =
+      reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
+    pv += offset / csum_block_size;
+    while (blocks > 0) {
+      unsigned n = _calc_blocks<Alg>(state, csum_block_size, blocks, p, pv);
+      pv += n;
+      blocks -= n;
+    }
+    Alg::fini(&state);
+    return 0;
+  }
+
+  template<class Alg>
+  static int verify_batch(
+    size_t csum_block_size,
+    size_t offset,
+    size_t length,
+    const bufferlist &bl,
+    const bufferptr& csum_data
+    ) {
+    assert(length % csum_block_size == 0);
+    size_t blocks = length / csum_block_size;
+    bufferlist::const_iterator p = bl.begin();
+    assert(bl.length() >= length);
+
+    typename Alg::state_t state;
+    Alg::init(&state);
+
+    const typename Alg::value_t *pv =
+      reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
+    pv += offset / csum_block_size;
+    size_t pos = offset;
+    typename Alg::value_t vals[BATCH];
+    while (blocks > 0) {
+      unsigned n = _calc_blocks<Alg>(state, csum_block_size, blocks, p, vals);
+      for (unsigned i = 0; i < n; ++i) {
+	if (*pv != vals[i]) {
+	  Alg::fini(&state);
+	  return pos;
+	}
+	++pv;
+	pos += csum_block_size;
+      }
+      blocks -= n;
+    }
+    Alg::fini(&state);
+    return -1;  // no errors
+  }
 };
 
 #endif
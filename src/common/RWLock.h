@@ -187,6 +187,11 @@ public:
       m_lock.get_write();
       locked = true;
     }
+    void lock() {
+      assert(!locked);
+      m_lock.get_write();
+      locked = true;
+    }
     void unlock() {
       assert(locked);
       m_lock.unlock();
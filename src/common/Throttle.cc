@@ -355,15 +355,25 @@ std::chrono::duration<double> BackoffThrottle::_get_delay(uint64_t c) const
   }
 }
 
+bool BackoffThrottle::_should_wait(uint64_t c) const
+{
+  return !(_get_delay(c) == std::chrono::duration<double>(0) &&
+	   waiters.empty() &&
+	   ((max == 0) || (current == 0) || ((current + c) <= max)));
+}
+
+bool BackoffThrottle::should_wait(uint64_t c)
+{
+  locker l(lock);
+  return _should_wait(c);
+}
+
 std::chrono::duration<double> BackoffThrottle::get(uint64_t c)
 {
   locker l(lock);
-  auto delay = _get_delay(c);
 
   // fast path
-  if (delay == std::chrono::duration<double>(0) &&
-      waiters.empty() &&
-      ((max == 0) || (current == 0) || ((current + c) <= max))) {
+  if (!_should_wait(c)) {
     current += c;
     return std::chrono::duration<double>(0);
   }
@@ -375,7 +385,7 @@ std::chrono::duration<double> BackoffThrottle::get(uint64_t c)
   }
 
   auto start = std::chrono::system_clock::now();
-  delay = _get_delay(c);
+  auto delay = _get_delay(c);
   while (true) {
     if (!((max == 0) || (current == 0) || (current + c) <= max)) {
       (*ticket)->wait(l);
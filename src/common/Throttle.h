@@ -181,6 +181,7 @@ class BackoffThrottle {
   uint64_t current = 0;
 
   std::chrono::duration<double> _get_delay(uint64_t c) const;
+  bool _should_wait(uint64_t c) const;
 
 public:
   /**
@@ -208,6 +209,9 @@ public:
   uint64_t get_current();
   uint64_t get_max();
 
+  /// true if get(c) would block or back off right now
+  bool should_wait(uint64_t c = 1);
+
   BackoffThrottle(
     unsigned expected_concurrency ///< [in] determines size of conds
     ) : conds(expected_concurrency) {}
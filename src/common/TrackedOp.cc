@@ -12,6 +12,7 @@
 
 #include "TrackedOp.h"
 #include "common/Formatter.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "common/debug.h"
@@ -302,7 +303,120 @@ void OpTracker::_mark_event(TrackedOp *op, const string &evt,
      
 }
 
+// latency in nanoseconds, from 1us up to 2^30us
+const PerfHistogram::axis_config_d OpTracker::stage_axis_config = {
+  "Latency (nsec)",
+  PerfHistogram::SCALE_LOG2,
+  0,
+  1000,
+  32,
+};
+
+static const char *stage_names[TRACKED_OP_STAGE_MAX] = {
+  "queued_for_pg",
+  "dequeued",
+  "reached_pg",
+  "started",
+  "sub_op_sent",
+  "txn_submitted",
+  "journal_queued",
+  "journal_written",
+  "local_commit",
+  "replica_commit",
+  "commit_sent",
+  "done",
+};
+
+const char *OpTracker::get_stage_name(tracked_op_stage_t stage)
+{
+  assert(stage < TRACKED_OP_STAGE_MAX);
+  return stage_names[stage];
+}
+
+void OpTracker::set_sample_rate(uint32_t rate)
+{
+  if (rate) {
+    // calibrates once, and leaves no clock where rdtsc is unimplemented
+    Cycles::init();
+    if (!Cycles::per_second()) {
+      dout(0) << "no cycle counter, not sampling op stages" << dendl;
+      rate = 0;
+    }
+  }
+  sample_rate.set(rate);
+}
+
+void OpTracker::start_sampling(TrackedOp *op)
+{
+  op->stages.reset(new TrackedOp::StageEvents);
+}
+
+void OpTracker::record_stages(TrackedOp *op)
+{
+  TrackedOp::StageEvents *stages = op->stages.get();
+  unsigned n = stages->num_events.load();
+  if (n > TrackedOp::StageEvents::MAX_EVENTS)
+    n = TrackedOp::StageEvents::MAX_EVENTS;
+  // events marked by different threads may have taken their slots out
+  // of order
+  vector<pair<uint64_t, uint8_t> > events;
+  events.reserve(n);
+  for (unsigned i = 0; i < n; ++i)
+    events.push_back(make_pair(stages->stamps[i], stages->ids[i]));
+  sort(events.begin(), events.end());
+
+  uint64_t prev = stages->start;
+  for (vector<pair<uint64_t, uint8_t> >::iterator i = events.begin();
+       i != events.end();
+       ++i) {
+    uint64_t ns = i->first > prev ?
+      Cycles::to_nanoseconds(i->first - prev) : 0;
+    stage_count[i->second].inc();
+    stage_sum_ns[i->second].add(ns);
+    stage_hist[i->second]->inc(ns);
+    prev = std::max(prev, i->first);
+  }
+  total_hist->inc(Cycles::to_nanoseconds(prev - stages->start));
+  sampled_ops.inc();
+}
+
+void OpTracker::dump_stage_latencies(Formatter *f)
+{
+  f->dump_unsigned("sample_rate", sample_rate.read());
+  f->dump_unsigned("sampled_ops", sampled_ops.read());
+  total_hist->dump_schema(f);
+  f->open_array_section("stages");
+  for (unsigned i = 0; i < TRACKED_OP_STAGE_MAX; ++i) {
+    uint64_t count = stage_count[i].read();
+    f->open_object_section("stage");
+    f->dump_string("stage", stage_names[i]);
+    f->dump_unsigned("count", count);
+    f->dump_unsigned("avg_ns", count ? stage_sum_ns[i].read() / count : 0);
+    stage_hist[i]->dump_values(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->open_object_section("total");
+  total_hist->dump_values(f);
+  f->close_section();
+}
+
+void OpTracker::reset_stage_latencies()
+{
+  sampled_ops.set(0);
+  for (unsigned i = 0; i < TRACKED_OP_STAGE_MAX; ++i) {
+    stage_count[i].set(0);
+    stage_sum_ns[i].set(0);
+    stage_hist[i]->reset();
+  }
+  total_hist->reset();
+}
+
 void OpTracker::RemoveOnDelete::operator()(TrackedOp *op) {
+  if (op->stages) {
+    op->mark_stage(TRACKED_OP_STAGE_DONE);
+    tracker->record_stages(op);
+  }
   if (!op->is_tracked) {
     op->_unregistered();
     delete op;
@@ -17,7 +17,9 @@
 #include <stdint.h>
 #include <include/utime.h>
 #include "common/Mutex.h"
+#include "common/Cycles.h"
 #include "common/histogram.h"
+#include "common/perf_histogram.h"
 #include "include/xlist.h"
 #include "msg/Message.h"
 #include "include/memory.h"
@@ -27,6 +29,27 @@
 class TrackedOp;
 typedef ceph::shared_ptr<TrackedOp> TrackedOpRef;
 
+/**
+ * Stage events recorded by sampled ops, see TrackedOp::mark_stage().
+ * The latency of a stage is the time from the previous stage event of
+ * the op, or from its creation, to this one.
+ */
+enum tracked_op_stage_t {
+  TRACKED_OP_STAGE_QUEUED_FOR_PG,   ///< dispatched
+  TRACKED_OP_STAGE_DEQUEUED,        ///< waited in the op queue
+  TRACKED_OP_STAGE_REACHED_PG,      ///< waited for the PG lock
+  TRACKED_OP_STAGE_STARTED,         ///< checked and prepared by the PG
+  TRACKED_OP_STAGE_SUB_OP_SENT,     ///< sent to the replicas
+  TRACKED_OP_STAGE_TXN_SUBMITTED,   ///< queued to the ObjectStore
+  TRACKED_OP_STAGE_JOURNAL_QUEUED,  ///< waited in the ObjectStore queue
+  TRACKED_OP_STAGE_JOURNAL_WRITTEN, ///< written to the journal
+  TRACKED_OP_STAGE_LOCAL_COMMIT,    ///< committed locally
+  TRACKED_OP_STAGE_REPLICA_COMMIT,  ///< acked by a replica
+  TRACKED_OP_STAGE_COMMIT_SENT,     ///< replied
+  TRACKED_OP_STAGE_DONE,            ///< released
+  TRACKED_OP_STAGE_MAX
+};
+
 class OpTracker;
 class OpHistory {
   set<pair<utime_t, TrackedOpRef> > arrived;
@@ -78,13 +101,34 @@ class OpTracker {
   bool tracking_enabled;
   RWLock       lock;
 
+  // 1 in sample_rate ops record their stages, none if 0
+  atomic_t sample_rate;
+  atomic64_t sampled_ops;
+  atomic64_t stage_count[TRACKED_OP_STAGE_MAX];
+  atomic64_t stage_sum_ns[TRACKED_OP_STAGE_MAX];
+  ceph::unique_ptr<PerfHistogram> stage_hist[TRACKED_OP_STAGE_MAX];
+  ceph::unique_ptr<PerfHistogram> total_hist;
+  void start_sampling(TrackedOp *op);
+  void record_stages(TrackedOp *op);
+
+  /// 1 in rate ops of each thread, so the threads share no counter
+  bool should_sample() {
+    uint32_t rate = sample_rate.read();
+    if (!rate)
+      return false;
+    static __thread uint32_t count = 0;
+    return ++count % rate == 0;
+  }
+
 public:
   CephContext *cct;
   OpTracker(CephContext *cct_, bool tracking, uint32_t num_shards) : seq(0), 
                                      num_optracker_shards(num_shards),
 				     complaint_time(0), log_threshold(0),
 				     tracking_enabled(tracking),
-				     lock("OpTracker::lock"), cct(cct_) {
+				     lock("OpTracker::lock"),
+				     sample_rate(0),
+				     sampled_ops(0), cct(cct_) {
 
     for (uint32_t i = 0; i < num_optracker_shards; i++) {
       char lock_name[32] = {0};
@@ -92,6 +136,11 @@ public:
       ShardedTrackingData* one_shard = new ShardedTrackingData(lock_name);
       sharded_in_flight_list.push_back(one_shard);
     }
+    vector<PerfHistogram::axis_config_d> axes;
+    axes.push_back(stage_axis_config);
+    for (unsigned i = 0; i < TRACKED_OP_STAGE_MAX; ++i)
+      stage_hist[i].reset(new PerfHistogram(axes));
+    total_hist.reset(new PerfHistogram(axes));
   }
       
   void set_complaint_and_threshold(float time, int threshold) {
@@ -105,6 +154,13 @@ public:
     RWLock::WLocker l(lock);
     tracking_enabled = enable;
   }
+  /// sample 1 in rate ops, or none if 0
+  void set_sample_rate(uint32_t rate);
+  /// latency histograms of the stages of the sampled ops
+  void dump_stage_latencies(Formatter *f);
+  void reset_stage_latencies();
+  static const char *get_stage_name(tracked_op_stage_t stage);
+  static const PerfHistogram::axis_config_d stage_axis_config;
   bool dump_ops_in_flight(Formatter *f, bool print_only_blocked=false);
   bool dump_historic_ops(Formatter *f);
   bool register_inflight_op(xlist<TrackedOp*>::item *i);
@@ -141,6 +197,8 @@ public:
     typename T::Ref retval(new T(params, this),
 			   RemoveOnDelete(this));
     retval->tracking_start();
+    if (should_sample())
+      start_sampling(retval.get());
     return retval;
   }
 };
@@ -162,6 +220,17 @@ protected:
   uint32_t warn_interval_multiplier; // limits output of a given op warning
   // Transitions from false -> true without locks being held
   atomic<bool> is_tracked; //whether in tracker and out of constructor
+
+  /// stage events of a sampled op, in the order their slots were taken
+  struct StageEvents {
+    static const unsigned MAX_EVENTS = 24;
+    uint64_t start; /// Cycles::rdtsc() when sampling started
+    std::atomic<unsigned> num_events;
+    uint8_t ids[MAX_EVENTS];
+    uint64_t stamps[MAX_EVENTS];
+    StageEvents() : start(Cycles::rdtsc()), num_events(0) {}
+  };
+  ceph::unique_ptr<StageEvents> stages; /// set if the op is sampled
   TrackedOp(OpTracker *_tracker, const utime_t& initiated) :
     xitem(this),
     tracker(_tracker),
@@ -197,6 +266,16 @@ public:
   }
 
   void mark_event(const string &event);
+  /// record a stage event if the op is sampled, without locking
+  void mark_stage(tracked_op_stage_t stage) {
+    if (!stages)
+      return;
+    unsigned i = stages->num_events++;
+    if (i < StageEvents::MAX_EVENTS) {
+      stages->ids[i] = stage;
+      stages->stamps[i] = Cycles::rdtsc();
+    }
+  }
   virtual const char *state_string() const {
     Mutex::Locker l(lock);
     return events.rbegin()->second.c_str();
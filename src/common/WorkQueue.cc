@@ -56,11 +56,15 @@ ThreadPool::ThreadPool(CephContext *cct_, string nm, string tn, int n, const cha
 
 void ThreadPool::TPHandle::suspend_tp_timeout()
 {
+  if (!hb)
+    return;
   cct->get_heartbeat_map()->clear_timeout(hb);
 }
 
 void ThreadPool::TPHandle::reset_tp_timeout()
 {
+  if (!hb)
+    return;
   cct->get_heartbeat_map()->reset_timeout(
     hb, grace, suicide_grace);
 }
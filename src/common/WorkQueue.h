@@ -39,6 +39,7 @@ class ThreadPool : public md_config_obs_t {
   int ioprio_class, ioprio_priority;
 
 public:
+  /// with a NULL hb, for work run outside of a thread pool, it does nothing
   class TPHandle {
     friend class ThreadPool;
     CephContext *cct;
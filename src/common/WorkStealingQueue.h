@@ -0,0 +1,338 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef WORK_STEALING_QUEUE_H
+#define WORK_STEALING_QUEUE_H
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
+
+#include "common/Cond.h"
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "include/utime.h"
+
+/**
+ * Sharded queue of items keyed by an ordering key (a PG), where idle
+ * consumers steal work from busy shards.
+ *
+ * Every key lives in a home shard chosen by the caller.  Producers
+ * push to the lock-free intake stack of the shard; the intake is moved
+ * to the per-key FIFOs by whoever next takes the shard lock.  A
+ * consumer claims a whole key from the ready list of its own shard or,
+ * failing that, of any other shard it can try-lock, pops up to a batch
+ * of its items and releases it.  A claimed key is never handed to a
+ * second consumer, so the items of a key are processed in order, but
+ * keys are served round-robin regardless of priority or cost.
+ */
+template <typename K, typename T>
+class WorkStealingQueue {
+  struct Node {
+    K key;
+    T item;
+    Node *next;
+    Node(const K &key, const T &item) : key(key), item(item), next(NULL) {}
+  };
+
+  struct KeyQueue {
+    std::list<T> items;
+    bool busy;   ///< claimed by a consumer
+    bool ready;  ///< on the ready list of the shard
+    KeyQueue() : busy(false), ready(false) {}
+  };
+
+  struct Shard {
+    std::atomic<Node*> intake;
+    Mutex lock;
+    Cond cond;
+    /// protected by lock
+    std::map<K, KeyQueue> keys;
+    std::list<K> ready;
+    std::atomic<unsigned> nready;  ///< ready.size(), readable unlocked
+    std::atomic<unsigned> sleepers;
+    std::atomic<uint64_t> queued;
+    std::atomic<uint64_t> stolen;
+    explicit Shard(const std::string &name)
+      : intake(NULL), lock(name), nready(0), sleepers(0), queued(0),
+	stolen(0) {}
+  };
+
+  std::vector<Shard*> shards;
+
+  /// move the intake of s to the key queues, oldest first
+  void drain_intake(Shard *s) {
+    assert(s->lock.is_locked_by_me());
+    Node *head = s->intake.exchange(NULL);
+    Node *fifo = NULL;
+    while (head) {
+      Node *next = head->next;
+      head->next = fifo;
+      fifo = head;
+      head = next;
+    }
+    while (fifo) {
+      Node *next = fifo->next;
+      KeyQueue &kq = s->keys[fifo->key];
+      kq.items.push_back(fifo->item);
+      make_ready(s, fifo->key, kq);
+      delete fifo;
+      fifo = next;
+    }
+  }
+
+  void make_ready(Shard *s, const K &key, KeyQueue &kq) {
+    if (!kq.busy && !kq.ready && !kq.items.empty()) {
+      kq.ready = true;
+      s->ready.push_back(key);
+      ++s->nready;
+    }
+  }
+
+  /// true if some shard has items a consumer could claim
+  bool any_claimable() const {
+    for (unsigned i = 0; i < shards.size(); ++i) {
+      if (shards[i]->intake.load() != NULL || shards[i]->nready.load() > 0)
+	return true;
+    }
+    return false;
+  }
+
+  /// claim the first ready key of s, which must be locked
+  bool claim_ready(Shard *s, K *key) {
+    drain_intake(s);
+    while (!s->ready.empty()) {
+      K k = s->ready.front();
+      s->ready.pop_front();
+      --s->nready;
+      typename std::map<K, KeyQueue>::iterator p = s->keys.find(k);
+      assert(p != s->keys.end() && p->second.ready);
+      p->second.ready = false;
+      p->second.busy = true;
+      *key = k;
+      return true;
+    }
+    return false;
+  }
+
+  void wake(unsigned shard) {
+    Shard *s = shards[shard];
+    if (s->sleepers.load() == 0) {
+      // no one is waiting here: let an idle consumer steal it
+      Shard *idle = NULL;
+      for (unsigned i = 1; i < shards.size(); ++i) {
+	Shard *o = shards[(shard + i) % shards.size()];
+	if (o->sleepers.load() > 0) {
+	  idle = o;
+	  break;
+	}
+      }
+      // every consumer is busy, and will look again after it counts
+      // itself a sleeper, see wait()
+      if (!idle)
+	return;
+      s = idle;
+    }
+    s->lock.Lock();
+    s->cond.SignalOne();
+    s->lock.Unlock();
+  }
+
+public:
+  explicit WorkStealingQueue(unsigned num_shards,
+			     const std::string &name = "WorkStealingQueue") {
+    assert(num_shards > 0);
+    for (unsigned i = 0; i < num_shards; ++i) {
+      char lock_name[64];
+      snprintf(lock_name, sizeof(lock_name), "%s.%u", name.c_str(), i);
+      shards.push_back(new Shard(lock_name));
+    }
+  }
+
+  ~WorkStealingQueue() {
+    for (unsigned i = 0; i < shards.size(); ++i) {
+      Node *n = shards[i]->intake.exchange(NULL);
+      while (n) {
+	Node *next = n->next;
+	delete n;
+	n = next;
+      }
+      delete shards[i];
+    }
+  }
+
+  unsigned get_num_shards() const {
+    return shards.size();
+  }
+
+  /// queue item behind the other items of key, without locking
+  void enqueue(unsigned shard, const K &key, const T &item) {
+    Shard *s = shards[shard];
+    Node *n = new Node(key, item);
+    ++s->queued;
+    n->next = s->intake.load();
+    while (!s->intake.compare_exchange_weak(n->next, n))
+      ;
+    wake(shard);
+  }
+
+  /// queue item ahead of the other items of key
+  void enqueue_front(unsigned shard, const K &key, const T &item) {
+    Shard *s = shards[shard];
+    s->lock.Lock();
+    drain_intake(s);
+    KeyQueue &kq = s->keys[key];
+    kq.items.push_front(item);
+    make_ready(s, key, kq);
+    ++s->queued;
+    s->lock.Unlock();
+    wake(shard);
+  }
+
+  /**
+   * Claim a key with queued items, from shard home or stolen from
+   * another shard.  The caller must pop() its items from *owner and
+   * release() it.
+   */
+  bool claim(unsigned home, K *key, unsigned *owner) {
+    Shard *s = shards[home];
+    s->lock.Lock();
+    bool found = claim_ready(s, key);
+    s->lock.Unlock();
+    if (found) {
+      *owner = home;
+      return true;
+    }
+    for (unsigned i = 1; i < shards.size(); ++i) {
+      unsigned victim = (home + i) % shards.size();
+      Shard *v = shards[victim];
+      if (v->queued.load() == 0 || !v->lock.TryLock())
+	continue;
+      found = claim_ready(v, key);
+      v->lock.Unlock();
+      if (found) {
+	++v->stolen;
+	*owner = victim;
+	return true;
+      }
+    }
+    return false;
+  }
+
+  /// pop the next item of a claimed key, if any is left
+  boost::optional<T> pop(unsigned owner, const K &key) {
+    Shard *s = shards[owner];
+    Mutex::Locker l(s->lock);
+    typename std::map<K, KeyQueue>::iterator p = s->keys.find(key);
+    assert(p != s->keys.end() && p->second.busy);
+    if (p->second.items.empty())
+      return boost::optional<T>();
+    T item = p->second.items.front();
+    p->second.items.pop_front();
+    --s->queued;
+    return item;
+  }
+
+  /// give a claimed key back, requeueing it if items were added meanwhile
+  void release(unsigned owner, const K &key) {
+    Shard *s = shards[owner];
+    s->lock.Lock();
+    drain_intake(s);
+    typename std::map<K, KeyQueue>::iterator p = s->keys.find(key);
+    assert(p != s->keys.end() && p->second.busy);
+    p->second.busy = false;
+    bool requeued = !p->second.items.empty();
+    if (requeued)
+      make_ready(s, key, p->second);
+    else
+      s->keys.erase(p);
+    s->lock.Unlock();
+    if (requeued)
+      wake(owner);
+  }
+
+  /**
+   * Remove the items of key, passing them back to front to f.  A key
+   * claimed by a consumer stays claimed until it is released.
+   */
+  template <typename F>
+  void remove(unsigned shard, const K &key, F &f) {
+    Shard *s = shards[shard];
+    Mutex::Locker l(s->lock);
+    drain_intake(s);
+    typename std::map<K, KeyQueue>::iterator p = s->keys.find(key);
+    if (p == s->keys.end())
+      return;
+    for (typename std::list<T>::reverse_iterator i = p->second.items.rbegin();
+	 i != p->second.items.rend();
+	 ++i) {
+      f(*i);
+      --s->queued;
+    }
+    p->second.items.clear();
+    if (p->second.ready) {
+      s->ready.remove(key);
+      --s->nready;
+      p->second.ready = false;
+    }
+    if (!p->second.busy)
+      s->keys.erase(p);
+  }
+
+  /**
+   * Wait on shard home until an item is queued, anywhere if no other
+   * consumer is idle, or the timeout expires.
+   */
+  void wait(CephContext *cct, unsigned home, utime_t timeout) {
+    Shard *s = shards[home];
+    s->lock.Lock();
+    ++s->sleepers;
+    // wake() looks for sleepers only after the item is pushed or made
+    // ready, so either it finds us, and signals under our lock, or we
+    // see the item here, on whichever shard it was queued
+    if (!any_claimable())
+      s->cond.WaitInterval(cct, s->lock, timeout);
+    --s->sleepers;
+    s->lock.Unlock();
+  }
+
+  void wake_all() {
+    for (unsigned i = 0; i < shards.size(); ++i) {
+      shards[i]->lock.Lock();
+      shards[i]->cond.Signal();
+      shards[i]->lock.Unlock();
+    }
+  }
+
+  bool empty(unsigned shard) const {
+    return shards[shard]->queued.load() == 0;
+  }
+
+  uint64_t get_stolen(unsigned shard) const {
+    return shards[shard]->stolen.load();
+  }
+
+  void dump(unsigned shard, Formatter *f) {
+    Shard *s = shards[shard];
+    Mutex::Locker l(s->lock);
+    drain_intake(s);
+    f->dump_unsigned("queued", s->queued.load());
+    f->dump_unsigned("keys", s->keys.size());
+    f->dump_unsigned("ready", s->ready.size());
+    f->dump_unsigned("stolen", s->stolen.load());
+  }
+};
+
+#endif
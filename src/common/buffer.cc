@@ -35,6 +35,7 @@
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
+#include <mutex>
 
 #include <ostream>
 namespace ceph {
@@ -198,6 +199,10 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     virtual int zero_copy_to_fd(int fd, loff_t *offset) {
       return -ENOTSUP;
     }
+    virtual ssize_t zero_copy_to_socket(int sd, unsigned off, unsigned l,
+					bool more) {
+      return -ENOTSUP;
+    }
     virtual bool is_page_aligned() {
       return ((long)data & ~CEPH_PAGE_MASK) == 0;
     }
@@ -401,7 +406,8 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
 #ifdef CEPH_HAVE_SPLICE
   class buffer::raw_pipe : public buffer::raw {
   public:
-    explicit raw_pipe(unsigned len) : raw(len), source_consumed(false) {
+    explicit raw_pipe(unsigned len)
+      : raw(len), source_consumed(false), sent(0), sender(-1) {
       size_t max = get_max_pipe_size();
       if (len > max) {
 	bdout << "raw_pipe: requested length " << len
@@ -410,6 +416,8 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
       }
       pipefds[0] = -1;
       pipefds[1] = -1;
+      sendfds[0] = -1;
+      sendfds[1] = -1;
 
       int r;
       if (::pipe(pipefds) == -1) {
@@ -441,6 +449,7 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
       if (data)
 	free(data);
       close_pipe(pipefds);
+      close_pipe(sendfds);
       dec_total_alloc(len);
       bdout << "raw_pipe " << this << " free " << (void *)data << " "
 	    << buffer::get_total_alloc() << bendl;
@@ -476,6 +485,62 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
       return 0;
     }
 
+    /*
+     * The source pipe is tee'd into sendfds, which is then moved into the
+     * socket, possibly over several calls as the socket drains.  The
+     * source is kept for the messenger to resend it from the start after
+     * a reconnect.  The send pipe belongs to one socket until it is all
+     * gone; other senders meanwhile get -ENOTSUP and copy the data.
+     */
+    ssize_t zero_copy_to_socket(int sd, unsigned off, unsigned l, bool more) {
+      std::lock_guard<std::mutex> lock(send_lock);
+      if (source_consumed || off + l != len)
+	return -ENOTSUP;
+      if (sender >= 0 && sender != sd)
+	return -ENOTSUP;
+      if (off == 0 && (sendfds[0] < 0 || sent > 0)) {
+	close_pipe(sendfds);
+	sendfds[0] = sendfds[1] = -1;
+	sent = 0;
+	if (::pipe(sendfds) == -1) {
+	  sendfds[0] = sendfds[1] = -1;
+	  return -ENOTSUP;
+	}
+	try {
+	  set_pipe_size(sendfds, len);
+	} catch (malformed_input &e) {
+	}
+	if (set_nonblocking(sendfds) < 0 ||
+	    ::tee(pipefds[0], sendfds[1], len, SPLICE_F_NONBLOCK) !=
+	      (ssize_t)len) {
+	  close_pipe(sendfds);
+	  sendfds[0] = sendfds[1] = -1;
+	  return -ENOTSUP;
+	}
+	sender = sd;
+      }
+      if (sendfds[0] < 0 || off != sent)
+	return -ENOTSUP;
+      int flags = SPLICE_F_NONBLOCK | (more ? SPLICE_F_MORE : 0);
+      ssize_t r = ::splice(sendfds[0], NULL, sd, NULL, l, flags);
+      if (r < 0) {
+	if (errno == EAGAIN || errno == EINTR)
+	  return 0;
+	r = -errno;
+	bdout << "raw_pipe: error splicing to socket: " << cpp_strerror(r)
+	      << bendl;
+	return r;
+      }
+      sent += r;
+      if (sent == len) {
+	close_pipe(sendfds);
+	sendfds[0] = sendfds[1] = -1;
+	sent = 0;
+	sender = -1;
+      }
+      return r;
+    }
+
     buffer::raw* clone_empty() {
       // cloning doesn't make sense for pipe-based buffers,
       // and is only used by unit tests for other types of buffers
@@ -573,6 +638,12 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     }
     bool source_consumed;
     int pipefds[2];
+    // the copy of the pipe being sent, how much of it is gone and the
+    // socket it goes to
+    std::mutex send_lock;
+    int sendfds[2];
+    unsigned sent;
+    int sender;
   };
 #endif // CEPH_HAVE_SPLICE
 
@@ -1029,6 +1100,11 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     return _raw->zero_copy_to_fd(fd, (loff_t*)offset);
   }
 
+  ssize_t buffer::ptr::zero_copy_to_socket(int sd, bool more) const
+  {
+    return _raw->zero_copy_to_socket(sd, _off, _len, more);
+  }
+
   // -- buffer::list::iterator --
   /*
   buffer::list::iterator operator=(const buffer::list::iterator& other)
@@ -2346,6 +2422,48 @@ __u32 buffer::list::crc32c(__u32 crc) const
   return crc;
 }
 
+void buffer::list::crc32c_batch(const std::vector<const list*> &bls,
+				std::vector<uint32_t> *crcs)
+{
+  crcs->resize(bls.size());
+  // the lists of each length that are one buffer without a cached crc
+  std::map<unsigned, std::vector<unsigned> > by_len;
+  for (unsigned i = 0; i < bls.size(); ++i) {
+    const std::list<ptr> &buffers = bls[i]->buffers();
+    pair<uint32_t, uint32_t> ccrc;
+    if (buffers.size() == 1 && buffers.front().length() &&
+	!buffers.front().get_raw()->get_crc(
+	  make_pair(buffers.front().offset(), buffers.front().end()), &ccrc))
+      by_len[buffers.front().length()].push_back(i);
+    else
+      (*crcs)[i] = bls[i]->crc32c(0);
+  }
+
+  std::vector<unsigned char const*> bufs;
+  std::vector<uint32_t> out;
+  for (std::map<unsigned, std::vector<unsigned> >::iterator p = by_len.begin();
+       p != by_len.end();
+       ++p) {
+    if (p->second.size() == 1) {
+      (*crcs)[p->second[0]] = bls[p->second[0]]->crc32c(0);
+      continue;
+    }
+    bufs.clear();
+    for (std::vector<unsigned>::iterator i = p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      bufs.push_back((unsigned char const*)bls[*i]->buffers().front().c_str());
+    out.resize(bufs.size());
+    ceph_crc32c_multi(0, &bufs[0], bufs.size(), p->first, &out[0]);
+    for (unsigned j = 0; j < p->second.size(); ++j) {
+      const ptr &bp = bls[p->second[j]]->buffers().front();
+      (*crcs)[p->second[j]] = out[j];
+      bp.get_raw()->set_crc(make_pair(bp.offset(), bp.end()),
+			    make_pair(0u, out[j]));
+    }
+  }
+}
+
 void buffer::list::invalidate_crc()
 {
   for (std::list<ptr>::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
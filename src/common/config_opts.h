@@ -166,6 +166,7 @@ OPTION(heartbeat_interval, OPT_INT, 5)
 OPTION(heartbeat_file, OPT_STR, "")
 OPTION(heartbeat_inject_failure, OPT_INT, 0)    // force an unhealthy heartbeat for N seconds
 OPTION(perf, OPT_BOOL, true)       // enable internal perf counters
+OPTION(perf_counter_shards, OPT_INT, 8) // per-thread shards of perf counters and averages
 
 OPTION(ms_type, OPT_STR, "simple")   // messenger backend
 OPTION(ms_tcp_nodelay, OPT_BOOL, true)
@@ -207,6 +208,11 @@ OPTION(ms_async_set_affinity, OPT_BOOL, true)
 // core
 OPTION(ms_async_affinity_cores, OPT_STR, "")
 OPTION(ms_async_send_inline, OPT_BOOL, true)
+// send iovec batches of at least that many bytes with MSG_ZEROCOPY, 0 to
+// copy them into the socket as usual
+OPTION(ms_async_zerocopy_min, OPT_U64, 0)
+// queued messages written out with one sendmsg(), 1 for one at a time
+OPTION(ms_async_send_batch, OPT_U32, 32)
 
 OPTION(inject_early_sigterm, OPT_BOOL, false)
 
@@ -431,6 +437,7 @@ OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
 OPTION(objecter_completion_locks_per_session, OPT_U64, 32) // num of completion locks per each session, for serializing same object responses
 OPTION(objecter_inject_no_watch_ping, OPT_BOOL, false)   // suppress watch pings
 OPTION(objecter_retry_writes_after_first_reply, OPT_BOOL, false)   // ignore the first reply for each write, and resend the osd op instead
+OPTION(objecter_pg_mapping, OPT_BOOL, false) // map every pg of each new osdmap up front (with osd_map_pg_mapping_threads threads)
 
 // Max number of deletes at once in a single Filer::purge call
 OPTION(filer_max_purge_ops, OPT_U32, 10)
@@ -678,6 +685,7 @@ OPTION(osd_tier_default_cache_hit_set_search_last_n, OPT_INT, 1)
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_max_advance, OPT_INT, 150) // make this < cache_size!
 OPTION(osd_map_cache_size, OPT_INT, 200)
+OPTION(osd_map_pg_mapping_threads, OPT_INT, 4) // map every pg of a new map up front with this many threads, 0 to run crush per lookup
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_map_share_max_epochs, OPT_INT, 100)  // cap on # of inc maps we send to peers, clients
 OPTION(osd_inject_bad_map_crc_probability, OPT_FLOAT, 0)
@@ -697,13 +705,34 @@ OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
 OPTION(osd_op_num_threads_per_shard, OPT_INT, 2)
 OPTION(osd_op_num_shards, OPT_INT, 5)
-OPTION(osd_op_queue, OPT_STR, "wpq") // PrioritzedQueue (prio), Weighted Priority Queue (wpq), or debug_random
+OPTION(osd_op_queue, OPT_STR, "wpq") // PrioritzedQueue (prio), Weighted Priority Queue (wpq), work_stealing, mclock, or debug_random
 OPTION(osd_op_queue_cut_off, OPT_STR, "low") // Min priority to go to strict queue. (low, high, debug_random)
+OPTION(osd_op_queue_ws_max_batch, OPT_U32, 8) // ops of a PG run per claim with osd_op_queue = work_stealing
+OPTION(osd_op_run_to_completion, OPT_BOOL, false) // run simple client writes on the messenger thread that received them
+OPTION(osd_op_run_to_completion_max_bytes, OPT_U64, 65536) // largest write run on the messenger thread
+// mclock reservation (ops/s), weight and limit (ops/s) per client for client
+// ops and per op class for the others, 0 for no reservation or limit
+OPTION(osd_op_queue_mclock_client_op_res, OPT_DOUBLE, 100.0)
+OPTION(osd_op_queue_mclock_client_op_wgt, OPT_DOUBLE, 500.0)
+OPTION(osd_op_queue_mclock_client_op_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_osd_subop_res, OPT_DOUBLE, 1000.0)
+OPTION(osd_op_queue_mclock_osd_subop_wgt, OPT_DOUBLE, 500.0)
+OPTION(osd_op_queue_mclock_osd_subop_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_snap_res, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_snap_wgt, OPT_DOUBLE, 5.0)
+OPTION(osd_op_queue_mclock_snap_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_recov_res, OPT_DOUBLE, 10.0)
+OPTION(osd_op_queue_mclock_recov_wgt, OPT_DOUBLE, 10.0)
+OPTION(osd_op_queue_mclock_recov_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_scrub_res, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_scrub_wgt, OPT_DOUBLE, 5.0)
+OPTION(osd_op_queue_mclock_scrub_lim, OPT_DOUBLE, 0.0)
 
 // Set to true for testing.  Users should NOT set this.
 // If set to true even after reading enough shards to
 // decode the object, any error will be reported.
 OPTION(osd_read_ec_check_for_errors, OPT_BOOL, false) // return error if any ec shard has an error
+OPTION(osd_ec_batch_stripes, OPT_U32, 64) // stripes encoded or decoded per plugin call, 0 for all
 
 // Only use clone_overlap for recovery if there are fewer than
 // osd_recover_clone_overlap_limit entries in the overlap set
@@ -812,6 +841,7 @@ OPTION(osd_enable_op_tracker, OPT_BOOL, true) // enable/disable OSD op tracking
 OPTION(osd_num_op_tracker_shard, OPT_U32, 32) // The number of shards for holding the ops
 OPTION(osd_op_history_size, OPT_U32, 20)    // Max number of completed ops to track
 OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
+OPTION(osd_op_tracker_sample_rate, OPT_U32, 100) // Record the stage latencies of 1 in N ops, 0 for none
 OPTION(osd_target_transaction_size, OPT_INT, 30)     // to adjust various transactions that batch smaller items
 OPTION(osd_failsafe_full_ratio, OPT_FLOAT, .97) // what % full makes an OSD "full" (failsafe)
 OPTION(osd_failsafe_nearfull_ratio, OPT_FLOAT, .90) // what % full makes an OSD near full (failsafe)
@@ -850,6 +880,7 @@ OPTION(rocksdb_db_paths, OPT_STR, "")   // path,size( path,size)*
 OPTION(rocksdb_log_to_ceph_log, OPT_BOOL, true)  // log to ceph log
 OPTION(rocksdb_cache_size, OPT_INT, 128*1024*1024)  // default rocksdb cache size
 OPTION(rocksdb_cache_shard_bits, OPT_INT, 4)  // rocksdb block cache shard bits, 4 bit -> 16 shards
+OPTION(rocksdb_cache_stats, OPT_BOOL, false)  // collect block cache hit/miss statistics
 OPTION(rocksdb_block_size, OPT_INT, 4*1024)  // default rocksdb block size
 // rocksdb options that will be used for omap(if omap_backend is rocksdb)
 OPTION(filestore_rocksdb_options, OPT_STR, "")
@@ -918,6 +949,13 @@ OPTION(bdev_aio, OPT_BOOL, true)
 OPTION(bdev_aio_poll_ms, OPT_INT, 250)  // milliseconds
 OPTION(bdev_aio_max_queue_depth, OPT_INT, 32)
 OPTION(bdev_block_size, OPT_INT, 4096)
+OPTION(bdev_uring, OPT_BOOL, false)  // use the io_uring backend for kernel devices
+OPTION(bdev_uring_queue_depth, OPT_INT, 256)
+OPTION(bdev_uring_sqpoll, OPT_BOOL, false)  // kernel thread polls the submission ring
+OPTION(bdev_uring_iopoll, OPT_BOOL, false)  // poll the device for completions (nvme with poll queues)
+OPTION(bdev_uring_poll_us, OPT_INT, 50)  // spin on the completion ring before sleeping
+OPTION(bdev_uring_registered_buffers, OPT_INT, 64)
+OPTION(bdev_uring_registered_buffer_size, OPT_INT, 65536)  // direct writes up to this size are copied into a registered buffer
 
 // if yes, osd will unbind all NVMe devices from kernel driver and bind them
 // to the uio_pci_generic driver. The purpose is to prevent the case where
@@ -932,6 +970,8 @@ OPTION(bluefs_max_log_runway, OPT_U64, 4194304)  // alloc this much at a time
 OPTION(bluefs_log_compact_min_ratio, OPT_FLOAT, 5.0)      // before we consider
 OPTION(bluefs_log_compact_min_size, OPT_U64, 16*1048576)  // before we consider
 OPTION(bluefs_min_flush_size, OPT_U64, 65536)  // ignore flush until its this big
+OPTION(bluefs_compact_log_sync, OPT_BOOL, false)  // block writers while compacting the log
+OPTION(bluefs_parallel_flush, OPT_BOOL, true)  // flush wal/db/slow devices concurrently
 
 OPTION(bluestore_bluefs, OPT_BOOL, true)
 OPTION(bluestore_bluefs_env_mirror, OPT_BOOL, false) // mirror to normal Env for debug
@@ -976,8 +1016,19 @@ OPTION(bluestore_compression_max_blob_size, OPT_U32, 4*1024*1024)
  */
 OPTION(bluestore_compression_required_ratio, OPT_DOUBLE, .875)
 OPTION(bluestore_cache_type, OPT_STR, "2q")   // lru, 2q
+OPTION(bluestore_2q_onode_kin_ratio, OPT_DOUBLE, .5)    // 2q onode warm_in share
+OPTION(bluestore_2q_onode_kout_ratio, OPT_DOUBLE, .5)   // 2q onode ghosts, relative to onode cache size
 OPTION(bluestore_onode_cache_size, OPT_U32, 16*1024)
 OPTION(bluestore_buffer_cache_size, OPT_U32, 512*1024*1024)
+OPTION(bluestore_decompressed_cache_size, OPT_U64, 0)  // per cache shard; 0 caches decompressed blobs as ordinary buffers
+OPTION(bluestore_cache_autotune, OPT_BOOL, false)  // balance onode/buffer/kv caches within bluestore_cache_size (read at mount)
+OPTION(bluestore_cache_size, OPT_U64, 1024*1024*1024)  // total memory for onode, buffer and kv caches (autotune only)
+OPTION(bluestore_cache_autotune_interval, OPT_DOUBLE, 5)  // seconds between cache rebalances
+OPTION(bluestore_cache_autotune_min_ratio, OPT_DOUBLE, .1)  // minimum share of each cache
+OPTION(bluestore_cache_autotune_step_ratio, OPT_DOUBLE, .05)  // max share moved per rebalance
+OPTION(bluestore_cache_autotune_onode_bytes, OPT_U32, 4096)  // estimated memory per cached onode
+OPTION(bluestore_cache_autotune_kv_ratio, OPT_DOUBLE, .3)  // initial kv share; changing it restarts the tuning
+OPTION(bluestore_cache_autotune_onode_ratio, OPT_DOUBLE, .2)  // initial onode share; changing it restarts the tuning
 OPTION(bluestore_kvbackend, OPT_STR, "rocksdb")
 OPTION(bluestore_allocator, OPT_STR, "bitmap")     // stupid | bitmap
 OPTION(bluestore_freelist_type, OPT_STR, "bitmap") // extent | bitmap
@@ -989,8 +1040,11 @@ OPTION(bluestore_fsck_on_mount, OPT_BOOL, false)
 OPTION(bluestore_fsck_on_umount, OPT_BOOL, false)
 OPTION(bluestore_sync_transaction, OPT_BOOL, false)  // perform kv txn synchronously
 OPTION(bluestore_sync_submit_transaction, OPT_BOOL, false)
+OPTION(bluestore_kv_sync_lanes, OPT_INT, 1) // parallel kv sync threads; sequencers are hashed by collection
 OPTION(bluestore_sync_wal_apply, OPT_BOOL, true)     // perform initial wal work synchronously (possibly in combination with aio so we only *queue* ios)
 OPTION(bluestore_wal_threads, OPT_INT, 4)
+OPTION(bluestore_wal_elevator, OPT_BOOL, false) // merge and sort wal writes from each kv commit by disk offset
+OPTION(bluestore_wal_elevator_max_io, OPT_U64, 4*1024*1024) // largest merged wal write
 OPTION(bluestore_wal_thread_timeout, OPT_INT, 30)
 OPTION(bluestore_wal_thread_suicide_timeout, OPT_INT, 120)
 OPTION(bluestore_max_ops, OPT_U64, 512)
@@ -1001,6 +1055,12 @@ OPTION(bluestore_nid_prealloc, OPT_INT, 1024)
 OPTION(bluestore_overlay_max_length, OPT_INT, 65536)
 OPTION(bluestore_overlay_max, OPT_INT, 0)
 OPTION(bluestore_clone_cow, OPT_BOOL, false)  // do copy-on-write for clones
+OPTION(bluestore_defrag, OPT_BOOL, false)  // rewrite fragmented objects in the background when idle
+OPTION(bluestore_defrag_interval, OPT_DOUBLE, 300)  // seconds between scans of all objects
+OPTION(bluestore_defrag_threshold, OPT_DOUBLE, .3)  // rewrite objects with a fragmentation score above this
+OPTION(bluestore_defrag_max_object_size, OPT_U64, 16*1024*1024)  // never rewrite objects larger than this
+OPTION(bluestore_defrag_bytes_per_sec, OPT_U64, 16*1024*1024)  // rewrite throttle
+OPTION(bluestore_defrag_idle_ops, OPT_U64, 0)  // only rewrite with at most this many client ops in flight
 OPTION(bluestore_default_buffered_read, OPT_BOOL, true)
 OPTION(bluestore_debug_misc, OPT_BOOL, false)
 OPTION(bluestore_debug_no_reuse_blocks, OPT_BOOL, false)
@@ -1291,6 +1351,8 @@ OPTION(rgw_data, OPT_STR, "/var/lib/ceph/radosgw/$cluster-$id")
 OPTION(rgw_enable_apis, OPT_STR, "s3, s3website, swift, swift_auth, admin")
 OPTION(rgw_cache_enabled, OPT_BOOL, true)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT, 10000)   // num of entries in rgw cache
+OPTION(rgw_cache_max_bytes, OPT_U64, 256 << 20)   // size of the entries in rgw cache, 0 for no limit
+OPTION(rgw_cache_shards, OPT_INT, 16)   // num of independently locked parts of rgw cache
 OPTION(rgw_socket_path, OPT_STR, "")   // path to unix domain socket, if not specified, rgw will not run as external fcgi
 OPTION(rgw_host, OPT_STR, "")  // host for radosgw, can be an IP, default is 0.0.0.0
 OPTION(rgw_port, OPT_STR, "")  // port to listen, format as "8080" "5000", if not specified, rgw will not run external fcgi
@@ -1407,6 +1469,8 @@ OPTION(rgw_obj_stripe_size, OPT_INT, 4 << 20)
 OPTION(rgw_extended_http_attrs, OPT_STR, "") // list of extended attrs that can be set on objects (beyond the default)
 OPTION(rgw_exit_timeout_secs, OPT_INT, 120) // how many seconds to wait for process to go down before exiting unconditionally
 OPTION(rgw_get_obj_window_size, OPT_INT, 16 << 20) // window size in bytes for single get obj request
+OPTION(rgw_get_obj_max_window_size, OPT_INT, 32 << 20) // max memory a get obj request holds as its window grows, rgw_get_obj_window_size to keep it fixed
+OPTION(rgw_get_obj_window_factor, OPT_DOUBLE, 2) // window is this many times what the client reads during one rados read
 OPTION(rgw_get_obj_max_req_size, OPT_INT, 4 << 20) // max length of a single get obj rados op
 OPTION(rgw_relaxed_s3_bucket_names, OPT_BOOL, false) // enable relaxed bucket name rules for US region buckets
 OPTION(rgw_defer_to_bucket_acls, OPT_STR, "") // if the user has bucket perms, use those before key perms (recurse and full_control)
@@ -9,6 +9,7 @@
 #include "common/sctp_crc32.h"
 #include "common/crc32c_intel_baseline.h"
 #include "common/crc32c_intel_fast.h"
+#include "common/crc32c_intel_multi.h"
 #include "common/crc32c_aarch64.h"
 
 /*
@@ -45,3 +46,27 @@ ceph_crc32c_func_t ceph_choose_crc32(void)
  */
 ceph_crc32c_func_t ceph_crc32c_func = ceph_choose_crc32();
 
+
+/*
+ * fall back to one buffer at a time with whatever ceph_crc32c_func is.
+ */
+static void ceph_crc32c_multi_generic(uint32_t crc, unsigned char const **bufs,
+				      unsigned n, unsigned length,
+				      uint32_t *out)
+{
+  for (unsigned i = 0; i < n; ++i) {
+    out[i] = ceph_crc32c_func(crc, bufs[i], length);
+  }
+}
+
+ceph_crc32c_multi_func_t ceph_choose_crc32c_multi(void)
+{
+  ceph_arch_probe();
+
+  if (ceph_arch_intel_sse42 && ceph_crc32c_intel_multi_exists()) {
+    return ceph_crc32c_intel_multi;
+  }
+  return ceph_crc32c_multi_generic;
+}
+
+ceph_crc32c_multi_func_t ceph_crc32c_multi_func = ceph_choose_crc32c_multi();
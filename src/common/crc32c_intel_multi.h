@@ -0,0 +1,25 @@
+#ifndef CEPH_COMMON_CRC32C_INTEL_MULTI_H
+#define CEPH_COMMON_CRC32C_INTEL_MULTI_H
+
+#include "include/int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* is the multi-buffer version compiled in */
+extern int ceph_crc32c_intel_multi_exists(void);
+
+/*
+ * calculate crc32c for n independent buffers of the same length,
+ * interleaving several buffers so that the crc32 instruction pipeline
+ * stays full.  requires SSE 4.2.
+ */
+extern void ceph_crc32c_intel_multi(uint32_t crc, unsigned char const **bufs,
+				    unsigned n, unsigned len, uint32_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,463 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef MCLOCK_QUEUE_H
+#define MCLOCK_QUEUE_H
+
+#include "OpQueue.h"
+
+#include <functional>
+#include <limits>
+#include <list>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "common/Clock.h"
+#include "common/Formatter.h"
+
+/// QoS of an mClockQueue client, rates in ops per second, 0 for none
+struct mClockClientInfo {
+  double reservation;
+  double weight;
+  double limit;
+  mClockClientInfo(double r = 0, double w = 1, double l = 0)
+    : reservation(r), weight(w), limit(l) {}
+};
+
+/**
+ * Tag scheduling op queue after mClock (Gulati et al., OSDI '10).
+ *
+ * The items of the regular queue are grouped by the scheduling client
+ * C that classify_f gives for them, and each client gets a
+ * reservation, weight and limit from info_f.  The head item of every
+ * client carries three tags, spaced 1/rate apart:
+ *
+ *   R  the client is owed service once R has passed
+ *   P  proportional share
+ *   L  the client is over its limit until L has passed
+ *
+ * R and L are never behind the arrival of the item.  A client becoming
+ * active starts its P at the smallest P of the active clients, so it
+ * gets no credit nor debt for the time it was idle.
+ *
+ * dequeue() serves the smallest R that has passed; otherwise the
+ * smallest P of the clients not over their limit, in which case the
+ * reservation is not charged.  When every client is over its limit the
+ * one closest to its limit is served: the queue is work conserving.
+ * The cost of the items is not used.
+ *
+ * As in dmclock, the clients with a queued item sit in indexed heaps,
+ * by R, by P, by L and by readiness (L passed) then P, so enqueue and
+ * dequeue cost O(log clients) rather than a scan of every client.
+ *
+ * The strict queue bypasses the tags and is served first, highest
+ * priority first.
+ */
+template <typename T, typename K, typename C>
+class mClockQueue : public OpQueue <T, K> {
+public:
+  typedef std::function<mClockClientInfo (const C&)> info_f;
+  typedef std::function<C (const K&, const T&)> classify_f;
+  typedef std::function<double ()> clock_f;
+
+private:
+  struct Request {
+    K cl;
+    T item;
+    double arrival;
+    Request(const K &cl, const T &item, double arrival)
+      : cl(cl), item(item), arrival(arrival) {}
+  };
+
+  struct Client {
+    const C *id;
+    std::list<Request> requests;
+    // tags of the last request that was made head
+    double prev_r, prev_p, prev_l;
+    // tags of the head request, if tagged
+    double r, p, l;
+    bool tagged;
+    bool ready;   ///< L had passed when last looked at
+    double last_active;
+    size_t heap_pos[4];
+    Client()
+      : id(NULL), prev_r(0), prev_p(0), prev_l(0), r(0), p(0), l(0),
+	tagged(false), ready(false), last_active(0) {}
+  };
+  typedef std::map<C, Client> Clients;
+
+  /// binary min-heap of clients, each knowing its position in heap N
+  template <int N, typename Less>
+  class Heap {
+    std::vector<Client*> data;
+    Less less;
+
+    void swap_at(size_t a, size_t b) {
+      std::swap(data[a], data[b]);
+      data[a]->heap_pos[N] = a;
+      data[b]->heap_pos[N] = b;
+    }
+    void sift_up(size_t i) {
+      while (i > 0) {
+	size_t parent = (i - 1) / 2;
+	if (!less(data[i], data[parent]))
+	  break;
+	swap_at(i, parent);
+	i = parent;
+      }
+    }
+    void sift_down(size_t i) {
+      while (true) {
+	size_t m = i, left = 2 * i + 1, right = left + 1;
+	if (left < data.size() && less(data[left], data[m]))
+	  m = left;
+	if (right < data.size() && less(data[right], data[m]))
+	  m = right;
+	if (m == i)
+	  break;
+	swap_at(i, m);
+	i = m;
+      }
+    }
+
+  public:
+    bool empty() const {
+      return data.empty();
+    }
+    Client *top() const {
+      return data.front();
+    }
+    void push(Client *c) {
+      c->heap_pos[N] = data.size();
+      data.push_back(c);
+      sift_up(data.size() - 1);
+    }
+    void erase(Client *c) {
+      size_t i = c->heap_pos[N];
+      swap_at(i, data.size() - 1);
+      data.pop_back();
+      if (i < data.size()) {
+	sift_up(i);
+	sift_down(data[i]->heap_pos[N]);
+      }
+    }
+    void adjust(Client *c) {
+      sift_up(c->heap_pos[N]);
+      sift_down(c->heap_pos[N]);
+    }
+  };
+
+  struct ByR {
+    bool operator()(const Client *a, const Client *b) const {
+      return a->r < b->r;
+    }
+  };
+  struct ByP {
+    bool operator()(const Client *a, const Client *b) const {
+      return a->p < b->p;
+    }
+  };
+  /// the ready clients first, by P
+  struct ByReady {
+    bool operator()(const Client *a, const Client *b) const {
+      if (a->ready != b->ready)
+	return a->ready;
+      return a->p < b->p;
+    }
+  };
+  /// the clients not ready yet first, by L
+  struct ByL {
+    bool operator()(const Client *a, const Client *b) const {
+      if (a->ready != b->ready)
+	return !a->ready;
+      return a->l < b->l;
+    }
+  };
+
+  // clients idle for that long lose their tags
+  static constexpr double IDLE_AGE = 300.0;
+
+  info_f get_info;
+  classify_f classify;
+  clock_f now;
+  std::map<unsigned, std::list<std::pair<K, T> > > strict;
+  Clients clients;
+  // the tagged clients
+  Heap<0, ByR> r_heap;
+  Heap<1, ByP> p_heap;
+  Heap<2, ByReady> ready_heap;
+  Heap<3, ByL> l_heap;
+  unsigned size;
+  unsigned strict_size;
+  double last_sweep;
+  uint64_t reservation_served;
+  uint64_t weight_served;
+
+  static double real_now() {
+    return (double)ceph_clock_now(NULL);
+  }
+
+  /// p_floor is the least P of the head, unless it is a backlog
+  void tag_head(Client &c, double p_floor) {
+    assert(!c.requests.empty());
+    const Request &req = c.requests.front();
+    mClockClientInfo info = get_info(*c.id);
+    const double inf = std::numeric_limits<double>::infinity();
+    c.r = info.reservation > 0 ?
+      std::max(c.prev_r + 1.0 / info.reservation, req.arrival) : inf;
+    c.p = std::max(c.prev_p + 1.0 / std::max(info.weight, 0.000001),
+		   p_floor);
+    c.l = info.limit > 0 ?
+      std::max(c.prev_l + 1.0 / info.limit, req.arrival) : 0;
+    if (info.reservation > 0)
+      c.prev_r = c.r;
+    c.prev_p = c.p;
+    if (info.limit > 0)
+      c.prev_l = c.l;
+    c.ready = false;
+  }
+
+  void push_tagged(Client &c) {
+    c.tagged = true;
+    r_heap.push(&c);
+    p_heap.push(&c);
+    ready_heap.push(&c);
+    l_heap.push(&c);
+  }
+
+  void erase_tagged(Client &c) {
+    c.tagged = false;
+    r_heap.erase(&c);
+    p_heap.erase(&c);
+    ready_heap.erase(&c);
+    l_heap.erase(&c);
+  }
+
+  void adjust_tagged(Client &c) {
+    r_heap.adjust(&c);
+    p_heap.adjust(&c);
+    ready_heap.adjust(&c);
+    l_heap.adjust(&c);
+  }
+
+  void sweep_idle(double t) {
+    if (t - last_sweep < IDLE_AGE)
+      return;
+    last_sweep = t;
+    for (typename Clients::iterator i = clients.begin(); i != clients.end();) {
+      if (i->second.requests.empty() && t - i->second.last_active > IDLE_AGE)
+	clients.erase(i++);
+      else
+	++i;
+    }
+  }
+
+  void insert(K cl, T item, bool front) {
+    double t = now();
+    C id = classify(cl, item);
+    typename Clients::iterator i = clients.find(id);
+    if (i == clients.end()) {
+      i = clients.insert(std::make_pair(id, Client())).first;
+      i->second.id = &i->first;
+    }
+    Client &c = i->second;
+    c.last_active = t;
+    if (front) {
+      // a requeued op takes over the tags of the current head
+      c.requests.push_front(Request(cl, item, t));
+    } else {
+      c.requests.push_back(Request(cl, item, t));
+    }
+    if (!c.tagged) {
+      tag_head(c, p_heap.empty() ? t : p_heap.top()->p);
+      push_tagged(c);
+    }
+    ++size;
+    sweep_idle(t);
+  }
+
+  T pop(Client &c, double t) {
+    T ret = c.requests.front().item;
+    c.requests.pop_front();
+    c.last_active = t;
+    --size;
+    if (c.requests.empty()) {
+      erase_tagged(c);
+    } else {
+      tag_head(c, -std::numeric_limits<double>::infinity());
+      adjust_tagged(c);
+    }
+    return ret;
+  }
+
+  template <typename F>
+  unsigned filter_requests(std::list<Request> &requests, F f) {
+    unsigned count = 0;
+    for (typename std::list<Request>::iterator i = requests.end();
+	 i != requests.begin();) {
+      --i;
+      if (f(*i)) {
+	i = requests.erase(i);
+	++count;
+      }
+    }
+    return count;
+  }
+
+  template <typename F>
+  void filter(F f) {
+    for (typename std::map<unsigned, std::list<std::pair<K, T> > >::iterator i =
+	   strict.begin();
+	 i != strict.end();) {
+      for (typename std::list<std::pair<K, T> >::iterator j = i->second.end();
+	   j != i->second.begin();) {
+	--j;
+	Request r(j->first, j->second, 0);
+	if (f(r)) {
+	  j = i->second.erase(j);
+	  --strict_size;
+	}
+      }
+      if (i->second.empty())
+	strict.erase(i++);
+      else
+	++i;
+    }
+    for (typename Clients::iterator i = clients.begin();
+	 i != clients.end();
+	 ++i) {
+      // if the head is removed, the next one inherits its tags
+      size -= filter_requests(i->second.requests, f);
+      if (i->second.requests.empty() && i->second.tagged)
+	erase_tagged(i->second);
+    }
+  }
+
+public:
+  mClockQueue(info_f get_info, classify_f classify,
+	      clock_f now = &mClockQueue::real_now)
+    : get_info(get_info), classify(classify), now(now),
+      size(0), strict_size(0), last_sweep(0),
+      reservation_served(0), weight_served(0) {}
+
+  unsigned length() const override final {
+    return size + strict_size;
+  }
+
+  void remove_by_filter(std::function<bool (T)> f) override final {
+    filter([&f](const Request &r) { return f(r.item); });
+  }
+
+  void remove_by_class(K k, std::list<T> *out = 0) override final {
+    filter([&k, out](const Request &r) {
+	if (!(r.cl == k))
+	  return false;
+	if (out)
+	  out->push_front(r.item);
+	return true;
+      });
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) override final {
+    strict[priority].push_back(std::make_pair(cl, item));
+    ++strict_size;
+  }
+
+  void enqueue_strict_front(K cl, unsigned priority, T item) override final {
+    strict[priority].push_front(std::make_pair(cl, item));
+    ++strict_size;
+  }
+
+  void enqueue(K cl, unsigned priority, unsigned cost, T item) override final {
+    insert(cl, item, false);
+  }
+
+  void enqueue_front(K cl, unsigned priority, unsigned cost,
+		     T item) override final {
+    insert(cl, item, true);
+  }
+
+  bool empty() const override final {
+    return !(size + strict_size);
+  }
+
+  T dequeue() override final {
+    assert(!empty());
+    if (strict_size) {
+      typename std::map<unsigned, std::list<std::pair<K, T> > >::iterator i =
+	--strict.end();
+      T ret = i->second.front().second;
+      i->second.pop_front();
+      if (i->second.empty())
+	strict.erase(i);
+      --strict_size;
+      return ret;
+    }
+
+    double t = now();
+    // clients whose limit tag has passed become ready
+    while (!l_heap.empty() && !l_heap.top()->ready && l_heap.top()->l <= t) {
+      Client *c = l_heap.top();
+      c->ready = true;
+      l_heap.adjust(c);
+      ready_heap.adjust(c);
+    }
+
+    assert(!r_heap.empty());
+    if (r_heap.top()->r <= t) {
+      ++reservation_served;
+      return pop(*r_heap.top(), t);
+    }
+    Client *c = ready_heap.top()->ready ? ready_heap.top() : l_heap.top();
+    // service beyond the reservation does not count against it
+    mClockClientInfo info = get_info(*c->id);
+    if (info.reservation > 0)
+      c->prev_r -= 1.0 / info.reservation;
+    ++weight_served;
+    return pop(*c, t);
+  }
+
+  uint64_t get_reservation_served() const {
+    return reservation_served;
+  }
+
+  uint64_t get_weight_served() const {
+    return weight_served;
+  }
+
+  void dump(ceph::Formatter *f) const override final {
+    f->dump_int("strict_size", strict_size);
+    f->dump_int("size", size);
+    f->dump_int("reservation_served", reservation_served);
+    f->dump_int("weight_served", weight_served);
+    f->open_array_section("clients");
+    for (typename Clients::const_iterator i = clients.begin();
+	 i != clients.end();
+	 ++i) {
+      if (i->second.requests.empty())
+	continue;
+      std::stringstream ss;
+      ss << i->first;
+      f->open_object_section("client");
+      f->dump_string("client", ss.str());
+      f->dump_int("queued", i->second.requests.size());
+      f->dump_float("reservation_tag", i->second.r);
+      f->dump_float("proportion_tag", i->second.p);
+      f->dump_float("limit_tag", i->second.l);
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include "common/Formatter.h"
 #include "common/valgrind.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <map>
 #include <sstream>
@@ -118,6 +119,28 @@ void PerfCountersCollection::dump_formatted(
     bool schema,
     const std::string &logger,
     const std::string &counter)
+{
+  dump_formatted_generic(f, schema, false, logger, counter);
+}
+
+/**
+ * Same as dump_formatted(), for the buckets of the histograms only.
+ */
+void PerfCountersCollection::dump_formatted_histograms(
+    Formatter *f,
+    bool schema,
+    const std::string &logger,
+    const std::string &counter)
+{
+  dump_formatted_generic(f, schema, true, logger, counter);
+}
+
+void PerfCountersCollection::dump_formatted_generic(
+    Formatter *f,
+    bool schema,
+    bool histograms,
+    const std::string &logger,
+    const std::string &counter)
 {
   Mutex::Locker lck(m_lock);
   f->open_object_section("perfcounter_collection");
@@ -126,7 +149,7 @@ void PerfCountersCollection::dump_formatted(
        l != m_loggers.end(); ++l) {
     // Optionally filter on logger name, pass through counter filter
     if (logger.empty() || (*l)->get_name() == logger) {
-      (*l)->dump_formatted(f, schema, counter);
+      (*l)->dump_formatted_generic(f, schema, histograms, counter);
     }
   }
   f->close_section();
@@ -136,6 +159,43 @@ void PerfCountersCollection::dump_formatted(
 
 PerfCounters::~PerfCounters()
 {
+  for (std::vector<perf_counter_value_d*>::iterator i = m_shards.begin();
+       i != m_shards.end();
+       ++i)
+    delete[] *i;
+}
+
+unsigned PerfCounters::thread_shard()
+{
+  static atomic_t next_shard(0);
+  static __thread unsigned shard = 0;
+  if (!shard)
+    shard = next_shard.inc();
+  return shard;
+}
+
+uint64_t PerfCounters::read_u64(int idx) const
+{
+  const perf_counter_data_any_d& data(data_of(idx));
+  size_t i = idx - m_lower_bound - 1;
+  if (!data.is_sharded())
+    return m_shards[0][i].u64.read();
+  uint64_t v = 0;
+  for (size_t s = 0; s < m_shards.size(); ++s)
+    v += m_shards[s][i].u64.read();
+  return v;
+}
+
+pair<uint64_t,uint64_t> PerfCounters::read_avg(int idx) const
+{
+  size_t i = idx - m_lower_bound - 1;
+  pair<uint64_t,uint64_t> a(0, 0);
+  for (size_t s = 0; s < m_shards.size(); ++s) {
+    pair<uint64_t,uint64_t> sa = m_shards[s][i].read_avg();
+    a.first += sa.first;
+    a.second += sa.second;
+  }
+  return a;
 }
 
 void PerfCounters::inc(int idx, uint64_t amt)
@@ -143,17 +203,16 @@ void PerfCounters::inc(int idx, uint64_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_U64))
     return;
+  perf_counter_value_d& value(value_of(idx));
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount.inc();
-    data.u64.add(amt);
-    data.avgcount2.inc();
+    value.avgcount.inc();
+    value.u64.add(amt);
+    value.avgcount2.inc();
   } else {
-    data.u64.add(amt);
+    value.u64.add(amt);
   }
 }
 
@@ -162,13 +221,12 @@ void PerfCounters::dec(int idx, uint64_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   assert(!(data.type & PERFCOUNTER_LONGRUNAVG));
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u64.sub(amt);
+  // shards of a counter may wrap around, their sum does not
+  value_of(idx).u64.sub(amt);
 }
 
 void PerfCounters::set(int idx, uint64_t amt)
@@ -176,20 +234,25 @@ void PerfCounters::set(int idx, uint64_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_U64))
     return;
 
-  ANNOTATE_BENIGN_RACE_SIZED(&data.u64, sizeof(data.u64),
+  // the value goes to the first shard, the others are cleared
+  size_t i = idx - m_lower_bound - 1;
+  perf_counter_value_d& value(m_shards[0][i]);
+  ANNOTATE_BENIGN_RACE_SIZED(&value.u64, sizeof(value.u64),
                              "perf counter atomic");
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount.inc();
-    data.u64.set(amt);
-    data.avgcount2.inc();
+    value.avgcount.inc();
+    value.u64.set(amt);
+    value.avgcount2.inc();
   } else {
-    data.u64.set(amt);
+    value.u64.set(amt);
+  }
+  if (data.is_sharded()) {
+    for (size_t s = 1; s < m_shards.size(); ++s)
+      m_shards[s][i].u64.set(0);
   }
 }
 
@@ -198,12 +261,10 @@ uint64_t PerfCounters::get(int idx) const
   if (!m_cct->_conf->perf)
     return 0;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_U64))
     return 0;
-  return data.u64.read();
+  return read_u64(idx);
 }
 
 void PerfCounters::tinc(int idx, utime_t amt)
@@ -211,17 +272,16 @@ void PerfCounters::tinc(int idx, utime_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_TIME))
     return;
+  perf_counter_value_d& value(value_of(idx));
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount.inc();
-    data.u64.add(amt.to_nsec());
-    data.avgcount2.inc();
+    value.avgcount.inc();
+    value.u64.add(amt.to_nsec());
+    value.avgcount2.inc();
   } else {
-    data.u64.add(amt.to_nsec());
+    value.u64.add(amt.to_nsec());
   }
 }
 
@@ -230,17 +290,16 @@ void PerfCounters::tinc(int idx, ceph::timespan amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_TIME))
     return;
+  perf_counter_value_d& value(value_of(idx));
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount.inc();
-    data.u64.add(amt.count());
-    data.avgcount2.inc();
+    value.avgcount.inc();
+    value.u64.add(amt.count());
+    value.avgcount2.inc();
   } else {
-    data.u64.add(amt.count());
+    value.u64.add(amt.count());
   }
 }
 
@@ -249,12 +308,10 @@ void PerfCounters::tset(int idx, utime_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  data.u64.set(amt.to_nsec());
+  value_of(idx).u64.set(amt.to_nsec());
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     assert(0);
 }
@@ -264,44 +321,74 @@ utime_t PerfCounters::tget(int idx) const
   if (!m_cct->_conf->perf)
     return utime_t();
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_TIME))
     return utime_t();
-  uint64_t v = data.u64.read();
+  uint64_t v = read_u64(idx);
   return utime_t(v / 1000000000ull, v % 1000000000ull);
 }
 
+void PerfCounters::hinc(int idx, int64_t x, int64_t y)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  const perf_counter_data_any_d& data(data_of(idx));
+  if (!(data.type & PERFCOUNTER_HISTOGRAM))
+    return;
+  assert(data.histogram);
+  if (data.histogram->get_dimensions() == 1)
+    data.histogram->inc(x);
+  else
+    data.histogram->inc(x, y);
+  perf_counter_value_d& value(value_of(idx));
+  value.avgcount.inc();
+  value.u64.add(x);
+  value.avgcount2.inc();
+}
+
 pair<uint64_t, uint64_t> PerfCounters::get_tavg_ms(int idx) const
 {
   if (!m_cct->_conf->perf)
     return make_pair(0, 0);
 
-  assert(idx > m_lower_bound);
-  assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  const perf_counter_data_any_d& data(data_of(idx));
   if (!(data.type & PERFCOUNTER_TIME))
     return make_pair(0, 0);
   if (!(data.type & PERFCOUNTER_LONGRUNAVG))
     return make_pair(0, 0);
-  pair<uint64_t,uint64_t> a = data.read_avg();
+  pair<uint64_t,uint64_t> a = read_avg(idx);
   return make_pair(a.second, a.first / 1000000ull);
 }
 
 void PerfCounters::reset()
 {
-  perf_counter_data_vec_t::iterator d = m_data.begin();
-  perf_counter_data_vec_t::iterator d_end = m_data.end();
-
-  while (d != d_end) {
-    d->reset();
-    ++d;
+  for (size_t i = 0; i < m_data.size(); ++i) {
+    perf_counter_data_any_d &d(m_data[i]);
+    // plain values are levels, not reset
+    if (d.type == PERFCOUNTER_U64)
+      continue;
+    for (size_t s = 0; s < m_shards.size(); ++s)
+      m_shards[s][i].reset();
+    if (d.histogram)
+      d.histogram->reset();
   }
 }
 
 void PerfCounters::dump_formatted(Formatter *f, bool schema,
     const std::string &counter)
+{
+  dump_formatted_generic(f, schema, false, counter);
+}
+
+void PerfCounters::dump_formatted_histograms(Formatter *f, bool schema,
+    const std::string &counter)
+{
+  dump_formatted_generic(f, schema, true, counter);
+}
+
+void PerfCounters::dump_formatted_generic(Formatter *f, bool schema,
+    bool histograms, const std::string &counter)
 {
   f->open_object_section(m_name.c_str());
   
@@ -311,8 +398,24 @@ void PerfCounters::dump_formatted(Formatter *f, bool schema,
       // Optionally filter on counter name
       continue;
     }
+    if (histograms && !(d->type & PERFCOUNTER_HISTOGRAM)) {
+      // Histograms are also dumped as averages, their buckets on their own
+      continue;
+    }
+    int idx = d - m_data.begin() + m_lower_bound + 1;
 
-    if (schema) {
+    if (histograms) {
+      f->open_object_section(d->name);
+      if (schema) {
+	f->dump_int("type", d->type);
+	f->dump_string("description", d->description ? d->description : "");
+	f->dump_string("nick", d->nick ? d->nick : "");
+	d->histogram->dump_schema(f);
+      } else {
+	d->histogram->dump_values(f);
+      }
+      f->close_section();
+    } else if (schema) {
       f->open_object_section(d->name);
       f->dump_int("type", d->type);
 
@@ -331,7 +434,7 @@ void PerfCounters::dump_formatted(Formatter *f, bool schema,
     } else {
       if (d->type & PERFCOUNTER_LONGRUNAVG) {
 	f->open_object_section(d->name);
-	pair<uint64_t,uint64_t> a = d->read_avg();
+	pair<uint64_t,uint64_t> a = read_avg(idx);
 	if (d->type & PERFCOUNTER_U64) {
 	  f->dump_unsigned("avgcount", a.second);
 	  f->dump_unsigned("sum", a.first);
@@ -345,7 +448,7 @@ void PerfCounters::dump_formatted(Formatter *f, bool schema,
 	}
 	f->close_section();
       } else {
-	uint64_t v = d->u64.read();
+	uint64_t v = read_u64(idx);
 	if (d->type & PERFCOUNTER_U64) {
 	  f->dump_unsigned(d->name, v);
 	} else if (d->type & PERFCOUNTER_TIME) {
@@ -376,6 +479,9 @@ PerfCounters::PerfCounters(CephContext *cct, const std::string &name,
     m_lock(m_lock_name.c_str())
 {
   m_data.resize(upper_bound - lower_bound - 1);
+  int shards = std::max(cct->_conf->perf_counter_shards, 1);
+  for (int s = 0; s < shards; ++s)
+    m_shards.push_back(new perf_counter_value_d[m_data.size()]);
 }
 
 PerfCountersBuilder::PerfCountersBuilder(CephContext *cct, const std::string &name,
@@ -421,8 +527,33 @@ void PerfCountersBuilder::add_time_avg(int idx, const char *name,
   add_impl(idx, name, description, nick, PERFCOUNTER_TIME | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_u64_counter_histogram(int idx, const char *name,
+    PerfHistogram::axis_config_d x_axis_config,
+    const char *description, const char *nick)
+{
+  std::vector<PerfHistogram::axis_config_d> axes;
+  axes.push_back(x_axis_config);
+  add_impl(idx, name, description, nick,
+	   PERFCOUNTER_U64 | PERFCOUNTER_LONGRUNAVG | PERFCOUNTER_HISTOGRAM,
+	   new PerfHistogram(axes));
+}
+
+void PerfCountersBuilder::add_u64_counter_histogram(int idx, const char *name,
+    PerfHistogram::axis_config_d x_axis_config,
+    PerfHistogram::axis_config_d y_axis_config,
+    const char *description, const char *nick)
+{
+  std::vector<PerfHistogram::axis_config_d> axes;
+  axes.push_back(x_axis_config);
+  axes.push_back(y_axis_config);
+  add_impl(idx, name, description, nick,
+	   PERFCOUNTER_U64 | PERFCOUNTER_LONGRUNAVG | PERFCOUNTER_HISTOGRAM,
+	   new PerfHistogram(axes));
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name,
-    const char *description, const char *nick, int ty)
+    const char *description, const char *nick, int ty,
+    PerfHistogram *histogram)
 {
   assert(idx > m_perf_counters->m_lower_bound);
   assert(idx < m_perf_counters->m_upper_bound);
@@ -434,6 +565,7 @@ void PerfCountersBuilder::add_impl(int idx, const char *name,
   data.description = description;
   data.nick = nick;
   data.type = (enum perfcounter_type_d)ty;
+  data.histogram.reset(histogram);
 }
 
 PerfCounters *PerfCountersBuilder::create_perf_counters()
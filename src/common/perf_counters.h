@@ -23,6 +23,8 @@
 #include "common/config_obs.h"
 #include "common/Mutex.h"
 #include "common/ceph_time.h"
+#include "common/perf_histogram.h"
+#include "include/memory.h"
 
 #include <stdint.h>
 #include <string>
@@ -39,6 +41,7 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
 /*
@@ -64,6 +67,15 @@ enum perfcounter_type_d
  * For the time average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * tinc. Calling tset on an average is an error and will assert out.
+ *
+ * A histogram counts hinc() values in buckets along one or two axes (see
+ * PerfHistogram), and keeps their avgcount and sum for "perf dump" like an
+ * average.  "perf histogram dump" shows the buckets.
+ *
+ * Counters and averages are split in perf_counter_shards shards: a thread
+ * only updates the values of its own shard, and reading adds them up, so
+ * that threads updating the same counter do not share its cache line.
+ * Plain values are kept in the first shard.
  */
 class PerfCounters
 {
@@ -98,9 +110,14 @@ public:
   void tinc(int idx, ceph::timespan v);
   utime_t tget(int idx) const;
 
+  /// count x, and y for a two dimensional histogram
+  void hinc(int idx, int64_t x, int64_t y = 0);
+
   void reset();
   void dump_formatted(ceph::Formatter *f, bool schema,
       const std::string &counter = "");
+  void dump_formatted_histograms(ceph::Formatter *f, bool schema,
+      const std::string &counter = "");
   pair<uint64_t, uint64_t> get_tavg_ms(int idx) const;
 
   const std::string& get_name() const;
@@ -114,56 +131,16 @@ private:
   PerfCounters(const PerfCounters &rhs);
   PerfCounters& operator=(const PerfCounters &rhs);
 
-  /** Represents a PerfCounters data element. */
-  struct perf_counter_data_any_d {
-    perf_counter_data_any_d()
-      : name(NULL),
-        description(NULL),
-        nick(NULL),
-	type(PERFCOUNTER_NONE),
-	u64(0),
-	avgcount(0),
-	avgcount2(0)
-    {}
-    perf_counter_data_any_d(const perf_counter_data_any_d& other)
-      : name(other.name),
-        description(other.description),
-        nick(other.nick),
-	type(other.type),
-	u64(other.u64.read()) {
-      pair<uint64_t,uint64_t> a = other.read_avg();
-      u64.set(a.first);
-      avgcount.set(a.second);
-      avgcount2.set(a.second);
-    }
-
-    const char *name;
-    const char *description;
-    const char *nick;
-    enum perfcounter_type_d type;
+  /** The value of a PerfCounters data element, in one shard. */
+  struct perf_counter_value_d {
     atomic64_t u64;
     atomic64_t avgcount;
     atomic64_t avgcount2;
 
-    void reset()
-    {
-      if (type != PERFCOUNTER_U64) {
-	u64.set(0);
-	avgcount.set(0);
-	avgcount2.set(0);
-      }
-    }
-
-    perf_counter_data_any_d& operator=(const perf_counter_data_any_d& other) {
-      name = other.name;
-      description = other.description;
-      nick = other.nick;
-      type = other.type;
-      pair<uint64_t,uint64_t> a = other.read_avg();
-      u64.set(a.first);
-      avgcount.set(a.second);
-      avgcount2.set(a.second);
-      return *this;
+    void reset() {
+      u64.set(0);
+      avgcount.set(0);
+      avgcount2.set(0);
     }
 
     /// read <sum, count> safely
@@ -176,6 +153,27 @@ private:
       return make_pair(sum, count);
     }
   };
+
+  /** Represents a PerfCounters data element. */
+  struct perf_counter_data_any_d {
+    perf_counter_data_any_d()
+      : name(NULL),
+        description(NULL),
+        nick(NULL),
+	type(PERFCOUNTER_NONE)
+    {}
+
+    const char *name;
+    const char *description;
+    const char *nick;
+    enum perfcounter_type_d type;
+    ceph::shared_ptr<PerfHistogram> histogram;
+
+    /// counters and averages are updated in the shard of the thread
+    bool is_sharded() const {
+      return type & (PERFCOUNTER_COUNTER | PERFCOUNTER_LONGRUNAVG);
+    }
+  };
   typedef std::vector<perf_counter_data_any_d> perf_counter_data_vec_t;
 
   CephContext *m_cct;
@@ -189,7 +187,40 @@ private:
 
   perf_counter_data_vec_t m_data;
 
+  /**
+   * m_shards[s][i] is the value of m_data[i] in shard s, every shard is
+   * allocated on its own so that they do not share cache lines but at
+   * their ends.
+   */
+  std::vector<perf_counter_value_d*> m_shards;
+
+  perf_counter_data_any_d& data_of(int idx) {
+    assert(idx > m_lower_bound);
+    assert(idx < m_upper_bound);
+    return m_data[idx - m_lower_bound - 1];
+  }
+  const perf_counter_data_any_d& data_of(int idx) const {
+    assert(idx > m_lower_bound);
+    assert(idx < m_upper_bound);
+    return m_data[idx - m_lower_bound - 1];
+  }
+  /// the value of idx to update from this thread
+  perf_counter_value_d& value_of(int idx) {
+    const perf_counter_data_any_d &data(data_of(idx));
+    unsigned shard = data.is_sharded() ? thread_shard() % m_shards.size() : 0;
+    return m_shards[shard][idx - m_lower_bound - 1];
+  }
+  /// u64 of idx, all shards added up
+  uint64_t read_u64(int idx) const;
+  /// <sum, count> of idx, all shards added up
+  pair<uint64_t,uint64_t> read_avg(int idx) const;
+  static unsigned thread_shard();
+
+  void dump_formatted_generic(ceph::Formatter *f, bool schema, bool histograms,
+      const std::string &counter);
+
   friend class PerfCountersBuilder;
+  friend class PerfCountersCollection;
 };
 
 class SortPerfCountersByName {
@@ -218,7 +249,19 @@ public:
       bool schema,
       const std::string &logger = "",
       const std::string &counter = "");
+  void dump_formatted_histograms(
+      ceph::Formatter *f,
+      bool schema,
+      const std::string &logger = "",
+      const std::string &counter = "");
 private:
+  void dump_formatted_generic(
+      ceph::Formatter *f,
+      bool schema,
+      bool histograms,
+      const std::string &logger,
+      const std::string &counter);
+
   CephContext *m_cct;
 
   /** Protects m_loggers */
@@ -253,12 +296,20 @@ public:
       const char *description=NULL, const char *nick = NULL);
   void add_time_avg(int key, const char *name,
       const char *description=NULL, const char *nick = NULL);
+  void add_u64_counter_histogram(int key, const char *name,
+      PerfHistogram::axis_config_d x_axis_config,
+      const char *description=NULL, const char *nick = NULL);
+  void add_u64_counter_histogram(int key, const char *name,
+      PerfHistogram::axis_config_d x_axis_config,
+      PerfHistogram::axis_config_d y_axis_config,
+      const char *description=NULL, const char *nick = NULL);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
   PerfCountersBuilder& operator=(const PerfCountersBuilder &rhs);
   void add_impl(int idx, const char *name,
-                const char *description, const char *nick, int ty);
+                const char *description, const char *nick, int ty,
+                PerfHistogram *histogram = NULL);
 
   PerfCounters *m_perf_counters;
 };
@@ -0,0 +1,149 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/perf_histogram.h"
+#include "common/Formatter.h"
+#include "include/assert.h"
+
+#include <limits>
+
+PerfHistogram::PerfHistogram(const std::vector<axis_config_d> &axes)
+  : m_axes(axes)
+{
+  assert(m_axes.size() == 1 || m_axes.size() == 2);
+  size_t n = 1;
+  for (std::vector<axis_config_d>::const_iterator i = m_axes.begin();
+       i != m_axes.end();
+       ++i) {
+    assert(i->m_buckets >= 3);
+    assert(i->m_quant_size > 0);
+    n *= i->m_buckets;
+  }
+  m_buckets.reset(new ceph::atomic64_t[n]);
+}
+
+int32_t PerfHistogram::get_bucket_for_axis(int64_t value,
+					   const axis_config_d &ac)
+{
+  if (value < ac.m_min)
+    return 0;
+  uint64_t quants = (uint64_t)(value - ac.m_min) / ac.m_quant_size;
+  int32_t bucket;
+  if (ac.m_scale_type == SCALE_LINEAR) {
+    bucket = quants >= (uint64_t)ac.m_buckets ? ac.m_buckets : quants + 1;
+  } else {
+    // bucket 1 is [0, 1) quants, bucket b > 1 is [2^(b-2), 2^(b-1))
+    bucket = quants ? 64 - __builtin_clzll(quants) + 1 : 1;
+  }
+  return bucket < ac.m_buckets - 1 ? bucket : ac.m_buckets - 1;
+}
+
+std::vector<std::pair<int64_t, int64_t> >
+PerfHistogram::get_axis_bucket_ranges(const axis_config_d &ac)
+{
+  std::vector<std::pair<int64_t, int64_t> > ranges;
+  ranges.push_back(std::make_pair(std::numeric_limits<int64_t>::min(),
+				  ac.m_min - 1));
+  int64_t lower = ac.m_min;
+  int64_t width = ac.m_quant_size;
+  for (int32_t b = 1; b < ac.m_buckets - 1; ++b) {
+    ranges.push_back(std::make_pair(lower, lower + width - 1));
+    lower += width;
+    if (ac.m_scale_type == SCALE_LOG2 && b > 1)
+      width *= 2;
+  }
+  ranges.push_back(std::make_pair(lower,
+				  std::numeric_limits<int64_t>::max()));
+  return ranges;
+}
+
+void PerfHistogram::inc(int64_t x)
+{
+  assert(m_axes.size() == 1);
+  m_buckets[get_bucket_for_axis(x, m_axes[0])].inc();
+}
+
+void PerfHistogram::inc(int64_t x, int64_t y)
+{
+  assert(m_axes.size() == 2);
+  int32_t bx = get_bucket_for_axis(x, m_axes[0]);
+  int32_t by = get_bucket_for_axis(y, m_axes[1]);
+  m_buckets[bx * m_axes[1].m_buckets + by].inc();
+}
+
+uint64_t PerfHistogram::get_bucket(int32_t x, int32_t y) const
+{
+  if (m_axes.size() == 1)
+    return m_buckets[x].read();
+  return m_buckets[x * m_axes[1].m_buckets + y].read();
+}
+
+void PerfHistogram::reset()
+{
+  size_t n = 1;
+  for (std::vector<axis_config_d>::const_iterator i = m_axes.begin();
+       i != m_axes.end();
+       ++i)
+    n *= i->m_buckets;
+  for (size_t i = 0; i < n; ++i)
+    m_buckets[i].set(0);
+}
+
+void PerfHistogram::dump_schema(ceph::Formatter *f) const
+{
+  f->open_array_section("axes");
+  for (std::vector<axis_config_d>::const_iterator i = m_axes.begin();
+       i != m_axes.end();
+       ++i) {
+    f->open_object_section("axis");
+    f->dump_string("name", i->m_name);
+    f->dump_string("scale_type",
+		   i->m_scale_type == SCALE_LINEAR ? "linear" : "log2");
+    f->dump_int("min", i->m_min);
+    f->dump_int("quant_size", i->m_quant_size);
+    f->dump_int("buckets", i->m_buckets);
+    f->open_array_section("ranges");
+    std::vector<std::pair<int64_t, int64_t> > ranges =
+      get_axis_bucket_ranges(*i);
+    for (std::vector<std::pair<int64_t, int64_t> >::iterator r =
+	   ranges.begin();
+	 r != ranges.end();
+	 ++r) {
+      f->open_object_section("range");
+      if (r != ranges.begin())
+	f->dump_int("min", r->first);
+      if (r + 1 != ranges.end())
+	f->dump_int("max", r->second);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void PerfHistogram::dump_values(ceph::Formatter *f) const
+{
+  f->open_array_section("values");
+  if (m_axes.size() == 1) {
+    for (int32_t x = 0; x < m_axes[0].m_buckets; ++x)
+      f->dump_unsigned("value", get_bucket(x));
+  } else {
+    for (int32_t x = 0; x < m_axes[0].m_buckets; ++x) {
+      f->open_array_section("row");
+      for (int32_t y = 0; y < m_axes[1].m_buckets; ++y)
+	f->dump_unsigned("value", get_bucket(x, y));
+      f->close_section();
+    }
+  }
+  f->close_section();
+}
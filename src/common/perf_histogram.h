@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_PERF_HISTOGRAM_H
+#define CEPH_COMMON_PERF_HISTOGRAM_H
+
+#include "include/atomic.h"
+
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * A histogram of one or two dimensions, e.g. latency, or latency vs.
+ * request size, kept as atomic bucket counters.
+ *
+ * Along each axis, bucket 0 counts the values below m_min and the last
+ * bucket the values beyond the range of the others.  With SCALE_LINEAR
+ * every other bucket is m_quant_size wide; with SCALE_LOG2 the first
+ * one is m_quant_size wide and each next one is twice as wide as the
+ * previous one.
+ */
+class PerfHistogram
+{
+public:
+  enum scale_type_d {
+    SCALE_LINEAR = 1,
+    SCALE_LOG2 = 2,
+  };
+
+  struct axis_config_d {
+    const char *m_name;
+    scale_type_d m_scale_type;
+    int64_t m_min;
+    int64_t m_quant_size;
+    int32_t m_buckets;
+  };
+
+  explicit PerfHistogram(const std::vector<axis_config_d> &axes);
+
+  void inc(int64_t x);
+  void inc(int64_t x, int64_t y);
+  void reset();
+
+  unsigned get_dimensions() const {
+    return m_axes.size();
+  }
+  /// raw counter of a bucket, y is ignored for one dimension
+  uint64_t get_bucket(int32_t x, int32_t y = 0) const;
+
+  /// axes and bucket ranges
+  void dump_schema(ceph::Formatter *f) const;
+  /// bucket counters, an array of arrays for two dimensions
+  void dump_values(ceph::Formatter *f) const;
+
+  static int32_t get_bucket_for_axis(int64_t value, const axis_config_d &ac);
+  /// [min, max] of every bucket of the axis
+  static std::vector<std::pair<int64_t, int64_t> >
+  get_axis_bucket_ranges(const axis_config_d &ac);
+
+private:
+  std::vector<axis_config_d> m_axes;
+  std::unique_ptr<ceph::atomic64_t[]> m_buckets;
+};
+
+#endif
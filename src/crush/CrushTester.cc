@@ -6,7 +6,9 @@
 #include "CrushTreeDumper.h"
 
 #include <algorithm>
+#include <atomic>
 #include <stdlib.h>
+#include <thread>
 #include <boost/lexical_cast.hpp>
 // to workaround https://svn.boost.org/trac/boost/ticket/9501
 #ifdef _LIBCPP_VERSION
@@ -291,6 +293,34 @@ int CrushTester::random_placement(int ruleno, vector<int>& out, int maxout, vect
   return 0;
 }
 
+void CrushTester::map_range(int ruleno, int maxout, const vector<__u32>& weight,
+			    vector<vector<int> > *out)
+{
+  // xs mapped by one thread at a time
+  const int chunk = 1024;
+
+  out->resize(max_x - min_x + 1);
+  std::atomic<int64_t> next(min_x);
+  auto worker = [&]() {
+    for (int64_t begin = next.fetch_add(chunk);
+	 begin <= max_x;
+	 begin = next.fetch_add(chunk)) {
+      int end = MIN(begin + chunk - 1, (int64_t)max_x);
+      for (int x = begin; x <= end; x++) {
+	uint32_t real_x = x;
+	if (pool_id != -1)
+	  real_x = crush_hash32_2(CRUSH_HASH_RJENKINS1, x, (uint32_t)pool_id);
+	crush.do_rule(ruleno, real_x, (*out)[x - min_x], maxout, weight);
+      }
+    }
+  };
+  vector<std::thread> workers;
+  for (int i = 0; i < num_threads; i++)
+    workers.push_back(std::thread(worker));
+  for (unsigned i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
 void CrushTester::write_integer_indexed_vector_data_string(vector<string> &dst, int index, vector<int> vector_data)
 {
   stringstream data_buffer (stringstream::in | stringstream::out);
@@ -612,6 +642,12 @@ int CrushTester::test()
         }
 
       }
+      // map the whole range up front on several threads, then go
+      // through the results in order below
+      vector<vector<int> > mapped;
+      if (use_crush && num_threads > 1 && !output_choose_tries)
+	map_range(r, nr, weight, &mapped);
+
       // compute the expected number of objects stored per device when a device's weight is considered
       vector<float> num_objects_expected(num_devices);
 
@@ -640,11 +676,15 @@ int CrushTester::test()
           if (use_crush) {
             if (output_mappings)
 	      err << "CRUSH"; // prepend CRUSH to placement output
-            uint32_t real_x = x;
-            if (pool_id != -1) {
-              real_x = crush_hash32_2(CRUSH_HASH_RJENKINS1, x, (uint32_t)pool_id);
+            if (!mapped.empty()) {
+              out.swap(mapped[x - min_x]);
+            } else {
+              uint32_t real_x = x;
+              if (pool_id != -1) {
+                real_x = crush_hash32_2(CRUSH_HASH_RJENKINS1, x, (uint32_t)pool_id);
+              }
+              crush.do_rule(r, real_x, out, nr, weight);
             }
-            crush.do_rule(r, real_x, out, nr, weight);
           } else {
             if (output_mappings)
 	      err << "RNG"; // prepend RNG to placement output to denote simulation
@@ -21,6 +21,7 @@ class CrushTester {
   int64_t pool_id;
 
   int num_batches;
+  int num_threads;
   bool use_crush;
 
   float mark_down_device_ratio;
@@ -76,6 +77,13 @@ class CrushTester {
    */
   int random_placement(int ruleno, vector<int>& out, int maxout, vector<__u32>& weight);
 
+  /*
+   * Map every x from min_x to max_x with ruleno for maxout replicas, the
+   * range split over num_threads threads; (*out)[x - min_x] gets x's result.
+   */
+  void map_range(int ruleno, int maxout, const vector<__u32>& weight,
+		 vector<vector<int> > *out);
+
   // scaffolding to store data for off-line processing
    struct tester_data_set {
      vector <string> device_utilization;
@@ -175,6 +183,7 @@ public:
       min_rep(-1), max_rep(-1),
       pool_id(-1),
       num_batches(1),
+      num_threads(1),
       use_crush(true),
       mark_down_device_ratio(0.0),
       mark_down_bucket_ratio(1.0),
@@ -260,6 +269,13 @@ public:
     return num_batches;
   }
 
+  void set_num_threads(int n) {
+    num_threads = n;
+  }
+  int get_num_threads() const {
+    return num_threads;
+  }
+
   void set_random_placement() {
     use_crush = false;
   }
@@ -11,6 +11,29 @@
 
 #define dout_subsys ceph_subsys_crush
 
+void CrushWrapper::do_rule(int rule, int x, vector<int>& out, int maxout,
+			   const vector<__u32>& weight) const
+{
+  // the result, scratch and workspace of this thread, kept across calls
+  // and grown as needed; laid out afresh for the map each time
+  static thread_local vector<uint64_t> work;
+  size_t work_size = crush_work_size(crush);
+  size_t size = (work_size + sizeof(int) * maxout * 4 + sizeof(uint64_t) - 1) /
+    sizeof(uint64_t);
+  if (work.size() < size)
+    work.resize(size);
+  int *rawout = (int *)&work[0];
+  int *scratch = rawout + maxout;
+  crush_work *cw = crush_init_workspace(crush, scratch + maxout * 3);
+  int numrep = crush_do_rule(crush, rule, x, rawout, maxout, &weight[0],
+			     weight.size(), scratch, cw);
+  if (numrep < 0)
+    numrep = 0;
+  out.resize(numrep);
+  for (int i=0; i<numrep; i++)
+    out[i] = rawout[i];
+}
+
 bool CrushWrapper::has_v2_rules() const
 {
   for (unsigned i=0; i<crush->max_rules; i++) {
@@ -50,7 +50,6 @@ inline static void decode(crush_rule_step &s, bufferlist::iterator &p)
 
 using namespace std;
 class CrushWrapper {
-  mutable Mutex mapper_lock;
 public:
   std::map<int32_t, string> type_map; /* bucket/device type names */
   std::map<int32_t, string> name_map; /* bucket/device names */
@@ -78,8 +77,7 @@ public:
   CrushWrapper(const CrushWrapper& other);
   const CrushWrapper& operator=(const CrushWrapper& other);
 
-  CrushWrapper() : mapper_lock("CrushWrapper::mapper_lock"),
-		   crush(0), have_rmaps(false) {
+  CrushWrapper() : crush(0), have_rmaps(false) {
     create();
   }
   ~CrushWrapper() {
@@ -1082,18 +1080,9 @@ public:
     return result;
   }
 
+  /// map x with the rule; safe to call from several threads at once
   void do_rule(int rule, int x, vector<int>& out, int maxout,
-	       const vector<__u32>& weight) const {
-    Mutex::Locker l(mapper_lock);
-    int rawout[maxout];
-    int scratch[maxout * 3];
-    int numrep = crush_do_rule(crush, rule, x, rawout, maxout, &weight[0], weight.size(), scratch);
-    if (numrep < 0)
-      numrep = 0;
-    out.resize(numrep);
-    for (int i=0; i<numrep; i++)
-      out[i] = rawout[i];
-  }
+	       const vector<__u32>& weight) const;
   
   bool check_crush_rule(int ruleset, int type, int size,  ostream& ss) {
    
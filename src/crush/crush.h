@@ -138,6 +138,7 @@ struct crush_bucket {
 	/*
 	 * cached random permutation: used for uniform bucket and for
 	 * the linear search fallback for the other bucket types.
+	 * crush_do_rule() keeps its own in a struct crush_work instead.
 	 */
 	__u32 perm_x;  /* @x for which *perm is defined */
 	__u32 perm_n;  /* num elements of *perm that are permuted/defined */
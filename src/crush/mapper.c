@@ -17,10 +17,12 @@
 # include <linux/kernel.h>
 # include <linux/crush/crush.h>
 # include <linux/crush/hash.h>
+# include <linux/crush/mapper.h>
 #else
 # include "crush_compat.h"
 # include "crush.h"
 # include "hash.h"
+# include "mapper.h"
 #endif
 #include "crush_ln_table.h"
 
@@ -68,61 +70,63 @@ int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size
  * wasn't very random, and had some other bad behaviors.  Instead, we
  * calculate an actual random permutation of the bucket members.
  * Since this is expensive, we optimize for the r=0 case, which
- * captures the vast majority of calls.
+ * captures the vast majority of calls.  The permutation lives in the
+ * caller's workspace so that the map itself is never written to.
  */
-static int bucket_perm_choose(struct crush_bucket *bucket,
+static int bucket_perm_choose(const struct crush_bucket *bucket,
+			      struct crush_work_bucket *work,
 			      int x, int r)
 {
 	unsigned int pr = r % bucket->size;
 	unsigned int i, s;
 
 	/* start a new permutation if @x has changed */
-	if (bucket->perm_x != (__u32)x || bucket->perm_n == 0) {
+	if (work->perm_x != (__u32)x || work->perm_n == 0) {
 		dprintk("bucket %d new x=%d\n", bucket->id, x);
-		bucket->perm_x = x;
+		work->perm_x = x;
 
 		/* optimize common r=0 case */
 		if (pr == 0) {
 			s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
 				bucket->size;
-			bucket->perm[0] = s;
-			bucket->perm_n = 0xffff;   /* magic value, see below */
+			work->perm[0] = s;
+			work->perm_n = 0xffff;   /* magic value, see below */
 			goto out;
 		}
 
 		for (i = 0; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm_n = 0;
-	} else if (bucket->perm_n == 0xffff) {
+			work->perm[i] = i;
+		work->perm_n = 0;
+	} else if (work->perm_n == 0xffff) {
 		/* clean up after the r=0 case above */
 		for (i = 1; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm[bucket->perm[0]] = 0;
-		bucket->perm_n = 1;
+			work->perm[i] = i;
+		work->perm[work->perm[0]] = 0;
+		work->perm_n = 1;
 	}
 
 	/* calculate permutation up to pr */
-	for (i = 0; i < bucket->perm_n; i++)
-		dprintk(" perm_choose have %d: %d\n", i, bucket->perm[i]);
-	while (bucket->perm_n <= pr) {
-		unsigned int p = bucket->perm_n;
+	for (i = 0; i < work->perm_n; i++)
+		dprintk(" perm_choose have %d: %d\n", i, work->perm[i]);
+	while (work->perm_n <= pr) {
+		unsigned int p = work->perm_n;
 		/* no point in swapping the final entry */
 		if (p < bucket->size - 1) {
 			i = crush_hash32_3(bucket->hash, x, bucket->id, p) %
 				(bucket->size - p);
 			if (i) {
-				unsigned int t = bucket->perm[p + i];
-				bucket->perm[p + i] = bucket->perm[p];
-				bucket->perm[p] = t;
+				unsigned int t = work->perm[p + i];
+				work->perm[p + i] = work->perm[p];
+				work->perm[p] = t;
 			}
 			dprintk(" perm_choose swap %d with %d\n", p, p+i);
 		}
-		bucket->perm_n++;
+		work->perm_n++;
 	}
 	for (i = 0; i < bucket->size; i++)
-		dprintk(" perm_choose  %d: %d\n", i, bucket->perm[i]);
+		dprintk(" perm_choose  %d: %d\n", i, work->perm[i]);
 
-	s = bucket->perm[pr];
+	s = work->perm[pr];
 out:
 	dprintk(" perm_choose %d sz=%d x=%d r=%d (%d) s=%d\n", bucket->id,
 		bucket->size, x, r, pr, s);
@@ -130,10 +134,10 @@ out:
 }
 
 /* uniform */
-static int bucket_uniform_choose(struct crush_bucket_uniform *bucket,
-				 int x, int r)
+static int bucket_uniform_choose(const struct crush_bucket_uniform *bucket,
+				 struct crush_work_bucket *work, int x, int r)
 {
-	return bucket_perm_choose(&bucket->h, x, r);
+	return bucket_perm_choose(&bucket->h, work, x, r);
 }
 
 /* list */
@@ -341,14 +345,17 @@ static int bucket_straw2_choose(struct crush_bucket_straw2 *bucket,
 }
 
 
-static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
+static int crush_bucket_choose(const struct crush_bucket *in,
+			       struct crush_work_bucket *work,
+			       int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
 	BUG_ON(in->size == 0);
 	switch (in->alg) {
 	case CRUSH_BUCKET_UNIFORM:
-		return bucket_uniform_choose((struct crush_bucket_uniform *)in,
-					  x, r);
+		return bucket_uniform_choose(
+			(const struct crush_bucket_uniform *)in,
+			work, x, r);
 	case CRUSH_BUCKET_LIST:
 		return bucket_list_choose((struct crush_bucket_list *)in,
 					  x, r);
@@ -391,6 +398,7 @@ static int is_out(const struct crush_map *map,
 /**
  * crush_choose_firstn - choose numrep distinct items of given type
  * @map: the crush_map
+ * @work: working space initialized by crush_init_workspace()
  * @bucket: the bucket we are choose an item from
  * @x: crush input value
  * @numrep: the number of items to choose
@@ -409,6 +417,7 @@ static int is_out(const struct crush_map *map,
  * @parent_r: r value passed from the parent
  */
 static int crush_choose_firstn(const struct crush_map *map,
+			       struct crush_work *work,
 			       struct crush_bucket *bucket,
 			       const __u32 *weight, int weight_max,
 			       int x, int numrep, int type,
@@ -468,9 +477,13 @@ parent_r %d stable %d\n",
 				if (local_fallback_retries > 0 &&
 				    flocal >= (in->size>>1) &&
 				    flocal > local_fallback_retries)
-					item = bucket_perm_choose(in, x, r);
+					item = bucket_perm_choose(
+						in, work->work[-1-in->id],
+						x, r);
 				else
-					item = crush_bucket_choose(in, x, r);
+					item = crush_bucket_choose(
+						in, work->work[-1-in->id],
+						x, r);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					skip_rep = 1;
@@ -514,6 +527,7 @@ parent_r %d stable %d\n",
 						else
 							sub_r = 0;
 						if (crush_choose_firstn(map,
+							 work,
 							 map->buckets[-1-item],
 							 weight, weight_max,
 							 x, stable ? 1 : outpos+1, 0,
@@ -595,6 +609,7 @@ reject:
  *
  */
 static void crush_choose_indep(const struct crush_map *map,
+			       struct crush_work *work,
 			       struct crush_bucket *bucket,
 			       const __u32 *weight, int weight_max,
 			       int x, int left, int numrep, int type,
@@ -673,7 +688,9 @@ static void crush_choose_indep(const struct crush_map *map,
 					break;
 				}
 
-				item = crush_bucket_choose(in, x, r);
+				item = crush_bucket_choose(
+					in, work->work[-1-in->id],
+					x, r);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					out[rep] = CRUSH_ITEM_NONE;
@@ -720,6 +737,7 @@ static void crush_choose_indep(const struct crush_map *map,
 				if (recurse_to_leaf) {
 					if (item < 0) {
 						crush_choose_indep(map,
+						   work,
 						   map->buckets[-1-item],
 						   weight, weight_max,
 						   x, 1, numrep, 0,
@@ -776,6 +794,68 @@ static void crush_choose_indep(const struct crush_map *map,
 #endif
 }
 
+/* keep the next crush_work_bucket after a permutation aligned */
+static size_t crush_work_perm_size(const struct crush_bucket *b)
+{
+	return (b->size * sizeof(__u32) + sizeof(void *) - 1) &
+		~(sizeof(void *) - 1);
+}
+
+/**
+ * crush_work_size - bytes of working space crush_do_rule() needs
+ * @map: the crush_map
+ *
+ * The size depends on the buckets of @map, so it has to be asked
+ * again after the map changes.
+ */
+size_t crush_work_size(const struct crush_map *map)
+{
+	size_t size = sizeof(struct crush_work) +
+		map->max_buckets * sizeof(struct crush_work_bucket *);
+	int b;
+
+	for (b = 0; b < map->max_buckets; b++) {
+		if (!map->buckets[b])
+			continue;
+		size += sizeof(struct crush_work_bucket) +
+			crush_work_perm_size(map->buckets[b]);
+	}
+	return size;
+}
+
+/**
+ * crush_init_workspace - lay out working space for crush_do_rule()
+ * @map: the crush_map
+ * @v: at least crush_work_size(@map) bytes, suitably aligned
+ *
+ * Returns @v as a crush_work with an empty permutation for each bucket.
+ * Each thread mapping with the same map needs its own workspace.
+ */
+struct crush_work *crush_init_workspace(const struct crush_map *map, void *v)
+{
+	struct crush_work *w = v;
+	char *point = (char *)v;
+	int b;
+
+	point += sizeof(struct crush_work);
+	w->work = (struct crush_work_bucket **)point;
+	point += map->max_buckets * sizeof(struct crush_work_bucket *);
+	for (b = 0; b < map->max_buckets; b++) {
+		if (!map->buckets[b]) {
+			w->work[b] = NULL;
+			continue;
+		}
+		w->work[b] = (struct crush_work_bucket *)point;
+		point += sizeof(struct crush_work_bucket);
+		w->work[b]->perm_x = 0;
+		w->work[b]->perm_n = 0;
+		w->work[b]->perm = (__u32 *)point;
+		point += crush_work_perm_size(map->buckets[b]);
+	}
+	BUG_ON((size_t)(point - (char *)v) != crush_work_size(map));
+	return w;
+}
+
 /**
  * crush_do_rule - calculate a mapping with the given input and rule
  * @map: the crush_map
@@ -786,11 +866,13 @@ static void crush_choose_indep(const struct crush_map *map,
  * @weight: weight vector (for map leaves)
  * @weight_max: size of weight vector
  * @scratch: scratch vector for private use; must be >= 3 * result_max
+ * @cw: working space from crush_init_workspace(), not shared with
+ *      other threads
  */
 int crush_do_rule(const struct crush_map *map,
 		  int ruleno, int x, int *result, int result_max,
 		  const __u32 *weight, int weight_max,
-		  int *scratch)
+		  int *scratch, struct crush_work *cw)
 {
 	int result_len;
 	int *a = scratch;
@@ -931,6 +1013,7 @@ int crush_do_rule(const struct crush_map *map,
 						recurse_tries = choose_tries;
 					osize += crush_choose_firstn(
 						map,
+						cw,
 						map->buckets[bno],
 						weight, weight_max,
 						x, numrep,
@@ -951,6 +1034,7 @@ int crush_do_rule(const struct crush_map *map,
 						    numrep : (result_max-osize));
 					crush_choose_indep(
 						map,
+						cw,
 						map->buckets[bno],
 						weight, weight_max,
 						x, out_size, numrep,
@@ -10,11 +10,30 @@
 
 #include "crush.h"
 
+/*
+ * the state a mapping builds up as it goes: the random permutation
+ * of each bucket, used for uniform buckets and for the linear search
+ * fallback of the others.  keeping it out of the crush_map lets
+ * several threads map with the same map at once.
+ */
+struct crush_work_bucket {
+	__u32 perm_x;  /* @x for which *perm is defined */
+	__u32 perm_n;  /* num elements of *perm that are permuted/defined */
+	__u32 *perm;
+};
+
+struct crush_work {
+	struct crush_work_bucket **work;  /* indexed like map->buckets */
+};
+
 extern int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size);
+extern size_t crush_work_size(const struct crush_map *map);
+extern struct crush_work *crush_init_workspace(const struct crush_map *map,
+					       void *v);
 extern int crush_do_rule(const struct crush_map *map,
 			 int ruleno,
 			 int x, int *result, int result_max,
 			 const __u32 *weights, int weight_max,
-			 int *scratch);
+			 int *scratch, struct crush_work *cw);
 
 #endif
@@ -72,6 +72,20 @@ int ErasureCode::minimum_to_decode_with_cost(const set<int> &want_to_read,
   return minimum_to_decode(want_to_read, available_chunks, minimum);
 }
 
+int ErasureCode::minimum_to_repair(const set<int> &want_to_read,
+                                   const set<int> &available,
+                                   map<int, vector<pair<int, int> > > *minimum)
+{
+  set<int> chunks;
+  int r = minimum_to_decode(want_to_read, available, &chunks);
+  if (r)
+    return r;
+  vector<pair<int, int> > all(1, make_pair(0, (int)get_sub_chunk_count()));
+  for (set<int>::iterator i = chunks.begin(); i != chunks.end(); ++i)
+    (*minimum)[*i] = all;
+  return 0;
+}
+
 int ErasureCode::encode_prepare(const bufferlist &raw,
                                 map<int, bufferlist> &encoded) const
 {
@@ -175,6 +189,243 @@ int ErasureCode::decode_chunks(const set<int> &want_to_read,
   assert("ErasureCode::decode_chunks not implemented" == 0);
 }
 
+int ErasureCode::encode_stripes(const set<int> &want_to_encode,
+                                const bufferlist &in,
+                                unsigned int stripe_width,
+                                map<int, bufferlist> *encoded)
+{
+  assert(stripe_width > 0);
+  assert(in.length() % stripe_width == 0);
+  for (unsigned int off = 0; off < in.length(); off += stripe_width) {
+    bufferlist stripe;
+    stripe.substr_of(in, off, stripe_width);
+    map<int, bufferlist> chunks;
+    int r = encode(want_to_encode, stripe, &chunks);
+    if (r)
+      return r;
+    for (map<int, bufferlist>::iterator i = chunks.begin();
+	 i != chunks.end();
+	 ++i)
+      (*encoded)[i->first].claim_append(i->second);
+  }
+  return 0;
+}
+
+int ErasureCode::decode_stripes(const set<int> &want_to_read,
+                                const map<int, bufferlist> &chunks,
+                                unsigned int chunk_size,
+                                map<int, bufferlist> *decoded)
+{
+  assert(chunk_size > 0);
+  unsigned int length = chunks.begin()->second.length();
+  assert(length % chunk_size == 0);
+  for (unsigned int off = 0; off < length; off += chunk_size) {
+    map<int, bufferlist> stripe;
+    for (map<int, bufferlist>::const_iterator i = chunks.begin();
+	 i != chunks.end();
+	 ++i) {
+      assert(i->second.length() == length);
+      stripe[i->first].substr_of(i->second, off, chunk_size);
+    }
+    map<int, bufferlist> out;
+    int r = decode(want_to_read, stripe, &out);
+    if (r)
+      return r;
+    for (set<int>::const_iterator i = want_to_read.begin();
+	 i != want_to_read.end();
+	 ++i)
+      (*decoded)[*i].claim_append(out[*i]);
+  }
+  return 0;
+}
+
+int ErasureCode::repair(const set<int> &want_to_read,
+                        const map<int, bufferlist> &helpers,
+                        unsigned int chunk_size,
+                        map<int, bufferlist> *repaired)
+{
+  // minimum_to_repair asked for whole chunks
+  return decode_stripes(want_to_read, helpers, chunk_size, repaired);
+}
+
+int ErasureCode::encode_stripes_contiguous(const set<int> &want_to_encode,
+					   const bufferlist &in,
+					   unsigned int stripe_width,
+					   map<int, bufferlist> *encoded)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  unsigned blocksize = get_chunk_size(stripe_width);
+  assert(stripe_width > 0);
+  assert(in.length() % stripe_width == 0);
+  if (blocksize * k != stripe_width)
+    // stripes are padded: each one must be prepared on its own
+    return ErasureCode::encode_stripes(want_to_encode, in, stripe_width,
+				       encoded);
+  if (in.length() == 0)
+    return 0;
+
+  // gather chunk i of every stripe in one aligned buffer so that
+  // encode_chunks runs once over the whole batch
+  unsigned int stripes = in.length() / stripe_width;
+  unsigned int length = stripes * blocksize;
+  char *data[k];
+  for (unsigned int i = 0; i < k; i++) {
+    bufferptr buf(buffer::create_aligned(length, SIMD_ALIGN));
+    data[i] = buf.c_str();
+    (*encoded)[chunk_index(i)].push_back(std::move(buf));
+  }
+  bufferlist::const_iterator p = in.begin();
+  for (unsigned int s = 0; s < stripes; s++) {
+    for (unsigned int i = 0; i < k; i++)
+      p.copy(blocksize, data[i] + s * blocksize);
+  }
+  for (unsigned int i = k; i < k + m; i++) {
+    bufferlist &chunk = (*encoded)[chunk_index(i)];
+    chunk.push_back(buffer::create_aligned(length, SIMD_ALIGN));
+  }
+  int r = encode_chunks(want_to_encode, encoded);
+  if (r)
+    return r;
+  for (unsigned int i = 0; i < k + m; i++) {
+    if (want_to_encode.count(i) == 0)
+      encoded->erase(i);
+  }
+  return 0;
+}
+
+int ErasureCode::decode_stripes_contiguous(const set<int> &want_to_read,
+					   const map<int, bufferlist> &chunks,
+					   unsigned int chunk_size,
+					   map<int, bufferlist> *decoded)
+{
+  assert(chunk_size > 0);
+  unsigned int length = chunks.begin()->second.length();
+  assert(length % chunk_size == 0);
+  for (map<int, bufferlist>::const_iterator i = chunks.begin();
+       i != chunks.end();
+       ++i)
+    assert(i->second.length() == length);
+  if (length == 0)
+    return 0;
+  // every stripe is at the same offset of each chunk: recovering the
+  // whole length at once recovers each stripe
+  return decode(want_to_read, chunks, decoded);
+}
+
+// out = a ^ b, in a new aligned buffer
+static void region_xor(const bufferlist &a, const bufferlist &b,
+		       bufferlist *out)
+{
+  assert(a.length() == b.length());
+  bufferptr buf(buffer::create_aligned(a.length(), ErasureCode::SIMD_ALIGN));
+  a.copy(0, a.length(), buf.c_str());
+  char *dst = buf.c_str();
+  for (std::list<bufferptr>::const_iterator p = b.buffers().begin();
+       p != b.buffers().end();
+       ++p) {
+    const char *src = p->c_str();
+    for (unsigned int i = 0; i < p->length(); i++)
+      dst[i] ^= src[i];
+    dst += p->length();
+  }
+  out->clear();
+  out->push_back(std::move(buf));
+}
+
+int ErasureCode::encode_delta(const bufferlist &old_data,
+                              const bufferlist &new_data,
+                              bufferlist *delta)
+{
+  if (old_data.length() != new_data.length())
+    return -EINVAL;
+  region_xor(old_data, new_data, delta);
+  return 0;
+}
+
+int ErasureCode::coding_delta(const map<int, bufferlist> &deltas,
+			      unsigned int offset,
+			      unsigned int length,
+			      map<int, bufferlist> *coding)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  map<int, bufferlist> encoded;
+  set<int> want_to_encode;
+  for (unsigned int i = 0; i < k; i++) {
+    bufferptr buf(buffer::create_aligned(length, SIMD_ALIGN));
+    map<int, bufferlist>::const_iterator d = deltas.find(chunk_index(i));
+    if (d != deltas.end())
+      d->second.copy(offset, length, buf.c_str());
+    else
+      buf.zero();
+    encoded[chunk_index(i)].push_back(std::move(buf));
+  }
+  for (unsigned int i = k; i < k + m; i++) {
+    encoded[chunk_index(i)].push_back(
+      buffer::create_aligned(length, SIMD_ALIGN));
+    want_to_encode.insert(chunk_index(i));
+  }
+  // the codes are linear: coding the delta of the data chunks gives
+  // the delta of the coding chunks
+  int r = encode_chunks(want_to_encode, &encoded);
+  if (r)
+    return r;
+  for (set<int>::iterator i = want_to_encode.begin();
+       i != want_to_encode.end();
+       ++i)
+    (*coding)[*i].claim_append(encoded[*i]);
+  return 0;
+}
+
+int ErasureCode::apply_delta(const map<int, bufferlist> &deltas,
+                             unsigned int chunk_size,
+                             map<int, bufferlist> *coding)
+{
+  assert(chunk_size > 0);
+  assert(!coding->empty());
+  unsigned int length = coding->begin()->second.length();
+  assert(length % chunk_size == 0);
+  map<int, bufferlist> coding_deltas;
+  for (unsigned int off = 0; off < length; off += chunk_size) {
+    int r = coding_delta(deltas, off, chunk_size, &coding_deltas);
+    if (r)
+      return r;
+  }
+  for (map<int, bufferlist>::iterator i = coding->begin();
+       i != coding->end();
+       ++i) {
+    if (coding_deltas.count(i->first) == 0)
+      return -EINVAL;
+    region_xor(i->second, coding_deltas[i->first], &i->second);
+  }
+  return 0;
+}
+
+int ErasureCode::apply_delta_contiguous(const map<int, bufferlist> &deltas,
+					unsigned int chunk_size,
+					map<int, bufferlist> *coding)
+{
+  assert(chunk_size > 0);
+  assert(!coding->empty());
+  unsigned int length = coding->begin()->second.length();
+  assert(length % chunk_size == 0);
+  if (length == 0)
+    return 0;
+  map<int, bufferlist> coding_deltas;
+  int r = coding_delta(deltas, 0, length, &coding_deltas);
+  if (r)
+    return r;
+  for (map<int, bufferlist>::iterator i = coding->begin();
+       i != coding->end();
+       ++i) {
+    if (coding_deltas.count(i->first) == 0)
+      return -EINVAL;
+    region_xor(i->second, coding_deltas[i->first], &i->second);
+  }
+  return 0;
+}
+
 int ErasureCode::parse(const ErasureCodeProfile &profile,
 		       ostream *ss)
 {
@@ -52,6 +52,10 @@ namespace ceph {
       return get_chunk_count() - get_data_chunk_count();
     }
 
+    virtual unsigned int get_sub_chunk_count() const {
+      return 1;
+    }
+
     virtual int minimum_to_decode(const set<int> &want_to_read,
                                   const set<int> &available_chunks,
                                   set<int> *minimum);
@@ -60,6 +64,10 @@ namespace ceph {
                                             const map<int, int> &available,
                                             set<int> *minimum);
 
+    virtual int minimum_to_repair(const set<int> &want_to_read,
+                                  const set<int> &available,
+                                  map<int, vector<pair<int, int> > > *minimum);
+
     int encode_prepare(const bufferlist &raw,
                        map<int, bufferlist> &encoded) const;
 
@@ -78,6 +86,29 @@ namespace ceph {
                               const map<int, bufferlist> &chunks,
                               map<int, bufferlist> *decoded);
 
+    virtual int encode_stripes(const set<int> &want_to_encode,
+                               const bufferlist &in,
+                               unsigned int stripe_width,
+                               map<int, bufferlist> *encoded);
+
+    virtual int decode_stripes(const set<int> &want_to_read,
+                               const map<int, bufferlist> &chunks,
+                               unsigned int chunk_size,
+                               map<int, bufferlist> *decoded);
+
+    virtual int repair(const set<int> &want_to_read,
+                       const map<int, bufferlist> &helpers,
+                       unsigned int chunk_size,
+                       map<int, bufferlist> *repaired);
+
+    virtual int encode_delta(const bufferlist &old_data,
+                             const bufferlist &new_data,
+                             bufferlist *delta);
+
+    virtual int apply_delta(const map<int, bufferlist> &deltas,
+                            unsigned int chunk_size,
+                            map<int, bufferlist> *coding);
+
     virtual const vector<int> &get_chunk_mapping() const;
 
     int to_mapping(const ErasureCodeProfile &profile,
@@ -108,8 +139,29 @@ namespace ceph {
     int parse(const ErasureCodeProfile &profile,
 	      ostream *ss);
 
+    /// encode all stripes with a single encode_chunks call
+    int encode_stripes_contiguous(const set<int> &want_to_encode,
+				  const bufferlist &in,
+				  unsigned int stripe_width,
+				  map<int, bufferlist> *encoded);
+
+    /// decode all stripes with a single decode_chunks call
+    int decode_stripes_contiguous(const set<int> &want_to_read,
+				  const map<int, bufferlist> &chunks,
+				  unsigned int chunk_size,
+				  map<int, bufferlist> *decoded);
+
+    /// apply the deltas of all stripes with a single encode_chunks call
+    int apply_delta_contiguous(const map<int, bufferlist> &deltas,
+			       unsigned int chunk_size,
+			       map<int, bufferlist> *coding);
+
   private:
     int chunk_index(unsigned int i) const;
+    int coding_delta(const map<int, bufferlist> &deltas,
+		     unsigned int offset,
+		     unsigned int length,
+		     map<int, bufferlist> *coding);
   };
 }
 
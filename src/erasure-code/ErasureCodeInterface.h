@@ -268,6 +268,16 @@ namespace ceph {
      */
     virtual unsigned int get_chunk_size(unsigned int object_size) const = 0;
 
+    /**
+     * Return the number of sub-chunks each chunk is divided into.
+     * A chunk of **chunk_size** bytes holds sub-chunk **i** at
+     * offset **i * chunk_size / get_sub_chunk_count()**.  Codes
+     * that do not repair from sub-chunks return 1.
+     *
+     * @return the number of sub-chunks in a chunk
+     */
+    virtual unsigned int get_sub_chunk_count() const = 0;
+
     /**
      * Compute the smallest subset of **available** chunks that needs
      * to be retrieved in order to successfully decode
@@ -316,6 +326,28 @@ namespace ceph {
                                             const map<int, int> &available,
                                             set<int> *minimum) = 0;
 
+    /**
+     * Compute the chunks and, for each of them, the sub-chunks that
+     * need to be retrieved from **available** to rebuild the lost
+     * **want_to_read** chunks with **repair**.  The sub-chunks are
+     * a list of (index, count) ranges, sorted by index.  A code
+     * able to rebuild a chunk from a fraction of its helpers may
+     * read more chunks than **minimum_to_decode** but fewer bytes
+     * overall.  When it cannot, every chunk is the full range
+     * (0, **get_sub_chunk_count()**).
+     *
+     * Returns -EIO if there are not enough chunk indexes in
+     * **available** to decode **want_to_read**.
+     *
+     * @param [in] want_to_read chunk indexes to be rebuilt
+     * @param [in] available chunk indexes containing valid data
+     * @param [out] minimum chunk indexes to the sub-chunks to retrieve
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int minimum_to_repair(const set<int> &want_to_read,
+                                  const set<int> &available,
+                                  map<int, vector<pair<int, int> > > *minimum) = 0;
+
     /**
      * Encode the content of **in** and store the result in
      * **encoded**. All buffers pointed to by **encoded** have the
@@ -359,6 +391,36 @@ namespace ceph {
     virtual int encode_chunks(const set<int> &want_to_encode,
                               map<int, bufferlist> *encoded) = 0;
 
+    /**
+     * Encode **in**, a concatenation of stripes of **stripe_width**
+     * bytes each, and store the result in **encoded**. It is
+     * equivalent to calling **encode** on each stripe in turn and
+     * appending each chunk to the matching entry of **encoded**:
+     * entry **i** of **encoded** is the concatenation of chunk **i**
+     * of every stripe.
+     *
+     * The length of **in** must be a multiple of **stripe_width**
+     * and the **encoded** map is expected to be a pointer to an
+     * empty map.
+     *
+     * A plugin whose encoding of a region only depends on the bytes
+     * at the same position in the other chunks can encode all the
+     * stripes with a single call into its kernel, which amortizes
+     * the per call setup over the whole batch.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] want_to_encode chunk indexes to be encoded
+     * @param [in] in stripes to be encoded
+     * @param [in] stripe_width size of a stripe in bytes
+     * @param [out] encoded map chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int encode_stripes(const set<int> &want_to_encode,
+                               const bufferlist &in,
+                               unsigned int stripe_width,
+                               map<int, bufferlist> *encoded) = 0;
+
     /**
      * Decode the **chunks** and store at least **want_to_read**
      * chunks in **decoded**.
@@ -400,6 +462,95 @@ namespace ceph {
                               const map<int, bufferlist> &chunks,
                               map<int, bufferlist> *decoded) = 0;
 
+    /**
+     * Decode **chunks**, each of which is the concatenation of the
+     * chunks of consecutive stripes as returned by
+     * **encode_stripes**, and store at least **want_to_read** in
+     * **decoded**. It is equivalent to calling **decode** on each
+     * stripe of **chunk_size** bytes in turn and appending the
+     * result to **decoded**.
+     *
+     * All buffers pointed by **chunks** must have the same size,
+     * which must be a multiple of **chunk_size**. The **decoded**
+     * map must be a pointer to an empty map.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] want_to_read chunk indexes to be decoded
+     * @param [in] chunks map chunk indexes to concatenated chunk data
+     * @param [in] chunk_size size of the chunk of a single stripe
+     * @param [out] decoded map chunk indexes to concatenated chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int decode_stripes(const set<int> &want_to_read,
+                               const map<int, bufferlist> &chunks,
+                               unsigned int chunk_size,
+                               map<int, bufferlist> *decoded) = 0;
+
+    /**
+     * Rebuild the **want_to_read** chunks of consecutive stripes from
+     * the sub-chunks returned by **minimum_to_repair**.  For each
+     * stripe, **helpers** hold the requested sub-chunks of the chunk
+     * in index order, so every buffer is a multiple of the size of
+     * the sub-chunks read from that chunk.  **repaired** receives the
+     * whole chunks, **chunk_size** bytes per stripe.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] want_to_read chunk indexes to be rebuilt
+     * @param [in] helpers map chunk indexes to the sub-chunks read
+     * @param [in] chunk_size size of the chunk of a single stripe
+     * @param [out] repaired map chunk indexes to concatenated chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int repair(const set<int> &want_to_read,
+                       const map<int, bufferlist> &helpers,
+                       unsigned int chunk_size,
+                       map<int, bufferlist> *repaired) = 0;
+
+    /**
+     * Store in **delta** the difference between **old_data** and
+     * **new_data**, two versions of the same region of a data
+     * chunk. The delta is what **apply_delta** expects for that
+     * chunk. Both buffers must have the same length.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] old_data content of the region before the write
+     * @param [in] new_data content of the region after the write
+     * @param [out] delta difference to be given to **apply_delta**
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int encode_delta(const bufferlist &old_data,
+                             const bufferlist &new_data,
+                             bufferlist *delta) = 0;
+
+    /**
+     * Update the coding chunks in **coding** to account for the
+     * data chunk changes described by **deltas**, as returned by
+     * **encode_delta**. Data chunks absent from **deltas** are
+     * unchanged. It allows a partial stripe write to only read and
+     * rewrite the modified data chunks and the coding chunks
+     * instead of re-encoding the whole stripe.
+     *
+     * Like the chunks returned by **encode_stripes**, each buffer
+     * is the concatenation of the chunks of consecutive stripes and
+     * all buffers in **deltas** and **coding** must have the same
+     * length, a multiple of **chunk_size**.  **coding** must contain
+     * every coding chunk; the buffers are replaced with the updated
+     * content.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] deltas map data chunk indexes to deltas
+     * @param [in] chunk_size size of the chunk of a single stripe
+     * @param [in,out] coding map coding chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int apply_delta(const map<int, bufferlist> &deltas,
+                            unsigned int chunk_size,
+                            map<int, bufferlist> *coding) = 0;
+
     /**
      * Return the ordered list of chunks or an empty vector
      * if no remapping is necessary.
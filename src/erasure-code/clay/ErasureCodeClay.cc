@@ -0,0 +1,544 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "common/debug.h"
+#include "crush/CrushWrapper.h"
+#include "osd/osd_types.h"
+#include "include/stringify.h"
+#include "erasure-code/ErasureCodePlugin.h"
+
+#include "ErasureCodeClay.h"
+
+// re-include our assert to clobber boost's
+#include "include/assert.h"
+
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix _prefix(_dout)
+
+static ostream& _prefix(std::ostream* _dout)
+{
+  return *_dout << "ErasureCodeClay: ";
+}
+
+int ErasureCodeClay::create_ruleset(const string &name,
+				    CrushWrapper &crush,
+				    ostream *ss) const
+{
+  int ruleid = crush.add_simple_ruleset(name, ruleset_root, ruleset_failure_domain,
+					"indep", pg_pool_t::TYPE_ERASURE, ss);
+  if (ruleid < 0)
+    return ruleid;
+  else {
+    crush.set_rule_mask_max_size(ruleid, get_chunk_count());
+    return crush.get_rule_mask_ruleset(ruleid);
+  }
+}
+
+unsigned int ErasureCodeClay::get_chunk_size(unsigned int object_size) const
+{
+  // every sub-chunk must be a valid chunk of both scalar codes
+  unsigned sc_alignment = std::max(pft.erasure_code->get_chunk_size(1),
+				   mds.erasure_code->get_chunk_size(1));
+  unsigned alignment = sub_chunk_no * k * sc_alignment;
+  unsigned tail = object_size % alignment;
+  unsigned padded_length = object_size + (tail ? (alignment - tail) : 0);
+  assert(padded_length % k == 0);
+  return padded_length / k;
+}
+
+int ErasureCodeClay::init(ErasureCodeProfile &profile, ostream *ss)
+{
+  int err = 0;
+  err |= to_string("ruleset-root", profile,
+		   &ruleset_root,
+		   "default", ss);
+  err |= to_string("ruleset-failure-domain", profile,
+		   &ruleset_failure_domain,
+		   "host", ss);
+  err |= parse(profile, ss);
+  if (err)
+    return err;
+  err = scalar_init(&mds, scalar_mds, technique, k + nu, m, ss);
+  if (err)
+    return err;
+  err = scalar_init(&pft, scalar_mds, technique, 2, 2, ss);
+  if (err)
+    return err;
+  return ErasureCode::init(profile, ss);
+}
+
+int ErasureCodeClay::parse(ErasureCodeProfile &profile, ostream *ss)
+{
+  int err = ErasureCode::parse(profile, ss);
+  err |= to_int("k", profile, &k, DEFAULT_K, ss);
+  err |= to_int("m", profile, &m, DEFAULT_M, ss);
+  err |= sanity_check_k(k, ss);
+  err |= to_int("d", profile, &d, stringify(k + m - 1), ss);
+  err |= to_int("w", profile, &w, DEFAULT_W, ss);
+  err |= to_string("scalar_mds", profile, &scalar_mds, "jerasure", ss);
+  err |= to_string("technique", profile, &technique, "reed_sol_van", ss);
+  if (err)
+    return err;
+  if (!chunk_mapping.empty()) {
+    *ss << "mapping is not supported by the clay plugin" << std::endl;
+    return -EINVAL;
+  }
+  if (scalar_mds != "jerasure" && scalar_mds != "isa") {
+    *ss << "scalar_mds=" << scalar_mds
+	<< " must be one of jerasure, isa" << std::endl;
+    return -EINVAL;
+  }
+  if (m < 1) {
+    *ss << "m=" << m << " must be >= 1" << std::endl;
+    return -EINVAL;
+  }
+  if (d < k + 1 || d > k + m - 1) {
+    *ss << "d=" << d << " must be within [" << k + 1 << ","
+	<< k + m - 1 << "]" << std::endl;
+    return -EINVAL;
+  }
+
+  q = d - k + 1;
+  nu = (k + m) % q ? q - (k + m) % q : 0;
+  t = (k + m + nu) / q;
+  sub_chunk_no = 1;
+  for (int i = 0; i < t; i++)
+    sub_chunk_no *= q;
+  dout(10) << __func__ << " k=" << k << " m=" << m << " d=" << d
+	   << " q=" << q << " t=" << t << " nu=" << nu
+	   << " sub_chunk_no=" << sub_chunk_no << dendl;
+  return 0;
+}
+
+int ErasureCodeClay::scalar_init(ScalarMDS *code, const std::string &plugin,
+				 const std::string &technique, int data,
+				 int coding, ostream *ss)
+{
+  code->profile["plugin"] = plugin;
+  code->profile["technique"] = technique;
+  code->profile["k"] = stringify(data);
+  code->profile["m"] = stringify(coding);
+  if (plugin == "jerasure")
+    code->profile["w"] = stringify(w);
+  ErasureCodePluginRegistry &registry = ErasureCodePluginRegistry::instance();
+  return registry.factory(plugin, directory, code->profile,
+			  &code->erasure_code, ss);
+}
+
+void ErasureCodeClay::get_plane_vector(int z, int *z_vec) const
+{
+  for (int i = 0; i < t; i++) {
+    z_vec[t - 1 - i] = z % q;
+    z /= q;
+  }
+}
+
+int ErasureCodeClay::plane_with_digit(int z, int y, int x) const
+{
+  int weight = 1;
+  for (int i = y + 1; i < t; i++)
+    weight *= q;
+  int digit = (z / weight) % q;
+  return z + (x - digit) * weight;
+}
+
+void ErasureCodeClay::get_repair_subchunks(int lost_node,
+					   vector<pair<int, int> > *subchunks) const
+{
+  int x0 = lost_node % q;
+  int y0 = lost_node / q;
+  // the planes where digit y0 is x0: q^y0 runs of q^(t-1-y0) planes
+  int run = 1;
+  for (int i = y0 + 1; i < t; i++)
+    run *= q;
+  int runs = sub_chunk_no / (run * q);
+  int index = x0 * run;
+  for (int i = 0; i < runs; i++) {
+    subchunks->push_back(make_pair(index, run));
+    index += q * run;
+  }
+}
+
+bool ErasureCodeClay::is_repair(const set<int> &want_to_read,
+				const set<int> &available) const
+{
+  if (want_to_read.size() != 1)
+    return false;
+  int lost = *want_to_read.begin();
+  if (available.count(lost))
+    return false;
+  if (available.size() < (unsigned)d)
+    return false;
+  // the other nodes of the column of the lost node must all help
+  int y0 = node_of(lost) / q;
+  for (int x = 0; x < q; x++) {
+    int node = y0 * q + x;
+    if (node == node_of(lost) || is_virtual(node))
+      continue;
+    if (!available.count(chunk_of(node)))
+      return false;
+  }
+  return true;
+}
+
+int ErasureCodeClay::minimum_to_repair(const set<int> &want_to_read,
+				       const set<int> &available,
+				       map<int, vector<pair<int, int> > > *minimum)
+{
+  if (!is_repair(want_to_read, available))
+    return ErasureCode::minimum_to_repair(want_to_read, available, minimum);
+  int lost = node_of(*want_to_read.begin());
+  vector<pair<int, int> > subchunks;
+  get_repair_subchunks(lost, &subchunks);
+  int y0 = lost / q;
+  for (int x = 0; x < q; x++) {
+    int node = y0 * q + x;
+    if (node != lost && !is_virtual(node))
+      (*minimum)[chunk_of(node)] = subchunks;
+  }
+  for (set<int>::const_iterator i = available.begin();
+       i != available.end() && minimum->size() < (unsigned)d;
+       ++i) {
+    if (!minimum->count(*i))
+      (*minimum)[*i] = subchunks;
+  }
+  assert(minimum->size() == (unsigned)d);
+  return 0;
+}
+
+int ErasureCodeClay::encode_chunks(const set<int> &want_to_encode,
+				   map<int, bufferlist> *encoded)
+{
+  unsigned int size = encoded->begin()->second.length();
+  int n = q * t;
+  char *C[n];
+  bufferptr zero(buffer::create_aligned(size, SIMD_ALIGN));
+  zero.zero();
+  set<int> parity;
+  for (int i = 0; i < n; i++) {
+    if (is_virtual(i)) {
+      C[i] = zero.c_str();
+    } else {
+      C[i] = (*encoded)[chunk_of(i)].c_str();
+      if (i >= k + nu)
+	parity.insert(i);
+    }
+  }
+  return decode_layered(parity, C, size);
+}
+
+int ErasureCodeClay::decode_chunks(const set<int> &want_to_read,
+				   const map<int, bufferlist> &chunks,
+				   map<int, bufferlist> *decoded)
+{
+  unsigned int size = chunks.begin()->second.length();
+  int n = q * t;
+  char *C[n];
+  bufferptr zero(buffer::create_aligned(size, SIMD_ALIGN));
+  zero.zero();
+  set<int> erased;
+  for (int i = 0; i < n; i++) {
+    if (is_virtual(i)) {
+      C[i] = zero.c_str();
+    } else {
+      C[i] = (*decoded)[chunk_of(i)].c_str();
+      if (chunks.find(chunk_of(i)) == chunks.end())
+	erased.insert(i);
+    }
+  }
+  if (erased.size() > (unsigned)m)
+    return -EIO;
+  return decode_layered(erased, C, size);
+}
+
+int ErasureCodeClay::repair(const set<int> &want_to_read,
+			    const map<int, bufferlist> &helpers,
+			    unsigned int chunk_size,
+			    map<int, bufferlist> *repaired)
+{
+  set<int> available;
+  for (map<int, bufferlist>::const_iterator i = helpers.begin();
+       i != helpers.end();
+       ++i)
+    available.insert(i->first);
+  if (helpers.size() != (unsigned)d || !is_repair(want_to_read, available))
+    // minimum_to_repair asked for whole chunks
+    return ErasureCode::repair(want_to_read, helpers, chunk_size, repaired);
+
+  assert(chunk_size % sub_chunk_no == 0);
+  unsigned int sc_size = chunk_size / sub_chunk_no;
+  unsigned int repair_size = chunk_size / q;
+  unsigned int length = helpers.begin()->second.length();
+  assert(length % repair_size == 0);
+  unsigned int stripes = length / repair_size;
+  int lost = node_of(*want_to_read.begin());
+  vector<pair<int, int> > subchunks;
+  get_repair_subchunks(lost, &subchunks);
+
+  // the sub-chunks of the helpers are unpacked at their offset in a
+  // whole chunk, the virtual nodes are never written and stay zero
+  int n = q * t;
+  bufferptr scratch(buffer::create_aligned(n * chunk_size, SIMD_ALIGN));
+  scratch.zero();
+  bufferptr out(buffer::create_aligned(stripes * chunk_size, SIMD_ALIGN));
+  char *C[n];
+  for (int i = 0; i < n; i++)
+    C[i] = scratch.c_str() + i * chunk_size;
+  set<int> helper_nodes;
+  for (set<int>::iterator i = available.begin(); i != available.end(); ++i)
+    helper_nodes.insert(node_of(*i));
+
+  for (unsigned int s = 0; s < stripes; s++) {
+    C[lost] = out.c_str() + s * chunk_size;
+    for (map<int, bufferlist>::const_iterator i = helpers.begin();
+	 i != helpers.end();
+	 ++i) {
+      assert(i->second.length() == length);
+      unsigned int off = s * repair_size;
+      for (vector<pair<int, int> >::iterator j = subchunks.begin();
+	   j != subchunks.end();
+	   ++j) {
+	i->second.copy(off, j->second * sc_size,
+		       C[node_of(i->first)] + j->first * sc_size);
+	off += j->second * sc_size;
+      }
+    }
+    int r = repair_one_lost_chunk(lost, helper_nodes, C, chunk_size);
+    if (r)
+      return r;
+  }
+  (*repaired)[*want_to_read.begin()].push_back(out);
+  return 0;
+}
+
+int ErasureCodeClay::pft_solve(char *c_lo, char *c_hi, char *u_lo, char *u_hi,
+			       const set<int> &known, unsigned int sc_size)
+{
+  char *buffers[4] = { c_lo, c_hi, u_lo, u_hi };
+  map<int, bufferlist> chunks;
+  map<int, bufferlist> decoded;
+  set<int> want;
+  for (int i = 0; i < 4; i++) {
+    decoded[i].push_back(buffer::create_static(sc_size, buffers[i]));
+    if (known.count(i))
+      chunks[i] = decoded[i];
+    else
+      want.insert(i);
+  }
+  return pft.erasure_code->decode_chunks(want, chunks, &decoded);
+}
+
+int ErasureCodeClay::pair_solve(char **C, char **U, int node, int z,
+				int known, unsigned int sc_size)
+{
+  int x = node % q;
+  int y = node / q;
+  int z_vec[t];
+  get_plane_vector(z, z_vec);
+  assert(z_vec[y] != x);
+  int partner = y * q + z_vec[y];
+  int zp = plane_with_digit(z, y, x);
+  char *cn = C[node] + z * sc_size;
+  char *un = U[node] + z * sc_size;
+  char *cp = C[partner] + zp * sc_size;
+  char *up = U[partner] + zp * sc_size;
+  bool lo = x < z_vec[y];
+  set<int> pft_known;
+  if (known & PAIR_NODE_C)
+    pft_known.insert(lo ? 0 : 1);
+  if (known & PAIR_NODE_U)
+    pft_known.insert(lo ? 2 : 3);
+  if (known & PAIR_PARTNER_C)
+    pft_known.insert(lo ? 1 : 0);
+  if (known & PAIR_PARTNER_U)
+    pft_known.insert(lo ? 3 : 2);
+  assert(pft_known.size() == 2);
+  if (lo)
+    return pft_solve(cn, cp, un, up, pft_known, sc_size);
+  else
+    return pft_solve(cp, cn, up, un, pft_known, sc_size);
+}
+
+int ErasureCodeClay::decode_plane(const set<int> &erased, char **U, int z,
+				  unsigned int sc_size)
+{
+  if (erased.empty())
+    return 0;
+  map<int, bufferlist> known;
+  map<int, bufferlist> all;
+  for (int i = 0; i < q * t; i++) {
+    all[i].push_back(buffer::create_static(sc_size, U[i] + z * sc_size));
+    if (!erased.count(i))
+      known[i] = all[i];
+  }
+  return mds.erasure_code->decode_chunks(erased, known, &all);
+}
+
+int ErasureCodeClay::decode_layered(const set<int> &erased, char **C,
+				    unsigned int size)
+{
+  assert(size % sub_chunk_no == 0);
+  assert(erased.size() <= (unsigned)m);
+  unsigned int sc_size = size / sub_chunk_no;
+  int n = q * t;
+  bufferptr ubuf(buffer::create_aligned(n * size, SIMD_ALIGN));
+  char *U[n];
+  for (int i = 0; i < n; i++)
+    U[i] = ubuf.c_str() + i * size;
+
+  // a plane depends on the planes where one less erased node is red
+  int z_vec[t];
+  vector<vector<int> > planes(t + 1);
+  for (int z = 0; z < sub_chunk_no; z++) {
+    get_plane_vector(z, z_vec);
+    int score = 0;
+    for (set<int>::const_iterator i = erased.begin(); i != erased.end(); ++i)
+      if (z_vec[*i / q] == *i % q)
+	score++;
+    planes[score].push_back(z);
+  }
+
+  for (int score = 0; score <= t; score++) {
+    for (vector<int>::iterator z = planes[score].begin();
+	 z != planes[score].end();
+	 ++z) {
+      get_plane_vector(*z, z_vec);
+      for (int i = 0; i < n; i++) {
+	if (erased.count(i))
+	  continue;
+	if (z_vec[i / q] == i % q) {
+	  memcpy(U[i] + *z * sc_size, C[i] + *z * sc_size, sc_size);
+	} else {
+	  // C of an erased partner was rebuilt at the previous score
+	  int r = pair_solve(C, U, i, *z, PAIR_NODE_C | PAIR_PARTNER_C, sc_size);
+	  if (r)
+	    return r;
+	}
+      }
+      int r = decode_plane(erased, U, *z, sc_size);
+      if (r)
+	return r;
+    }
+    for (vector<int>::iterator z = planes[score].begin();
+	 z != planes[score].end();
+	 ++z) {
+      get_plane_vector(*z, z_vec);
+      for (set<int>::const_iterator i = erased.begin(); i != erased.end(); ++i) {
+	int x = *i % q;
+	int y = *i / q;
+	int r = 0;
+	if (z_vec[y] == x) {
+	  memcpy(C[*i] + *z * sc_size, U[*i] + *z * sc_size, sc_size);
+	} else if (!erased.count(y * q + z_vec[y])) {
+	  r = pair_solve(C, U, *i, *z, PAIR_NODE_U | PAIR_PARTNER_C, sc_size);
+	} else {
+	  // the partner plane has the same score and was decoded above
+	  r = pair_solve(C, U, *i, *z, PAIR_NODE_U | PAIR_PARTNER_U, sc_size);
+	}
+	if (r)
+	  return r;
+      }
+    }
+  }
+  return 0;
+}
+
+int ErasureCodeClay::repair_one_lost_chunk(int lost_node,
+					   const set<int> &helpers,
+					   char **C, unsigned int size)
+{
+  unsigned int sc_size = size / sub_chunk_no;
+  int n = q * t;
+  int x0 = lost_node % q;
+  int y0 = lost_node / q;
+  bufferptr ubuf(buffer::create_aligned(n * size, SIMD_ALIGN));
+  char *U[n];
+  for (int i = 0; i < n; i++)
+    U[i] = ubuf.c_str() + i * size;
+
+  // the column of the lost node and the nodes that do not help are
+  // the m erasures of every repair plane
+  set<int> aloof;
+  set<int> erased;
+  for (int i = 0; i < n; i++) {
+    if (i / q == y0)
+      erased.insert(i);
+    else if (!is_virtual(i) && !helpers.count(i))
+      aloof.insert(i);
+  }
+  erased.insert(aloof.begin(), aloof.end());
+  assert(erased.size() == (unsigned)m);
+
+  int z_vec[t];
+  vector<vector<int> > planes(t + 1);
+  for (int z = 0; z < sub_chunk_no; z++) {
+    get_plane_vector(z, z_vec);
+    if (z_vec[y0] != x0)
+      continue;
+    int score = 0;
+    for (set<int>::iterator i = aloof.begin(); i != aloof.end(); ++i)
+      if (z_vec[*i / q] == *i % q)
+	score++;
+    planes[score].push_back(z);
+  }
+
+  for (int score = 0; score <= t; score++) {
+    for (vector<int>::iterator z = planes[score].begin();
+	 z != planes[score].end();
+	 ++z) {
+      get_plane_vector(*z, z_vec);
+      for (int i = 0; i < n; i++) {
+	if (erased.count(i))
+	  continue;
+	int r = 0;
+	if (z_vec[i / q] == i % q) {
+	  memcpy(U[i] + *z * sc_size, C[i] + *z * sc_size, sc_size);
+	} else if (!aloof.count(i / q * q + z_vec[i / q])) {
+	  r = pair_solve(C, U, i, *z, PAIR_NODE_C | PAIR_PARTNER_C, sc_size);
+	} else {
+	  // U of an aloof partner was decoded at the previous score
+	  r = pair_solve(C, U, i, *z, PAIR_NODE_C | PAIR_PARTNER_U, sc_size);
+	}
+	if (r)
+	  return r;
+      }
+      int r = decode_plane(erased, U, *z, sc_size);
+      if (r)
+	return r;
+    }
+  }
+
+  // the lost node is red in the repair planes, and coupled with the
+  // rest of its column in all the others
+  for (int score = 0; score <= t; score++) {
+    for (vector<int>::iterator z = planes[score].begin();
+	 z != planes[score].end();
+	 ++z) {
+      memcpy(C[lost_node] + *z * sc_size, U[lost_node] + *z * sc_size,
+	     sc_size);
+      for (int x = 0; x < q; x++) {
+	if (x == x0)
+	  continue;
+	int r = pair_solve(C, U, y0 * q + x, *z, PAIR_NODE_C | PAIR_NODE_U,
+			   sc_size);
+	if (r)
+	  return r;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef CEPH_ERASURE_CODE_CLAY_H
+#define CEPH_ERASURE_CODE_CLAY_H
+
+#include "erasure-code/ErasureCode.h"
+
+/**
+ * Coupled-layer (Clay) regenerating code
+ *
+ * The k + m chunks, padded with nu always zero virtual chunks, are the
+ * nodes (x, y) of a q x t grid with q = d - k + 1.  Each chunk is cut
+ * in q^t sub-chunks, the planes z of the code, and z_y is the y-th
+ * base q digit of z.  In every plane, the uncoupled sub-chunks U form
+ * a codeword of the scalar (k + nu, m) MDS code.  The stored, coupled
+ * sub-chunks C are U, except that node (x, y) of plane z and node
+ * (z_y, y) of the plane where digit y is x are mixed by a pairwise
+ * transform, a (2, 2) MDS code of the scalar plugin: any two of their
+ * C and U sub-chunks give the other two.
+ *
+ * A single lost chunk (x, y) is rebuilt from the planes where z_y is
+ * x, 1/q of each of d helper chunks, instead of k whole chunks.
+ */
+class ErasureCodeClay : public ErasureCode {
+public:
+  std::string DEFAULT_K;
+  std::string DEFAULT_M;
+  std::string DEFAULT_W;
+  int k, m, d, w;
+  int q, t, nu;
+  int sub_chunk_no;
+  std::string scalar_mds;
+  std::string technique;
+  std::string directory;
+  std::string ruleset_root;
+  std::string ruleset_failure_domain;
+
+  struct ScalarMDS {
+    ErasureCodeInterfaceRef erasure_code;
+    ErasureCodeProfile profile;
+  };
+  ScalarMDS mds;   ///< (k + nu, m) code of each plane
+  ScalarMDS pft;   ///< (2, 2) code of the pairwise transform
+
+  explicit ErasureCodeClay(const std::string &dir)
+    : DEFAULT_K("4"),
+      DEFAULT_M("2"),
+      DEFAULT_W("8"),
+      k(0), m(0), d(0), w(8),
+      q(0), t(0), nu(0),
+      sub_chunk_no(0),
+      directory(dir),
+      ruleset_root("default"),
+      ruleset_failure_domain("host")
+  {}
+
+  virtual ~ErasureCodeClay() {}
+
+  virtual int create_ruleset(const string &name,
+			     CrushWrapper &crush,
+			     ostream *ss) const;
+
+  virtual unsigned int get_chunk_count() const {
+    return k + m;
+  }
+
+  virtual unsigned int get_data_chunk_count() const {
+    return k;
+  }
+
+  virtual unsigned int get_sub_chunk_count() const {
+    return sub_chunk_no;
+  }
+
+  virtual unsigned int get_chunk_size(unsigned int object_size) const;
+
+  virtual int minimum_to_repair(const set<int> &want_to_read,
+				const set<int> &available,
+				map<int, vector<pair<int, int> > > *minimum);
+
+  virtual int encode_chunks(const set<int> &want_to_encode,
+			    map<int, bufferlist> *encoded);
+
+  virtual int decode_chunks(const set<int> &want_to_read,
+			    const map<int, bufferlist> &chunks,
+			    map<int, bufferlist> *decoded);
+
+  virtual int repair(const set<int> &want_to_read,
+		     const map<int, bufferlist> &helpers,
+		     unsigned int chunk_size,
+		     map<int, bufferlist> *repaired);
+
+  virtual int init(ErasureCodeProfile &profile, ostream *ss);
+
+  virtual int parse(ErasureCodeProfile &profile, ostream *ss);
+
+  /// sub-chunk ranges of the helpers when rebuilding node lost_node
+  void get_repair_subchunks(int lost_node,
+			    vector<pair<int, int> > *subchunks) const;
+
+private:
+  enum {
+    PAIR_NODE_C = 1,
+    PAIR_NODE_U = 2,
+    PAIR_PARTNER_C = 4,
+    PAIR_PARTNER_U = 8,
+  };
+
+  int node_of(int chunk) const {
+    return chunk < k ? chunk : chunk + nu;
+  }
+  int chunk_of(int node) const {
+    return node < k ? node : node - nu;
+  }
+  bool is_virtual(int node) const {
+    return node >= k && node < k + nu;
+  }
+  /// base q digits of plane z, most significant first
+  void get_plane_vector(int z, int *z_vec) const;
+  /// plane z with digit y replaced by x
+  int plane_with_digit(int z, int y, int x) const;
+
+  bool is_repair(const set<int> &want_to_read,
+		 const set<int> &available) const;
+
+  int scalar_init(ScalarMDS *code, const std::string &plugin,
+		  const std::string &technique, int data, int coding,
+		  ostream *ss);
+
+  /**
+   * Solve the pairwise transform of two nodes of a column, given
+   * two of c_lo, c_hi, u_lo, u_hi (pft chunks 0, 1, 2, 3), where
+   * lo is the node with the lowest x.  All are sc_size long.
+   */
+  int pft_solve(char *c_lo, char *c_hi, char *u_lo, char *u_hi,
+		const set<int> &known, unsigned int sc_size);
+  /**
+   * Solve the couple of node at plane z, given the values selected
+   * by known, an or of PAIR_* flags
+   */
+  int pair_solve(char **C, char **U, int node, int z, int known,
+		 unsigned int sc_size);
+  /// decode the U of the erased nodes of plane z
+  int decode_plane(const set<int> &erased, char **U, int z,
+		   unsigned int sc_size);
+  /// rebuild the C of the erased nodes, all C[i] are size long
+  int decode_layered(const set<int> &erased, char **C,
+		     unsigned int size);
+  /// rebuild lost_node of one stripe from the repair planes of helpers
+  int repair_one_lost_chunk(int lost_node, const set<int> &helpers,
+			    char **C, unsigned int size);
+};
+
+#endif
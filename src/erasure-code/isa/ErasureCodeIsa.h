@@ -94,6 +94,33 @@ public:
                             const map<int, bufferlist> &chunks,
                             map<int, bufferlist> *decoded);
 
+  // ec_encode_data works byte by byte, a batch of stripes is coded
+  // with the same tables in one call
+  virtual int encode_stripes(const set<int> &want_to_encode,
+                             const bufferlist &in,
+                             unsigned int stripe_width,
+                             map<int, bufferlist> *encoded)
+  {
+    return encode_stripes_contiguous(want_to_encode, in, stripe_width,
+                                     encoded);
+  }
+
+  virtual int decode_stripes(const set<int> &want_to_read,
+                             const map<int, bufferlist> &chunks,
+                             unsigned int chunk_size,
+                             map<int, bufferlist> *decoded)
+  {
+    return decode_stripes_contiguous(want_to_read, chunks, chunk_size,
+                                     decoded);
+  }
+
+  virtual int apply_delta(const map<int, bufferlist> &deltas,
+                          unsigned int chunk_size,
+                          map<int, bufferlist> *coding)
+  {
+    return apply_delta_contiguous(deltas, chunk_size, coding);
+  }
+
   virtual int init(ErasureCodeProfile &profile, ostream *ss);
 
   virtual void isa_encode(char **data,
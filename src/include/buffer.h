@@ -225,6 +225,9 @@ namespace buffer CEPH_BUFFER_API {
 
     bool can_zero_copy() const;
     int zero_copy_to_fd(int fd, int64_t *offset) const;
+    /// splice the tail of a zero copy buffer into a nonblocking socket,
+    /// returns the bytes moved, or -ENOTSUP if it has to be copied
+    ssize_t zero_copy_to_socket(int sd, bool more) const;
 
     unsigned wasted();
 
@@ -595,6 +598,11 @@ namespace buffer CEPH_BUFFER_API {
     void prepare_iov(std::vector<iovec> *piov) const;
     uint32_t crc32c(uint32_t crc) const;
 	void invalidate_crc();
+
+    /// crc32c(0) of each list, those of one buffer with no cached crc
+    /// and of the same length hashed together with ceph_crc32c_multi()
+    static void crc32c_batch(const std::vector<const list*> &bls,
+			     std::vector<uint32_t> *crcs);
   };
 
   /*
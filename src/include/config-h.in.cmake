@@ -90,6 +90,9 @@
 /* Defined if you have libaio */
 #cmakedefine HAVE_LIBAIO
 
+/* Defined if linux/io_uring.h is available */
+#cmakedefine HAVE_IO_URING
+
 /* Defined if OpenLDAP enabled */
 #cmakedefine HAVE_OPENLDAP
 
@@ -29,4 +29,32 @@ static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsi
 	return ceph_crc32c_func(crc, data, length);
 }
 
+typedef void (*ceph_crc32c_multi_func_t)(uint32_t crc, unsigned char const **bufs,
+					 unsigned n, unsigned length, uint32_t *out);
+
+/*
+ * static global with the chosen multi-buffer implementation
+ */
+extern ceph_crc32c_multi_func_t ceph_crc32c_multi_func;
+
+extern ceph_crc32c_multi_func_t ceph_choose_crc32c_multi(void);
+
+/**
+ * calculate crc32c for several independent buffers of the same length
+ *
+ * This is equivalent to calling ceph_crc32c() on each buffer, but lets
+ * the implementation hash several buffers at once.
+ *
+ * @param crc initial value for each buffer
+ * @param bufs array of n buffer pointers (NULL means zero-filled)
+ * @param n number of buffers
+ * @param length length of each buffer
+ * @param out array of n crc values
+ */
+static inline void ceph_crc32c_multi(uint32_t crc, unsigned char const **bufs,
+				     unsigned n, unsigned length, uint32_t *out)
+{
+	ceph_crc32c_multi_func(crc, bufs, n, length, out);
+}
+
 #endif
@@ -281,6 +281,19 @@ public:
     return -EOPNOTSUPP;
   }
 
+  /// bytes currently used by the block cache, or -EOPNOTSUPP
+  virtual int64_t get_cache_usage() const {
+    return -EOPNOTSUPP;
+  }
+  /// resize the block cache
+  virtual int set_cache_size(uint64_t s) {
+    return -EOPNOTSUPP;
+  }
+  /// cumulative block cache hits and misses, if they are being collected
+  virtual int get_cache_hit_stats(uint64_t *hits, uint64_t *misses) const {
+    return -EOPNOTSUPP;
+  }
+
   virtual ~KeyValueDB() {}
 
   /// compact the underlying store
@@ -16,6 +16,7 @@
 #include "rocksdb/write_batch.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/cache.h"
+#include "rocksdb/statistics.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/utilities/convenience.h"
 #include "rocksdb/merge_operator.h"
@@ -169,6 +170,10 @@ int RocksDBStore::tryInterpret(const string key, const string val, rocksdb::Opti
     int ret = string2bool(val, disableWAL);
     if (ret != 0)
       return ret;
+  } else if (key == "cache_stats") {
+    int ret = string2bool(val, cache_stats);
+    if (ret != 0)
+      return ret;
   } else {
     //unrecognize config options.
     return -EINVAL;
@@ -279,15 +284,20 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     opt.env = static_cast<rocksdb::Env*>(priv);
   }
 
-  auto cache = rocksdb::NewLRUCache(g_conf->rocksdb_cache_size, g_conf->rocksdb_cache_shard_bits);
+  bbt_cache = rocksdb::NewLRUCache(g_conf->rocksdb_cache_size, g_conf->rocksdb_cache_shard_bits);
   rocksdb::BlockBasedTableOptions bbt_opts;
   bbt_opts.block_size = g_conf->rocksdb_block_size;
-  bbt_opts.block_cache = cache;
+  bbt_opts.block_cache = bbt_cache;
   opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(bbt_opts));
   dout(10) << __func__ << " set block size to " << g_conf->rocksdb_block_size
            << " cache size to " << g_conf->rocksdb_cache_size
            << " num of cache shards to " << (1 << g_conf->rocksdb_cache_shard_bits) << dendl;
 
+  if (cache_stats || g_conf->rocksdb_cache_stats) {
+    dbstats = rocksdb::CreateDBStatistics();
+    opt.statistics = dbstats;
+  }
+
   opt.merge_operator.reset(new MergeOperatorRouter(*this));
   status = rocksdb::DB::Open(opt, path, &db);
   if (!status.ok()) {
@@ -342,6 +352,30 @@ RocksDBStore::~RocksDBStore()
   }
 }
 
+int64_t RocksDBStore::get_cache_usage() const
+{
+  if (!bbt_cache)
+    return -EOPNOTSUPP;
+  return bbt_cache->GetUsage();
+}
+
+int RocksDBStore::set_cache_size(uint64_t s)
+{
+  if (!bbt_cache)
+    return -EOPNOTSUPP;
+  bbt_cache->SetCapacity(s);
+  return 0;
+}
+
+int RocksDBStore::get_cache_hit_stats(uint64_t *hits, uint64_t *misses) const
+{
+  if (!dbstats)
+    return -EOPNOTSUPP;
+  *hits = dbstats->getTickerCount(rocksdb::BLOCK_CACHE_HIT);
+  *misses = dbstats->getTickerCount(rocksdb::BLOCK_CACHE_MISS);
+  return 0;
+}
+
 void RocksDBStore::close()
 {
   // stop compaction thread
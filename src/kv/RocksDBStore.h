@@ -47,6 +47,7 @@ namespace rocksdb{
   class WriteBatch;
   class Iterator;
   class Logger;
+  class Statistics;
   struct Options;
 }
 
@@ -62,6 +63,8 @@ class RocksDBStore : public KeyValueDB {
   void *priv;
   rocksdb::DB *db;
   rocksdb::Env *env;
+  std::shared_ptr<rocksdb::Cache> bbt_cache;
+  std::shared_ptr<rocksdb::Statistics> dbstats;
   string options_str;
   int do_open(ostream &out, bool create_if_missing);
 
@@ -90,6 +93,7 @@ public:
   /// compact the underlying rocksdb store
   bool compact_on_mount;
   bool disableWAL;
+  bool cache_stats;   ///< collect block cache hit stats
   void compact();
 
   int tryInterpret(const string key, const string val, rocksdb::Options &opt);
@@ -123,7 +127,8 @@ public:
     compact_queue_stop(false),
     compact_thread(this),
     compact_on_mount(false),
-    disableWAL(false)
+    disableWAL(false),
+    cache_stats(false)
   {}
 
   ~RocksDBStore();
@@ -138,6 +143,10 @@ public:
 
   void close();
 
+  int64_t get_cache_usage() const;
+  int set_cache_size(uint64_t s);
+  int get_cache_hit_stats(uint64_t *hits, uint64_t *misses) const;
+
   class RocksDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     rocksdb::WriteBatch *bat;
@@ -301,6 +301,10 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
    * supporting primary_temp mappings without breaking old clients/OSDs.*/
   assert(g_conf->mon_osd_allow_primary_temp || osdmap.primary_temp->empty());
 
+  // the pgmon maps every pg with the new map
+  if (!osdmap.have_pg_mapping() && g_conf->osd_map_pg_mapping_threads > 0)
+    osdmap.build_pg_mapping(g_conf->osd_map_pg_mapping_threads);
+
   if (mon->is_leader()) {
     // kick pgmon, make sure it's seen the latest map
     mon->pgmon()->check_osd_map(osdmap.epoch);
@@ -1975,6 +1979,15 @@ bool OSDMonitor::preprocess_boot(MonOpRequestRef op)
     goto ignore;
   }
 
+  if ((osdmap.get_features(CEPH_ENTITY_TYPE_OSD, NULL) &
+       CEPH_FEATURE_OSD_EC_OVERWRITES) &&
+      !(m->get_connection()->get_features() & CEPH_FEATURE_OSD_EC_OVERWRITES)) {
+    dout(0) << __func__ << " osdmap requires ec overwrites but osd at "
+            << m->get_orig_source_inst()
+            << " doesn't announce support -- ignore" << dendl;
+    goto ignore;
+  }
+
   if (osdmap.test_flag(CEPH_OSDMAP_REQUIRE_JEWEL) &&
       !(m->osd_features & CEPH_FEATURE_SERVER_JEWEL)) {
     mon->clog->info() << "disallowing boot of OSD "
@@ -3074,7 +3087,8 @@ namespace {
     MIN_WRITE_RECENCY_FOR_PROMOTE, FAST_READ,
     HIT_SET_GRADE_DECAY_RATE, HIT_SET_SEARCH_LAST_N,
     SCRUB_MIN_INTERVAL, SCRUB_MAX_INTERVAL, DEEP_SCRUB_INTERVAL,
-    RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY};
+    RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY,
+    ALLOW_EC_OVERWRITES};
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -3573,7 +3587,8 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       ("deep_scrub_interval", DEEP_SCRUB_INTERVAL)
       ("recovery_priority", RECOVERY_PRIORITY)
       ("recovery_op_priority", RECOVERY_OP_PRIORITY)
-      ("scrub_priority", SCRUB_PRIORITY);
+      ("scrub_priority", SCRUB_PRIORITY)
+      ("allow_ec_overwrites", ALLOW_EC_OVERWRITES);
 
     typedef std::set<osd_pool_get_choices> choices_set_t;
 
@@ -3584,7 +3599,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       (CACHE_MIN_FLUSH_AGE)(CACHE_MIN_EVICT_AGE)(MIN_READ_RECENCY_FOR_PROMOTE)
       (HIT_SET_GRADE_DECAY_RATE)(HIT_SET_SEARCH_LAST_N);
     const choices_set_t ONLY_ERASURE_CHOICES = boost::assign::list_of
-      (ERASURE_CODE_PROFILE);
+      (ERASURE_CODE_PROFILE)(ALLOW_EC_OVERWRITES);
 
     choices_set_t selected_choices;
     if (var == "all") {
@@ -3672,6 +3687,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 			   p->has_flag(pg_pool_t::get_flag_by_name(i->first)) ?
 			   "true" : "false");
 	    break;
+	  case ALLOW_EC_OVERWRITES:
+	    f->dump_string("allow_ec_overwrites",
+			   p->allows_ecoverwrites() ? "true" : "false");
+	    break;
 	  case HIT_SET_PERIOD:
 	    f->dump_int("hit_set_period", p->hit_set_period);
 	    break;
@@ -3879,6 +3898,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	      (p->has_flag(pg_pool_t::get_flag_by_name(i->first)) ?
 	       "true" : "false") << "\n";
 	    break;
+	  case ALLOW_EC_OVERWRITES:
+	    ss << "allow_ec_overwrites: " <<
+	      (p->allows_ecoverwrites() ? "true" : "false") << "\n";
+	    break;
 	  case MIN_WRITE_RECENCY_FOR_PROMOTE:
 	    ss << "min_write_recency_for_promote: " <<
 	      p->min_write_recency_for_promote << "\n";
@@ -5315,6 +5338,28 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
       return -EINVAL;
     }
     p.min_write_recency_for_promote = n;
+  } else if (var == "allow_ec_overwrites") {
+    if (!p.is_erasure()) {
+      ss << "ec overwrites can only be enabled for an erasure coded pool";
+      return -EINVAL;
+    }
+    if (val == "true" || (interr.empty() && n == 1)) {
+      // an osd without the feature asserts on the rollback code that
+      // overwrite log entries carry
+      if (!(osdmap.get_up_osd_features() & CEPH_FEATURE_OSD_EC_OVERWRITES)) {
+	ss << "not all up OSDs have CEPH_FEATURE_OSD_EC_OVERWRITES feature";
+	return -EPERM;
+      }
+      p.set_flag(pg_pool_t::FLAG_EC_OVERWRITES);
+    } else if (val == "false" || (interr.empty() && n == 0)) {
+      // objects may already have been overwritten and lost their
+      // shard hashes; appends alone cannot restore them
+      ss << "ec overwrites cannot be disabled once enabled";
+      return -EINVAL;
+    } else {
+      ss << "expecting value 'true', 'false', '0', or '1'";
+      return -EINVAL;
+    }
   } else if (var == "fast_read") {
     if (p.is_replicated()) {
         ss << "fast read is not supported in replication pool";
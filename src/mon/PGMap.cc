@@ -338,6 +338,9 @@ void PGMap::calc_stats()
   pg_sum = pool_stat_t();
   osd_sum = osd_stat_t();
   pg_by_osd.clear();
+  num_pg_by_last_epoch_clean.clear();
+  for (int i = 0; i < NUM_STUCK; ++i)
+    pg_by_stuck_since[i].clear();
 
   for (ceph::unordered_map<pg_t,pg_stat_t>::iterator p = pg_stat.begin();
        p != pg_stat.end();
@@ -436,6 +439,71 @@ void PGMap::remove_osd(int osd)
   }
 }
 
+// the stuck states, in the order the health summary counts a pg under
+// the first one it is in
+static const int stuck_types[PGMap::NUM_STUCK] = {
+  PGMap::STUCK_INACTIVE,
+  PGMap::STUCK_UNCLEAN,
+  PGMap::STUCK_DEGRADED,
+  PGMap::STUCK_UNDERSIZED,
+  PGMap::STUCK_STALE
+};
+
+static bool is_stuck_state(int type, unsigned state)
+{
+  switch (type) {
+  case PGMap::STUCK_INACTIVE:
+    return !(state & PG_STATE_ACTIVE);
+  case PGMap::STUCK_UNCLEAN:
+    return !(state & PG_STATE_CLEAN);
+  case PGMap::STUCK_DEGRADED:
+    return state & PG_STATE_DEGRADED;
+  case PGMap::STUCK_UNDERSIZED:
+    return state & PG_STATE_UNDERSIZED;
+  case PGMap::STUCK_STALE:
+    return state & PG_STATE_STALE;
+  default:
+    assert(0 == "unknown stuck type");
+  }
+}
+
+/// when the pg entered the stuck state type (it must be in it)
+static utime_t get_stuck_since(int type, const pg_stat_t &s)
+{
+  switch (type) {
+  case PGMap::STUCK_INACTIVE:
+    return s.last_active;
+  case PGMap::STUCK_UNCLEAN:
+    return s.last_clean;
+  case PGMap::STUCK_DEGRADED:
+    return s.last_undegraded;
+  case PGMap::STUCK_UNDERSIZED:
+    return s.last_fullsized;
+  case PGMap::STUCK_STALE:
+    return s.last_unstale;
+  default:
+    assert(0 == "unknown stuck type");
+  }
+}
+
+void PGMap::stuck_pg_add(const pg_t &pgid, const pg_stat_t &s)
+{
+  for (int i = 0; i < NUM_STUCK; ++i) {
+    if (is_stuck_state(stuck_types[i], s.state))
+      pg_by_stuck_since[i].insert(
+	make_pair(get_stuck_since(stuck_types[i], s), pgid));
+  }
+}
+
+void PGMap::stuck_pg_sub(const pg_t &pgid, const pg_stat_t &s)
+{
+  for (int i = 0; i < NUM_STUCK; ++i) {
+    if (is_stuck_state(stuck_types[i], s.state))
+      pg_by_stuck_since[i].erase(
+	make_pair(get_stuck_since(stuck_types[i], s), pgid));
+  }
+}
+
 void PGMap::stat_pg_add(const pg_t &pgid, const pg_stat_t &s,
                         bool sameosds)
 {
@@ -444,6 +512,8 @@ void PGMap::stat_pg_add(const pg_t &pgid, const pg_stat_t &s,
 
   num_pg++;
   num_pg_by_state[s.state]++;
+  num_pg_by_last_epoch_clean[s.get_effective_last_epoch_clean()]++;
+  stuck_pg_add(pgid, s);
 
   if ((s.state & PG_STATE_CREATING) &&
       s.parent_split_bits == 0) {
@@ -483,6 +553,13 @@ void PGMap::stat_pg_sub(const pg_t &pgid, const pg_stat_t &s,
   if (end == 0)
     num_pg_by_state.erase(s.state);
 
+  map<epoch_t,int>::iterator q =
+    num_pg_by_last_epoch_clean.find(s.get_effective_last_epoch_clean());
+  assert(q != num_pg_by_last_epoch_clean.end());
+  if (--q->second == 0)
+    num_pg_by_last_epoch_clean.erase(q);
+  stuck_pg_sub(pgid, s);
+
   if ((s.state & PG_STATE_CREATING) &&
       s.parent_split_bits == 0) {
     creating_pgs.erase(pgid);
@@ -553,16 +630,10 @@ void PGMap::stat_osd_sub(const osd_stat_t &s)
 
 epoch_t PGMap::calc_min_last_epoch_clean() const
 {
-  if (pg_stat.empty())
+  if (num_pg_by_last_epoch_clean.empty())
     return 0;
 
-  ceph::unordered_map<pg_t,pg_stat_t>::const_iterator p = pg_stat.begin();
-  epoch_t min = p->second.get_effective_last_epoch_clean();
-  for (++p; p != pg_stat.end(); ++p) {
-    epoch_t lec = p->second.get_effective_last_epoch_clean();
-    if (lec < min)
-      min = lec;
-  }
+  epoch_t min = num_pg_by_last_epoch_clean.begin()->first;
   // also scan osd epochs
   // don't trim past the oldest reported osd epoch
   for (ceph::unordered_map<int32_t, epoch_t>::const_iterator i = osd_epochs.begin();
@@ -996,72 +1067,46 @@ void PGMap::get_stuck_stats(int types, const utime_t cutoff,
                             ceph::unordered_map<pg_t, pg_stat_t>& stuck_pgs) const
 {
   assert(types != 0);
-  for (ceph::unordered_map<pg_t, pg_stat_t>::const_iterator i = pg_stat.begin();
-       i != pg_stat.end();
-       ++i) {
-    utime_t val = cutoff; // don't care about >= cutoff so that is infinity
-
-    if ((types & STUCK_INACTIVE) && !(i->second.state & PG_STATE_ACTIVE)) {
-      if (i->second.last_active < val)
-	val = i->second.last_active;
-    }
-
-    if ((types & STUCK_UNCLEAN) && !(i->second.state & PG_STATE_CLEAN)) {
-      if (i->second.last_clean < val)
-	val = i->second.last_clean;
-    }
-
-    if ((types & STUCK_DEGRADED) && (i->second.state & PG_STATE_DEGRADED)) {
-      if (i->second.last_undegraded < val)
-	val = i->second.last_undegraded;
-    }
-
-    if ((types & STUCK_UNDERSIZED) && (i->second.state & PG_STATE_UNDERSIZED)) {
-      if (i->second.last_fullsized < val)
-	val = i->second.last_fullsized;
-    }
-
-    if ((types & STUCK_STALE) && (i->second.state & PG_STATE_STALE)) {
-      if (i->second.last_unstale < val)
-	val = i->second.last_unstale;
-    }
-
-    // val is now the earliest any of the requested stuck states began
-    if (val < cutoff) {
-      stuck_pgs[i->first] = i->second;
+  for (int i = 0; i < NUM_STUCK; ++i) {
+    if (!(types & stuck_types[i]))
+      continue;
+    for (set<pair<utime_t,pg_t> >::const_iterator p =
+	   pg_by_stuck_since[i].begin();
+	 p != pg_by_stuck_since[i].end() && p->first < cutoff;
+	 ++p) {
+      ceph::unordered_map<pg_t, pg_stat_t>::const_iterator s =
+	pg_stat.find(p->second);
+      assert(s != pg_stat.end());
+      stuck_pgs[p->second] = s->second;
     }
   }
 }
 
 bool PGMap::get_stuck_counts(const utime_t cutoff, map<string, int>& note) const
 {
-  int inactive = 0;
-  int unclean = 0;
-  int degraded = 0;
-  int undersized = 0;
-  int stale = 0;
-
-  for (ceph::unordered_map<pg_t, pg_stat_t>::const_iterator i = pg_stat.begin();
-       i != pg_stat.end();
-       ++i) {
-
-    if (! (i->second.state & PG_STATE_ACTIVE)) {
-      if (i->second.last_active < cutoff)
-        ++inactive;
-    } else if (! (i->second.state & PG_STATE_CLEAN)) {
-      if (i->second.last_clean < cutoff)
-        ++unclean;
-    } else if (i->second.state & PG_STATE_DEGRADED) {
-      if (i->second.last_undegraded < cutoff)
-        ++degraded;
-    } else if (i->second.state & PG_STATE_UNDERSIZED) {
-      if (i->second.last_fullsized < cutoff)
-        ++undersized;
-    } else if (i->second.state & PG_STATE_STALE) {
-      if (i->second.last_unstale < cutoff)
-        ++stale;
+  int counts[NUM_STUCK] = { 0 };
+
+  for (int i = 0; i < NUM_STUCK; ++i) {
+    for (set<pair<utime_t,pg_t> >::const_iterator p =
+	   pg_by_stuck_since[i].begin();
+	 p != pg_by_stuck_since[i].end() && p->first < cutoff;
+	 ++p) {
+      // count each pg under the first stuck state it is in only
+      ceph::unordered_map<pg_t, pg_stat_t>::const_iterator s =
+	pg_stat.find(p->second);
+      assert(s != pg_stat.end());
+      int j = 0;
+      while (j < i && !is_stuck_state(stuck_types[j], s->second.state))
+	++j;
+      if (j == i)
+	++counts[i];
     }
   }
+  int inactive = counts[0];
+  int unclean = counts[1];
+  int degraded = counts[2];
+  int undersized = counts[3];
+  int stale = counts[4];
   
   if (inactive)
     note["stuck inactive"] = inactive;
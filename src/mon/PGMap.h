@@ -119,6 +119,23 @@ public:
   mutable epoch_t min_last_epoch_clean;
   ceph::unordered_map<int,int> blocked_by_sum;
   ceph::unordered_map<int,set<pg_t> > pg_by_osd;
+  /// effective last_epoch_clean -> number of pgs
+  map<epoch_t,int> num_pg_by_last_epoch_clean;
+
+  // Bits that use to be enum StuckPG
+  static const int STUCK_INACTIVE = (1<<0);
+  static const int STUCK_UNCLEAN = (1<<1);
+  static const int STUCK_UNDERSIZED = (1<<2);
+  static const int STUCK_DEGRADED = (1<<3);
+  static const int STUCK_STALE = (1<<4);
+  static const int NUM_STUCK = 5;
+
+  /**
+   * per stuck state, in the order of stuck_types[], the pgs in it keyed
+   * by when they entered it, so that finding the ones stuck for longer
+   * than some cutoff does not look at any other pg.
+   */
+  set<pair<utime_t,pg_t> > pg_by_stuck_since[NUM_STUCK];
 
   utime_t stamp;
 
@@ -176,18 +193,14 @@ public:
 
   epoch_t calc_min_last_epoch_clean() const;
 
+  void stuck_pg_add(const pg_t &pgid, const pg_stat_t &s);
+  void stuck_pg_sub(const pg_t &pgid, const pg_stat_t &s);
+
  public:
 
   set<pg_t> creating_pgs;
   map<int,map<epoch_t,set<pg_t> > > creating_pgs_by_osd_epoch;
 
-  // Bits that use to be enum StuckPG
-  static const int STUCK_INACTIVE = (1<<0);
-  static const int STUCK_UNCLEAN = (1<<1);
-  static const int STUCK_UNDERSIZED = (1<<2);
-  static const int STUCK_DEGRADED = (1<<3);
-  static const int STUCK_STALE = (1<<4);
-  
   PGMap()
     : version(0),
       last_osdmap_epoch(0), last_pg_scan(0),
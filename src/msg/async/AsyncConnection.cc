@@ -25,6 +25,12 @@
 
 #include "include/sock_compat.h"
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#define HAVE_MSG_ZEROCOPY
+#endif
+
 // Constant to limit starting sequence number to 2^31.  Nothing special about it, just a big number.  PLR
 #define SEQ_MASK  0x7fffffff 
 
@@ -255,16 +261,17 @@ void AsyncConnection::restore_sigpipe()
 
 // return the length of msg needed to be sent,
 // < 0 means error occured
-ssize_t AsyncConnection::do_sendmsg(struct msghdr &msg, unsigned len, bool more)
+ssize_t AsyncConnection::do_sendmsg(struct msghdr &msg, unsigned len, bool more,
+                                    int flags)
 {
   suppress_sigpipe();
 
   while (len > 0) {
     ssize_t r;
 #if defined(MSG_NOSIGNAL)
-    r = ::sendmsg(sd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    r = ::sendmsg(sd, &msg, flags | MSG_NOSIGNAL | (more ? MSG_MORE : 0));
 #else
-    r = ::sendmsg(sd, &msg, (more ? MSG_MORE : 0));
+    r = ::sendmsg(sd, &msg, flags | (more ? MSG_MORE : 0));
 #endif /* defined(MSG_NOSIGNAL) */
 
     if (r == 0) {
@@ -274,6 +281,12 @@ ssize_t AsyncConnection::do_sendmsg(struct msghdr &msg, unsigned len, bool more)
         continue;
       } else if (errno == EAGAIN) {
         break;
+#ifdef HAVE_MSG_ZEROCOPY
+      } else if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+        // out of optmem for the completions, copy this one
+        flags &= ~MSG_ZEROCOPY;
+        continue;
+#endif
       } else {
         ldout(async_msgr->cct, 1) << __func__ << " sendmsg error: " << cpp_strerror(errno) << dendl;
         restore_sigpipe();
@@ -281,6 +294,12 @@ ssize_t AsyncConnection::do_sendmsg(struct msghdr &msg, unsigned len, bool more)
       }
     }
 
+#ifdef HAVE_MSG_ZEROCOPY
+    // every sendmsg() that took data gets the next completion id
+    if (r > 0 && (flags & MSG_ZEROCOPY))
+      ++zerocopy_seq;
+#endif
+
     len -= r;
     if (len == 0) break;
 
@@ -314,29 +333,70 @@ ssize_t AsyncConnection::_try_send(bool more)
     }
   }
 
+  if (zerocopy_state > 0)
+    reap_zerocopy();
+
   uint64_t sent_bytes = 0;
   list<bufferptr>::const_iterator pb = outcoming_bl.buffers().begin();
-  uint64_t left_pbrs = outcoming_bl.buffers().size();
-  while (left_pbrs) {
+  list<bufferptr>::const_iterator end = outcoming_bl.buffers().end();
+  while (pb != end) {
+    list<bufferptr>::const_iterator next = pb;
+    ++next;
+    if (pb->can_zero_copy()) {
+      // pipe backed data goes from pipe to socket
+      ssize_t r = pb->zero_copy_to_socket(sd, next != end || more);
+      if (r != -ENOTSUP) {
+        if (r < 0) {
+          ldout(async_msgr->cct, 1) << __func__ << " splice error: "
+                                    << cpp_strerror(r) << dendl;
+          return r;
+        }
+        sent_bytes += r;
+        logger->inc(l_msgr_send_splice_bytes, r);
+        if (r < (ssize_t)pb->length()) {
+          ldout(async_msgr->cct, 5) << __func__ << " spliced " << r << " of "
+                                    << pb->length() << ", creating event for writing"
+                                    << dendl;
+          break;
+        }
+        pb = next;
+        continue;
+      }
+    }
+
     struct msghdr msg;
-    uint64_t size = MIN(left_pbrs, ASYNC_IOV_MAX);
-    left_pbrs -= size;
     memset(&msg, 0, sizeof(msg));
     msg.msg_iovlen = 0;
     msg.msg_iov = msgvec;
     unsigned msglen = 0;
-    while (size > 0) {
+    list<bufferptr>::const_iterator first = pb;
+    while (pb != end && msg.msg_iovlen < ASYNC_IOV_MAX &&
+           (pb == first || !pb->can_zero_copy())) {
       msgvec[msg.msg_iovlen].iov_base = (void*)(pb->c_str());
       msgvec[msg.msg_iovlen].iov_len = pb->length();
       msg.msg_iovlen++;
       msglen += pb->length();
       ++pb;
-      size--;
     }
 
-    ssize_t r = do_sendmsg(msg, msglen, left_pbrs || more);
+    int flags = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    uint64_t zerocopy_min = async_msgr->cct->_conf->ms_async_zerocopy_min;
+    if (zerocopy_min && msglen >= zerocopy_min && enable_zerocopy())
+      flags = MSG_ZEROCOPY;
+#endif
+    uint32_t seq = zerocopy_seq;
+    ssize_t r = do_sendmsg(msg, msglen, pb != end || more, flags);
     if (r < 0)
       return r;
+    if (zerocopy_seq != seq) {
+      // keep the pages alive until the kernel is done with them
+      bufferlist pinned;
+      for (list<bufferptr>::const_iterator p = first; p != pb; ++p)
+        pinned.append(*p);
+      zerocopy_pending.push_back(make_pair(zerocopy_seq - 1, pinned));
+      logger->inc(l_msgr_send_zerocopy_bytes, msglen - r);
+    }
 
     // "r" is the remaining length
     sent_bytes += msglen - r;
@@ -384,6 +444,59 @@ ssize_t AsyncConnection::_try_send(bool more)
   return outcoming_bl.length();
 }
 
+bool AsyncConnection::enable_zerocopy()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  if (zerocopy_state == 0 && sd >= 0) {
+    int on = 1;
+    if (::setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+      ldout(async_msgr->cct, 1) << __func__ << " SO_ZEROCOPY failed: "
+                                << cpp_strerror(errno) << dendl;
+      zerocopy_state = -1;
+    } else {
+      zerocopy_state = 1;
+    }
+  }
+  return zerocopy_state > 0;
+#else
+  return false;
+#endif
+}
+
+// release the buffers of the MSG_ZEROCOPY sends the kernel has completed,
+// which it reports on the socket error queue
+void AsyncConnection::reap_zerocopy()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  while (!zerocopy_pending.empty()) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+        continue;
+      struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      // ids [ee_info, ee_data] are done; TCP completes them in order
+      while (!zerocopy_pending.empty() &&
+             (int32_t)(ee->ee_data - zerocopy_pending.front().first) >= 0) {
+        if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+          logger->inc(l_msgr_send_zerocopy_copied_bytes,
+                      zerocopy_pending.front().second.length());
+        zerocopy_pending.pop_front();
+      }
+    }
+  }
+#endif
+}
+
 // Because this func will be called multi times to populate
 // the needed buffer, so the passed in bufferptr must be the same.
 // Normally, only "read_message" will pass existing bufferptr in
@@ -482,6 +595,11 @@ void AsyncConnection::process()
   bool already_dispatch_writer = false;
   std::lock_guard<std::mutex> l(lock);
   last_active = ceph::coarse_mono_clock::now();
+  if (zerocopy_state > 0) {
+    // pending completions keep the socket readable until reaped
+    std::lock_guard<std::mutex> wl(write_lock);
+    reap_zerocopy();
+  }
   do {
     ldout(async_msgr->cct, 20) << __func__ << " prev state is " << get_state_name(prev_state) << dendl;
     prev_state = state;
@@ -2296,7 +2414,8 @@ void AsyncConnection::_stop()
   center->dispatch_event_external(EventCallbackRef(new C_clean_handler(this)));
 }
 
-void AsyncConnection::prepare_send_message(uint64_t features, Message *m, bufferlist &bl)
+void AsyncConnection::prepare_send_message(uint64_t features, Message *m, bufferlist &bl,
+                                           bool defer_data_crc)
 {
   ldout(async_msgr->cct, 20) << __func__ << " m" << " " << *m << dendl;
 
@@ -2308,15 +2427,57 @@ void AsyncConnection::prepare_send_message(uint64_t features, Message *m, buffer
     ldout(async_msgr->cct, 20) << __func__ << " half-reencoding features "
                                << features << " " << m << " " << *m << dendl;
 
-  // encode and copy out of *m
-  m->encode(features, msgr->crcflags);
+  // encode and copy out of *m; a deferred data crc is filled in by
+  // calc_data_crcs() together with those of the other queued messages
+  int crcflags = msgr->crcflags;
+  if (defer_data_crc)
+    crcflags &= ~MSG_CRC_DATA;
+  m->encode(features, crcflags);
 
   bl.append(m->get_payload());
   bl.append(m->get_middle());
   bl.append(m->get_data());
 }
 
+void AsyncConnection::calc_data_crcs(const vector<Message*> &msgs)
+{
+  if (!(msgr->crcflags & MSG_CRC_DATA) || msgs.empty())
+    return;
+
+  vector<const bufferlist*> data;
+  data.reserve(msgs.size());
+  for (vector<Message*>::const_iterator p = msgs.begin(); p != msgs.end(); ++p)
+    data.push_back(&(*p)->get_data());
+  vector<uint32_t> crcs;
+  bufferlist::crc32c_batch(data, &crcs);
+  for (unsigned i = 0; i < msgs.size(); ++i) {
+    ceph_msg_footer& footer = msgs[i]->get_footer();
+    footer.data_crc = crcs[i];
+    footer.flags = (unsigned)footer.flags & ~CEPH_MSG_FOOTER_NOCRC;
+  }
+}
+
 ssize_t AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
+{
+  _append_message(m, bl);
+
+  ldout(async_msgr->cct, 20) << __func__ << " sending " << m->get_seq()
+                             << " " << m << dendl;
+  ssize_t rc = _try_send(more);
+  if (rc < 0) {
+    ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
+                              << cpp_strerror(errno) << dendl;
+  } else if (rc == 0) {
+    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " done." << dendl;
+  } else {
+    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " continuely." << dendl;
+  }
+  m->put();
+
+  return rc;
+}
+
+void AsyncConnection::_append_message(Message *m, bufferlist& bl)
 {
   assert(can_write == WriteStatus::CANWRITE);
   m->set_seq(out_seq.inc());
@@ -2402,20 +2563,6 @@ ssize_t AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
   }
 
   logger->inc(l_msgr_send_bytes, outcoming_bl.length() - original_bl_len);
-  ldout(async_msgr->cct, 20) << __func__ << " sending " << m->get_seq()
-                             << " " << m << dendl;
-  ssize_t rc = _try_send(more);
-  if (rc < 0) {
-    ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
-                              << cpp_strerror(errno) << dendl;
-  } else if (rc == 0) {
-    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " done." << dendl;
-  } else {
-    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " continuely." << dendl;
-  }
-  m->put();
-
-  return rc;
 }
 
 void AsyncConnection::reset_recv_state()
@@ -2571,17 +2718,46 @@ void AsyncConnection::handle_write()
       keepalive = false;
     }
 
+    // gather up to ms_async_send_batch queued messages, and about as
+    // many buffers as one sendmsg() takes, and write them out together
+    unsigned max_batch = MAX(1u, async_msgr->cct->_conf->ms_async_send_batch);
+    vector<Message*> batch;
+    vector<bufferlist> batch_data;
+    vector<Message*> deferred;
     while (1) {
-      bufferlist data;
-      Message *m = _get_next_outgoing(&data);
-      if (!m)
-        break;
+      batch.clear();
+      batch_data.clear();
+      deferred.clear();
+      unsigned nbufs = outcoming_bl.buffers().size();
+      while (batch.size() < max_batch && nbufs < (unsigned)ASYNC_IOV_MAX) {
+        bufferlist data;
+        Message *m = _get_next_outgoing(&data);
+        if (!m)
+          break;
 
-      // send_message or requeue messages may not encode message
-      if (!data.length())
-        prepare_send_message(get_features(), m, data);
+        // send_message or requeue messages may not encode message
+        if (!data.length()) {
+          prepare_send_message(get_features(), m, data, true);
+          deferred.push_back(m);
+        }
+        // plus the tag and header, and the footer
+        nbufs += data.buffers().size() + 2;
+        batch.push_back(m);
+        batch_data.push_back(bufferlist());
+        batch_data.back().claim(data);
+      }
+      if (batch.empty())
+        break;
 
-      r = write_message(m, data, _has_next_outgoing());
+      calc_data_crcs(deferred);
+      for (unsigned i = 0; i < batch.size(); ++i)
+        _append_message(batch[i], batch_data[i]);
+      logger->inc(l_msgr_send_batch, batch.size());
+      ldout(async_msgr->cct, 20) << __func__ << " sending " << batch.size()
+                                 << " messages" << dendl;
+      r = _try_send(_has_next_outgoing());
+      for (unsigned i = 0; i < batch.size(); ++i)
+        batch[i]->put();
       if (r < 0) {
         ldout(async_msgr->cct, 1) << __func__ << " send msg failed" << dendl;
         write_lock.unlock();
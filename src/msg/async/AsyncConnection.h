@@ -21,9 +21,11 @@
 #include <pthread.h>
 #include <signal.h>
 #include <climits>
+#include <deque>
 #include <list>
 #include <mutex>
 #include <map>
+#include <vector>
 using namespace std;
 
 #include "auth/AuthSessionHandler.h"
@@ -53,7 +55,10 @@ class AsyncConnection : public Connection {
   ssize_t read_bulk(int fd, char *buf, unsigned len);
   void suppress_sigpipe();
   void restore_sigpipe();
-  ssize_t do_sendmsg(struct msghdr &msg, unsigned len, bool more);
+  ssize_t do_sendmsg(struct msghdr &msg, unsigned len, bool more,
+                     int flags = 0);
+  bool enable_zerocopy();
+  void reap_zerocopy();
   ssize_t try_send(bufferlist &bl, bool more=false) {
     std::lock_guard<std::mutex> l(write_lock);
     outcoming_bl.claim_append(bl);
@@ -63,7 +68,9 @@ class AsyncConnection : public Connection {
   // the main usage is avoid error happen outside messenger threads
   ssize_t _try_send(bool more=false);
   ssize_t _send(Message *m);
-  void prepare_send_message(uint64_t features, Message *m, bufferlist &bl);
+  void prepare_send_message(uint64_t features, Message *m, bufferlist &bl,
+                            bool defer_data_crc=false);
+  void calc_data_crcs(const vector<Message*> &msgs);
   ssize_t read_until(unsigned needed, char *p);
   ssize_t _process_connection();
   void _connect();
@@ -78,6 +85,7 @@ class AsyncConnection : public Connection {
   int randomize_out_seq();
   void handle_ack(uint64_t seq);
   void _send_keepalive_or_ack(bool ack=false, utime_t *t=NULL);
+  void _append_message(Message *m, bufferlist& bl);
   ssize_t write_message(Message *m, bufferlist& bl, bool more);
   void inject_delay();
   ssize_t _reply_accept(char tag, ceph_msg_connect &connect, ceph_msg_connect_reply &reply,
@@ -116,6 +124,9 @@ class AsyncConnection : public Connection {
       ::close(sd);
       sd = -1;
     }
+    zerocopy_pending.clear();
+    zerocopy_seq = 0;
+    zerocopy_state = 0;
   }
   Message *_get_next_outgoing(bufferlist *bl) {
     Message *m = 0;
@@ -322,6 +333,12 @@ class AsyncConnection : public Connection {
   list<Message*> sent; // the first bufferlist need to inject seq
   bufferlist outcoming_bl;
   bool keepalive;
+  // buffers sent with MSG_ZEROCOPY, which the kernel may still reference,
+  // by the sequence number of the last sendmsg() that covered them
+  std::deque<pair<uint32_t, bufferlist> > zerocopy_pending;
+  uint32_t zerocopy_seq = 0;
+  // SO_ZEROCOPY on sd: 0 not tried yet, 1 enabled, -1 unsupported
+  std::atomic<int> zerocopy_state = {0};
 
   std::mutex lock;
   utime_t backoff;         // backoff time
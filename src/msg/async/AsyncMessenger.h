@@ -51,6 +51,10 @@ enum {
   l_msgr_send_bytes,
   l_msgr_created_connections,
   l_msgr_active_connections,
+  l_msgr_send_splice_bytes,
+  l_msgr_send_zerocopy_bytes,
+  l_msgr_send_zerocopy_copied_bytes,
+  l_msgr_send_batch,
   l_msgr_last,
 };
 
@@ -82,6 +86,10 @@ class Worker : public Thread {
     plb.add_u64_counter(l_msgr_send_bytes, "msgr_send_bytes", "Network received bytes");
     plb.add_u64_counter(l_msgr_created_connections, "msgr_created_connections", "Created connection number");
     plb.add_u64_counter(l_msgr_active_connections, "msgr_active_connections", "Active connection number");
+    plb.add_u64_counter(l_msgr_send_splice_bytes, "msgr_send_splice_bytes", "Network sent bytes spliced from pipes");
+    plb.add_u64_counter(l_msgr_send_zerocopy_bytes, "msgr_send_zerocopy_bytes", "Network sent bytes with MSG_ZEROCOPY");
+    plb.add_u64_counter(l_msgr_send_zerocopy_copied_bytes, "msgr_send_zerocopy_copied_bytes", "Network sent bytes with MSG_ZEROCOPY the kernel copied anyway");
+    plb.add_u64_avg(l_msgr_send_batch, "msgr_send_batch", "Queued messages sent together");
 
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
@@ -1825,6 +1825,15 @@ public:
     TrackedOpRef op = TrackedOpRef(),
     ThreadPool::TPHandle *handle = NULL) = 0;
 
+  /**
+   * throttle_would_block
+   *
+   * True if queueing a transaction of about @p bytes right now would
+   * wait in the store's submit throttles.  Only a hint: callers that
+   * must not block use it to pick a queued path instead.
+   */
+  virtual bool throttle_would_block(uint64_t bytes) { return false; }
+
 
   int queue_transactions(
     Sequencer *osr,
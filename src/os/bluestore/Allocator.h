@@ -72,6 +72,12 @@ public:
 
   virtual uint64_t get_free() = 0;
 
+  /*
+   * Fragmentation of free space, from 0 (one free extent) to 1 (no
+   * two free alloc_units adjacent).
+   */
+  virtual double get_fragmentation(uint64_t alloc_unit) = 0;
+
   virtual void shutdown() = 0;
   static Allocator *create(string type, int64_t size, int64_t block_size);
 };
@@ -350,6 +350,7 @@ void BitMapZone::init(int64_t zone_num, int64_t total_blocks, bool def)
   m_type = ZONE;
 
   m_used_blocks = def? total_blocks: 0;
+  m_max_free_run = def? 0: total_blocks;
 
   int64_t num_bmaps = total_blocks / BmapEntry::size();
   debug_assert(num_bmaps < std::numeric_limits<int16_t>::max());
@@ -376,6 +377,59 @@ int64_t BitMapZone::get_used_blocks()
   return std::atomic_load(&m_used_blocks);
 }
 
+/*
+ * Recompute the longest free run in the zone, a word at a time.
+ * A free run may span words, so carry the free tail of each word
+ * into the head of the next.
+ */
+void BitMapZone::update_max_free_run()
+{
+  int64_t run = 0;
+  int64_t best = 0;
+
+  for (auto& bmap : *m_bmap_list) {
+    bmap_t bits = bmap.atomic_fetch();
+    if (bits == BmapEntry::empty_bmask()) {
+      run += BmapEntry::size();
+      continue;
+    }
+    if (bits == BmapEntry::full_bmask()) {
+      best = MAX(best, run);
+      run = 0;
+      continue;
+    }
+
+    /*
+     * Bit 0 is the msb, so leading zeros extend the current run and
+     * trailing zeros start the next one.
+     */
+    best = MAX(best, run + __builtin_clzl(bits));
+    int inner = 0;
+    for (bmap_t free = ~bits; free; free &= free << 1) {
+      inner++;
+    }
+    best = MAX(best, inner);
+    run = __builtin_ctzl(bits);
+  }
+  best = MAX(best, run);
+
+  std::atomic_store(&m_max_free_run, (int32_t) best);
+}
+
+int64_t BitMapZone::count_free_runs()
+{
+  int64_t runs = 0;
+  bmap_t carry = 0;  // last bit of the previous word was free
+
+  for (auto& bmap : *m_bmap_list) {
+    bmap_t free = ~bmap.atomic_fetch();
+    bmap_t prev = (free >> 1) | (carry << (BmapEntry::size() - 1));
+    runs += __builtin_popcountl(free & ~prev);
+    carry = free & 1;
+  }
+  return runs;
+}
+
 bool BitMapZone::reserve_blocks(int64_t num_blocks)
 {
   debug_assert(0);
@@ -491,6 +545,7 @@ void BitMapZone::set_blocks_used(int64_t start_block, int64_t num_blocks)
     blks -= falling_in_bmap;
   }
   add_used_blocks(num_blocks);
+  update_max_free_run();
 }
 
 void BitMapZone::free_blocks_int(int64_t start_block, int64_t num_blocks)
@@ -587,14 +642,19 @@ int64_t BitMapZone::alloc_blocks(int64_t num_blocks, int64_t *start_block)
   }
 
   add_used_blocks(allocated);
+  update_max_free_run();
   return allocated;
 }
 
 void BitMapZone::free_blocks(int64_t start_block, int64_t num_blocks)
 {
+  if (num_blocks == 0) {
+    return;
+  }
   free_blocks_int(start_block, num_blocks);
   sub_used_blocks(num_blocks);
   debug_assert(get_used_blocks() >= 0);
+  update_max_free_run();
 }
 
 /*
@@ -626,6 +686,7 @@ int64_t BitMapZone::alloc_blocks_dis(int64_t num_blocks,
   }
 
   add_used_blocks(allocated);
+  update_max_free_run();
 
   return allocated;
 }
@@ -710,6 +771,7 @@ void BitMapAreaIN::init_common(int64_t total_blocks, int64_t area_idx, bool def)
   m_level = BitMapArea::get_level(total_blocks);
   m_type = BitMapArea::level_to_type(m_level);
   m_reserved_blocks = 0;
+  m_max_free_run = 0;
 
   m_used_blocks = def? total_blocks: 0;
 }
@@ -747,6 +809,7 @@ void BitMapAreaIN::init(int64_t total_blocks, int64_t area_idx, bool def)
   BitMapAreaList *list = new BitMapAreaList(children, num_child);
   m_child_list = list;
   m_num_child = num_child;
+  update_max_free_run();
 }
 
 BitMapAreaIN::BitMapAreaIN(int64_t total_blocks, int64_t area_idx)
@@ -775,7 +838,8 @@ bool BitMapAreaIN::child_check_n_lock(BitMapArea *child, int64_t required)
 {
   child->lock_shared();
 
-  if (child->is_exhausted()) {
+  if (child->is_exhausted() ||
+      child->get_max_free_run() < required) {
     child->unlock();
     return false;
   }
@@ -843,6 +907,41 @@ int64_t BitMapAreaIN::get_reserved_blocks()
   return m_reserved_blocks;
 }
 
+int64_t BitMapAreaIN::count_free_runs()
+{
+  int64_t runs = 0;
+  for (int64_t i = 0; i < m_child_list->size(); i++) {
+    runs += m_child_list->get_nth_item(i)->count_free_runs();
+  }
+  return runs;
+}
+
+void BitMapAreaIN::raise_max_free_run(int64_t run)
+{
+  uint64_t cur = std::atomic_load(&m_max_free_run);
+  uint64_t next = 0;
+  do {
+    int64_t bound = MAX((int64_t) (cur & 0xffffffffull), run);
+    next = ((cur >> 32) + 1) << 32 | (uint64_t) bound;
+  } while (!m_max_free_run.compare_exchange_weak(cur, next));
+}
+
+/*
+ * Tighten the bound to the children's summaries. Allocations only
+ * shrink runs, so a stale child read errs high; a free that raced
+ * with the scan bumps the raise count and the store is dropped.
+ */
+void BitMapAreaIN::update_max_free_run()
+{
+  uint64_t cur = std::atomic_load(&m_max_free_run);
+  int64_t best = 0;
+  for (int64_t i = 0; i < m_child_list->size(); i++) {
+    best = MAX(best, m_child_list->get_nth_item(i)->get_max_free_run());
+  }
+  uint64_t next = (cur & ~0xffffffffull) | (uint64_t) best;
+  m_max_free_run.compare_exchange_strong(cur, next);
+}
+
 bool BitMapAreaIN::is_allocated(int64_t start_block, int64_t num_blocks)
 {
   BitMapArea *area = NULL;
@@ -888,16 +987,28 @@ int64_t BitMapAreaIN::alloc_blocks_int(bool wait, bool wrap,
     }
 
     allocated = child->alloc_blocks(wait, num_blocks, start_block);
-    child_unlock(child);
     if (allocated == num_blocks) {
+      child_unlock(child);
       (*start_block) += child->get_index() * m_child_size_blocks;
       break;
     }
 
-    child->free_blocks(*start_block, allocated);
+    /*
+     * Give back a partial run while the child is still locked, so no
+     * one sees its summary before the run is back.
+     */
+    if (allocated) {
+      child->free_blocks(*start_block, allocated);
+      raise_max_free_run(child->get_max_free_run());
+    }
+    child_unlock(child);
     *start_block = 0;
     allocated = 0;
   }
+
+  if (!allocated) {
+    update_max_free_run();
+  }
   return allocated;
 }
 
@@ -1023,6 +1134,7 @@ void BitMapAreaIN::free_blocks_int(int64_t start_block, int64_t num_blocks)
     falling_in_child = MIN(m_child_size_blocks - child_block_offset,
               num_blocks);
     child->free_blocks(child_block_offset, falling_in_child);
+    raise_max_free_run(child->get_max_free_run());
     start_block += falling_in_child;
     num_blocks -= falling_in_child;
   }
@@ -1079,6 +1191,7 @@ void BitMapAreaLeaf::init(int64_t total_blocks, int64_t area_idx,
 
   m_child_list = list;
   m_num_child = num_child;
+  update_max_free_run();
 
   BitMapAreaLeaf::incr_count();
 }
@@ -1101,13 +1214,22 @@ BitMapAreaLeaf::~BitMapAreaLeaf()
 
 bool BitMapAreaLeaf::child_check_n_lock(BitMapArea *child, int64_t required, bool lock)
 {
+  /*
+   * Skip zones that cannot hold the request without touching their
+   * lock; the summary is rechecked once the zone is locked.
+   */
+  if (child->get_max_free_run() < required) {
+    return false;
+  }
+
   if (lock) {
     child->lock_excl();
   } else if (!child->lock_excl_try()) {
     return false;
   }
 
-  if (child->is_exhausted()) {
+  if (child->is_exhausted() ||
+      child->get_max_free_run() < required) {
     child->unlock();
     return false;
   }
@@ -1137,16 +1259,28 @@ int64_t BitMapAreaLeaf::alloc_blocks_int(bool wait, bool wrap,
     debug_assert(child->get_type() == ZONE);
 
     allocated = child->alloc_blocks(num_blocks, start_block);
-    child_unlock(child);
     if (allocated == num_blocks) {
+      child_unlock(child);
       (*start_block) += child->get_index() * m_child_size_blocks;
       break;
     }
 
-    child->free_blocks(*start_block, allocated);
+    /*
+     * Give back a partial run while the child is still locked, so no
+     * one sees its summary before the run is back.
+     */
+    if (allocated) {
+      child->free_blocks(*start_block, allocated);
+      raise_max_free_run(child->get_max_free_run());
+    }
+    child_unlock(child);
     *start_block = 0;
     allocated = 0;
   }
+
+  if (!allocated) {
+    update_max_free_run();
+  }
   return allocated;
 }
 
@@ -1199,7 +1333,9 @@ void BitMapAreaLeaf::free_blocks_int(int64_t start_block, int64_t num_blocks)
 
     child->lock_excl();
     child->free_blocks(child_block_offset, falling_in_child);
+    int64_t run = child->get_max_free_run();
     child->unlock();
+    raise_max_free_run(run);
     start_block += falling_in_child;
     num_blocks -= falling_in_child;
   }
@@ -1339,12 +1475,12 @@ bool BitAllocator::child_check_n_lock(BitMapArea *child, int64_t required)
 {
   child->lock_shared();
 
-  if (child->is_exhausted()) {
+  if (child->is_exhausted() ||
+      child->get_max_free_run() < required) {
     child->unlock();
     return false;
   }
 
-
   return true;
 }
 
@@ -249,6 +249,19 @@ public:
   virtual void free_blocks(int64_t start_block, int64_t num_blocks) = 0;
   virtual int64_t size() = 0;
 
+  /*
+   * Longest contiguous free run inside one zone of this area. Exact
+   * for a zone, an upper bound for areas; contiguous searches skip
+   * any child whose summary is smaller than the request.
+   */
+  virtual int64_t get_max_free_run() = 0;
+
+  /*
+   * Number of free runs, counted per zone. Lockless, so only a
+   * snapshot while allocations are in flight.
+   */
+  virtual int64_t count_free_runs() = 0;
+
   int64_t child_count();
   int64_t get_index();
   int64_t get_level();
@@ -310,9 +323,12 @@ class BitMapZone: public BitMapArea{
 
 private:
   std::atomic<int32_t> m_used_blocks;
+  std::atomic<int32_t> m_max_free_run;
   std::vector <BmapEntry> *m_bmap_list;
   std::mutex m_lock;
 
+  void update_max_free_run();
+
 public:
   static int64_t count;
   static int64_t total_blocks;
@@ -331,6 +347,10 @@ public:
   int64_t size() {
     return get_total_blocks();
   }
+  int64_t get_max_free_run() {
+    return std::atomic_load(&m_max_free_run);
+  }
+  int64_t count_free_runs();
 
   void lock_excl();
   bool lock_excl_try();
@@ -381,6 +401,17 @@ protected:
   std::mutex m_blocks_lock;
   BitMapAreaList *m_child_list;
 
+  /*
+   * Upper bound of the longest free run of any child (low 32 bits)
+   * and a count of raises (high 32 bits). Frees raise the bound, a
+   * failed search tightens it from the children unless a raise
+   * raced with it.
+   */
+  std::atomic<uint64_t> m_max_free_run;
+
+  void raise_max_free_run(int64_t run);
+  void update_max_free_run();
+
   virtual bool is_allocated(int64_t start_block, int64_t num_blocks);
   virtual bool is_exhausted();
   
@@ -421,6 +452,10 @@ public:
   virtual int64_t size() {
     return m_total_blocks;
   }
+  virtual int64_t get_max_free_run() {
+    return std::atomic_load(&m_max_free_run) & 0xffffffffull;
+  }
+  virtual int64_t count_free_runs();
 
   virtual int64_t alloc_blocks_int(bool wait, bool wrap,
                      int64_t num_blocks, int64_t *start_block);
@@ -250,6 +250,16 @@ uint64_t BitMapAllocator::get_free()
     m_block_size);
 }
 
+double BitMapAllocator::get_fragmentation(uint64_t alloc_unit)
+{
+  uint64_t units = get_free() / alloc_unit;
+  uint64_t runs = m_bit_alloc->count_free_runs();
+  if (units <= 1 || runs <= 1) {
+    return 0;
+  }
+  return MIN(1.0, (double)(runs - 1) / (units - 1));
+}
+
 void BitMapAllocator::dump(ostream& out)
 {
   std::lock_guard<std::mutex> l(m_lock);
@@ -18,6 +18,9 @@
 #include <unistd.h>
 
 #include "KernelDevice.h"
+#if defined(HAVE_IO_URING)
+#include "UringDevice.h"
+#endif
 #if defined(HAVE_SPDK)
 #include "NVMEDevice.h"
 #endif
@@ -53,11 +56,18 @@ BlockDevice *BlockDevice::create(const string& path, aio_callback_t cb, void *cb
     if (strncmp(bname, SPDK_PREFIX, sizeof(SPDK_PREFIX)-1) == 0)
       type = "ust-nvme";
   }
+  if (type == "kernel" && g_conf->bdev_uring)
+    type = "uring";
   dout(1) << __func__ << " path " << path << " type " << type << dendl;
 
   if (type == "kernel") {
     return new KernelDevice(cb, cbpriv);
   }
+#if defined(HAVE_IO_URING)
+  if (type == "uring") {
+    return new UringDevice(cb, cbpriv);
+  }
+#endif
 #if defined(HAVE_SPDK)
   if (type == "ust-nvme") {
     return new NVMEDevice(cb, cbpriv);
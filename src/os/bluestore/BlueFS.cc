@@ -6,6 +6,7 @@
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "common/Formatter.h"
 #include "BlockDevice.h"
 #include "Allocator.h"
 
@@ -77,6 +78,12 @@ void BlueFS::_init_logger()
 		    "Bytes written to WAL");
   b.add_u64_counter(l_bluefs_bytes_written_sst, "bytes_written_sst",
 		    "Bytes written to SSTs");
+  b.add_time_avg(l_bluefs_sync_lat, "sync_lat",
+		 "Average rocksdb file sync latency");
+  b.add_time_avg(l_bluefs_range_sync_lat, "range_sync_lat",
+		 "Average rocksdb file range sync latency");
+  b.add_time_avg(l_bluefs_dir_sync_lat, "dir_sync_lat",
+		 "Average rocksdb directory sync latency");
   logger = b.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -364,6 +371,16 @@ int BlueFS::mount()
            << dendl;
 
   _init_logger();
+  _start_flush_threads();
+
+  sync_lat_hook = new SyncLatencyHook(this);
+  r = g_ceph_context->get_admin_socket()->register_command(
+    "bluefs sync latency", "bluefs sync latency", sync_lat_hook,
+    "show histograms of rocksdb sync call latency");
+  if (r < 0 && r != -EEXIST) {
+    derr << __func__ << " error registering admin socket command: "
+	 << cpp_strerror(r) << dendl;
+  }
   return 0;
 
  out:
@@ -375,7 +392,13 @@ void BlueFS::umount()
 {
   dout(1) << __func__ << dendl;
 
+  g_ceph_context->get_admin_socket()->unregister_command(
+    "bluefs sync latency");
+  delete sync_lat_hook;
+  sync_lat_hook = nullptr;
+
   sync_metadata();
+  _stop_flush_threads();
 
   _close_writer(log_writer);
   log_writer = NULL;
@@ -534,6 +557,7 @@ int BlueFS::_replay()
     dout(10) << __func__ << " 0x" << std::hex << pos << std::dec
              << ": " << t << dendl;
 
+    uint64_t jump_to = 0;
     bufferlist::iterator p = t.op_bl.begin();
     while (!p.end()) {
       __u8 op;
@@ -557,6 +581,22 @@ int BlueFS::_replay()
 	}
 	break;
 
+      case bluefs_transaction_t::OP_JUMP:
+        {
+	  uint64_t next_seq;
+	  uint64_t offset;
+	  ::decode(next_seq, p);
+	  ::decode(offset, p);
+	  dout(20) << __func__ << " 0x" << std::hex << pos << std::dec
+                   << ":  op_jump seq " << next_seq
+                   << " offset 0x" << std::hex << offset << std::dec << dendl;
+	  assert(next_seq >= log_seq);
+	  assert(offset >= log_reader->buf.pos);
+	  log_seq = next_seq - 1; // we will increment it below
+	  jump_to = offset;
+	}
+	break;
+
       case bluefs_transaction_t::OP_ALLOC_ADD:
         {
 	  __u8 id;
@@ -692,6 +732,11 @@ int BlueFS::_replay()
 
     // we successfully replayed the transaction; bump the seq and log size
     ++log_seq;
+    if (jump_to) {
+      dout(10) << __func__ << " 0x" << std::hex << log_reader->buf.pos
+	       << ": jump to 0x" << jump_to << std::dec << dendl;
+      log_reader->buf.seek(jump_to);
+    }
     log_file->fnode.size = log_reader->buf.pos;
   }
 
@@ -918,8 +963,12 @@ uint64_t BlueFS::_estimate_log_size()
   return ROUND_UP_TO(size, super.block_size);
 }
 
-void BlueFS::_maybe_compact_log()
+void BlueFS::_maybe_compact_log(std::unique_lock<std::mutex>& l)
 {
+  if (new_log) {
+    dout(10) << __func__ << " compaction already in progress" << dendl;
+    return;
+  }
   uint64_t current = log_writer->file->fnode.size;
   uint64_t expected = _estimate_log_size();
   float ratio = (float)current / (float)expected;
@@ -929,52 +978,57 @@ void BlueFS::_maybe_compact_log()
   if (current < g_conf->bluefs_log_compact_min_size ||
       ratio < g_conf->bluefs_log_compact_min_ratio)
     return;
-  _compact_log();
+  if (g_conf->bluefs_compact_log_sync) {
+    _compact_log_sync();
+  } else {
+    _compact_log_async(l);
+  }
   dout(20) << __func__ << " done, actual " << log_writer->file->fnode.size
 	   << " vs expected " << expected << dendl;
 }
 
-void BlueFS::_compact_log()
+void BlueFS::_compact_log_dump_metadata(bluefs_transaction_t *t)
 {
-  // FIXME: we currently hold the lock while writing out the compacted log,
-  // which may mean a latency spike.  we could drop the lock while writing out
-  // the big compacted log, while continuing to log at the end of the old log
-  // file, and once it's done swap out the old log extents for the new ones.
-  dout(10) << __func__ << dendl;
-  File *log_file = log_writer->file.get();
-
-  // clear out log (be careful who calls us!!!)
-  log_t.clear();
-
-  bluefs_transaction_t t;
-  t.seq = 1;
-  t.uuid = super.uuid;
+  t->seq = 1;
+  t->uuid = super.uuid;
   dout(20) << __func__ << " op_init" << dendl;
-  t.op_init();
+  t->op_init();
   for (unsigned bdev = 0; bdev < MAX_BDEV; ++bdev) {
     interval_set<uint64_t>& p = block_all[bdev];
     for (interval_set<uint64_t>::iterator q = p.begin(); q != p.end(); ++q) {
       dout(20) << __func__ << " op_alloc_add " << bdev << " 0x"
                << std::hex << q.get_start() << "~" << q.get_len() << std::dec
                << dendl;
-      t.op_alloc_add(bdev, q.get_start(), q.get_len());
+      t->op_alloc_add(bdev, q.get_start(), q.get_len());
     }
   }
   for (auto& p : file_map) {
     if (p.first == 1)
       continue;
     dout(20) << __func__ << " op_file_update " << p.second->fnode << dendl;
-    t.op_file_update(p.second->fnode);
+    t->op_file_update(p.second->fnode);
   }
   for (auto& p : dir_map) {
     dout(20) << __func__ << " op_dir_create " << p.first << dendl;
-    t.op_dir_create(p.first);
+    t->op_dir_create(p.first);
     for (auto& q : p.second->file_map) {
       dout(20) << __func__ << " op_dir_link " << p.first << "/" << q.first
 	       << " to " << q.second->fnode.ino << dendl;
-      t.op_dir_link(p.first, q.first, q.second->fnode.ino);
+      t->op_dir_link(p.first, q.first, q.second->fnode.ino);
     }
   }
+}
+
+void BlueFS::_compact_log_sync()
+{
+  dout(10) << __func__ << dendl;
+  File *log_file = log_writer->file.get();
+
+  // clear out log (be careful who calls us!!!)
+  log_t.clear();
+
+  bluefs_transaction_t t;
+  _compact_log_dump_metadata(&t);
   dout(20) << __func__ << " op_jump_seq " << log_seq << dendl;
   t.op_jump_seq(log_seq);
 
@@ -1017,6 +1071,136 @@ void BlueFS::_compact_log()
   logger->inc(l_bluefs_log_compactions);
 }
 
+/*
+ * Compact the log without blocking writers while the compacted log is
+ * written out:
+ *
+ *  1. log a jump to old_log_jump_to, the end of the log's currently
+ *     allocated space, and continue logging there;
+ *  2. write the metadata as of that jump, plus a jump to new_log_jump_to,
+ *     to freshly allocated space, with the lock dropped;
+ *  3. splice the extents past old_log_jump_to onto the compacted log so
+ *     that they start at new_log_jump_to, and write the super.
+ *
+ * On replay the compacted log jumps straight to the entries logged
+ * meanwhile.
+ */
+void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
+{
+  dout(10) << __func__ << dendl;
+  File *log_file = log_writer->file.get();
+  assert(!new_log);
+  assert(!new_log_writer);
+
+  new_log = new File;
+  new_log->fnode.ino = 0;   // so that _flush_range won't log it
+  new_log->fnode.prefer_bdev = log_file->fnode.prefer_bdev;
+
+  // 1. make sure the current log_t is the one that carries our jump
+  while (log_flushing) {
+    dout(10) << __func__ << " log is currently flushing, waiting" << dendl;
+    log_cond.wait(l);
+  }
+  old_log_jump_to = log_file->fnode.get_allocated();
+  uint64_t need = old_log_jump_to + g_conf->bluefs_max_log_runway;
+  while (log_file->fnode.get_allocated() < need) {
+    int r = _allocate(log_file->fnode.prefer_bdev,
+		      need - log_file->fnode.get_allocated(),
+		      &log_file->fnode.extents);
+    assert(r == 0);
+  }
+  uint64_t seq = log_seq + 1;
+  dout(10) << __func__ << " old_log_jump_to 0x" << std::hex << old_log_jump_to
+	   << std::dec << " seq " << seq << " log extents "
+	   << log_file->fnode.extents << dendl;
+  log_t.op_file_update(log_file->fnode);
+  log_t.op_jump(seq, old_log_jump_to);
+
+  // the metadata as of seq, which includes everything in log_t
+  bluefs_transaction_t t;
+  _compact_log_dump_metadata(&t);
+
+  _flush_and_sync_log(l, 0, old_log_jump_to);
+
+  // 2. write the compacted log; leave room for the jump op and padding
+  new_log_jump_to = ROUND_UP_TO(t.op_bl.length() + super.block_size * 2,
+				g_conf->bluefs_alloc_size);
+  t.op_jump(seq, new_log_jump_to);
+  bufferlist bl;
+  ::encode(t, bl);
+  _pad_bl(bl);
+  assert(bl.length() <= new_log_jump_to);
+  dout(10) << __func__ << " new_log_jump_to 0x" << std::hex << new_log_jump_to
+	   << std::dec << dendl;
+
+  int r = _allocate(new_log->fnode.prefer_bdev, new_log_jump_to,
+		    &new_log->fnode.extents);
+  assert(r == 0);
+  assert(new_log->fnode.get_allocated() == new_log_jump_to);
+  new_log_writer = _create_writer(new_log);
+  new_log_writer->append(bl);
+  r = _flush(new_log_writer, true);
+  assert(r == 0);
+
+  l.unlock();
+  wait_for_aio(new_log_writer);
+  flush_bdev();
+  l.lock();
+
+  // 3. swap in the compacted log.  let any flush of the old log that
+  // raced with us finish first so the log writer is quiescent.
+  while (log_flushing) {
+    dout(10) << __func__ << " log is currently flushing, waiting" << dendl;
+    log_cond.wait(l);
+  }
+  vector<bluefs_extent_t> old_extents;
+  uint64_t discarded = 0;
+  auto p = log_file->fnode.extents.begin();
+  while (discarded < old_log_jump_to) {
+    assert(p != log_file->fnode.extents.end());
+    if (discarded + p->length <= old_log_jump_to) {
+      discarded += p->length;
+      old_extents.push_back(*p);
+      ++p;
+    } else {
+      uint64_t drop = old_log_jump_to - discarded;
+      old_extents.push_back(bluefs_extent_t(p->bdev, p->offset, drop));
+      p->offset += drop;
+      p->length -= drop;
+      discarded += drop;
+    }
+  }
+  new_log->fnode.extents.insert(new_log->fnode.extents.end(),
+				p, log_file->fnode.extents.end());
+  log_file->fnode.extents.swap(new_log->fnode.extents);
+  log_writer->pos = log_writer->pos - old_log_jump_to + new_log_jump_to;
+  log_file->fnode.size = log_writer->pos;
+  dout(10) << __func__ << " log extents now " << log_file->fnode.extents
+	   << dendl;
+
+  dout(10) << __func__ << " writing super" << dendl;
+  super.log_fnode = log_file->fnode;
+  ++super.version;
+  _write_super();
+
+  l.unlock();
+  flush_bdev();
+  l.lock();
+
+  dout(10) << __func__ << " release old log extents " << old_extents << dendl;
+  for (auto& r : old_extents) {
+    alloc[r.bdev]->release(r.offset, r.length);
+  }
+
+  new_log->fnode.extents.clear();
+  _close_writer(new_log_writer);
+  new_log_writer = nullptr;
+  new_log.reset();
+  log_cond.notify_all();
+
+  logger->inc(l_bluefs_log_compactions);
+}
+
 void BlueFS::_pad_bl(bufferlist& bl)
 {
   uint64_t partial = bl.length() % super.block_size;
@@ -1028,11 +1212,22 @@ void BlueFS::_pad_bl(bufferlist& bl)
 }
 
 int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
-				uint64_t want_seq)
+				uint64_t want_seq,
+				uint64_t jump_to)
 {
-  while (log_flushing) {
-    dout(10) << __func__ << " want_seq " << want_seq
-	     << " log is currently flushing, waiting" << dendl;
+  while (true) {
+    if (log_flushing) {
+      dout(10) << __func__ << " want_seq " << want_seq
+	       << " log is currently flushing, waiting" << dendl;
+    } else if (new_log_writer &&
+	       log_writer->file->fnode.get_allocated() - log_writer->pos <
+	       g_conf->bluefs_min_log_runway) {
+      // the log's extents are about to be swapped; don't add to them
+      dout(10) << __func__ << " want_seq " << want_seq
+	       << " low on runway, waiting for log compaction" << dendl;
+    } else {
+      break;
+    }
     log_cond.wait(l);
   }
   if (want_seq && want_seq <= log_seq_stable) {
@@ -1080,6 +1275,13 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
   int r = _flush(log_writer, true);
   assert(r == 0);
 
+  if (jump_to) {
+    dout(10) << __func__ << " jumping log offset from 0x" << std::hex
+	     << log_writer->pos << " -> 0x" << jump_to << std::dec << dendl;
+    log_writer->pos = jump_to;
+    log_writer->file->fnode.size = jump_to;
+  }
+
   // drop lock while we wait for io
   l.unlock();
   wait_for_aio(log_writer);
@@ -1150,10 +1352,10 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
   }
   if (h->file->fnode.size < offset + length) {
     h->file->fnode.size = offset + length;
-    if (h->file->fnode.ino != 1) {
+    if (h->file->fnode.ino > 1) {
       // we do not need to dirty the log file when the file size
       // changes because replay is smart enough to discover it on its
-      // own.
+      // own.  (ino 0 is a log being compacted, which is not logged.)
       must_dirty = true;
     }
   }
@@ -1351,10 +1553,120 @@ void BlueFS::flush_bdev()
 {
   // NOTE: this is safe to call without a lock.
   dout(20) << __func__ << dendl;
+  if (flush_threads.empty()) {
+    for (auto p : bdev) {
+      if (p)
+	p->flush();
+    }
+    return;
+  }
+
+  // flush the devices concurrently; each flush waits on its own device
+  std::lock_guard<std::mutex> r(flush_round_lock);
+  {
+    std::lock_guard<std::mutex> l(flush_lock);
+    ++flush_round;
+    flush_pending = flush_threads.size();
+    flush_cond.notify_all();
+  }
   for (auto p : bdev) {
-    if (p)
+    if (p) {
       p->flush();
+      break;
+    }
+  }
+  std::unique_lock<std::mutex> l(flush_lock);
+  while (flush_pending)
+    flush_cond.wait(l);
+}
+
+void BlueFS::_start_flush_threads()
+{
+  if (!g_conf->bluefs_parallel_flush)
+    return;
+  bool first = true;
+  for (unsigned id = 0; id < MAX_BDEV; ++id) {
+    if (!bdev[id])
+      continue;
+    if (first) {
+      first = false;  // flushed by the caller
+      continue;
+    }
+    FlushThread *t = new FlushThread(this, id);
+    t->create("bluefs_flush");
+    flush_threads.push_back(t);
+  }
+  dout(10) << __func__ << " " << flush_threads.size() << " threads" << dendl;
+}
+
+void BlueFS::_stop_flush_threads()
+{
+  {
+    std::lock_guard<std::mutex> l(flush_lock);
+    flush_stop = true;
+    flush_cond.notify_all();
+  }
+  for (auto t : flush_threads) {
+    t->join();
+    delete t;
   }
+  flush_threads.clear();
+  flush_stop = false;
+}
+
+void BlueFS::_flush_thread(unsigned id)
+{
+  dout(10) << __func__ << " " << id << " start" << dendl;
+  std::unique_lock<std::mutex> l(flush_lock);
+  uint64_t seen = flush_round;
+  while (true) {
+    while (!flush_stop && flush_round == seen)
+      flush_cond.wait(l);
+    if (flush_stop)
+      break;
+    seen = flush_round;
+    l.unlock();
+    bdev[id]->flush();
+    l.lock();
+    if (--flush_pending == 0)
+      flush_cond.notify_all();
+  }
+  dout(10) << __func__ << " " << id << " finish" << dendl;
+}
+
+void BlueFS::note_sync_latency(unsigned which, utime_t lat)
+{
+  assert(which < SYNC_MAX);
+  static const int idx[SYNC_MAX] = {
+    l_bluefs_sync_lat, l_bluefs_range_sync_lat, l_bluefs_dir_sync_lat
+  };
+  logger->tinc(idx[which], lat);
+  uint64_t us = lat.to_nsec() / 1000;
+  std::lock_guard<std::mutex> l(sync_lat_lock);
+  sync_lat_hist[which].add(MIN(us, (uint64_t)INT32_MAX));
+}
+
+void BlueFS::dump_sync_latency(Formatter *f)
+{
+  static const char *names[SYNC_MAX] = { "sync", "range_sync", "dir_sync" };
+  std::lock_guard<std::mutex> l(sync_lat_lock);
+  f->open_object_section("sync_latency_us");
+  for (unsigned i = 0; i < SYNC_MAX; ++i) {
+    f->open_object_section(names[i]);
+    sync_lat_hist[i].dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+bool BlueFS::SyncLatencyHook::call(std::string command, cmdmap_t& cmdmap,
+				   std::string format, bufferlist& out)
+{
+  Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+  fs->dump_sync_latency(f);
+  f->flush(out);
+  delete f;
+  return true;
 }
 
 int BlueFS::_allocate(uint8_t id, uint64_t len, vector<bluefs_extent_t> *ev)
@@ -1448,7 +1760,7 @@ void BlueFS::sync_metadata()
       p->commit_finish();
     }
   }
-  _maybe_compact_log();
+  _maybe_compact_log(l);
   utime_t end = ceph_clock_now(NULL);
   utime_t dur = end - start;
   dout(10) << __func__ << " done in " << dur << dendl;
@@ -4,10 +4,14 @@
 #define CEPH_OS_BLUESTORE_BLUEFS_H
 
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
 
 #include "bluefs_types.h"
 #include "common/RefCountedObj.h"
+#include "common/Thread.h"
+#include "common/admin_socket.h"
+#include "common/histogram.h"
 #include "BlockDevice.h"
 
 #include "boost/intrusive/list.hpp"
@@ -35,6 +39,9 @@ enum {
   l_bluefs_files_written_sst,
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
+  l_bluefs_sync_lat,
+  l_bluefs_range_sync_lat,
+  l_bluefs_dir_sync_lat,
   l_bluefs_last,
 };
 
@@ -51,6 +58,14 @@ public:
     WRITER_SST,
   };
 
+  /// sync calls made on behalf of rocksdb, see note_sync_latency()
+  enum {
+    SYNC_FILE,      ///< WritableFile::Sync/Fsync
+    SYNC_RANGE,     ///< WritableFile::RangeSync
+    SYNC_DIR,       ///< Directory::Fsync
+    SYNC_MAX,
+  };
+
   struct File : public RefCountedObject {
     bluefs_fnode_t fnode;
     int refs;
@@ -207,6 +222,44 @@ private:
   bool log_flushing = false;  ///< true while flushing the log
   std::condition_variable log_cond;
 
+  // async log compaction; new_log is set while one is in progress
+  FileRef new_log;
+  FileWriter *new_log_writer = nullptr;
+  uint64_t old_log_jump_to = 0;  ///< old log offset where new entries start
+  uint64_t new_log_jump_to = 0;  ///< same offset in the compacted log
+
+  // parallel bdev flush: the caller flushes the first bdev, and one
+  // thread per additional bdev flushes the others concurrently
+  struct FlushThread : public Thread {
+    BlueFS *fs;
+    unsigned id;
+    FlushThread(BlueFS *f, unsigned i) : fs(f), id(i) {}
+    void *entry() {
+      fs->_flush_thread(id);
+      return NULL;
+    }
+  };
+  vector<FlushThread*> flush_threads;
+  std::mutex flush_round_lock;  ///< one flush_bdev() round at a time
+  std::mutex flush_lock;
+  std::condition_variable flush_cond;
+  uint64_t flush_round = 0;     ///< last round started
+  unsigned flush_pending = 0;   ///< flush threads still busy with it
+  bool flush_stop = false;
+
+  // sync latency, in usec
+  std::mutex sync_lat_lock;
+  pow2_hist_t sync_lat_hist[SYNC_MAX];
+
+  class SyncLatencyHook : public AdminSocketHook {
+    BlueFS *fs;
+  public:
+    explicit SyncLatencyHook(BlueFS *f) : fs(f) {}
+    bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	      bufferlist& out) override;
+  };
+  SyncLatencyHook *sync_lat_hook = nullptr;
+
   /*
    * There are up to 3 block devices:
    *
@@ -239,14 +292,20 @@ private:
   int _fsync(FileWriter *h, std::unique_lock<std::mutex>& l);
 
   int _flush_and_sync_log(std::unique_lock<std::mutex>& l,
-			  uint64_t want_seq = 0);
+			  uint64_t want_seq = 0,
+			  uint64_t jump_to = 0);
   uint64_t _estimate_log_size();
-  void _maybe_compact_log();
-  void _compact_log();
+  void _maybe_compact_log(std::unique_lock<std::mutex>& l);
+  void _compact_log_dump_metadata(bluefs_transaction_t *t);
+  void _compact_log_sync();
+  void _compact_log_async(std::unique_lock<std::mutex>& l);
 
   //void _aio_finish(void *priv);
 
   void flush_bdev();  // this is safe to call without a lock
+  void _start_flush_threads();
+  void _stop_flush_threads();
+  void _flush_thread(unsigned id);
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
   int _truncate(FileWriter *h, uint64_t off);
@@ -341,6 +400,10 @@ public:
   /// compact metadata
   int compact();
 
+  /// record the latency of a SYNC_* call
+  void note_sync_latency(unsigned which, utime_t lat);
+  void dump_sync_latency(Formatter *f);
+
   int add_block_device(unsigned bdev, string path);
   uint64_t get_block_device_size(unsigned bdev);
 
@@ -3,6 +3,7 @@
 
 #include "BlueRocksEnv.h"
 #include "BlueFS.h"
+#include "common/Clock.h"
 #include "include/stringify.h"
 #include "kv/RocksDBStore.h"
 
@@ -217,7 +218,9 @@ class BlueRocksWritableFile : public rocksdb::WritableFile {
   }
 
   rocksdb::Status Sync() { // sync data
+    utime_t start = ceph_clock_now(NULL);
     fs->fsync(h);
+    fs->note_sync_latency(BlueFS::SYNC_FILE, ceph_clock_now(NULL) - start);
     return rocksdb::Status::OK();
   }
 
@@ -268,8 +271,12 @@ class BlueRocksWritableFile : public rocksdb::WritableFile {
     offset -= partial;
     nbytes += partial;
     nbytes &= ~4095;
-    if (nbytes)
+    if (nbytes) {
+      utime_t start = ceph_clock_now(NULL);
       fs->flush_range(h, offset, nbytes);
+      fs->note_sync_latency(BlueFS::SYNC_RANGE,
+			    ceph_clock_now(NULL) - start);
+    }
     return rocksdb::Status::OK();
   }
 
@@ -295,7 +302,9 @@ class BlueRocksDirectory : public rocksdb::Directory {
   // Fsync directory. Can be called concurrently from multiple threads.
   rocksdb::Status Fsync() {
     // it is sufficient to flush the log.
+    utime_t start = ceph_clock_now(NULL);
     fs->sync_metadata();
+    fs->note_sync_latency(BlueFS::SYNC_DIR, ceph_clock_now(NULL) - start);
     return rocksdb::Status::OK();
   }
 };
@@ -24,6 +24,7 @@
 #include "include/compat.h"
 #include "include/intarith.h"
 #include "include/stringify.h"
+#include "common/Cond.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "Allocator.h"
@@ -470,29 +471,48 @@ ostream& operator<<(ostream& out, const BlueStore::Buffer& b)
   out << "buffer(" << &b << " space " << b.space << " 0x" << std::hex
       << b.offset << "~" << b.length << std::dec
       << " " << BlueStore::Buffer::get_state_name(b.state);
-  if (b.flags)
-    out << " " << BlueStore::Buffer::get_flag_name(b.flags);
+  for (unsigned f = 1; f <= b.flags; f <<= 1) {
+    if (b.flags & f)
+      out << " " << BlueStore::Buffer::get_flag_name(f);
+  }
   return out << ")";
 }
 
 
 // Cache
 
-BlueStore::Cache *BlueStore::Cache::create(string type)
+BlueStore::Cache *BlueStore::Cache::create(string type, PerfCounters *logger)
 {
+  Cache *c = nullptr;
   if (type == "lru")
-    return new LRUCache;
-  if (type == "2q")
-    return new TwoQCache;
-  assert(0 == "unrecognized cache type");
+    c = new LRUCache;
+  else if (type == "2q")
+    c = new TwoQCache;
+  else
+    assert(0 == "unrecognized cache type");
+  c->logger = logger;
+  return c;
+}
+
+void BlueStore::Cache::trim_decompressed(uint64_t max)
+{
+  std::lock_guard<std::mutex> l(lock);
+  while (decompressed_bytes > max) {
+    Buffer *b = &*decompressed_lru.rbegin();
+    b->space->_rm_buffer(b);
+  }
 }
 
 // LRUCache
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.LRUCache(" << this << ") "
 
-void BlueStore::LRUCache::_touch_onode(OnodeRef& o)
+void BlueStore::LRUCache::_touch_onode(OnodeRef& o, int level)
 {
+  if (level == 0) {
+    // don't let a scan refresh the onode
+    return;
+  }
   auto p = onode_lru.iterator_to(*o);
   onode_lru.erase(p);
   onode_lru.push_front(*o);
@@ -596,11 +616,100 @@ void BlueStore::LRUCache::_audit(const char *when)
 #define dout_prefix *_dout << "bluestore.2QCache(" << this << ") "
 
 
-void BlueStore::TwoQCache::_touch_onode(OnodeRef& o)
+void BlueStore::TwoQCache::_add_onode(OnodeRef& o, int level)
+{
+  assert(o->cache_private == ONODE_NEW);
+  auto p = onode_ghosts.find(onode_ghost_t(o->space, o->oid));
+  if (p != onode_ghosts.end()) {
+    // we trimmed it from warm_in recently; it is hot.
+    dout(20) << __func__ << " ghost hit, move to hot " << o->oid << dendl;
+    onode_warm_out.erase(p->second);
+    onode_ghosts.erase(p);
+    o->cache_private = ONODE_HOT;
+    onode_hot.push_front(*o);
+    logger->inc(l_bluestore_onode_ghost_hits);
+  } else if (level > 0) {
+    o->cache_private = ONODE_WARM_IN;
+    onode_warm_in.push_front(*o);
+  } else {
+    // take caller hint to start at the back of the warm queue, and do
+    // not remember it when it gets trimmed
+    o->cache_private = ONODE_WARM_IN_SCAN;
+    onode_warm_in.push_back(*o);
+    logger->inc(l_bluestore_onode_cold_inserts);
+  }
+}
+
+void BlueStore::TwoQCache::_touch_onode(OnodeRef& o, int level)
 {
-  auto p = onode_lru.iterator_to(*o);
-  onode_lru.erase(p);
-  onode_lru.push_front(*o);
+  switch (o->cache_private) {
+  case ONODE_WARM_IN:
+    if (level == 0) {
+      // a scan reached it; let it go first
+      onode_warm_in.erase(onode_warm_in.iterator_to(*o));
+      onode_warm_in.push_back(*o);
+      o->cache_private = ONODE_WARM_IN_SCAN;
+      logger->inc(l_bluestore_onode_cold_inserts);
+    }
+    // otherwise do nothing (somewhat counter-intuitively!)
+    break;
+  case ONODE_WARM_IN_SCAN:
+    if (level > 0) {
+      // a real access; remember it if it gets trimmed
+      o->cache_private = ONODE_WARM_IN;
+    }
+    break;
+  case ONODE_HOT:
+    if (level > 0) {
+      onode_hot.erase(onode_hot.iterator_to(*o));
+      onode_hot.push_front(*o);
+    }
+    break;
+  default:
+    assert(0 == "bad cache_private");
+  }
+}
+
+void BlueStore::TwoQCache::_clear_space(OnodeSpace *space)
+{
+  auto p = onode_warm_out.begin();
+  while (p != onode_warm_out.end()) {
+    if (p->first == space) {
+      onode_ghosts.erase(*p);
+      p = onode_warm_out.erase(p);
+    } else {
+      ++p;
+    }
+  }
+}
+
+int BlueStore::TwoQCache::_trim_onode_list(onode_list_t& l, int num,
+					   bool ghost)
+{
+  int trimmed = 0;
+  while (num > 0 && !l.empty()) {
+    Onode *o = &*l.rbegin();
+    int refs = o->nref.load();
+    if (refs > 1) {
+      dout(20) << __func__ << "  " << o->oid << " has " << refs
+	       << " refs; stopping with " << num << " left to trim" << dendl;
+      break;
+    }
+    dout(30) << __func__ << "  trim " << o->oid << dendl;
+    if (ghost && o->cache_private == ONODE_WARM_IN) {
+      onode_warm_out.push_front(onode_ghost_t(o->space, o->oid));
+      onode_ghosts[onode_warm_out.front()] = onode_warm_out.begin();
+    }
+    l.erase(l.iterator_to(*o));
+    o->cache_private = ONODE_NEW;
+    o->get();  // paranoia
+    o->space->onode_map.erase(o->oid);
+    o->blob_map._clear();    // clear blobs and their buffers, too
+    o->put();
+    --num;
+    ++trimmed;
+  }
+  return trimmed;
 }
 
 void BlueStore::TwoQCache::_add_buffer(Buffer *b, int level, Buffer *near)
@@ -696,7 +805,8 @@ void BlueStore::TwoQCache::trim(uint64_t onode_max, uint64_t buffer_max)
 {
   std::lock_guard<std::mutex> l(lock);
 
-  dout(20) << __func__ << " onodes " << onode_lru.size() << " / " << onode_max
+  dout(20) << __func__ << " onodes " << onode_hot.size() << " hot + "
+	   << onode_warm_in.size() << " warm / " << onode_max
 	   << " buffers " << buffer_bytes << " / " << buffer_max
 	   << dendl;
 
@@ -794,33 +904,36 @@ void BlueStore::TwoQCache::trim(uint64_t onode_max, uint64_t buffer_max)
   }
 
   // onodes
-  int num = onode_lru.size() - onode_max;
-  if (num <= 0)
-    return; // don't even try
-
-  auto p = onode_lru.end();
-  assert(p != onode_lru.begin());
-  --p;
-  while (num > 0) {
-    Onode *o = &*p;
-    int refs = o->nref.load();
-    if (refs > 1) {
-      dout(20) << __func__ << "  " << o->oid << " has " << refs
-	       << " refs; stopping with " << num << " left to trim" << dendl;
-      break;
+  int num = onode_hot.size() + onode_warm_in.size() - onode_max;
+  if (num > 0) {
+    // warm_in gives up what it has over kin and hot the rest.  what
+    // warm_in cannot give up now (its tail is in use) waits for the
+    // next trim rather than coming out of hot; what hot cannot give
+    // up comes out of warm_in.
+    int kin = onode_max * g_conf->bluestore_2q_onode_kin_ratio;
+    int warm = MAX(0, MIN(num, (int)onode_warm_in.size() - kin));
+    int hot = num - warm;
+    int trimmed = 0;
+    if (warm > 0) {
+      trimmed = _trim_onode_list(onode_warm_in, warm, true);
+      logger->inc(l_bluestore_onode_warm_trims, trimmed);
     }
-    dout(30) << __func__ << "  trim " << o->oid << dendl;
-    if (p != onode_lru.begin()) {
-      onode_lru.erase(p--);
-    } else {
-      onode_lru.erase(p);
-      assert(num == 1);
+    if (hot > 0) {
+      trimmed = _trim_onode_list(onode_hot, hot, false);
+      logger->inc(l_bluestore_onode_hot_trims, trimmed);
+      hot -= trimmed;
     }
-    o->get();  // paranoia
-    o->space->onode_map.erase(o->oid);
-    o->blob_map._clear();    // clear blobs and their buffers, too
-    o->put();
-    --num;
+    if (hot > 0) {
+      trimmed = _trim_onode_list(onode_warm_in, hot, true);
+      logger->inc(l_bluestore_onode_warm_trims, trimmed);
+    }
+  }
+
+  // and the ghosts
+  uint64_t kout = onode_max * g_conf->bluestore_2q_onode_kout_ratio;
+  while (onode_warm_out.size() > kout) {
+    onode_ghosts.erase(onode_warm_out.back());
+    onode_warm_out.pop_back();
   }
 }
 
@@ -870,13 +983,15 @@ void BlueStore::TwoQCache::_audit(const char *when)
     uint64_t lc = 0, oc = 0;
     set<OnodeSpace*> spaces;
 
-    for (auto i = onode_lru.begin(); i != onode_lru.end(); ++i) {
-      assert(i->space->onode_map.count(i->oid));
-      if (spaces.count(i->space) == 0) {
-	spaces.insert(i->space);
-	oc += i->space->onode_map.size();
+    for (auto l : { &onode_hot, &onode_warm_in }) {
+      for (auto i = l->begin(); i != l->end(); ++i) {
+	assert(i->space->onode_map.count(i->oid));
+	if (spaces.count(i->space) == 0) {
+	  spaces.insert(i->space);
+	  oc += i->space->onode_map.size();
+	}
+	++lc;
       }
-      ++lc;
     }
 
     if (lc != oc) {
@@ -925,11 +1040,15 @@ int BlueStore::BufferSpace::_discard(uint64_t offset, uint64_t length)
 	if (b->data.length()) {
 	  bufferlist bl;
 	  bl.substr_of(b->data, b->length - tail, tail);
-	  _add_buffer(new Buffer(this, b->state, b->seq, end, bl), 0, b);
+	  _add_buffer(new Buffer(this, b->state, b->seq, end, bl,
+				 b->flags & Buffer::FLAG_DECOMPRESSED), 0, b);
 	} else {
-	  _add_buffer(new Buffer(this, b->state, b->seq, end, tail), 0, b);
+	  _add_buffer(new Buffer(this, b->state, b->seq, end, tail,
+				 b->flags & Buffer::FLAG_DECOMPRESSED), 0, b);
 	}
-	if (!b->is_writing()) {
+	if (b->is_decompressed()) {
+	  cache->_adjust_decompressed_size(front - (int64_t)b->length);
+	} else if (!b->is_writing()) {
 	  cache->_adjust_buffer_size(b, front - (int64_t)b->length);
 	}
 	b->truncate(front);
@@ -937,7 +1056,9 @@ int BlueStore::BufferSpace::_discard(uint64_t offset, uint64_t length)
 	break;
       } else {
 	// drop tail
-	if (!b->is_writing()) {
+	if (b->is_decompressed()) {
+	  cache->_adjust_decompressed_size(front - (int64_t)b->length);
+	} else if (!b->is_writing()) {
 	  cache->_adjust_buffer_size(b, front - (int64_t)b->length);
 	}
 	b->truncate(front);
@@ -955,9 +1076,11 @@ int BlueStore::BufferSpace::_discard(uint64_t offset, uint64_t length)
     if (b->data.length()) {
       bufferlist bl;
       bl.substr_of(b->data, b->length - keep, keep);
-      _add_buffer(new Buffer(this, b->state, b->seq, end, bl), 0, b);
+      _add_buffer(new Buffer(this, b->state, b->seq, end, bl,
+			     b->flags & Buffer::FLAG_DECOMPRESSED), 0, b);
     } else {
-      _add_buffer(new Buffer(this, b->state, b->seq, end, keep), 0, b);
+      _add_buffer(new Buffer(this, b->state, b->seq, end, keep,
+			     b->flags & Buffer::FLAG_DECOMPRESSED), 0, b);
     }
     _rm_buffer(i);
     cache->_audit("discard end 2");
@@ -987,7 +1110,9 @@ void BlueStore::BufferSpace::read(
 	res_intervals.insert(offset, l);
 	offset += l;
 	length -= l;
-	if (!b->is_writing()) {
+	if (b->is_decompressed()) {
+	  cache->_touch_decompressed(b);
+	} else if (!b->is_writing()) {
 	  cache->_touch_buffer(b);
 	}
 	continue;
@@ -1000,7 +1125,9 @@ void BlueStore::BufferSpace::read(
 	offset += gap;
 	length -= gap;
       }
-      if (!b->is_writing()) {
+      if (b->is_decompressed()) {
+	cache->_touch_decompressed(b);
+      } else if (!b->is_writing()) {
 	cache->_touch_buffer(b);
       }
       if (b->length > length) {
@@ -1056,16 +1183,18 @@ void BlueStore::BufferSpace::finish_write(uint64_t seq)
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.OnodeSpace(" << this << " in " << cache << ") "
 
-void BlueStore::OnodeSpace::add(const ghobject_t& oid, OnodeRef o)
+void BlueStore::OnodeSpace::add(const ghobject_t& oid, OnodeRef o,
+				  int level)
 {
   std::lock_guard<std::mutex> l(cache->lock);
   dout(30) << __func__ << " " << oid << " " << o << dendl;
   assert(onode_map.count(oid) == 0);
   onode_map[oid] = o;
-  cache->_add_onode(o, 1);
+  cache->_add_onode(o, level);
 }
 
-BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
+BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid,
+						   int level)
 {
   std::lock_guard<std::mutex> l(cache->lock);
   dout(30) << __func__ << dendl;
@@ -1075,7 +1204,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
     return OnodeRef();
   }
   dout(30) << __func__ << " " << oid << " hit " << p->second << dendl;
-  cache->_touch_onode(p->second);
+  cache->_touch_onode(p->second, level);
   return p->second;
 }
 
@@ -1090,6 +1219,7 @@ void BlueStore::OnodeSpace::clear()
     p.second->blob_map._clear();
   }
   onode_map.clear();
+  cache->_clear_space(this);
 }
 
 void BlueStore::OnodeSpace::rename(OnodeRef& oldo,
@@ -1118,7 +1248,7 @@ void BlueStore::OnodeSpace::rename(OnodeRef& oldo,
 
   // add at new position and fix oid, key
   onode_map.insert(make_pair(new_oid, o));
-  cache->_touch_onode(o);
+  cache->_touch_onode(o, 1);
   o->oid = new_oid;
   get_object_key(new_oid, &o->key);
 }
@@ -1246,6 +1376,13 @@ void BlueStore::Onode::flush()
   dout(20) << __func__ << " done" << dendl;
 }
 
+void BlueStore::Onode::wait_defrag()
+{
+  std::unique_lock<std::mutex> l(flush_lock);
+  while (defrag_pending)
+    flush_cond.wait(l);
+}
+
 
 
 // =======================================================
@@ -1304,7 +1441,8 @@ BlueStore::BnodeRef BlueStore::Collection::get_bnode(
 
 BlueStore::OnodeRef BlueStore::Collection::get_onode(
   const ghobject_t& oid,
-  bool create)
+  bool create,
+  int level)
 {
   assert(create ? lock.is_wlocked() : lock.is_locked());
 
@@ -1317,9 +1455,12 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
     }
   }
 
-  OnodeRef o = onode_map.lookup(oid);
-  if (o)
+  OnodeRef o = onode_map.lookup(oid, level);
+  if (o) {
+    ++store->onode_hits;
+    store->logger->inc(l_bluestore_onode_hits);
     return o;
+  }
 
   string key;
   get_object_key(oid, &key);
@@ -1328,7 +1469,11 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
 	   << pretty_binary_string(key) << dendl;
 
   bufferlist v;
+  ceph::mono_time start = ceph::mono_clock::now();
   int r = store->db->get(PREFIX_OBJ, key, &v);
+  store->onode_miss_ns += (ceph::mono_clock::now() - start).count();
+  ++store->onode_misses;
+  store->logger->inc(l_bluestore_onode_misses);
   dout(20) << " r " << r << " v.len " << v.length() << dendl;
   Onode *on;
   if (v.length() == 0) {
@@ -1349,7 +1494,7 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
     on->blob_map.decode(p, cache);
   }
   o.reset(on);
-  onode_map.add(oid, o);
+  onode_map.add(oid, o, level);
   return o;
 }
 
@@ -1404,12 +1549,19 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
     kv_sync_thread(this),
     kv_stop(false),
     logger(NULL),
+    cache_tune_thread(this),
+    defrag_thread(this),
     csum_type(bluestore_blob_t::CSUM_CRC32C),
     sync_wal_apply(cct->_conf->bluestore_sync_wal_apply)
 {
   _init_logger();
   g_ceph_context->_conf->add_observer(this);
   set_cache_shards(1);
+
+  // set from the config at mount, if autotune is on
+  cache_ratio[CACHE_ONODE] = 0;
+  cache_ratio[CACHE_KV] = 0;
+  cache_ratio[CACHE_BUFFER] = 1.0;
 }
 
 BlueStore::~BlueStore()
@@ -1436,6 +1588,9 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_compression_algorithm",
     "bluestore_compression_min_blob_size",
     "bluestore_compression_max_blob_size",
+    "bluestore_cache_size",
+    "bluestore_cache_autotune_onode_ratio",
+    "bluestore_cache_autotune_kv_ratio",
     NULL
   };
   return KEYS;
@@ -1454,6 +1609,17 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
       changed.count("bluestore_compression_max_blob_size")) {
     _set_compression();
   }
+  if (changed.count("bluestore_cache_size") ||
+      changed.count("bluestore_cache_autotune_onode_ratio") ||
+      changed.count("bluestore_cache_autotune_kv_ratio")) {
+    // picked up by _cache_tune_thread, if autotune is running
+    std::lock_guard<std::mutex> l(cache_tune_lock);
+    cache_tune_resize = true;
+    if (changed.count("bluestore_cache_autotune_onode_ratio") ||
+	changed.count("bluestore_cache_autotune_kv_ratio"))
+      cache_tune_reset = true;
+    cache_tune_cond.notify_all();
+  }
 }
 
 void BlueStore::_set_compression()
@@ -1544,6 +1710,31 @@ void BlueStore::_init_logger()
   b.add_u64(l_bluestore_wal_write_ops, "wal_write_ops", "Sum for wal write op");
   b.add_u64(l_bluestore_wal_write_bytes, "wal_write_bytes", "Sum for wal write bytes");
   b.add_u64(l_bluestore_write_penalty_read_ops, " write_penalty_read_ops", "Sum for write penalty read ops");
+  b.add_u64_counter(l_bluestore_onode_hits, "onode_hits", "Onode cache hits");
+  b.add_u64_counter(l_bluestore_onode_misses, "onode_misses", "Onode cache misses");
+  b.add_u64_counter(l_bluestore_buffer_hit_bytes, "buffer_hit_bytes", "Bytes read from the buffer cache");
+  b.add_u64_counter(l_bluestore_buffer_miss_bytes, "buffer_miss_bytes", "Bytes read that missed the buffer cache");
+  b.add_u64(l_bluestore_cache_onode_bytes, "cache_onode_bytes", "Memory target for onode cache (autotune)");
+  b.add_u64(l_bluestore_cache_buffer_bytes, "cache_buffer_bytes", "Memory target for buffer cache (autotune)");
+  b.add_u64(l_bluestore_cache_kv_bytes, "cache_kv_bytes", "Memory target for kv block cache (autotune)");
+  b.add_u64(l_bluestore_cache_onode_hit_pct, "cache_onode_hit_pct", "Onode cache hit percentage over last autotune interval");
+  b.add_u64(l_bluestore_cache_buffer_hit_pct, "cache_buffer_hit_pct", "Buffer cache hit percentage over last autotune interval");
+  b.add_u64(l_bluestore_cache_kv_hit_pct, "cache_kv_hit_pct", "KV block cache hit percentage over last autotune interval");
+  b.add_u64_counter(l_bluestore_onode_ghost_hits, "onode_ghost_hits", "Onodes reloaded soon after trim and made hot (2q)");
+  b.add_u64_counter(l_bluestore_onode_cold_inserts, "onode_cold_inserts", "Onodes inserted or demoted at the cold end by scans");
+  b.add_u64_counter(l_bluestore_onode_warm_trims, "onode_warm_trims", "Onodes trimmed from the warm list (2q)");
+  b.add_u64_counter(l_bluestore_onode_hot_trims, "onode_hot_trims", "Onodes trimmed from the hot list (2q)");
+  b.add_u64_counter(l_bluestore_wal_elevator_batches, "wal_elevator_batches", "Batches of wal writes submitted by the elevator");
+  b.add_u64_counter(l_bluestore_wal_elevator_extents, "wal_elevator_extents", "Wal extents fed to the elevator");
+  b.add_u64_counter(l_bluestore_wal_elevator_ios, "wal_elevator_ios", "Writes submitted by the elevator after merging");
+  b.add_u64(l_bluestore_wal_elevator_merge_pct, "wal_elevator_merge_pct", "Percentage of wal extents merged into other writes");
+  b.add_u64_counter(l_bluestore_wal_elevator_seek_saved, "wal_elevator_seek_saved", "Seek distance in bytes saved by sorting wal writes");
+  b.add_u64_counter(l_bluestore_defrag_objects, "defrag_objects", "Objects rewritten by background defrag");
+  b.add_u64_counter(l_bluestore_defrag_bytes, "defrag_bytes", "Bytes rewritten by background defrag");
+  b.add_u64(l_bluestore_frag_score, "frag_score", "Mean object fragmentation score of the last defrag scan, in 1/1000");
+  b.add_u64_counter(l_bluestore_decompressed_bytes, "decompressed_bytes", "Bytes produced by decompressing blobs on read");
+  b.add_u64_counter(l_bluestore_decompress_saved_bytes, "decompress_saved_bytes", "Bytes of compressed blobs read from cache instead of decompressed");
+  b.add_u64(l_bluestore_decompressed_cache_bytes, "decompressed_cache_bytes", "Bytes of decompressed blob data cached");
   logger = b.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -2208,8 +2399,15 @@ int BlueStore::_open_db(bool create)
   FreelistManager::setup_merge_operators(db);
   db->set_merge_operator(PREFIX_STAT, merge_op);
 
-  if (kv_backend == "rocksdb")
+  if (kv_backend == "rocksdb") {
     options = g_conf->bluestore_rocksdb_options;
+    if (g_conf->bluestore_cache_autotune) {
+      // the cache tuner needs block cache hit stats
+      if (!options.empty())
+	options += ",";
+      options += "cache_stats=true";
+    }
+  }
   db->init(options);
   if (create)
     r = db->create_and_open(err);
@@ -2704,7 +2902,7 @@ void BlueStore::set_cache_shards(unsigned num)
   assert(num >= old);
   cache_shards.resize(num);
   for (unsigned i = old; i < num; ++i) {
-    cache_shards[i] = Cache::create(g_conf->bluestore_cache_type);
+    cache_shards[i] = Cache::create(g_conf->bluestore_cache_type, logger);
   }
 }
 
@@ -2727,6 +2925,13 @@ int BlueStore::mount()
     }
   }
 
+  cache_autotune = g_conf->bluestore_cache_autotune;
+  if (cache_autotune) {
+    int r = _set_cache_ratios();
+    if (r < 0)
+      return r;
+  }
+
   if (g_conf->bluestore_fsck_on_mount) {
     int rc = fsck();
     if (rc < 0)
@@ -2784,7 +2989,11 @@ int BlueStore::mount()
 
   finisher.start();
   wal_tp.start();
-  kv_sync_thread.create("bstore_kv_sync");
+  _kv_start();
+  if (cache_autotune) {
+    _cache_tune_apply();
+    cache_tune_thread.create("bstore_cache_tune");
+  }
 
   r = _wal_replay();
   if (r < 0)
@@ -2793,10 +3002,22 @@ int BlueStore::mount()
   _set_csum();
   _set_compression();
 
+  defrag_osr = new OpSequencer;
+  defrag_thread.create("bstore_defrag");
+  frag_hook = new FragmentationHook(this);
+  r = cct->get_admin_socket()->register_command(
+    "bluestore fragmentation", "bluestore fragmentation", frag_hook,
+    "show free space and object extent fragmentation");
+  if (r < 0 && r != -EEXIST) {
+    derr << __func__ << " error registering admin socket command: "
+	 << cpp_strerror(r) << dendl;
+  }
+
   mounted = true;
   return 0;
 
  out_stop:
+  _cache_tune_stop();
   _kv_stop();
   wal_wq.drain();
   wal_tp.stop();
@@ -2824,10 +3045,20 @@ int BlueStore::umount()
   assert(mounted);
   dout(1) << __func__ << dendl;
 
+  cct->get_admin_socket()->unregister_command("bluestore fragmentation");
+  delete frag_hook;
+  frag_hook = nullptr;
+  dout(20) << __func__ << " stopping defrag thread" << dendl;
+  _defrag_stop();
+  defrag_osr->flush();
+  defrag_osr.reset();
+
   _sync();
   _reap_collections();
   coll_map.clear();
 
+  dout(20) << __func__ << " stopping cache tune thread" << dendl;
+  _cache_tune_stop();
   dout(20) << __func__ << " stopping kv thread" << dendl;
   _kv_stop();
   dout(20) << __func__ << " draining wal_wq" << dendl;
@@ -3324,6 +3555,15 @@ void BlueStore::_sync()
   // flush aios in flight
   bdev->flush();
 
+  for (auto lane : kv_lanes) {
+    std::unique_lock<std::mutex> l(lane->lock);
+    while (!lane->committing.empty() ||
+	   !lane->queue.empty()) {
+      dout(20) << " waiting for kv lane " << lane->id << " to commit" << dendl;
+      lane->sync_cond.wait(l);
+    }
+  }
+
   std::unique_lock<std::mutex> l(kv_lock);
   while (!kv_committing.empty() ||
 	 !kv_queue.empty()) {
@@ -3458,9 +3698,7 @@ bool BlueStore::exists(CollectionHandle &c_, const ghobject_t& oid)
       r = false;
   }
 
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
 
   return r;
 }
@@ -3499,9 +3737,7 @@ int BlueStore::stat(
     st->st_nlink = 1;
   }
 
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   return 0;
 }
 
@@ -3542,7 +3778,10 @@ int BlueStore::read(
   {
     RWLock::RLocker l(c->lock);
 
-    OnodeRef o = c->get_onode(oid, false);
+    // scrub and recovery reads should not push hot onodes out
+    int level = (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+			     CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) ? 0 : 1;
+    OnodeRef o = c->get_onode(oid, false, level);
     if (!o || !o->exists) {
       r = -ENOENT;
       goto out;
@@ -3555,9 +3794,7 @@ int BlueStore::read(
   }
 
  out:
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   dout(10) << __func__ << " " << cid << " " << oid
 	   << " 0x" << std::hex << offset << "~" << length << std::dec
 	   << " = " << r << dendl;
@@ -3635,8 +3872,15 @@ int BlueStore::_do_read(
 
   ready_regions_t ready_regions;
 
+  // decompressed blobs go to their own cache, unless the client says
+  // the data won't be needed again
+  bool cache_decompressed = g_conf->bluestore_decompressed_cache_size &&
+    (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		 CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0;
+
   // build blob-wise list to of stuff read (that isn't cached)
   blobs2read_t blobs2read;
+  uint64_t buffer_hits = 0, buffer_misses = 0, decompress_saved = 0;
   unsigned left = length;
   uint64_t pos = offset;
   auto lp = o->onode.seek_lextent(offset);
@@ -3677,6 +3921,9 @@ int BlueStore::_do_read(
 	ready_regions[pos].claim(pc->second);
 	dout(30) << __func__ << "    use cache 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
+	buffer_hits += l;
+	if (bptr->blob.is_compressed())
+	  decompress_saved += l;
 	++pc;
       } else {
 	l = b_len;
@@ -3687,6 +3934,7 @@ int BlueStore::_do_read(
 	dout(30) << __func__ << "    will read 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
 	blobs2read[bptr].emplace_back(region_t(pos, b_off, l));
+	buffer_misses += l;
       }
       pos += l;
       b_off += l;
@@ -3696,7 +3944,15 @@ int BlueStore::_do_read(
     ++lp;
   }
 
+  buffer_hit_bytes += buffer_hits;
+  buffer_miss_bytes += buffer_misses;
+  logger->inc(l_bluestore_buffer_hit_bytes, buffer_hits);
+  logger->inc(l_bluestore_buffer_miss_bytes, buffer_misses);
+  if (decompress_saved)
+    logger->inc(l_bluestore_decompress_saved_bytes, decompress_saved);
+
   //enumerate and read/decompress desired blobs
+  ceph::mono_time read_start = ceph::mono_clock::now();
   blobs2read_t::iterator b2r_it = blobs2read.begin();
   while (b2r_it != blobs2read.end()) {
     BlobRef bptr = b2r_it->first;
@@ -3719,7 +3975,10 @@ int BlueStore::_do_read(
       r = _decompress(compressed_bl, &raw_bl);
       if (r < 0)
 	return r;
-      if (buffered) {
+      logger->inc(l_bluestore_decompressed_bytes, raw_bl.length());
+      if (cache_decompressed) {
+	bptr->bc.did_decompress(raw_bl);
+      } else if (buffered) {
 	bptr->bc.did_read(0, raw_bl);
       }
       for (auto& i : b2r_it->second) {
@@ -3770,6 +4029,9 @@ int BlueStore::_do_read(
     }
     ++b2r_it;
   }
+  if (!blobs2read.empty()) {
+    buffer_miss_ns += (ceph::mono_clock::now() - read_start).count();
+  }
 
   // generate a resulting buffer
   auto pr = ready_regions.begin();
@@ -3935,9 +4197,7 @@ int BlueStore::fiemap(
   }
 
  out:
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   ::encode(m, bl);
   dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
 	   << " size = 0 (" << m << ")" << std::dec << dendl;
@@ -3986,9 +4246,7 @@ int BlueStore::getattr(
     r = 0;
   }
  out:
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   dout(10) << __func__ << " " << c->cid << " " << oid << " " << name
 	   << " = " << r << dendl;
   return r;
@@ -4030,9 +4288,7 @@ int BlueStore::getattrs(
   }
 
  out:
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   dout(10) << __func__ << " " << c->cid << " " << oid
 	   << " = " << r << dendl;
   return r;
@@ -4209,9 +4465,7 @@ int BlueStore::collection_list(
   }
 
  out:
-  c->cache->trim(
-    g_conf->bluestore_onode_cache_size,
-    g_conf->bluestore_buffer_cache_size);
+  _trim_cache(c->cache);
   dout(10) << __func__ << " " << c->cid
 	   << " start " << start << " end " << end << " max " << max
 	   << " = " << r << ", ls.size() = " << ls->size()
@@ -4735,20 +4989,14 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       txc->blobs.clear();
       if (!g_conf->bluestore_sync_transaction) {
 	if (g_conf->bluestore_sync_submit_transaction) {
-	  _txc_finalize_kv(txc, txc->t);
-	  int r = db->submit_transaction(txc->t);
-	  assert(r == 0);
+	  _txc_kv_submit(txc);
 	}
       } else {
 	_txc_finalize_kv(txc, txc->t);
 	int r = db->submit_transaction_sync(txc->t);
 	assert(r == 0);
       }
-      {
-	std::lock_guard<std::mutex> l(kv_lock);
-	kv_queue.push_back(txc);
-	kv_cond.notify_one();
-      }
+      _txc_kv_queue(txc);
       return;
     case TransContext::STATE_KV_QUEUED:
       txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
@@ -4760,7 +5008,9 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       txc->log_state_latency(logger, l_bluestore_state_kv_done_lat);
       if (txc->wal_txn) {
 	txc->state = TransContext::STATE_WAL_QUEUED;
-	if (sync_wal_apply) {
+	if (g_conf->bluestore_wal_elevator) {
+	  _wal_elevator_queue(txc);
+	} else if (sync_wal_apply) {
 	  _wal_apply(txc);
 	} else {
 	  wal_wq.queue(txc);
@@ -4781,7 +5031,16 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 
     case TransContext::STATE_WAL_AIO_WAIT:
       txc->log_state_latency(logger, l_bluestore_state_wal_aio_wait_lat);
-      _wal_finish(txc);
+      {
+	// txc may be gone once it is queued for cleanup
+	list<TransContext*> batch;
+	batch.swap(txc->wal_batch);
+	_wal_finish(txc);
+	for (auto f : batch) {
+	  f->log_state_latency(logger, l_bluestore_state_wal_aio_wait_lat);
+	  _wal_finish(f);
+	}
+      }
       return;
 
     case TransContext::STATE_WAL_CLEANUP:
@@ -4966,9 +5225,7 @@ void BlueStore::_osr_reap_done(OpSequencer *osr)
   }
 
   if (c) {
-    c->cache->trim(
-      g_conf->bluestore_onode_cache_size,
-      g_conf->bluestore_buffer_cache_size);
+    _trim_cache(c->cache);
   }
 }
 
@@ -5022,6 +5279,8 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 	 ++p) {
       alloc->release(p.get_start(), p.get_len());
     }
+    if (!txc->released.empty())
+      kv_release_pending = true;
   }
 
   txc->allocated.clear();
@@ -5029,6 +5288,487 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
   _txc_update_store_statfs(txc);
 }
 
+int BlueStore::_set_cache_ratios()
+{
+  double onode = g_conf->bluestore_cache_autotune_onode_ratio;
+  double kv = g_conf->bluestore_cache_autotune_kv_ratio;
+  if (onode < 0 || kv < 0 || onode + kv > 1.0) {
+    derr << __func__ << " bluestore_cache_autotune_onode_ratio " << onode
+	 << " and bluestore_cache_autotune_kv_ratio " << kv
+	 << " must be >= 0 and sum to at most 1.0" << dendl;
+    return -EINVAL;
+  }
+  cache_ratio[CACHE_ONODE] = onode;
+  cache_ratio[CACHE_KV] = kv;
+  cache_ratio[CACHE_BUFFER] = 1.0 - onode - kv;
+  return 0;
+}
+
+void BlueStore::_cache_tune_apply()
+{
+  uint64_t total = g_conf->bluestore_cache_size;
+  uint64_t shards = MAX(1, cache_shards.size());
+  uint64_t onode_bytes = total * cache_ratio[CACHE_ONODE];
+  uint64_t buffer_bytes = total * cache_ratio[CACHE_BUFFER];
+  uint64_t kv_bytes = total * cache_ratio[CACHE_KV];
+
+  cache_onode_max = MAX(1, onode_bytes /
+			MAX(1, g_conf->bluestore_cache_autotune_onode_bytes) /
+			shards);
+  cache_buffer_max = buffer_bytes / shards;
+  if (cache_autotune && db) {
+    int r = db->set_cache_size(kv_bytes);
+    if (r < 0) {
+      dout(20) << __func__ << " kv cache is not resizable: "
+	       << cpp_strerror(r) << dendl;
+      kv_bytes = 0;
+    }
+  }
+  logger->set(l_bluestore_cache_onode_bytes, onode_bytes);
+  logger->set(l_bluestore_cache_buffer_bytes, buffer_bytes);
+  logger->set(l_bluestore_cache_kv_bytes, kv_bytes);
+  dout(10) << __func__ << " onode " << onode_bytes
+	   << " (" << cache_onode_max << " per shard)"
+	   << " buffer " << buffer_bytes
+	   << " (" << cache_buffer_max << " per shard)"
+	   << " kv " << kv_bytes << dendl;
+}
+
+/*
+ * Periodically move memory between the onode, buffer and kv caches.
+ *
+ * Each cache is charged with the time spent servicing its misses over the
+ * last interval, divided by its current share; memory moves from the cache
+ * with the lowest cost density to the one with the highest.  The kv cache
+ * only takes part if the kv backend reports block cache hit stats, in which
+ * case each miss is charged like a device read of one block.
+ */
+void BlueStore::_cache_tune_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  uint64_t last_onode_hits = onode_hits, last_onode_misses = onode_misses;
+  uint64_t last_onode_miss_ns = onode_miss_ns;
+  uint64_t last_buffer_hit_bytes = buffer_hit_bytes;
+  uint64_t last_buffer_miss_bytes = buffer_miss_bytes;
+  uint64_t last_buffer_miss_ns = buffer_miss_ns;
+  uint64_t last_kv_hits = 0, last_kv_misses = 0;
+  db->get_cache_hit_stats(&last_kv_hits, &last_kv_misses);
+
+  std::unique_lock<std::mutex> l(cache_tune_lock);
+  while (!cache_tune_stop) {
+    double interval = MAX(.01, g_conf->bluestore_cache_autotune_interval);
+    cache_tune_cond.wait_for(
+      l, std::chrono::microseconds((uint64_t)(interval * 1000000.0)));
+    if (cache_tune_stop)
+      break;
+    if (cache_tune_resize) {
+      // new ratios restart the tuning from there
+      if (cache_tune_reset)
+	_set_cache_ratios();
+      cache_tune_resize = cache_tune_reset = false;
+      _cache_tune_apply();
+      continue;
+    }
+
+    uint64_t oh = onode_hits - last_onode_hits;
+    uint64_t om = onode_misses - last_onode_misses;
+    uint64_t ons = onode_miss_ns - last_onode_miss_ns;
+    uint64_t bh = buffer_hit_bytes - last_buffer_hit_bytes;
+    uint64_t bm = buffer_miss_bytes - last_buffer_miss_bytes;
+    uint64_t bns = buffer_miss_ns - last_buffer_miss_ns;
+    last_onode_hits += oh;
+    last_onode_misses += om;
+    last_onode_miss_ns += ons;
+    last_buffer_hit_bytes += bh;
+    last_buffer_miss_bytes += bm;
+    last_buffer_miss_ns += bns;
+
+    uint64_t kh = 0, km = 0;
+    bool have_kv_stats = false;
+    uint64_t kv_hits, kv_misses;
+    if (db->get_cache_hit_stats(&kv_hits, &kv_misses) == 0) {
+      have_kv_stats = true;
+      kh = kv_hits - last_kv_hits;
+      km = kv_misses - last_kv_misses;
+      last_kv_hits = kv_hits;
+      last_kv_misses = kv_misses;
+    }
+
+    if (oh + om)
+      logger->set(l_bluestore_cache_onode_hit_pct, oh * 100 / (oh + om));
+    if (bh + bm)
+      logger->set(l_bluestore_cache_buffer_hit_pct, bh * 100 / (bh + bm));
+    if (kh + km)
+      logger->set(l_bluestore_cache_kv_hit_pct, kh * 100 / (kh + km));
+
+    double cost[CACHE_MAX];
+    cost[CACHE_ONODE] = ons;
+    cost[CACHE_BUFFER] = bns;
+    cost[CACHE_KV] = 0;
+    if (have_kv_stats && bm) {
+      cost[CACHE_KV] = (double)km * g_conf->rocksdb_block_size * bns / bm;
+    }
+    dout(20) << __func__ << " onode " << oh << "/" << om << " " << ons << "ns"
+	     << " buffer " << bh << "/" << bm << " " << bns << "ns"
+	     << " kv " << kh << "/" << km << dendl;
+
+    int lo = -1, hi = -1;
+    double lo_density = 0, hi_density = 0;
+    for (int i = 0; i < CACHE_MAX; ++i) {
+      if (i == CACHE_KV && !have_kv_stats)
+	continue;
+      double density = cost[i] / MAX(cache_ratio[i], .001);
+      if (lo < 0 || density < lo_density) {
+	lo = i;
+	lo_density = density;
+      }
+      if (hi < 0 || density > hi_density) {
+	hi = i;
+	hi_density = density;
+      }
+    }
+    // leave some hysteresis so that we don't flap between two caches
+    if (lo < 0 || lo == hi || hi_density <= lo_density * 1.25)
+      continue;
+    double step = MIN(g_conf->bluestore_cache_autotune_step_ratio,
+		      cache_ratio[lo] -
+		      g_conf->bluestore_cache_autotune_min_ratio);
+    if (step <= 0)
+      continue;
+    cache_ratio[lo] -= step;
+    cache_ratio[hi] += step;
+    dout(10) << __func__ << " moved " << step << " from " << lo << " to " << hi
+	     << ", ratios onode " << cache_ratio[CACHE_ONODE]
+	     << " buffer " << cache_ratio[CACHE_BUFFER]
+	     << " kv " << cache_ratio[CACHE_KV] << dendl;
+    _cache_tune_apply();
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+// ---------------
+// fragmentation
+
+void BlueStore::frag_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("objects", objects);
+  f->dump_unsigned("fragmented", fragmented);
+  f->dump_unsigned("rewritten", rewritten);
+  f->dump_float("score", objects ? score_sum / objects : 0);
+  f->dump_stream("stamp") << stamp;
+}
+
+bool BlueStore::FragmentationHook::call(std::string command, cmdmap_t& cmdmap,
+					std::string format, bufferlist& out)
+{
+  Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+  store->dump_fragmentation(f);
+  f->flush(out);
+  delete f;
+  return true;
+}
+
+void BlueStore::dump_fragmentation(Formatter *f)
+{
+  f->open_object_section("fragmentation");
+
+  f->open_object_section("allocator");
+  f->dump_unsigned("free", alloc->get_free());
+  f->dump_unsigned("alloc_unit", min_alloc_size);
+  f->dump_float("score", alloc->get_fragmentation(min_alloc_size));
+  f->close_section();
+
+  // only score what is already cached; a full scan is the defrag
+  // thread's job
+  frag_stats_t cached;
+  {
+    RWLock::RLocker l(coll_lock);
+    for (auto& p : coll_map) {
+      CollectionRef c = p.second;
+      RWLock::RLocker cl(c->lock);
+      vector<OnodeRef> onodes;
+      c->onode_map.map_any([&](OnodeRef o) {
+	  if (o->exists)
+	    onodes.push_back(o);
+	  return false;
+	});
+      for (auto& o : onodes) {
+	bool shared;
+	cached.add(_onode_fragmentation(c, o, &shared),
+		   g_conf->bluestore_defrag_threshold);
+      }
+    }
+  }
+  cached.stamp = ceph_clock_now(g_ceph_context);
+  f->open_object_section("cached_objects");
+  cached.dump(f);
+  f->close_section();
+
+  {
+    std::lock_guard<std::mutex> l(defrag_lock);
+    f->open_object_section("last_scan");
+    defrag_last_scan.dump(f);
+    f->close_section();
+  }
+
+  f->close_section();
+}
+
+/*
+ * Score how scattered an object's data is on disk: 0 if the logical
+ * extents map to one contiguous physical run, 1 if no two adjacent
+ * allocation units are physically contiguous.  A compressed blob is
+ * counted whole, since it is read whole.
+ */
+double BlueStore::_onode_fragmentation(CollectionRef& c, OnodeRef& o,
+				       bool *shared)
+{
+  *shared = false;
+  uint64_t runs = 0, bytes = 0;
+  uint64_t last_end = 0;
+  for (auto& p : o->onode.extent_map) {
+    if (p.second.is_shared())
+      *shared = true;
+    BlobRef b = c->get_blob(o, p.second.blob);
+    assert(b);
+    uint64_t x_off = p.second.offset, x_len = p.second.length;
+    if (b->blob.is_compressed()) {
+      x_off = 0;
+      x_len = b->blob.get_ondisk_length();
+    }
+    b->blob.map(x_off, x_len, [&](uint64_t offset, uint64_t length) {
+	if (offset == bluestore_pextent_t::INVALID_OFFSET)
+	  return;
+	if (!runs || offset != last_end)
+	  ++runs;
+	last_end = offset + length;
+	bytes += length;
+      });
+  }
+  uint64_t units = (bytes + min_alloc_size - 1) / min_alloc_size;
+  if (units <= 1 || runs <= 1)
+    return 0;
+  return MIN(1.0, (double)(runs - 1) / (units - 1));
+}
+
+struct C_DefragCommitted : public Context {
+  BlueStore::OnodeRef o;
+  C_SaferCond *committed;
+  C_DefragCommitted(BlueStore::OnodeRef& o, C_SaferCond *committed)
+    : o(o), committed(committed) {}
+  void finish(int r) {
+    {
+      std::lock_guard<std::mutex> l(o->flush_lock);
+      o->defrag_pending = false;
+      o->flush_cond.notify_all();
+    }
+    committed->complete(r);
+  }
+};
+
+/*
+ * The rewrite counts against the store throttles like a client txc.
+ * Take them for the largest object we rewrite before locking anything,
+ * as queue_transactions does, and give back what the txc did not use.
+ */
+int BlueStore::_defrag_object(CollectionRef& c, const ghobject_t& oid,
+			      uint64_t *rewritten)
+{
+  uint64_t max_bytes = g_conf->bluestore_defrag_max_object_size;
+  throttle_ops.get(1);
+  throttle_bytes.get(max_bytes);
+  throttle_wal_ops.get(1);
+  throttle_wal_bytes.get(max_bytes);
+  uint64_t bytes = 0;
+  int r = _do_defrag_object(c, oid, max_bytes, &bytes);
+  if (r < 0) {
+    throttle_ops.put(1);
+    throttle_wal_ops.put(1);
+    bytes = 0;
+  }
+  throttle_bytes.put(max_bytes - bytes);
+  throttle_wal_bytes.put(max_bytes - bytes);
+  *rewritten = bytes;
+  return r;
+}
+
+/*
+ * Rewrite an object so that its data gets freshly (and hopefully
+ * contiguously) allocated.  The rewrite goes through defrag_osr, so
+ * client ops that touch the object before it commits wait for it in
+ * _txc_add_transaction (Onode::wait_defrag) to keep their kv updates
+ * after ours; the collection lock is dropped once the txc is queued.
+ */
+int BlueStore::_do_defrag_object(CollectionRef& c, const ghobject_t& oid,
+				 uint64_t max_bytes, uint64_t *rewritten)
+{
+  RWLock::WLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists)
+    return -ENOENT;
+  {
+    // leave objects with client io in flight for the next scan
+    std::lock_guard<std::mutex> fl(o->flush_lock);
+    if (!o->flush_txns.empty())
+      return -EAGAIN;
+  }
+
+  bool shared;
+  double score = _onode_fragmentation(c, o, &shared);
+  if (shared || score <= g_conf->bluestore_defrag_threshold ||
+      o->onode.size > max_bytes)
+    return -EAGAIN;
+  if (alloc->get_free() < o->onode.size * 2) {
+    dout(10) << __func__ << " " << oid << " not enough free space" << dendl;
+    return -ENOSPC;
+  }
+
+  interval_set<uint64_t> ranges;
+  for (auto& p : o->onode.extent_map) {
+    uint64_t end = MIN(p.first + p.second.length, o->onode.size);
+    if (end > p.first)
+      ranges.insert(p.first, end - p.first);
+  }
+  map<uint64_t, bufferlist> data;
+  uint64_t bytes = 0;
+  for (auto p = ranges.begin(); p != ranges.end(); ++p) {
+    int r = _do_read(c.get(), o, p.get_start(), p.get_len(),
+		     data[p.get_start()]);
+    if (r < 0) {
+      derr << __func__ << " " << oid << " read 0x" << std::hex
+	   << p.get_start() << "~" << p.get_len() << std::dec
+	   << ": " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    bytes += p.get_len();
+  }
+  dout(10) << __func__ << " " << oid << " score " << score
+	   << " rewriting 0x" << std::hex << ranges << std::dec << dendl;
+
+  C_SaferCond committed;
+  TransContext *txc = _txc_create(defrag_osr.get());
+  txc->oncommit = new C_DefragCommitted(o, &committed);
+  txc->first_collection = c;
+  uint64_t size = o->onode.size;
+  int r = _do_truncate(txc, c, o, 0);
+  assert(r == 0);  // truncate to 0 does not fail
+  for (auto& p : data) {
+    r = _do_write(txc, c, o, p.first, p.second.length(), p.second, 0);
+    if (r < 0) {
+      derr << __func__ << " unexpected error " << cpp_strerror(r)
+	   << " rewriting " << oid << dendl;
+      assert(0 == "unexpected error");
+    }
+  }
+  o->onode.size = size;
+  txc->write_onode(o);
+  txc->ops = 1;
+  txc->bytes = bytes;
+  {
+    std::lock_guard<std::mutex> fl(o->flush_lock);
+    o->defrag_pending = true;
+  }
+  _txc_start(txc);
+  l.unlock();
+  committed.wait();
+  *rewritten = bytes;
+  return 0;
+}
+
+void BlueStore::_defrag_collection(CollectionRef& c, frag_stats_t *stats)
+{
+  double threshold = g_conf->bluestore_defrag_threshold;
+  ghobject_t next;
+  while (next != ghobject_t::get_max()) {
+    vector<ghobject_t> ls;
+    int r = collection_list(c->cid, next, ghobject_t::get_max(), true, 256,
+			    &ls, &next);
+    if (r < 0)
+      break;
+    for (auto& oid : ls) {
+      double score;
+      bool shared;
+      {
+	RWLock::RLocker l(c->lock);
+	OnodeRef o = c->get_onode(oid, false);
+	if (!o || !o->exists)
+	  continue;
+	score = _onode_fragmentation(c, o, &shared);
+      }
+      stats->add(score, threshold);
+      if (score <= threshold || shared)
+	continue;
+
+      // only rewrite while client io is (nearly) idle
+      {
+	std::unique_lock<std::mutex> l(defrag_lock);
+	while (!defrag_stop &&
+	       throttle_ops.get_current() >
+	       (int64_t)g_conf->bluestore_defrag_idle_ops) {
+	  defrag_cond.wait_for(l, std::chrono::milliseconds(100));
+	}
+	if (defrag_stop)
+	  return;
+      }
+
+      uint64_t bytes = 0;
+      if (_defrag_object(c, oid, &bytes) < 0)
+	continue;
+      ++stats->rewritten;
+      logger->inc(l_bluestore_defrag_objects);
+      logger->inc(l_bluestore_defrag_bytes, bytes);
+
+      uint64_t rate = g_conf->bluestore_defrag_bytes_per_sec;
+      if (rate) {
+	std::unique_lock<std::mutex> l(defrag_lock);
+	if (!defrag_stop)
+	  defrag_cond.wait_for(
+	    l, std::chrono::microseconds(bytes * 1000000ull / rate));
+	if (defrag_stop)
+	  return;
+      }
+    }
+  }
+}
+
+void BlueStore::_defrag_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock<std::mutex> l(defrag_lock);
+  while (!defrag_stop) {
+    double interval = MAX(1.0, g_conf->bluestore_defrag_interval);
+    defrag_cond.wait_for(
+      l, std::chrono::microseconds((uint64_t)(interval * 1000000.0)));
+    if (defrag_stop)
+      break;
+    if (!g_conf->bluestore_defrag)
+      continue;
+
+    l.unlock();
+    vector<CollectionRef> colls;
+    {
+      RWLock::RLocker cl(coll_lock);
+      for (auto& p : coll_map)
+	colls.push_back(p.second);
+    }
+    frag_stats_t stats;
+    for (auto& c : colls) {
+      _defrag_collection(c, &stats);
+    }
+    stats.stamp = ceph_clock_now(g_ceph_context);
+    dout(10) << __func__ << " scanned " << stats.objects << " objects, "
+	     << stats.fragmented << " fragmented, " << stats.rewritten
+	     << " rewritten" << dendl;
+    l.lock();
+    if (defrag_stop)
+      break;
+    defrag_last_scan = stats;
+    logger->set(l_bluestore_frag_score,
+		stats.objects ? stats.score_sum * 1000 / stats.objects : 0);
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
 void BlueStore::_kv_sync_thread()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -5036,7 +5776,10 @@ void BlueStore::_kv_sync_thread()
   while (true) {
     assert(kv_committing.empty());
     assert(wal_cleaning.empty());
-    if (kv_queue.empty() && wal_cleanup_queue.empty()) {
+    // extents released by txcs of the other lanes only become
+    // allocatable once an allocator commit here has covered them
+    bool release = kv_release_pending && !kv_lanes.empty();
+    if (kv_queue.empty() && wal_cleanup_queue.empty() && !release) {
       if (kv_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
@@ -5048,13 +5791,20 @@ void BlueStore::_kv_sync_thread()
 	       << " cleaning " << wal_cleanup_queue.size() << dendl;
       kv_committing.swap(kv_queue);
       wal_cleaning.swap(wal_cleanup_queue);
+      kv_lane_loggers[0]->set(l_bluestore_kv_lane_queue_depth, 0);
       utime_t start = ceph_clock_now(NULL);
       l.unlock();
 
       dout(30) << __func__ << " committing txc " << kv_committing << dendl;
       dout(30) << __func__ << " wal_cleaning txc " << wal_cleaning << dendl;
 
-      alloc->commit_start();
+      {
+	// releases from txcs other lanes have finalized but not yet
+	// submitted must not be picked up by this commit
+	std::lock_guard<std::mutex> sl(kv_submit_lock);
+	kv_release_pending = false;
+	alloc->commit_start();
+      }
 
       // flush/barrier on block device
       bdev->flush();
@@ -5064,9 +5814,7 @@ void BlueStore::_kv_sync_thread()
 	for (std::deque<TransContext *>::iterator it = kv_committing.begin();
 	     it != kv_committing.end();
 	     ++it) {
-	  _txc_finalize_kv((*it), (*it)->t);
-	  int r = db->submit_transaction((*it)->t);
-	  assert(r == 0);
+	  _txc_kv_submit(*it);
 	}
       }
 
@@ -5096,7 +5844,10 @@ void BlueStore::_kv_sync_thread()
 	    ++it) {
 	bluestore_wal_transaction_t& wt =*(*it)->wal_txn;
 	// kv metadata updates
-	_txc_finalize_kv(*it, t);
+	{
+	  std::lock_guard<std::mutex> sl(kv_submit_lock);
+	  _txc_finalize_kv(*it, t);
+	}
 	// cleanup the wal
 	string key;
 	get_wal_key(wt.seq, &key);
@@ -5110,6 +5861,9 @@ void BlueStore::_kv_sync_thread()
       dout(20) << __func__ << " committed " << kv_committing.size()
 	       << " cleaned " << wal_cleaning.size()
 	       << " in " << dur << dendl;
+      kv_lane_loggers[0]->inc(l_bluestore_kv_lane_commits);
+      kv_lane_loggers[0]->inc(l_bluestore_kv_lane_txcs, kv_committing.size());
+      kv_lane_loggers[0]->tinc(l_bluestore_kv_lane_commit_lat, dur);
       while (!kv_committing.empty()) {
 	TransContext *txc = kv_committing.front();
 	_txc_state_proc(txc);
@@ -5120,6 +5874,7 @@ void BlueStore::_kv_sync_thread()
 	_txc_state_proc(txc);
 	wal_cleaning.pop_front();
       }
+      _wal_elevator_kick();
 
       alloc->commit_finish();
 
@@ -5138,6 +5893,168 @@ void BlueStore::_kv_sync_thread()
   dout(10) << __func__ << " finish" << dendl;
 }
 
+void BlueStore::_kv_lane_thread(KVSyncLane *lane)
+{
+  dout(10) << __func__ << " " << lane->id << " start" << dendl;
+  std::unique_lock<std::mutex> l(lane->lock);
+  while (true) {
+    assert(lane->committing.empty());
+    if (lane->queue.empty()) {
+      if (lane->stop)
+	break;
+      dout(20) << __func__ << " " << lane->id << " sleep" << dendl;
+      lane->sync_cond.notify_all();
+      lane->cond.wait(l);
+      dout(20) << __func__ << " " << lane->id << " wake" << dendl;
+    } else {
+      dout(20) << __func__ << " " << lane->id << " committing "
+	       << lane->queue.size() << dendl;
+      lane->committing.swap(lane->queue);
+      lane->logger->set(l_bluestore_kv_lane_queue_depth, 0);
+      utime_t start = ceph_clock_now(NULL);
+      l.unlock();
+
+      dout(30) << __func__ << " " << lane->id << " committing txc "
+	       << lane->committing << dendl;
+
+      // flush/barrier on block device
+      bdev->flush();
+
+      if (!g_conf->bluestore_sync_transaction &&
+	  !g_conf->bluestore_sync_submit_transaction) {
+	for (auto txc : lane->committing) {
+	  _txc_kv_submit(txc);
+	}
+      }
+
+      // allocator commit, wal cleanup and bluefs balancing stay with
+      // kv_sync_thread, which we wake below if we released anything;
+      // here we only need the sync
+      KeyValueDB::Transaction t = db->get_transaction();
+      int r = db->submit_transaction_sync(t);
+      assert(r == 0);
+
+      utime_t dur = ceph_clock_now(NULL) - start;
+      dout(20) << __func__ << " " << lane->id << " committed "
+	       << lane->committing.size() << " in " << dur << dendl;
+      lane->logger->inc(l_bluestore_kv_lane_commits);
+      lane->logger->inc(l_bluestore_kv_lane_txcs, lane->committing.size());
+      lane->logger->tinc(l_bluestore_kv_lane_commit_lat, dur);
+      while (!lane->committing.empty()) {
+	TransContext *txc = lane->committing.front();
+	_txc_state_proc(txc);
+	lane->committing.pop_front();
+      }
+      _wal_elevator_kick();
+
+      if (kv_release_pending) {
+	std::lock_guard<std::mutex> kl(kv_lock);
+	kv_cond.notify_one();
+      }
+
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " " << lane->id << " finish" << dendl;
+}
+
+void BlueStore::_kv_start()
+{
+  unsigned num = 1;
+  if (g_conf->bluestore_kv_sync_lanes > 1 &&
+      !g_conf->bluestore_sync_transaction) {
+    num = g_conf->bluestore_kv_sync_lanes;
+  }
+  dout(10) << __func__ << " " << num << " lanes" << dendl;
+  for (unsigned i = 0; i < num; ++i) {
+    PerfCountersBuilder b(g_ceph_context,
+			  string("bluestore_kv_lane_") + stringify(i),
+			  l_bluestore_kv_lane_first, l_bluestore_kv_lane_last);
+    b.add_u64(l_bluestore_kv_lane_queue_depth, "queue_depth",
+	      "Transactions waiting for this lane");
+    b.add_u64_counter(l_bluestore_kv_lane_commits, "commits",
+		      "Sync commits by this lane");
+    b.add_u64_counter(l_bluestore_kv_lane_txcs, "txcs",
+		      "Transactions committed by this lane");
+    b.add_time_avg(l_bluestore_kv_lane_commit_lat, "commit_lat",
+		   "Average sync commit latency");
+    PerfCounters *l = b.create_perf_counters();
+    g_ceph_context->get_perfcounters_collection()->add(l);
+    kv_lane_loggers.push_back(l);
+  }
+  kv_sync_thread.create("bstore_kv_sync");
+  for (unsigned i = 1; i < num; ++i) {
+    KVSyncLane *lane = new KVSyncLane(this, i, kv_lane_loggers[i]);
+    kv_lanes.push_back(lane);
+    lane->create("bstore_kv_lane");
+  }
+}
+
+void BlueStore::_kv_stop()
+{
+  dout(10) << __func__ << dendl;
+  // lanes may still queue wal cleanup work for kv_sync_thread; stop
+  // them first
+  for (auto lane : kv_lanes) {
+    {
+      std::lock_guard<std::mutex> l(lane->lock);
+      lane->stop = true;
+      lane->cond.notify_all();
+    }
+    lane->join();
+    delete lane;
+  }
+  kv_lanes.clear();
+  {
+    std::lock_guard<std::mutex> l(kv_lock);
+    kv_stop = true;
+    kv_cond.notify_all();
+  }
+  kv_sync_thread.join();
+  kv_stop = false;
+  for (auto l : kv_lane_loggers) {
+    g_ceph_context->get_perfcounters_collection()->remove(l);
+    delete l;
+  }
+  kv_lane_loggers.clear();
+}
+
+void BlueStore::_txc_kv_queue(TransContext *txc)
+{
+  OpSequencer *osr = txc->osr.get();
+  // a sequencer sticks to one lane (until the lane count changes across
+  // a remount) so that its txcs commit in order
+  if (osr->kv_lane < 0 || osr->kv_lane > (int)kv_lanes.size()) {
+    osr->kv_lane = 0;
+    if (!kv_lanes.empty() && txc->first_collection) {
+      osr->kv_lane = std::hash<coll_t>()(txc->first_collection->cid) %
+	(kv_lanes.size() + 1);
+    }
+    dout(20) << __func__ << " osr " << osr << " lane " << osr->kv_lane
+	     << dendl;
+  }
+  if (osr->kv_lane == 0) {
+    std::lock_guard<std::mutex> l(kv_lock);
+    kv_queue.push_back(txc);
+    kv_lane_loggers[0]->set(l_bluestore_kv_lane_queue_depth, kv_queue.size());
+    kv_cond.notify_one();
+  } else {
+    KVSyncLane *lane = kv_lanes[osr->kv_lane - 1];
+    std::lock_guard<std::mutex> l(lane->lock);
+    lane->queue.push_back(txc);
+    lane->logger->set(l_bluestore_kv_lane_queue_depth, lane->queue.size());
+    lane->cond.notify_one();
+  }
+}
+
+void BlueStore::_txc_kv_submit(TransContext *txc)
+{
+  std::lock_guard<std::mutex> l(kv_submit_lock);
+  _txc_finalize_kv(txc, txc->t);
+  int r = db->submit_transaction(txc->t);
+  assert(r == 0);
+}
+
 bluestore_wal_op_t *BlueStore::_get_wal_op(TransContext *txc, OnodeRef o)
 {
   if (!txc->wal_txn) {
@@ -5178,6 +6095,151 @@ int BlueStore::_wal_apply(TransContext *txc)
   return 0;
 }
 
+void BlueStore::_wal_elevator_queue(TransContext *txc)
+{
+  dout(20) << __func__ << " txc " << txc << " seq " << txc->wal_txn->seq
+	   << dendl;
+  std::lock_guard<std::mutex> l(wal_lock);
+  wal_elevator_queue.push_back(txc);
+}
+
+/*
+ * add a write to an offset -> data map of non-overlapping extents,
+ * replacing whatever it overlaps.
+ */
+static void wal_elevator_insert(map<uint64_t,bufferlist> *m,
+				uint64_t off, bufferlist& bl)
+{
+  uint64_t end = off + bl.length();
+  auto p = m->lower_bound(off);
+  if (p != m->begin()) {
+    auto q = p;
+    --q;
+    uint64_t qend = q->first + q->second.length();
+    if (qend > off) {
+      if (qend > end) {
+	bufferlist tail;
+	tail.substr_of(q->second, end - q->first, qend - end);
+	(*m)[end].swap(tail);
+      }
+      bufferlist head;
+      head.substr_of(q->second, 0, off - q->first);
+      q->second.swap(head);
+    }
+  }
+  while (p != m->end() && p->first < end) {
+    uint64_t pend = p->first + p->second.length();
+    if (pend > end) {
+      bufferlist tail;
+      tail.substr_of(p->second, end - p->first, pend - end);
+      m->erase(p);
+      (*m)[end].swap(tail);
+      break;
+    }
+    m->erase(p++);
+  }
+  (*m)[off].swap(bl);
+}
+
+void BlueStore::_wal_elevator_kick()
+{
+  // every lane kicks; a batch must reach the device before any later
+  // one is gathered, or an older write to an extent could land last
+  std::lock_guard<std::mutex> sl(wal_submit_lock);
+  deque<TransContext*> q;
+  {
+    std::lock_guard<std::mutex> l(wal_lock);
+    q.swap(wal_elevator_queue);
+  }
+  if (q.empty())
+    return;
+
+  // apply in wal seq order so that later writes win where they overlap
+  std::sort(q.begin(), q.end(), [](TransContext *a, TransContext *b) {
+      return a->wal_txn->seq < b->wal_txn->seq;
+    });
+  map<uint64_t,bufferlist> extents;
+  uint64_t num_extents = 0;
+  uint64_t seek_before = 0, seek_after = 0;
+  uint64_t pos = 0;
+  bool first = true;
+  for (auto txc : q) {
+    txc->log_state_latency(logger, l_bluestore_state_wal_queued_lat);
+    txc->state = TransContext::STATE_WAL_APPLYING;
+    for (auto& wo : txc->wal_txn->ops) {
+      assert(wo.op == bluestore_wal_op_t::OP_WRITE);
+      logger->inc(l_bluestore_wal_write_ops);
+      logger->inc(l_bluestore_wal_write_bytes, wo.data.length());
+      bufferlist::iterator p = wo.data.begin();
+      for (auto& e : wo.extents) {
+	bufferlist bl;
+	p.copy(e.length, bl);
+	if (!first) {
+	  seek_before += e.offset > pos ? e.offset - pos : pos - e.offset;
+	}
+	first = false;
+	pos = e.offset + e.length;
+	wal_elevator_insert(&extents, e.offset, bl);
+	++num_extents;
+      }
+    }
+  }
+
+  // merge adjacent extents and submit everything in offset order on
+  // the first txc's ioc; the rest complete along with it
+  TransContext *leader = q.front();
+  uint64_t max_io = g_conf->bluestore_wal_elevator_max_io;
+  uint64_t num_ios = 0;
+  first = true;
+  auto p = extents.begin();
+  while (p != extents.end()) {
+    uint64_t off = p->first;
+    bufferlist bl;
+    bl.claim_append(p->second);
+    ++p;
+    while (p != extents.end() &&
+	   p->first == off + bl.length() &&
+	   bl.length() + p->second.length() <= max_io) {
+      bl.claim_append(p->second);
+      ++p;
+    }
+    if (!first) {
+      seek_after += off - pos;
+    }
+    first = false;
+    pos = off + bl.length();
+    dout(20) << __func__ << " write 0x" << std::hex << off << "~"
+	     << bl.length() << std::dec << dendl;
+    int r = bdev->aio_write(off, bl, &leader->ioc, false);
+    assert(r == 0);
+    ++num_ios;
+  }
+
+  dout(10) << __func__ << " " << q.size() << " txcs " << num_extents
+	   << " extents -> " << num_ios << " ios, seek 0x" << std::hex
+	   << seek_before << " -> 0x" << seek_after << std::dec << dendl;
+  logger->inc(l_bluestore_wal_elevator_batches);
+  logger->inc(l_bluestore_wal_elevator_extents, num_extents);
+  logger->inc(l_bluestore_wal_elevator_ios, num_ios);
+  uint64_t total_extents = wal_elevator_extents += num_extents;
+  uint64_t total_ios = wal_elevator_ios += num_ios;
+  if (total_extents) {
+    logger->set(l_bluestore_wal_elevator_merge_pct,
+		100 - MIN(total_ios * 100 / total_extents, 100));
+  }
+  if (seek_before > seek_after) {
+    logger->inc(l_bluestore_wal_elevator_seek_saved, seek_before - seek_after);
+  }
+
+  for (auto txc : q) {
+    if (txc != leader) {
+      txc->state = TransContext::STATE_WAL_AIO_WAIT;
+      leader->wal_batch.push_back(txc);
+    }
+  }
+  _txc_state_proc(leader);
+}
+
 int BlueStore::_wal_finish(TransContext *txc)
 {
   bluestore_wal_transaction_t& wt = *txc->wal_txn;
@@ -5246,6 +6308,7 @@ int BlueStore::_wal_replay()
     txc->state = TransContext::STATE_KV_DONE;
     _txc_state_proc(txc);
   }
+  _wal_elevator_kick();
   dout(20) << __func__ << " flushing osr" << dendl;
   osr->flush();
   dout(10) << __func__ << " completed " << count << " events" << dendl;
@@ -5293,6 +6356,17 @@ int BlueStore::queue_transactions(
     _txc_add_transaction(txc, &(*p));
   }
 
+  throttle_ops.get(txc->ops);
+  throttle_bytes.get(txc->bytes);
+  throttle_wal_ops.get(txc->ops);
+  throttle_wal_bytes.get(txc->bytes);
+
+  _txc_start(txc);
+  return 0;
+}
+
+void BlueStore::_txc_start(TransContext *txc)
+{
   // delayed csum calculation?
   for (auto& d : txc->deferred_csum) {
     BlobRef b = d.onode->get_blob(d.blob);
@@ -5317,14 +6391,8 @@ int BlueStore::queue_transactions(
     txc->t->set(PREFIX_WAL, key, bl);
   }
 
-  throttle_ops.get(txc->ops);
-  throttle_bytes.get(txc->bytes);
-  throttle_wal_ops.get(txc->ops);
-  throttle_wal_bytes.get(txc->bytes);
-
   // execute (start)
   _txc_state_proc(txc);
-  return 0;
 }
 
 void BlueStore::_txc_aio_submit(TransContext *txc)
@@ -5462,6 +6530,13 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       }
       ghobject_t oid = i.get_oid(op->oid);
       o = c->get_onode(oid, create);
+      // wait out a defrag rewrite of the object without holding up the
+      // rest of the collection; another one may start before we relock
+      while (o && o->is_defrag_pending()) {
+	l.unlock();
+	o->wait_defrag();
+	l.lock();
+      }
       if (!create) {
 	if (!o || !o->exists) {
 	  dout(10) << __func__ << " op " << op->op << " got ENOENT on "
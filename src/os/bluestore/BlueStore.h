@@ -33,6 +33,7 @@
 #include "include/unordered_map.h"
 #include "include/memory.h"
 #include "common/Finisher.h"
+#include "common/admin_socket.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
@@ -62,9 +63,43 @@ enum {
   l_bluestore_wal_write_ops,
   l_bluestore_wal_write_bytes,
   l_bluestore_write_penalty_read_ops,
+  l_bluestore_onode_hits,
+  l_bluestore_onode_misses,
+  l_bluestore_buffer_hit_bytes,
+  l_bluestore_buffer_miss_bytes,
+  l_bluestore_cache_onode_bytes,
+  l_bluestore_cache_buffer_bytes,
+  l_bluestore_cache_kv_bytes,
+  l_bluestore_cache_onode_hit_pct,
+  l_bluestore_cache_buffer_hit_pct,
+  l_bluestore_cache_kv_hit_pct,
+  l_bluestore_onode_ghost_hits,
+  l_bluestore_onode_cold_inserts,
+  l_bluestore_onode_warm_trims,
+  l_bluestore_onode_hot_trims,
+  l_bluestore_wal_elevator_batches,
+  l_bluestore_wal_elevator_extents,
+  l_bluestore_wal_elevator_ios,
+  l_bluestore_wal_elevator_merge_pct,
+  l_bluestore_wal_elevator_seek_saved,
+  l_bluestore_defrag_objects,
+  l_bluestore_defrag_bytes,
+  l_bluestore_frag_score,
+  l_bluestore_decompressed_bytes,
+  l_bluestore_decompress_saved_bytes,
+  l_bluestore_decompressed_cache_bytes,
   l_bluestore_last
 };
 
+enum {
+  l_bluestore_kv_lane_first = 732530,
+  l_bluestore_kv_lane_queue_depth,
+  l_bluestore_kv_lane_commits,
+  l_bluestore_kv_lane_txcs,
+  l_bluestore_kv_lane_commit_lat,
+  l_bluestore_kv_lane_last
+};
+
 class BlueStore : public ObjectStore,
 		  public md_config_obs_t {
   // -----------------------------------------------------
@@ -101,12 +136,13 @@ public:
       }
     }
     enum {
-      FLAG_NOCACHE = 1,  ///< trim when done WRITING (do not become CLEAN)
-      // NOTE: fix operator<< when you define a second flag
+      FLAG_NOCACHE = 1,       ///< trim when done WRITING (do not become CLEAN)
+      FLAG_DECOMPRESSED = 2,  ///< decompressed blob data, see Cache
     };
     static const char *get_flag_name(int s) {
       switch (s) {
       case FLAG_NOCACHE: return "nocache";
+      case FLAG_DECOMPRESSED: return "decompressed";
       default: return "???";
       }
     }
@@ -139,6 +175,9 @@ public:
     bool is_writing() const {
       return state == STATE_WRITING;
     }
+    bool is_decompressed() const {
+      return flags & FLAG_DECOMPRESSED;
+    }
 
     uint64_t end() const {
       return offset + length;
@@ -189,6 +228,8 @@ public:
       buffer_map[b->offset].reset(b);
       if (b->is_writing()) {
         writing_map[b->seq].push_back(*b);
+      } else if (b->is_decompressed()) {
+	cache->_add_decompressed(b);
       } else {
 	cache->_add_buffer(b, level, near);
       }
@@ -206,6 +247,8 @@ public:
         it->second.erase(it->second.iterator_to(*p->second));
         if (it->second.empty())
           writing_map.erase(it);
+      } else if (p->second->is_decompressed()) {
+	cache->_rm_decompressed(p->second.get());
       } else {
 	cache->_rm_buffer(p->second.get());
       }
@@ -252,6 +295,14 @@ public:
       b->cache_private = _discard(offset, bl.length());
       _add_buffer(b, 1, nullptr);
     }
+    /// cache decompressed blob data under the Cache's decompressed budget
+    void did_decompress(bufferlist& bl) {
+      std::lock_guard<std::mutex> l(cache->lock);
+      Buffer *b = new Buffer(this, Buffer::STATE_CLEAN, 0, 0, bl,
+			     Buffer::FLAG_DECOMPRESSED);
+      _discard(0, bl.length());
+      _add_buffer(b, 1, nullptr);
+    }
 
     void read(uint64_t offset, uint64_t length,
 	      BlueStore::ready_regions_t& res,
@@ -469,6 +520,7 @@ public:
 
     OnodeSpace *space;    ///< containing OnodeSpace
     boost::intrusive::list_member_hook<> lru_item;
+    uint16_t cache_private = 0; ///< opaque (to us) value used by Cache impl
 
     BnodeRef bnode;  ///< ref to Bnode [optional]
 
@@ -480,6 +532,7 @@ public:
     std::mutex flush_lock;  ///< protect flush_txns
     std::condition_variable flush_cond;   ///< wait here for unapplied txns
     set<TransContext*> flush_txns;   ///< committing or wal txns
+    bool defrag_pending = false;     ///< defrag rewrite not yet committed
 
     Onode(OnodeSpace *s, const ghobject_t& o, const string& k)
       : nref(0),
@@ -498,6 +551,11 @@ public:
     }
 
     void flush();
+    bool is_defrag_pending() {
+      std::lock_guard<std::mutex> l(flush_lock);
+      return defrag_pending;
+    }
+    void wait_defrag();
     void get() {
       ++nref;
     }
@@ -511,14 +569,31 @@ public:
   /// a cache (shard) of onodes and buffers
   struct Cache {
     std::mutex lock;                ///< protect lru and other structures
+    PerfCounters *logger = nullptr;
 
-    static Cache *create(string type);
+    /// decompressed blob data is kept apart from the raw buffers, in a
+    /// plain LRU with its own budget, so it neither displaces nor is
+    /// displaced by uncompressed data
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > decompressed_list_t;
+    decompressed_list_t decompressed_lru;
+    uint64_t decompressed_bytes = 0;
+
+    static Cache *create(string type, PerfCounters *logger);
 
     virtual ~Cache() {}
 
+    /// level 0 means a scan (e.g., scrub) access: insert at, or leave
+    /// the onode near, the cold end
     virtual void _add_onode(OnodeRef& o, int level) = 0;
     virtual void _rm_onode(OnodeRef& o) = 0;
-    virtual void _touch_onode(OnodeRef& o) = 0;
+    virtual void _touch_onode(OnodeRef& o, int level) = 0;
+    /// the onodes of space are gone; drop anything else we keep for it
+    virtual void _clear_space(OnodeSpace *space) {}
 
     virtual void _add_buffer(Buffer *b, int level, Buffer *near) = 0;
     virtual void _rm_buffer(Buffer *b) = 0;
@@ -527,6 +602,31 @@ public:
 
     virtual void trim(uint64_t onode_max, uint64_t buffer_max) = 0;
 
+    void _add_decompressed(Buffer *b) {
+      decompressed_lru.push_front(*b);
+      decompressed_bytes += b->length;
+      logger->inc(l_bluestore_decompressed_cache_bytes, b->length);
+    }
+    void _rm_decompressed(Buffer *b) {
+      assert(decompressed_bytes >= b->length);
+      decompressed_bytes -= b->length;
+      logger->dec(l_bluestore_decompressed_cache_bytes, b->length);
+      decompressed_lru.erase(decompressed_lru.iterator_to(*b));
+    }
+    void _adjust_decompressed_size(int64_t delta) {
+      assert((int64_t)decompressed_bytes + delta >= 0);
+      decompressed_bytes += delta;
+      if (delta > 0)
+	logger->inc(l_bluestore_decompressed_cache_bytes, delta);
+      else
+	logger->dec(l_bluestore_decompressed_cache_bytes, -delta);
+    }
+    void _touch_decompressed(Buffer *b) {
+      decompressed_lru.erase(decompressed_lru.iterator_to(*b));
+      decompressed_lru.push_front(*b);
+    }
+    void trim_decompressed(uint64_t max);
+
 #ifdef DEBUG_CACHE
     virtual void _audit(const char *s) = 0;
 #else
@@ -557,16 +657,18 @@ public:
 
   public:
     void _add_onode(OnodeRef& o, int level) override {
-      if (level > 0)
+      if (level > 0) {
 	onode_lru.push_front(*o);
-      else
+      } else {
 	onode_lru.push_back(*o);
+	logger->inc(l_bluestore_onode_cold_inserts);
+      }
     }
     void _rm_onode(OnodeRef& o) override {
       auto q = onode_lru.iterator_to(*o);
       onode_lru.erase(q);
     }
-    void _touch_onode(OnodeRef& o) override;
+    void _touch_onode(OnodeRef& o, int level) override;
 
     void _add_buffer(Buffer *b, int level, Buffer *near) override {
       if (near) {
@@ -603,16 +705,15 @@ public:
 #endif
   };
 
-  // 2Q cache for buffers, LRU for onodes
+  // 2Q cache for buffers and onodes
   struct TwoQCache : public Cache {
   private:
-    // stick with LRU for onodes for now (fixme?)
     typedef boost::intrusive::list<
       Onode,
       boost::intrusive::member_hook<
         Onode,
 	boost::intrusive::list_member_hook<>,
-	&Onode::lru_item> > onode_lru_list_t;
+	&Onode::lru_item> > onode_list_t;
     typedef boost::intrusive::list<
       Buffer,
       boost::intrusive::member_hook<
@@ -620,7 +721,30 @@ public:
 	boost::intrusive::list_member_hook<>,
 	&Buffer::lru_item> > buffer_list_t;
 
-    onode_lru_list_t onode_lru;
+    onode_list_t onode_hot;      //< "Am" hot onodes
+    onode_list_t onode_warm_in;  //< "A1in" newly warm onodes
+
+    /// "A1out" ghost entries: onodes trimmed from warm_in, by space,
+    /// since the same oid may be cached by more than one collection
+    typedef pair<const OnodeSpace*,ghobject_t> onode_ghost_t;
+    struct onode_ghost_hash {
+      size_t operator()(const onode_ghost_t& g) const {
+	return std::hash<ghobject_t>()(g.second) ^
+	  std::hash<const OnodeSpace*>()(g.first);
+      }
+    };
+    list<onode_ghost_t> onode_warm_out;
+    ceph::unordered_map<onode_ghost_t,list<onode_ghost_t>::iterator,
+			onode_ghost_hash> onode_ghosts;
+
+    enum {
+      ONODE_NEW = 0,
+      ONODE_WARM_IN,      ///< in onode_warm_in
+      ONODE_WARM_IN_SCAN, ///< in onode_warm_in, only seen by scans
+      ONODE_HOT,          ///< in onode_hot
+    };
+
+    int _trim_onode_list(onode_list_t& l, int num, bool ghost);
 
     buffer_list_t buffer_hot;      //< "Am" hot buffers
     buffer_list_t buffer_warm_in;  //< "A1in" newly warm buffers
@@ -638,17 +762,23 @@ public:
     uint64_t buffer_list_bytes[BUFFER_TYPE_MAX] = {0}; ///< bytes per type
 
   public:
-    void _add_onode(OnodeRef& o, int level) override {
-      if (level > 0)
-	onode_lru.push_front(*o);
-      else
-	onode_lru.push_back(*o);
-    }
+    void _add_onode(OnodeRef& o, int level) override;
     void _rm_onode(OnodeRef& o) override {
-      auto q = onode_lru.iterator_to(*o);
-      onode_lru.erase(q);
+      switch (o->cache_private) {
+      case ONODE_WARM_IN:
+      case ONODE_WARM_IN_SCAN:
+	onode_warm_in.erase(onode_warm_in.iterator_to(*o));
+	break;
+      case ONODE_HOT:
+	onode_hot.erase(onode_hot.iterator_to(*o));
+	break;
+      default:
+	assert(0 == "bad cache_private");
+      }
+      o->cache_private = ONODE_NEW;
     }
-    void _touch_onode(OnodeRef& o) override;
+    void _touch_onode(OnodeRef& o, int level) override;
+    void _clear_space(OnodeSpace *space) override;
 
     void _add_buffer(Buffer *b, int level, Buffer *near) override;
     void _rm_buffer(Buffer *b) override;
@@ -687,8 +817,8 @@ public:
       clear();
     }
 
-    void add(const ghobject_t& oid, OnodeRef o);
-    OnodeRef lookup(const ghobject_t& o);
+    void add(const ghobject_t& oid, OnodeRef o, int level = 1);
+    OnodeRef lookup(const ghobject_t& o, int level = 1);
     void rename(OnodeRef& o, const ghobject_t& old_oid,
 		const ghobject_t& new_oid);
     void clear();
@@ -714,7 +844,7 @@ public:
     // contention.
     OnodeSpace onode_map;
 
-    OnodeRef get_onode(const ghobject_t& oid, bool create);
+    OnodeRef get_onode(const ghobject_t& oid, bool create, int level = 1);
     BnodeRef get_bnode(uint32_t hash);
 
     BlobRef get_blob(OnodeRef& o, int64_t blob) {
@@ -832,6 +962,7 @@ public:
     boost::intrusive::list_member_hook<> wal_queue_item;
     bluestore_wal_transaction_t *wal_txn; ///< wal transaction (if any)
     vector<OnodeRef> wal_op_onodes;
+    list<TransContext*> wal_batch; ///< txcs whose wal ios ride on our ioc
 
     interval_set<uint64_t> allocated, released;
     struct volatile_statfs{
@@ -964,6 +1095,8 @@ public:
 
     uint64_t last_seq = 0;
 
+    int kv_lane = -1;  ///< kv sync lane; fixed while txcs are in flight
+
     OpSequencer()
 	//set the qlock to PTHREAD_MUTEX_RECURSIVE mode
       : parent(NULL) {
@@ -1097,6 +1230,75 @@ public:
     }
   };
 
+  /// an additional kv sync thread serving a subset of the sequencers
+  struct KVSyncLane : public Thread {
+    BlueStore *store;
+    unsigned id;
+    PerfCounters *logger;
+    std::mutex lock;
+    std::condition_variable cond, sync_cond;
+    bool stop = false;
+    deque<TransContext*> queue, committing;
+    KVSyncLane(BlueStore *s, unsigned i, PerfCounters *l)
+      : store(s), id(i), logger(l) {}
+    void *entry() {
+      store->_kv_lane_thread(this);
+      return NULL;
+    }
+  };
+
+  struct CacheTuneThread : public Thread {
+    BlueStore *store;
+    explicit CacheTuneThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_cache_tune_thread();
+      return NULL;
+    }
+  };
+
+  struct DefragThread : public Thread {
+    BlueStore *store;
+    explicit DefragThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_defrag_thread();
+      return NULL;
+    }
+  };
+
+  /// "bluestore fragmentation" admin socket command
+  class FragmentationHook : public AdminSocketHook {
+    BlueStore *store;
+  public:
+    explicit FragmentationHook(BlueStore *s) : store(s) {}
+    bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	      bufferlist& out) override;
+  };
+
+  /// object extent fragmentation, summed over a set of onodes
+  struct frag_stats_t {
+    uint64_t objects = 0;     ///< onodes scored
+    uint64_t fragmented = 0;  ///< onodes over bluestore_defrag_threshold
+    uint64_t rewritten = 0;   ///< onodes rewritten by defrag
+    double score_sum = 0;
+    utime_t stamp;            ///< when the scan finished
+
+    void add(double score, double threshold) {
+      ++objects;
+      score_sum += score;
+      if (score > threshold)
+	++fragmented;
+    }
+    void dump(Formatter *f) const;
+  };
+
+  /// the caches that share bluestore_cache_size when autotuning
+  enum {
+    CACHE_ONODE = 0,
+    CACHE_BUFFER,
+    CACHE_KV,
+    CACHE_MAX
+  };
+
   // --------------------------------------------------------
   // members
 private:
@@ -1127,7 +1329,10 @@ private:
 
   interval_set<uint64_t> bluefs_extents;  ///< block extents owned by bluefs
 
-  std::mutex wal_lock;
+  std::mutex wal_lock;                 ///< protects wal_elevator_queue
+  deque<TransContext*> wal_elevator_queue; ///< committed, waiting for a batch
+  std::mutex wal_submit_lock;          ///< serializes elevator batches
+  std::atomic<uint64_t> wal_elevator_extents = {0}, wal_elevator_ios = {0};
   atomic64_t wal_seq;
   ThreadPool wal_tp;
   WALWQ wal_wq;
@@ -1141,8 +1346,38 @@ private:
   deque<TransContext*> kv_queue, kv_committing;
   deque<TransContext*> wal_cleanup_queue, wal_cleaning;
 
+  vector<KVSyncLane*> kv_lanes;          ///< lanes 1..n-1; lane 0 is kv_sync_thread
+  vector<PerfCounters*> kv_lane_loggers; ///< indexed by lane
+  std::mutex kv_submit_lock;  ///< orders txc finalize+submit vs alloc commit_start
+  std::atomic<bool> kv_release_pending = {false}; ///< released, not yet committed
+
   PerfCounters *logger;
 
+  CacheTuneThread cache_tune_thread;
+  std::mutex cache_tune_lock;
+  std::condition_variable cache_tune_cond;
+  bool cache_tune_stop = false;
+  bool cache_autotune = false;      ///< bluestore_cache_autotune at mount
+  bool cache_tune_resize = false;   ///< cache size or ratios changed
+  bool cache_tune_reset = false;    ///< initial ratios changed
+  double cache_ratio[CACHE_MAX];        ///< share of bluestore_cache_size
+  std::atomic<uint64_t> cache_onode_max = {0};  ///< per shard, autotune only
+  std::atomic<uint64_t> cache_buffer_max = {0}; ///< per shard, autotune only
+
+  // cache feedback, sampled by _cache_tune_thread
+  std::atomic<uint64_t> onode_hits = {0}, onode_misses = {0};
+  std::atomic<uint64_t> onode_miss_ns = {0};      ///< time spent loading onodes
+  std::atomic<uint64_t> buffer_hit_bytes = {0}, buffer_miss_bytes = {0};
+  std::atomic<uint64_t> buffer_miss_ns = {0};     ///< time spent reading misses
+
+  DefragThread defrag_thread;
+  std::mutex defrag_lock;
+  std::condition_variable defrag_cond;
+  bool defrag_stop = false;
+  OpSequencerRef defrag_osr;   ///< rewrites; each waits for commit
+  frag_stats_t defrag_last_scan; ///< protected by defrag_lock
+  FragmentationHook *frag_hook = nullptr;
+
   std::mutex reap_lock;
   list<CollectionRef> removed_collections;
 
@@ -1249,19 +1484,61 @@ private:
 
   void _osr_reap_done(OpSequencer *osr);
 
-  void _kv_sync_thread();
-  void _kv_stop() {
+  void _cache_tune_thread();
+  void _cache_tune_stop() {
+    if (!cache_tune_thread.is_started())
+      return;
+    {
+      std::lock_guard<std::mutex> l(cache_tune_lock);
+      cache_tune_stop = true;
+      cache_tune_cond.notify_all();
+    }
+    cache_tune_thread.join();
+    cache_tune_stop = false;
+    cache_tune_resize = cache_tune_reset = false;
+  }
+  void _cache_tune_apply();
+  int _set_cache_ratios();
+
+  double _onode_fragmentation(CollectionRef& c, OnodeRef& o, bool *shared);
+  int _defrag_object(CollectionRef& c, const ghobject_t& oid,
+		     uint64_t *rewritten);
+  int _do_defrag_object(CollectionRef& c, const ghobject_t& oid,
+			uint64_t max_bytes, uint64_t *rewritten);
+  void _defrag_collection(CollectionRef& c, frag_stats_t *stats);
+  void _defrag_thread();
+  void _defrag_stop() {
     {
-      std::lock_guard<std::mutex> l(kv_lock);
-      kv_stop = true;
-      kv_cond.notify_all();
+      std::lock_guard<std::mutex> l(defrag_lock);
+      defrag_stop = true;
+      defrag_cond.notify_all();
+    }
+    defrag_thread.join();
+    defrag_stop = false;
+  }
+  void _txc_start(TransContext *txc);
+
+  void _trim_cache(Cache *c) {
+    if (cache_autotune) {
+      c->trim(cache_onode_max, cache_buffer_max);
+    } else {
+      c->trim(g_conf->bluestore_onode_cache_size,
+	      g_conf->bluestore_buffer_cache_size);
     }
-    kv_sync_thread.join();
-    kv_stop = false;
+    c->trim_decompressed(g_conf->bluestore_decompressed_cache_size);
   }
 
+  void _kv_sync_thread();
+  void _kv_lane_thread(KVSyncLane *lane);
+  void _kv_start();
+  void _kv_stop();
+  void _txc_kv_queue(TransContext *txc);
+  void _txc_kv_submit(TransContext *txc);
+
   bluestore_wal_op_t *_get_wal_op(TransContext *txc, OnodeRef o);
   int _wal_apply(TransContext *txc);
+  void _wal_elevator_queue(TransContext *txc);
+  void _wal_elevator_kick();
   int _wal_finish(TransContext *txc);
   int _do_wal_op(TransContext *txc, bluestore_wal_op_t& wo);
   int _wal_replay();
@@ -1305,6 +1582,9 @@ public:
 
   int fsck() override;
 
+  /// allocator and object extent fragmentation
+  void dump_fragmentation(Formatter *f);
+
   void set_cache_shards(unsigned num) override;
 
   int validate_hobject_key(const hobject_t &obj) const override {
@@ -1485,6 +1765,13 @@ public:
     TrackedOpRef op = TrackedOpRef(),
     ThreadPool::TPHandle *handle = NULL) override;
 
+  bool throttle_would_block(uint64_t bytes) override {
+    return throttle_ops.should_wait(1) ||
+      throttle_bytes.should_wait(bytes) ||
+      throttle_wal_ops.should_wait(1) ||
+      throttle_wal_bytes.should_wait(bytes);
+  }
+
 private:
 
   // --------------------------------------------------------
@@ -251,6 +251,20 @@ uint64_t StupidAllocator::get_free()
   return num_free;
 }
 
+double StupidAllocator::get_fragmentation(uint64_t alloc_unit)
+{
+  std::lock_guard<std::mutex> l(lock);
+  uint64_t units = num_free / alloc_unit;
+  uint64_t extents = 0;
+  for (auto& bin : free) {
+    extents += bin.num_intervals();
+  }
+  if (units <= 1 || extents <= 1) {
+    return 0;
+  }
+  return MIN(1.0, (double)(extents - 1) / (units - 1));
+}
+
 void StupidAllocator::dump(ostream& out)
 {
   std::lock_guard<std::mutex> l(lock);
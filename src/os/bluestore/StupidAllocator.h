@@ -49,6 +49,7 @@ public:
   void commit_finish();
 
   uint64_t get_free();
+  double get_fragmentation(uint64_t alloc_unit);
 
   void dump(std::ostream& out);
 
@@ -0,0 +1,816 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <thread>
+
+#include "UringDevice.h"
+#include "include/types.h"
+#include "include/compat.h"
+#include "common/errno.h"
+#include "common/debug.h"
+#include "common/blkdev.h"
+#include "common/align.h"
+#include "common/ceph_time.h"
+
+#define dout_subsys ceph_subsys_bdev
+#undef dout_prefix
+#define dout_prefix *_dout << "bdev(" << path << ") "
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		 NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+				 unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringDevice::UringDevice(aio_callback_t cb, void *cbpriv)
+  : fd_direct(-1),
+    fd_buffered(-1),
+    size(0), block_size(0),
+    fs(NULL),
+    debug_lock("UringDevice::debug_lock"),
+    flush_lock("UringDevice::flush_lock"),
+    aio_callback(cb),
+    aio_callback_priv(cbpriv),
+    ring_fd(-1),
+    sqpoll(false), iopoll(false), fixed_file(false),
+    sq_entries(0), cq_entries(0),
+    sq_ptr(NULL), cq_ptr(NULL),
+    sq_len(0), cq_len(0),
+    sqes(NULL), sqes_len(0),
+    sq_head(NULL), sq_tail(NULL), sq_mask(NULL), sq_flags(NULL),
+    sq_array(NULL),
+    cq_head(NULL), cq_tail(NULL), cq_mask(NULL),
+    cqes(NULL),
+    reg_base(NULL), reg_count(0), reg_size(0),
+    aio_thread(this)
+{
+  rotational = true;
+}
+
+int UringDevice::_lock()
+{
+  struct flock l;
+  memset(&l, 0, sizeof(l));
+  l.l_type = F_WRLCK;
+  l.l_whence = SEEK_SET;
+  l.l_start = 0;
+  l.l_len = 0;
+  int r = ::fcntl(fd_direct, F_SETLK, &l);
+  if (r < 0)
+    return -errno;
+  return 0;
+}
+
+int UringDevice::open(string p)
+{
+  path = p;
+  int r = 0;
+  dout(1) << __func__ << " path " << path << dendl;
+
+  fd_direct = ::open(path.c_str(), O_RDWR | O_DIRECT);
+  if (fd_direct < 0) {
+    int r = -errno;
+    derr << __func__ << " open got: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  fd_buffered = ::open(path.c_str(), O_RDWR);
+  if (fd_buffered < 0) {
+    r = -errno;
+    derr << __func__ << " open got: " << cpp_strerror(r) << dendl;
+    goto out_direct;
+  }
+
+  // disable readahead as it will wreak havoc on our mix of
+  // directio/aio and buffered io.
+  r = posix_fadvise(fd_buffered, 0, 0, POSIX_FADV_RANDOM);
+  if (r) {
+    r = -r;
+    derr << __func__ << " open got: " << cpp_strerror(r) << dendl;
+    goto out_fail;
+  }
+
+  r = _lock();
+  if (r < 0) {
+    derr << __func__ << " failed to lock " << path << ": " << cpp_strerror(r)
+	 << dendl;
+    goto out_fail;
+  }
+
+  struct stat st;
+  r = ::fstat(fd_direct, &st);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fstat got " << cpp_strerror(r) << dendl;
+    goto out_fail;
+  }
+  if (S_ISBLK(st.st_mode)) {
+    int64_t s;
+    r = get_block_device_size(fd_direct, &s);
+    if (r < 0) {
+      goto out_fail;
+    }
+
+    rotational = block_device_is_rotational(path.c_str());
+    size = s;
+  } else {
+    size = st.st_size;
+    //regular file is rotational device
+    rotational = true;
+  }
+
+  block_size = g_conf->bdev_block_size;
+  if (block_size != (unsigned)st.st_blksize) {
+    dout(1) << __func__ << " backing device/file reports st_blksize "
+	    << st.st_blksize << ", using bdev_block_size "
+	    << block_size << " anyway" << dendl;
+  }
+
+  fs = FS::create_by_fd(fd_direct);
+  assert(fs);
+
+  r = _ring_start();
+  if (r < 0) {
+    derr << __func__ << " failed to set up io_uring: " << cpp_strerror(r)
+	 << dendl;
+    goto out_fs;
+  }
+
+  dout(1) << __func__
+	  << " size " << size
+	  << " (0x" << std::hex << size << std::dec << ", "
+	  << pretty_si_t(size) << "B)"
+	  << " block_size " << block_size
+	  << " (" << pretty_si_t(block_size) << "B)"
+	  << " " << (rotational ? "rotational" : "non-rotational")
+	  << dendl;
+  return 0;
+
+ out_fs:
+  delete fs;
+  fs = NULL;
+ out_fail:
+  VOID_TEMP_FAILURE_RETRY(::close(fd_buffered));
+  fd_buffered = -1;
+ out_direct:
+  VOID_TEMP_FAILURE_RETRY(::close(fd_direct));
+  fd_direct = -1;
+  return r;
+}
+
+void UringDevice::close()
+{
+  dout(1) << __func__ << dendl;
+  _ring_stop();
+
+  assert(fs);
+  delete fs;
+  fs = NULL;
+
+  assert(fd_direct >= 0);
+  VOID_TEMP_FAILURE_RETRY(::close(fd_direct));
+  fd_direct = -1;
+
+  assert(fd_buffered >= 0);
+  VOID_TEMP_FAILURE_RETRY(::close(fd_buffered));
+  fd_buffered = -1;
+
+  path.clear();
+}
+
+int UringDevice::_ring_start()
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  sqpoll = g_conf->bdev_uring_sqpoll;
+  iopoll = g_conf->bdev_uring_iopoll;
+  if (sqpoll) {
+    p.flags |= IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = 1000;  // ms
+  }
+  if (iopoll) {
+    p.flags |= IORING_SETUP_IOPOLL;
+  }
+  ring_fd = sys_io_uring_setup(g_conf->bdev_uring_queue_depth, &p);
+  if (ring_fd < 0) {
+    return -errno;
+  }
+  sq_entries = p.sq_entries;
+  cq_entries = p.cq_entries;
+  if (!(p.features & IORING_FEAT_NODROP)) {
+    // we do not bound ios in flight by the cq size, so we rely on the
+    // kernel holding on to overflowed completions
+    derr << __func__ << " kernel io_uring lacks IORING_FEAT_NODROP" << dendl;
+    VOID_TEMP_FAILURE_RETRY(::close(ring_fd));
+    ring_fd = -1;
+    return -EOPNOTSUPP;
+  }
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  sq_ptr = ::mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  cq_ptr = ::mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+  void *s = ::mmap(NULL, sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || s == MAP_FAILED) {
+    int r = -errno;
+    if (sq_ptr != MAP_FAILED)
+      ::munmap(sq_ptr, sq_len);
+    if (cq_ptr != MAP_FAILED)
+      ::munmap(cq_ptr, cq_len);
+    if (s != MAP_FAILED)
+      ::munmap(s, sqes_len);
+    sq_ptr = cq_ptr = NULL;
+    VOID_TEMP_FAILURE_RETRY(::close(ring_fd));
+    ring_fd = -1;
+    return r;
+  }
+  sqes = static_cast<struct io_uring_sqe*>(s);
+
+  char *sp = static_cast<char*>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned*>(sp + p.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned*>(sp + p.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned*>(sp + p.sq_off.ring_mask);
+  sq_flags = reinterpret_cast<unsigned*>(sp + p.sq_off.flags);
+  sq_array = reinterpret_cast<unsigned*>(sp + p.sq_off.array);
+  char *cp = static_cast<char*>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned*>(cp + p.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned*>(cp + p.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned*>(cp + p.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe*>(cp + p.cq_off.cqes);
+
+  // registered file and buffers are optimizations; carry on without
+  // them if the kernel (or RLIMIT_MEMLOCK) will not let us.
+  int r = sys_io_uring_register(ring_fd, IORING_REGISTER_FILES, &fd_direct, 1);
+  fixed_file = (r == 0);
+  if (!fixed_file) {
+    dout(1) << __func__ << " unable to register fd: "
+	    << cpp_strerror(-errno) << dendl;
+  }
+
+  reg_count = g_conf->bdev_uring_registered_buffers;
+  reg_size = align_up((uint64_t)g_conf->bdev_uring_registered_buffer_size,
+		      block_size);
+  if (reg_count && reg_size) {
+    void *b;
+    r = ::posix_memalign(&b, CEPH_PAGE_SIZE, reg_count * reg_size);
+    assert(r == 0);
+    reg_base = static_cast<char*>(b);
+    vector<iovec> iov(reg_count);
+    for (unsigned i = 0; i < reg_count; ++i) {
+      iov[i].iov_base = reg_base + i * reg_size;
+      iov[i].iov_len = reg_size;
+    }
+    r = sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, &iov[0],
+			      reg_count);
+    if (r < 0) {
+      dout(1) << __func__ << " unable to register " << reg_count
+	      << " buffers: " << cpp_strerror(-errno) << dendl;
+      ::free(reg_base);
+      reg_base = NULL;
+      reg_count = 0;
+    }
+  } else {
+    reg_count = 0;
+  }
+  for (unsigned i = 0; i < reg_count; ++i) {
+    reg_free.push_back(i);
+  }
+
+  dout(10) << __func__ << " sq " << sq_entries << " cq " << cq_entries
+	   << (sqpoll ? " sqpoll" : "") << (iopoll ? " iopoll" : "")
+	   << (fixed_file ? " fixed_file" : "")
+	   << " " << reg_count << " x " << reg_size << " registered buffers"
+	   << dendl;
+  aio_thread.create("bstore_uring");
+  return 0;
+}
+
+void UringDevice::_ring_stop()
+{
+  dout(10) << __func__ << dendl;
+  {
+    std::lock_guard<std::mutex> l(inflight_lock);
+    aio_stop = true;
+    inflight_cond.notify_all();
+  }
+  aio_thread.join();
+  aio_stop = false;
+
+  ::munmap(sqes, sqes_len);
+  ::munmap(sq_ptr, sq_len);
+  ::munmap(cq_ptr, cq_len);
+  sqes = NULL;
+  sq_ptr = cq_ptr = NULL;
+  VOID_TEMP_FAILURE_RETRY(::close(ring_fd));
+  ring_fd = -1;
+  if (reg_base) {
+    ::free(reg_base);
+    reg_base = NULL;
+  }
+  reg_count = 0;
+  reg_free.clear();
+}
+
+int UringDevice::_get_reg_buf()
+{
+  std::lock_guard<std::mutex> l(reg_lock);
+  if (reg_free.empty())
+    return -1;
+  int i = reg_free.back();
+  reg_free.pop_back();
+  return i;
+}
+
+void UringDevice::_put_reg_buf(const void *p)
+{
+  const char *c = static_cast<const char*>(p);
+  if (!reg_base || c < reg_base || c >= reg_base + reg_count * reg_size)
+    return;
+  std::lock_guard<std::mutex> l(reg_lock);
+  reg_free.push_back((c - reg_base) / reg_size);
+}
+
+int UringDevice::flush()
+{
+  bool ret = io_since_flush.compare_and_swap(1, 0);
+  if (!ret) {
+    dout(10) << __func__ << " no-op (no ios since last flush)" << dendl;
+    return 0;
+  }
+  dout(10) << __func__ << " start" << dendl;
+  if (g_conf->bdev_inject_crash) {
+    // sleep for a moment to give other threads a chance to submit or
+    // wait on io that races with a flush.
+    derr << __func__ << " injecting crash. first we sleep..." << dendl;
+    sleep(g_conf->bdev_inject_crash_flush_delay);
+    derr << __func__ << " and now we die" << dendl;
+    g_ceph_context->_log->flush();
+    _exit(1);
+  }
+  utime_t start = ceph_clock_now(NULL);
+  int r = ::fdatasync(fd_direct);
+  utime_t end = ceph_clock_now(NULL);
+  utime_t dur = end - start;
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fdatasync got: " << cpp_strerror(r) << dendl;
+    assert(0);
+  }
+  dout(5) << __func__ << " in " << dur << dendl;;
+  return r;
+}
+
+int UringDevice::_reap(unsigned max)
+{
+  // we are the only consumer of the completion ring
+  unsigned head = *cq_head;
+  unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  FS::aio_t *aio[max];
+  unsigned n = 0;
+  while (head != tail && n < max) {
+    struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    aio[n] = reinterpret_cast<FS::aio_t*>(cqe->user_data);
+    aio[n]->rval = cqe->res;
+    ++head;
+    ++n;
+  }
+  if (n == 0)
+    return 0;
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+  {
+    std::lock_guard<std::mutex> l(inflight_lock);
+    inflight -= n;
+  }
+
+  dout(30) << __func__ << " got " << n << " completed aios" << dendl;
+  for (unsigned i = 0; i < n; ++i) {
+    IOContext *ioc = static_cast<IOContext*>(aio[i]->priv);
+    _aio_log_finish(ioc, aio[i]->offset, aio[i]->length);
+    if (aio[i]->iov.size() == 1) {
+      _put_reg_buf(aio[i]->iov[0].iov_base);
+    }
+    int left = --ioc->num_running;
+    int r = aio[i]->get_return_value();
+    dout(10) << __func__ << " finished aio " << aio[i] << " r " << r
+	     << " ioc " << ioc
+	     << " with " << left << " aios left" << dendl;
+    assert(r >= 0);
+    if (left == 0) {
+      // check waiting count before doing callback (which may
+      // destroy this ioc).
+      ioc->aio_wake();
+      if (ioc->priv) {
+	aio_callback(aio_callback_priv, ioc->priv);
+      }
+    }
+  }
+  return n;
+}
+
+void UringDevice::_aio_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  auto poll = std::chrono::microseconds(g_conf->bdev_uring_poll_us);
+  auto last = ceph::mono_clock::now();
+  while (true) {
+    if (_reap(16) > 0) {
+      last = ceph::mono_clock::now();
+      reap_ioc();
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> l(inflight_lock);
+      if (inflight == 0) {
+	if (aio_stop)
+	  break;
+	reap_ioc();
+	inflight_cond.wait_for(
+	  l, std::chrono::milliseconds(g_conf->bdev_aio_poll_ms));
+	last = ceph::mono_clock::now();
+	continue;
+      }
+    }
+    // with iopoll completions only show up when we ask the kernel to
+    // poll the device; otherwise spin on the shared ring for a bit
+    // before going to sleep in the kernel.
+    if (!iopoll && ceph::mono_clock::now() - last < poll) {
+      std::this_thread::yield();
+      continue;
+    }
+    int r = sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+    if (r < 0 && errno != EINTR && errno != EAGAIN) {
+      derr << __func__ << " io_uring_enter got " << cpp_strerror(-errno)
+	   << dendl;
+    }
+  }
+  dout(10) << __func__ << " end" << dendl;
+}
+
+void UringDevice::_aio_log_start(
+  IOContext *ioc,
+  uint64_t offset,
+  uint64_t length)
+{
+  dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  if (g_conf->bdev_debug_inflight_ios) {
+    Mutex::Locker l(debug_lock);
+    if (debug_inflight.intersects(offset, length)) {
+      derr << __func__ << " inflight overlap of 0x"
+	   << std::hex
+	   << offset << "~" << length << std::dec
+	   << " with " << debug_inflight << dendl;
+      assert(0);
+    }
+    debug_inflight.insert(offset, length);
+  }
+}
+
+void UringDevice::_aio_log_finish(
+  IOContext *ioc,
+  uint64_t offset,
+  uint64_t length)
+{
+  dout(20) << __func__ << " 0x"
+	   << std::hex << offset << "~" << length << std::dec << dendl;
+  if (g_conf->bdev_debug_inflight_ios) {
+    Mutex::Locker l(debug_lock);
+    debug_inflight.erase(offset, length);
+  }
+}
+
+void UringDevice::_submit_sqes(unsigned n)
+{
+  if (sqpoll) {
+    // the kernel thread picks up the new tail on its own unless it has
+    // gone idle
+    if (__atomic_load_n(sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+      sys_io_uring_enter(ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }
+    return;
+  }
+  int retries = 0;
+  while (n > 0) {
+    int r = sys_io_uring_enter(ring_fd, n, 0, 0);
+    if (r < 0) {
+      r = -errno;
+      if ((r == -EAGAIN || r == -EBUSY || r == -EINTR) && retries++ < 16) {
+	usleep(125 << std::min(retries, 8));
+	continue;
+      }
+      derr << __func__ << " io_uring_enter got " << cpp_strerror(r) << dendl;
+      assert(0 == "io_uring submit failed");
+    }
+    n -= r;
+  }
+  if (retries)
+    derr << __func__ << " retries " << retries << dendl;
+}
+
+void UringDevice::aio_submit(IOContext *ioc)
+{
+  dout(20) << __func__ << " ioc " << ioc
+	   << " pending " << ioc->num_pending.load()
+	   << " running " << ioc->num_running.load()
+	   << dendl;
+  // move these aside, and get our end iterator position now, as the
+  // aios might complete as soon as they are submitted and queue more
+  // wal aio's.
+  list<FS::aio_t>::iterator e = ioc->running_aios.begin();
+  ioc->running_aios.splice(e, ioc->pending_aios);
+  list<FS::aio_t>::iterator p = ioc->running_aios.begin();
+
+  int pending = ioc->num_pending.load();
+  ioc->num_running += pending;
+  ioc->num_pending -= pending;
+  assert(ioc->num_pending.load() == 0);  // we should be only thread doing this
+
+  std::lock_guard<std::mutex> sl(sq_lock);
+  unsigned queued = 0;
+  bool done = false;
+  while (!done) {
+    FS::aio_t& aio = *p;
+    aio.priv = static_cast<void*>(ioc);
+    dout(20) << __func__ << "  aio " << &aio << " fd " << aio.fd
+	     << " 0x" << std::hex << aio.offset << "~" << aio.length
+	     << std::dec << dendl;
+
+    // be careful: as soon as the tail is published we race with
+    // completion, so do not touch ioc after the last one.
+    ++p;
+    done = (p == e);
+
+    unsigned tail = *sq_tail;
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+      // the kernel consumes sqes on submit (or from its sqpoll thread),
+      // so we only wait for ring space here, never for completions
+      _submit_sqes(queued);
+      queued = 0;
+      while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+	std::this_thread::yield();
+      }
+    }
+    {
+      std::lock_guard<std::mutex> l(inflight_lock);
+      if (inflight++ == 0) {
+	inflight_cond.notify_all();
+      }
+    }
+
+    unsigned idx = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    if (aio.iocb.aio_lio_opcode == IO_CMD_PREAD) {
+      sqe->opcode = IORING_OP_READV;
+      aio.iov.resize(1);
+      aio.iov[0].iov_base = aio.iocb.u.c.buf;
+      aio.iov[0].iov_len = aio.iocb.u.c.nbytes;
+      sqe->addr = reinterpret_cast<uint64_t>(&aio.iov[0]);
+      sqe->len = 1;
+    } else if (aio.iov.size() == 1 && reg_base &&
+	       static_cast<char*>(aio.iov[0].iov_base) >= reg_base &&
+	       static_cast<char*>(aio.iov[0].iov_base) <
+	       reg_base + reg_count * reg_size) {
+      sqe->opcode = IORING_OP_WRITE_FIXED;
+      sqe->addr = reinterpret_cast<uint64_t>(aio.iov[0].iov_base);
+      sqe->len = aio.iov[0].iov_len;
+      sqe->buf_index =
+	(static_cast<char*>(aio.iov[0].iov_base) - reg_base) / reg_size;
+    } else {
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->addr = reinterpret_cast<uint64_t>(&aio.iov[0]);
+      sqe->len = aio.iov.size();
+    }
+    sqe->off = aio.offset;
+    if (fixed_file) {
+      sqe->fd = 0;
+      sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+      sqe->fd = aio.fd;
+    }
+    sqe->user_data = reinterpret_cast<uint64_t>(&aio);
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++queued;
+  }
+  _submit_sqes(queued);
+}
+
+int UringDevice::aio_write(
+  uint64_t off,
+  bufferlist &bl,
+  IOContext *ioc,
+  bool buffered)
+{
+  uint64_t len = bl.length();
+  dout(20) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	   << (buffered ? " (buffered)" : " (direct)")
+	   << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+
+  _aio_log_start(ioc, off, len);
+
+  if (!buffered) {
+    ioc->pending_aios.push_back(FS::aio_t(ioc, fd_direct));
+    ++ioc->num_pending;
+    FS::aio_t& aio = ioc->pending_aios.back();
+    int slot = -1;
+    if (g_conf->bdev_inject_crash &&
+	rand() % g_conf->bdev_inject_crash == 0) {
+      derr << __func__ << " bdev_inject_crash: dropping io 0x" << std::hex
+	   << off << "~" << len << std::dec
+	   << dendl;
+      // generate a real io so that aio_wait behaves properly, but make it
+      // a read instead of write, and toss the result.
+      aio.pread(off, len);
+    } else if (len <= reg_size && (slot = _get_reg_buf()) >= 0) {
+      // copy into a registered buffer; the kernel already has it pinned
+      char *buf = reg_base + slot * reg_size;
+      bl.copy(0, len, buf);
+      aio.iov.resize(1);
+      aio.iov[0].iov_base = buf;
+      aio.iov[0].iov_len = len;
+      aio.pwritev(off);
+    } else {
+      if (bl.rebuild_aligned_size_and_memory(block_size, block_size)) {
+	dout(20) << __func__ << " rebuilding buffer to be aligned" << dendl;
+      }
+      bl.prepare_iov(&aio.iov);
+      aio.bl.claim_append(bl);
+      aio.pwritev(off);
+    }
+    dout(5) << __func__ << " 0x" << std::hex << off << "~" << len
+	    << std::dec << " aio " << &aio
+	    << (slot >= 0 ? " (registered buffer)" : "") << dendl;
+  } else {
+    dout(5) << __func__ << " 0x" << std::hex << off << "~" << len
+	    << std::dec << " buffered" << dendl;
+    if (g_conf->bdev_inject_crash &&
+	rand() % g_conf->bdev_inject_crash == 0) {
+      derr << __func__ << " bdev_inject_crash: dropping io 0x" << std::hex
+	   << off << "~" << len << std::dec << dendl;
+      return 0;
+    }
+    vector<iovec> iov;
+    bl.prepare_iov(&iov);
+    int r = ::pwritev(fd_buffered, &iov[0], iov.size(), off);
+    _aio_log_finish(ioc, off, bl.length());
+
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << " pwritev error: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    // initiate IO (but do not wait)
+    r = ::sync_file_range(fd_buffered, off, len, SYNC_FILE_RANGE_WRITE);
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << " sync_file_range error: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+
+  io_since_flush.set(1);
+  return 0;
+}
+
+int UringDevice::read(uint64_t off, uint64_t len, bufferlist *pbl,
+		      IOContext *ioc,
+		      bool buffered)
+{
+  dout(5) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	  << (buffered ? " (buffered)" : " (direct)")
+	  << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+
+  _aio_log_start(ioc, off, len);
+  ++ioc->num_reading;
+
+  bufferptr p = buffer::create_page_aligned(len);
+  int r = ::pread(buffered ? fd_buffered : fd_direct,
+		  p.c_str(), len, off);
+  if (r < 0) {
+    r = -errno;
+    goto out;
+  }
+  assert((uint64_t)r == len);
+  pbl->clear();
+  pbl->push_back(std::move(p));
+
+  dout(40) << "data: ";
+  pbl->hexdump(*_dout);
+  *_dout << dendl;
+
+ out:
+  _aio_log_finish(ioc, off, len);
+  --ioc->num_reading;
+  ioc->aio_wake();
+  return r < 0 ? r : 0;
+}
+
+int UringDevice::direct_read_unaligned(uint64_t off, uint64_t len, char *buf)
+{
+  uint64_t aligned_off = align_down(off, block_size);
+  uint64_t aligned_len = align_up(off+len, block_size) - aligned_off;
+  bufferptr p = buffer::create_page_aligned(aligned_len);
+  int r = 0;
+
+  r = ::pread(fd_direct, p.c_str(), aligned_len, aligned_off);
+  if (r < 0) {
+    r = -errno;
+    goto out;
+  }
+  assert((uint64_t)r == aligned_len);
+  memcpy(buf, p.c_str() + (off - aligned_off), len);
+
+ out:
+  return r < 0 ? r : 0;
+}
+
+int UringDevice::read_random(uint64_t off, uint64_t len, char *buf,
+			     bool buffered)
+{
+  dout(5) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	  << dendl;
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+  int r = 0;
+
+  //if it's direct io and unaligned, we have to use a internal buffer
+  if (!buffered && ((off % block_size != 0)
+                    || (len % block_size != 0)
+                    || (uintptr_t(buf) % CEPH_PAGE_SIZE != 0)))
+    return direct_read_unaligned(off, len, buf);
+
+  char *t = buf;
+  uint64_t left = len;
+  while (left > 0) {
+    r = ::pread(buffered ? fd_buffered : fd_direct, t, left, off);
+    if (r < 0) {
+      r = -errno;
+      goto out;
+    }
+    off += r;
+    t += r;
+    left -= r;
+  }
+
+ out:
+  return r < 0 ? r : 0;
+}
+
+int UringDevice::invalidate_cache(uint64_t off, uint64_t len)
+{
+  dout(5) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	  << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  int r = posix_fadvise(fd_buffered, off, len, POSIX_FADV_DONTNEED);
+  if (r) {
+    r = -r;
+    derr << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	 << " error: " << cpp_strerror(r) << dendl;
+  }
+  return r;
+}
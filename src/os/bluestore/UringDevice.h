@@ -0,0 +1,132 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_BLUESTORE_URINGDEVICE_H
+#define CEPH_OS_BLUESTORE_URINGDEVICE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <linux/io_uring.h>
+
+#include "os/fs/FS.h"
+#include "include/interval_set.h"
+
+#include "BlockDevice.h"
+
+/**
+ * BlockDevice on top of an io_uring submission/completion ring pair
+ *
+ * Submitters fill sqes directly in the shared submission ring, and the
+ * completion thread reaps cqes from the shared completion ring without
+ * a syscall, spinning for bdev_uring_poll_us before it sleeps in the
+ * kernel.  Small direct writes are copied into a pool of registered
+ * buffers and issued as fixed-buffer writes, which saves pinning the
+ * pages on every io.  The device fd is registered as well.
+ */
+class UringDevice : public BlockDevice {
+  int fd_direct, fd_buffered;
+  uint64_t size;
+  uint64_t block_size;
+  string path;
+  FS *fs;
+
+  Mutex debug_lock;
+  interval_set<uint64_t> debug_inflight;
+
+  Mutex flush_lock;
+  atomic_t io_since_flush;
+
+  aio_callback_t aio_callback;
+  void *aio_callback_priv;
+  std::atomic<bool> aio_stop = {false};
+
+  // -- ring --
+  int ring_fd;
+  bool sqpoll, iopoll;
+  bool fixed_file;                 ///< fd_direct is registered as file 0
+  unsigned sq_entries, cq_entries;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len;
+  io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  io_uring_cqe *cqes;
+
+  std::mutex sq_lock;              ///< serializes submitters
+  std::mutex inflight_lock;
+  std::condition_variable inflight_cond;  ///< wakes an idle completion thread
+  unsigned inflight = 0;           ///< submitted, not yet reaped
+
+  // -- registered buffers --
+  char *reg_base;                  ///< one region, split in reg_count slots
+  unsigned reg_count;
+  uint64_t reg_size;
+  std::mutex reg_lock;
+  vector<unsigned> reg_free;
+
+  struct AioCompletionThread : public Thread {
+    UringDevice *bdev;
+    explicit AioCompletionThread(UringDevice *b) : bdev(b) {}
+    void *entry() {
+      bdev->_aio_thread();
+      return NULL;
+    }
+  } aio_thread;
+
+  void _aio_thread();
+  int _ring_start();
+  void _ring_stop();
+  int _reap(unsigned max);
+  void _submit_sqes(unsigned n);
+
+  int _get_reg_buf();
+  void _put_reg_buf(const void *p);
+
+  void _aio_log_start(IOContext *ioc, uint64_t offset, uint64_t length);
+  void _aio_log_finish(IOContext *ioc, uint64_t offset, uint64_t length);
+
+  int _lock();
+
+  int direct_read_unaligned(uint64_t off, uint64_t len, char *buf);
+
+public:
+  UringDevice(aio_callback_t cb, void *cbpriv);
+
+  void aio_submit(IOContext *ioc) override;
+
+  uint64_t get_size() const override {
+    return size;
+  }
+  uint64_t get_block_size() const override {
+    return block_size;
+  }
+
+  int read(uint64_t off, uint64_t len, bufferlist *pbl,
+	   IOContext *ioc,
+	   bool buffered) override;
+  int read_random(uint64_t off, uint64_t len, char *buf, bool buffered) override;
+
+  int aio_write(uint64_t off, bufferlist& bl,
+		IOContext *ioc,
+		bool buffered) override;
+  int flush() override;
+
+  // for managing buffered readers/writers
+  int invalidate_cache(uint64_t off, uint64_t len) override;
+  int open(string path) override;
+  void close() override;
+};
+
+#endif
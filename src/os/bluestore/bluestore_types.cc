@@ -724,23 +724,23 @@ void bluestore_blob_t::calc_csum(uint64_t b_off, const bufferlist& bl)
 {
   switch (csum_type) {
   case CSUM_XXHASH32:
-    Checksummer::calculate<Checksummer::xxhash32>(
+    Checksummer::calculate_batch<Checksummer::xxhash32>(
       get_csum_chunk_size(), b_off, bl.length(), bl, &csum_data);
     break;
   case CSUM_XXHASH64:
-    Checksummer::calculate<Checksummer::xxhash64>(
+    Checksummer::calculate_batch<Checksummer::xxhash64>(
       get_csum_chunk_size(), b_off, bl.length(), bl, &csum_data);
     break;;
   case CSUM_CRC32C:
-    Checksummer::calculate<Checksummer::crc32c>(
+    Checksummer::calculate_batch<Checksummer::crc32c>(
       get_csum_chunk_size(), b_off, bl.length(), bl, &csum_data);
     break;
   case CSUM_CRC32C_16:
-    Checksummer::calculate<Checksummer::crc32c_16>(
+    Checksummer::calculate_batch<Checksummer::crc32c_16>(
       get_csum_chunk_size(), b_off, bl.length(), bl, &csum_data);
     break;
   case CSUM_CRC32C_8:
-    Checksummer::calculate<Checksummer::crc32c_8>(
+    Checksummer::calculate_batch<Checksummer::crc32c_8>(
       get_csum_chunk_size(), b_off, bl.length(), bl, &csum_data);
     break;
   }
@@ -756,23 +756,23 @@ int bluestore_blob_t::verify_csum(uint64_t b_off, const bufferlist& bl,
   case CSUM_NONE:
     break;
   case CSUM_XXHASH32:
-    *b_bad_off = Checksummer::verify<Checksummer::xxhash32>(
+    *b_bad_off = Checksummer::verify_batch<Checksummer::xxhash32>(
       get_csum_chunk_size(), b_off, bl.length(), bl, csum_data);
     break;
   case CSUM_XXHASH64:
-    *b_bad_off = Checksummer::verify<Checksummer::xxhash64>(
+    *b_bad_off = Checksummer::verify_batch<Checksummer::xxhash64>(
       get_csum_chunk_size(), b_off, bl.length(), bl, csum_data);
     break;
   case CSUM_CRC32C:
-    *b_bad_off = Checksummer::verify<Checksummer::crc32c>(
+    *b_bad_off = Checksummer::verify_batch<Checksummer::crc32c>(
       get_csum_chunk_size(), b_off, bl.length(), bl, csum_data);
     break;
   case CSUM_CRC32C_16:
-    *b_bad_off = Checksummer::verify<Checksummer::crc32c_16>(
+    *b_bad_off = Checksummer::verify_batch<Checksummer::crc32c_16>(
       get_csum_chunk_size(), b_off, bl.length(), bl, csum_data);
     break;
   case CSUM_CRC32C_8:
-    *b_bad_off = Checksummer::verify<Checksummer::crc32c_8>(
+    *b_bad_off = Checksummer::verify_batch<Checksummer::crc32c_8>(
       get_csum_chunk_size(), b_off, bl.length(), bl, csum_data);
     break;
   default:
@@ -1003,8 +1003,10 @@ void FileJournal::queue_completions_thru(uint64_t seq)
     }
     if (next.finish)
       finisher->queue(next.finish);
-    if (next.tracked_op)
+    if (next.tracked_op) {
+      next.tracked_op->mark_stage(TRACKED_OP_STAGE_JOURNAL_WRITTEN);
       next.tracked_op->mark_event("journaled_completion_queued");
+    }
     items.erase(it++);
   }
   batch_unpop_completions(items);
@@ -1668,8 +1670,10 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, uint32_t orig_len,
 	  << " (" << oncommit << ")" << dendl;
   assert(e.length() > 0);
 
-  if (osd_op)
+  if (osd_op) {
+    osd_op->mark_stage(TRACKED_OP_STAGE_JOURNAL_QUEUED);
     osd_op->mark_event("commit_queued_for_journal_write");
+  }
   if (logger) {
     logger->inc(l_os_jq_bytes, orig_len);
     logger->inc(l_os_jq_ops, 1);
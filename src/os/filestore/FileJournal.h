@@ -455,6 +455,9 @@ private:
   void flush();
 
   void reserve_throttle_and_backoff(uint64_t count);
+  bool throttle_would_block(uint64_t count) {
+    return throttle.should_wait(count);
+  }
 
   bool is_writeable() {
     return read_pos == 0;
@@ -2044,6 +2044,13 @@ struct C_JournaledAhead : public Context {
   }
 };
 
+bool FileStore::throttle_would_block(uint64_t bytes)
+{
+  if (throttle_ops.should_wait(1) || throttle_bytes.should_wait(bytes))
+    return true;
+  return journal && journal->throttle_would_block(bytes);
+}
+
 int FileStore::queue_transactions(Sequencer *posr, vector<Transaction>& tls,
 				  TrackedOpRef osd_op,
 				  ThreadPool::TPHandle *handle)
@@ -476,6 +476,7 @@ public:
   int queue_transactions(Sequencer *osr, vector<Transaction>& tls,
 			 TrackedOpRef op = TrackedOpRef(),
 			 ThreadPool::TPHandle *handle = NULL);
+  bool throttle_would_block(uint64_t bytes);
 
   /**
    * set replay guard xattr on given file
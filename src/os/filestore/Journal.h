@@ -58,6 +58,14 @@ public:
    */
   virtual void reserve_throttle_and_backoff(uint64_t count) = 0;
 
+  /**
+   * throttle_would_block
+   *
+   * True if reserve_throttle_and_backoff(count) would wait right now.
+   * Only a hint; the answer may change before the reservation is made.
+   */
+  virtual bool throttle_would_block(uint64_t count) { return false; }
+
   virtual int dump(ostream& out) { return -EOPNOTSUPP; }
 
   void set_wait_on_full(bool b) { wait_on_full = b; }
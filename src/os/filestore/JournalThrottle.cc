@@ -65,3 +65,8 @@ uint64_t JournalThrottle::get_max()
 {
   return throttle.get_max();
 }
+
+bool JournalThrottle::should_wait(uint64_t c)
+{
+  return throttle.should_wait(c);
+}
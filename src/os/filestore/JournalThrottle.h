@@ -93,6 +93,9 @@ public:
   uint64_t get_current();
   uint64_t get_max();
 
+  /// true if get(c) would block or back off right now
+  bool should_wait(uint64_t c);
+
   JournalThrottle(
     unsigned expected_concurrency ///< [in] determines size of conds
     ) : throttle(expected_concurrency) {}
@@ -77,6 +77,7 @@ ostream &operator<<(ostream &lhs, const ECBackend::read_request_t &rhs)
   return lhs << "read_request_t(to_read=[" << rhs.to_read << "]"
 	     << ", need=" << rhs.need
 	     << ", want_attrs=" << rhs.want_attrs
+	     << ", subchunks=" << rhs.subchunks
 	     << ")";
 }
 
@@ -218,7 +219,8 @@ struct RecoveryMessages {
     ECBackend *ec,
     const hobject_t &hoid, uint64_t off, uint64_t len,
     const set<pg_shard_t> &need,
-    bool attrs) {
+    bool attrs,
+    const map<pg_shard_t, vector<pair<int, int> > > &subchunks) {
     list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
     to_read.push_back(boost::make_tuple(off, len, 0));
     assert(!reads.count(hoid));
@@ -232,7 +234,8 @@ struct RecoveryMessages {
 	  attrs,
 	  new OnRecoveryReadComplete(
 	    ec,
-	    hoid))));
+	    hoid),
+	  subchunks)));
   }
 
   map<pg_shard_t, vector<PushOp> > pushes;
@@ -365,8 +368,6 @@ void ECBackend::handle_recovery_read_complete(
     from[i->first.shard].claim(i->second);
   }
   dout(10) << __func__ << ": " << from << dendl;
-  int r = ECUtil::decode(sinfo, ec_impl, from, target);
-  assert(r == 0);
   if (attrs) {
     op.xattrs.swap(*attrs);
 
@@ -400,6 +401,27 @@ void ECBackend::handle_recovery_read_complete(
   }
   assert(op.xattrs.size());
   assert(op.obc);
+  int r;
+  if (op.subchunks.empty()) {
+    r = ECUtil::decode(sinfo, ec_impl, from, target);
+  } else {
+    // the helpers sent the sub-chunks of every chunk up to the end of
+    // the object, the length of the chunks is known from its size
+    map<int, vector<pair<int, int> > > subchunks;
+    for (map<pg_shard_t, vector<pair<int, int> > >::iterator i =
+	   op.subchunks.begin();
+	 i != op.subchunks.end();
+	 ++i)
+      subchunks[i->first.shard] = i->second;
+    uint64_t end = MIN(
+      op.extent_requested.first + op.extent_requested.second,
+      sinfo.logical_to_next_stripe_offset(op.obc->obs.oi.size));
+    uint64_t chunk_length = end > op.extent_requested.first ?
+      sinfo.aligned_logical_offset_to_chunk_offset(
+	end - op.extent_requested.first) : 0;
+    r = ECUtil::repair(sinfo, ec_impl, subchunks, from, chunk_length, target);
+  }
+  assert(r == 0);
   continue_recovery_op(op, m);
 }
 
@@ -495,8 +517,10 @@ void ECBackend::continue_recovery_op(
       set<int> want(op.missing_on_shards.begin(), op.missing_on_shards.end());
       set<pg_shard_t> to_read;
       uint64_t recovery_max_chunk = get_recovery_chunk_size();
+      op.subchunks.clear();
       int r = get_min_avail_to_read_shards(
-	op.hoid, want, true, false, &to_read);
+	op.hoid, want, true, false, &to_read,
+	ec_impl->get_sub_chunk_count() > 1 ? &op.subchunks : 0);
       if (r != 0) {
 	// we must have lost a recovery source
 	assert(!op.recovery_progress.first);
@@ -512,7 +536,8 @@ void ECBackend::continue_recovery_op(
 	op.recovery_progress.data_recovered_to,
 	recovery_max_chunk,
 	to_read,
-	op.recovery_progress.first);
+	op.recovery_progress.first,
+	op.subchunks);
       op.extent_requested = make_pair(op.recovery_progress.data_recovered_to,
 				      recovery_max_chunk);
       dout(10) << __func__ << ": IDLE return " << op << dendl;
@@ -884,6 +909,9 @@ void ECBackend::handle_sub_write(
   tls.reserve(2);
   tls.push_back(std::move(localt));
   tls.push_back(std::move(op.t));
+  // msg is the client op for the primary's own shard
+  if (msg && from == get_parent()->whoami_shard())
+    msg->mark_stage(TRACKED_OP_STAGE_TXN_SUBMITTED);
   get_parent()->queue_transactions(tls, msg);
 }
 
@@ -898,6 +926,14 @@ void ECBackend::handle_sub_read(
       i != op.to_read.end();
       ++i) {
     int r = 0;
+    // whole chunks are read at once
+    map<hobject_t, vector<pair<int, int> >, hobject_t::BitwiseComparator>::iterator s =
+      op.subchunks.find(i->first);
+    if (s != op.subchunks.end() &&
+	s->second.size() == 1 &&
+	s->second.front().first == 0 &&
+	s->second.front().second == (int)ec_impl->get_sub_chunk_count())
+      s = op.subchunks.end();
     ECUtil::HashInfoRef hinfo = get_hash_info(i->first);
     if (!hinfo) {
       r = -EIO;
@@ -908,13 +944,23 @@ void ECBackend::handle_sub_read(
     for (list<boost::tuple<uint64_t, uint64_t, uint32_t> >::iterator j =
 	   i->second.begin(); j != i->second.end(); ++j) {
       bufferlist bl;
-      r = store->read(
-	ch,
-	ghobject_t(i->first, ghobject_t::NO_GEN, shard),
-	j->get<0>(),
-	j->get<1>(),
-	bl, j->get<2>(),
-	true); // Allow EIO return
+      if (s != op.subchunks.end()) {
+	r = read_subchunks(
+	  i->first,
+	  j->get<0>(),
+	  j->get<1>(),
+	  j->get<2>(),
+	  s->second,
+	  &bl);
+      } else {
+	r = store->read(
+	  ch,
+	  ghobject_t(i->first, ghobject_t::NO_GEN, shard),
+	  j->get<0>(),
+	  j->get<1>(),
+	  bl, j->get<2>(),
+	  true); // Allow EIO return
+      }
       if (r < 0) {
 	get_parent()->clog_error() << __func__
 				   << ": Error " << r
@@ -936,7 +982,8 @@ void ECBackend::handle_sub_read(
       // are read in sections, so the digest check here won't be done here.
       // Do NOT check osd_read_eio_on_bad_digest here.  We need to report
       // the state of our chunk in case other chunks could substitute.
-      if ((bl.length() == hinfo->get_total_chunk_size()) &&
+      if (hinfo->has_chunk_hash() &&
+	  (bl.length() == hinfo->get_total_chunk_size()) &&
 	  (j->get<0>() == 0)) {
 	dout(20) << __func__ << ": Checking hash of " << i->first << dendl;
 	bufferhash h(-1);
@@ -979,6 +1026,43 @@ error:
   reply->tid = op.tid;
 }
 
+int ECBackend::read_subchunks(
+  const hobject_t &hoid,
+  uint64_t off,
+  uint64_t len,
+  uint32_t flags,
+  const vector<pair<int, int> > &subchunks,
+  bufferlist *bl)
+{
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t sub_chunk_size = chunk_size / ec_impl->get_sub_chunk_count();
+  assert(off % chunk_size == 0);
+  ghobject_t goid(hoid, ghobject_t::NO_GEN,
+		  get_parent()->whoami_shard().shard);
+  for (uint64_t base = off; base < off + len; base += chunk_size) {
+    for (vector<pair<int, int> >::const_iterator i = subchunks.begin();
+	 i != subchunks.end();
+	 ++i) {
+      bufferlist tmp;
+      uint64_t sub_len = i->second * sub_chunk_size;
+      int r = store->read(
+	ch,
+	goid,
+	base + i->first * sub_chunk_size,
+	sub_len,
+	tmp, flags,
+	true); // Allow EIO return
+      if (r < 0)
+	return r;
+      bl->claim_append(tmp);
+      // the chunks end with the object
+      if ((uint64_t)r < sub_len)
+	return bl->length();
+    }
+  }
+  return bl->length();
+}
+
 void ECBackend::handle_sub_write_reply(
   pg_shard_t from,
   ECSubWriteReply &op)
@@ -988,6 +1072,11 @@ void ECBackend::handle_sub_write_reply(
   if (op.committed) {
     assert(i->second.pending_commit.count(from));
     i->second.pending_commit.erase(from);
+    if (i->second.client_op) {
+      i->second.client_op->mark_stage(
+	from == get_parent()->whoami_shard() ?
+	  TRACKED_OP_STAGE_LOCAL_COMMIT : TRACKED_OP_STAGE_REPLICA_COMMIT);
+    }
     if (from != get_parent()->whoami_shard()) {
       get_parent()->update_peer_last_complete_ondisk(from, op.last_complete);
     }
@@ -1253,11 +1342,22 @@ void ECBackend::check_recovery_sources(const OSDMapRef osdmap)
     assert(j != tid_to_read_map.end());
     filter_read_op(osdmap, j->second);
   }
+
+  // shards may have come back, retry an overwrite whose reads failed;
+  // the reads still in flight are not resent
+  if (!waiting_reads.empty() && waiting_reads.front()->rmw_blocked) {
+    Op *op = waiting_reads.front();
+    dout(10) << __func__ << ": retrying reads for " << *op << dendl;
+    op->rmw_blocked = false;
+    op->rmw_started = false;
+    check_waiting();
+  }
 }
 
 void ECBackend::on_change()
 {
   dout(10) << __func__ << dendl;
+  waiting_reads.clear();
   writing.clear();
   tid_to_op_map.clear();
   for (map<ceph_tid_t, ReadOp>::iterator i = tid_to_read_map.begin();
@@ -1328,6 +1428,11 @@ struct MustPrependHashInfo : public ObjectModDesc::Visitor {
       state = FOUND_APPEND;
     }
   }
+  void rollback_extents(version_t, uint64_t, uint64_t, uint64_t) {
+    if (state == EMPTY) {
+      state = FOUND_APPEND;
+    }
+  }
   void rmobject(version_t) {
     if (state == EMPTY) {
       state = FOUND_CREATE_STASH;
@@ -1393,39 +1498,204 @@ void ECBackend::submit_transaction(
 	ref));
   }
 
-  for (vector<pg_log_entry_t>::iterator i = op->log_entries.begin();
-       i != op->log_entries.end();
+  dout(10) << __func__ << ": op " << *op << " queued" << dendl;
+  waiting_reads.push_back(op);
+  check_waiting();
+  dout(10) << "onreadable_sync: " << op->on_local_applied_sync << dendl;
+}
+
+bool ECBackend::rmw_must_wait(Op *op)
+{
+  // the chunks must be read after the earlier writes to the same
+  // objects are on disk
+  for (list<Op*>::iterator i = writing.begin(); i != writing.end(); ++i) {
+    if ((*i)->pending_apply.empty())
+      continue;
+    for (map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator>::iterator j =
+	   op->rmw_reads.begin();
+	 j != op->rmw_reads.end();
+	 ++j) {
+      if ((*i)->unstable_hash_infos.count(j->first))
+	return true;
+    }
+  }
+  return false;
+}
+
+void ECBackend::check_waiting()
+{
+  while (!waiting_reads.empty()) {
+    Op *op = waiting_reads.front();
+    if (!op->rmw_planned) {
+      op->t->get_overwrite_reads(
+	op->unstable_hash_infos,
+	ec_impl,
+	sinfo,
+	&(op->rmw_reads));
+      op->rmw_planned = true;
+    }
+    if (!op->rmw_reads.empty()) {
+      if (op->rmw_blocked) {
+	dout(10) << __func__ << ": op " << *op
+		 << " blocked on failed reads" << dendl;
+	return;
+      }
+      if (!op->rmw_started) {
+	if (rmw_must_wait(op)) {
+	  dout(10) << __func__ << ": op " << *op
+		   << " waiting for earlier writes to apply" << dendl;
+	  return;
+	}
+	start_rmw_reads(op);
+      }
+      return;
+    }
+    waiting_reads.pop_front();
+    dout(10) << __func__ << ": op " << *op << " starting" << dendl;
+    start_write(op);
+    writing.push_back(op);
+  }
+}
+
+struct OnRMWReadComplete :
+  public GenContext<pair<RecoveryMessages*, ECBackend::read_result_t& > &> {
+  ECBackend *ec;
+  ceph_tid_t tid;
+  hobject_t hoid;
+  OnRMWReadComplete(ECBackend *ec, ceph_tid_t tid, const hobject_t &hoid)
+    : ec(ec), tid(tid), hoid(hoid) {}
+  void finish(pair<RecoveryMessages *, ECBackend::read_result_t &> &in) {
+    ec->handle_rmw_read(tid, hoid, in.second);
+  }
+};
+
+void ECBackend::start_rmw_reads(Op *op)
+{
+  map<hobject_t, read_request_t, hobject_t::BitwiseComparator> for_read_op;
+  for (map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator>::iterator i =
+	 op->rmw_reads.begin();
+       i != op->rmw_reads.end();
        ++i) {
-    MustPrependHashInfo vis;
-    i->mod_desc.visit(&vis);
-    if (vis.must_prepend_hash_info()) {
-      dout(10) << __func__ << ": stashing HashInfo for "
-	       << i->soid << " for entry " << *i << dendl;
-      assert(op->unstable_hash_infos.count(i->soid));
-      ObjectModDesc desc;
-      map<string, boost::optional<bufferlist> > old_attrs;
-      bufferlist old_hinfo;
-      ::encode(*(op->unstable_hash_infos[i->soid]), old_hinfo);
-      old_attrs[ECUtil::get_hinfo_key()] = old_hinfo;
-      desc.setattrs(old_attrs);
-      i->mod_desc.swap(desc);
-      i->mod_desc.claim_append(desc);
-      assert(i->mod_desc.can_rollback());
+    // a retry only resends the reads that failed
+    if (op->rmw_in_flight.count(i->first))
+      continue;
+    set<pg_shard_t> shards;
+    int r = get_min_avail_to_read_shards(
+      i->first,
+      i->second.shards,
+      false,
+      false,
+      &shards);
+    if (r < 0) {
+      block_rmw(op, i->first, r);
+      return;
     }
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
+    for (interval_set<uint64_t>::iterator j = i->second.extents.begin();
+	 j != i->second.extents.end();
+	 ++j) {
+      to_read.push_back(boost::make_tuple(j.get_start(), j.get_len(), 0));
+    }
+    for_read_op.insert(
+      make_pair(
+	i->first,
+	read_request_t(
+	  i->first,
+	  to_read,
+	  shards,
+	  false,
+	  new OnRMWReadComplete(this, op->tid, i->first))));
+  }
+  dout(10) << __func__ << ": op " << *op << " reading "
+	   << for_read_op.size() << " of " << op->rmw_reads.size()
+	   << " objects" << dendl;
+  op->rmw_started = true;
+  if (for_read_op.empty())
+    return;
+  for (map<hobject_t, read_request_t, hobject_t::BitwiseComparator>::iterator i =
+	 for_read_op.begin();
+       i != for_read_op.end();
+       ++i) {
+    op->rmw_in_flight.insert(i->first);
+  }
+  start_read_op(
+    CEPH_MSG_PRIO_DEFAULT,
+    for_read_op,
+    op->client_op,
+    false,
+    false);
+}
+
+void ECBackend::block_rmw(Op *op, const hobject_t &hoid, int r)
+{
+  get_parent()->clog_error() << __func__ << ": cannot read " << hoid
+			     << " for overwrite: " << cpp_strerror(r)
+			     << ", blocking writes until shards recover";
+  dout(10) << __func__ << ": op " << *op << " blocked" << dendl;
+  op->rmw_blocked = true;
+}
+
+void ECBackend::handle_rmw_read(
+  ceph_tid_t tid,
+  const hobject_t &hoid,
+  read_result_t &res)
+{
+  map<ceph_tid_t, Op>::iterator iter = tid_to_op_map.find(tid);
+  assert(iter != tid_to_op_map.end());
+  Op *op = &(iter->second);
+  map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator>::iterator plan =
+    op->rmw_reads.find(hoid);
+  assert(plan != op->rmw_reads.end());
+  assert(op->rmw_in_flight.count(hoid));
+  op->rmw_in_flight.erase(hoid);
+  if (res.r != 0) {
+    // the other objects of this read still complete, but the op stays
+    // at the front of waiting_reads until the retry succeeds
+    block_rmw(op, hoid, res.r);
+    return;
   }
 
-  dout(10) << __func__ << ": op " << *op << " starting" << dendl;
-  start_write(op);
-  writing.push_back(op);
-  dout(10) << "onreadable_sync: " << op->on_local_applied_sync << dendl;
+  ECTransaction::read_chunks_t &chunks = op->read_chunks[hoid];
+  for (list<boost::tuple<uint64_t, uint64_t, map<pg_shard_t, bufferlist> > >::iterator i =
+	 res.returned.begin();
+       i != res.returned.end();
+       ++i) {
+    uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+      i->get<0>());
+    map<int, bufferlist> to_decode;
+    for (map<pg_shard_t, bufferlist>::iterator j = i->get<2>().begin();
+	 j != i->get<2>().end();
+	 ++j) {
+      to_decode[j->first.shard].claim(j->second);
+    }
+    map<int, bufferlist*> out;
+    for (set<int>::iterator j = plan->second.shards.begin();
+	 j != plan->second.shards.end();
+	 ++j) {
+      map<int, bufferlist>::iterator have = to_decode.find(*j);
+      if (have != to_decode.end())
+	chunks[*j][chunk_off] = have->second;
+      else
+	out[*j] = &(chunks[*j][chunk_off]);
+    }
+    if (!out.empty()) {
+      int r = ECUtil::decode(sinfo, ec_impl, to_decode, out);
+      assert(r == 0);
+    }
+  }
+  op->rmw_reads.erase(plan);
+  dout(10) << __func__ << ": op " << *op << " read " << hoid << dendl;
+  check_waiting();
 }
 
+
 int ECBackend::get_min_avail_to_read_shards(
   const hobject_t &hoid,
   const set<int> &want,
   bool for_recovery,
   bool do_redundant_reads,
-  set<pg_shard_t> *to_read)
+  set<pg_shard_t> *to_read,
+  map<pg_shard_t, vector<pair<int, int> > > *subchunks)
 {
   // Make sure we don't do redundant reads for recovery
   assert(!for_recovery || !do_redundant_reads);
@@ -1486,7 +1756,18 @@ int ECBackend::get_min_avail_to_read_shards(
   }
 
   set<int> need;
-  int r = ec_impl->minimum_to_decode(want, have, &need);
+  map<int, vector<pair<int, int> > > need_subchunks;
+  int r;
+  if (subchunks) {
+    r = ec_impl->minimum_to_repair(want, have, &need_subchunks);
+    for (map<int, vector<pair<int, int> > >::iterator i =
+	   need_subchunks.begin();
+	 i != need_subchunks.end();
+	 ++i)
+      need.insert(i->first);
+  } else {
+    r = ec_impl->minimum_to_decode(want, have, &need);
+  }
   if (r < 0)
     return r;
 
@@ -1502,6 +1783,8 @@ int ECBackend::get_min_avail_to_read_shards(
        ++i) {
     assert(shards.count(shard_id_t(*i)));
     to_read->insert(shards[shard_id_t(*i)]);
+    if (subchunks)
+      (*subchunks)[shards[shard_id_t(*i)]] = need_subchunks[*i];
   }
   return 0;
 }
@@ -1577,6 +1860,10 @@ void ECBackend::start_read_op(
 	messages[*j].attrs_to_read.insert(i->first);
 	need_attrs = false;
       }
+      map<pg_shard_t, vector<pair<int, int> > >::const_iterator s =
+	i->second.subchunks.find(*j);
+      if (s != i->second.subchunks.end())
+	messages[*j].subchunks[i->first] = s->second;
       op.obj_to_source[i->first].insert(*j);
       op.source_to_obj[*j].insert(i->first);
     }
@@ -1768,9 +2055,31 @@ void ECBackend::check_op(Op *op)
        ++i) {
     dout(20) << __func__ << " tid " << i->first <<": " << i->second << dendl;
   }
+  check_waiting();
 }
 
 void ECBackend::start_write(Op *op) {
+  for (vector<pg_log_entry_t>::iterator i = op->log_entries.begin();
+       i != op->log_entries.end();
+       ++i) {
+    MustPrependHashInfo vis;
+    i->mod_desc.visit(&vis);
+    if (vis.must_prepend_hash_info()) {
+      dout(10) << __func__ << ": stashing HashInfo for "
+	       << i->soid << " for entry " << *i << dendl;
+      assert(op->unstable_hash_infos.count(i->soid));
+      ObjectModDesc desc;
+      map<string, boost::optional<bufferlist> > old_attrs;
+      bufferlist old_hinfo;
+      ::encode(*(op->unstable_hash_infos[i->soid]), old_hinfo);
+      old_attrs[ECUtil::get_hinfo_key()] = old_hinfo;
+      desc.setattrs(old_attrs);
+      i->mod_desc.swap(desc);
+      i->mod_desc.claim_append(desc);
+      assert(i->mod_desc.can_rollback());
+    }
+  }
+
   map<shard_id_t, ObjectStore::Transaction> trans;
   for (set<pg_shard_t>::const_iterator i =
 	 get_parent()->get_actingbackfill_shards().begin();
@@ -1782,6 +2091,8 @@ void ECBackend::start_write(Op *op) {
 
   op->t->generate_transactions(
     op->unstable_hash_infos,
+    op->read_chunks,
+    op->log_entries,
     ec_impl,
     get_parent()->get_info().pgid.pgid,
     sinfo,
@@ -2049,6 +2360,19 @@ void ECBackend::rollback_append(
       old_size));
 }
 
+void ECBackend::rollback_extents(
+  const hobject_t &hoid,
+  version_t gen,
+  uint64_t old_size,
+  uint64_t off,
+  uint64_t len,
+  ObjectStore::Transaction *t)
+{
+  ECTransaction::generate_rollback_extents(
+    hoid, gen, old_size, off, len,
+    ec_impl, sinfo, coll, get_parent()->whoami_shard().shard, t);
+}
+
 void ECBackend::be_deep_scrub(
   const hobject_t &poid,
   uint32_t seed,
@@ -2099,7 +2423,8 @@ void ECBackend::be_deep_scrub(
     o.digest_present = false;
     return;
   } else {
-    if (hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
+    if (hinfo->has_chunk_hash() &&
+	hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
       dout(0) << "_scan_list  " << poid << " got incorrect hash on read" << dendl;
       o.read_error = true;
       return;
@@ -2117,8 +2442,14 @@ void ECBackend::be_deep_scrub(
      * we match our chunk hash and our recollection of the hash for
      * chunk 0 matches that of our peers, there is likely no corruption.
      */
-    o.digest = hinfo->get_chunk_hash(0);
-    o.digest_present = true;
+    if (hinfo->has_chunk_hash()) {
+      o.digest = hinfo->get_chunk_hash(0);
+      o.digest_present = true;
+    } else {
+      // overwritten objects on an ec_overwrites pool carry no hashes;
+      // only the size was checked
+      o.digest_present = false;
+    }
   }
 
   o.omap_digest = seed;
@@ -69,6 +69,15 @@ public:
     ECSubRead &op,
     ECSubReadReply *reply
     );
+  /// read the sub-chunks of every chunk of [off, off + len) of hoid
+  int read_subchunks(
+    const hobject_t &hoid,
+    uint64_t off,
+    uint64_t len,
+    uint32_t flags,
+    const vector<pair<int, int> > &subchunks,
+    bufferlist *bl
+    );
   void handle_sub_write_reply(
     pg_shard_t from,
     ECSubWriteReply &op
@@ -234,6 +243,7 @@ private:
 
     // valid in state READING
     pair<uint64_t, uint64_t> extent_requested;
+    map<pg_shard_t, vector<pair<int, int> > > subchunks;
 
     void dump(Formatter *f) const;
 
@@ -277,15 +287,19 @@ public:
     const list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
     const set<pg_shard_t> need;
     const bool want_attrs;
+    /// sub-chunk ranges to read from each shard of need, all if absent
+    const map<pg_shard_t, vector<pair<int, int> > > subchunks;
     GenContext<pair<RecoveryMessages *, read_result_t& > &> *cb;
     read_request_t(
       const hobject_t &hoid,
       const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
       const set<pg_shard_t> &need,
       bool want_attrs,
-      GenContext<pair<RecoveryMessages *, read_result_t& > &> *cb)
+      GenContext<pair<RecoveryMessages *, read_result_t& > &> *cb,
+      const map<pg_shard_t, vector<pair<int, int> > > &subchunks =
+        map<pg_shard_t, vector<pair<int, int> > >())
       : to_read(to_read), need(need), want_attrs(want_attrs),
-	cb(cb) {}
+	subchunks(subchunks), cb(cb) {}
   };
   friend ostream &operator<<(ostream &lhs, const read_request_t &rhs);
 
@@ -344,6 +358,14 @@ public:
    * As with client reads, there is a possibility of out-of-order
    * completions. Thus, callbacks and completion are called in order
    * on the writing list.
+   *
+   * An op overwriting existing stripes first needs the old chunks it
+   * changes and the parity of those stripes.  Ops therefore wait in
+   * submission order on waiting_reads; the op at the front reads what
+   * it needs once the earlier writes to its objects have applied, and
+   * moves to writing once its reads are complete.  If those reads
+   * cannot be served the op stays at the front, blocking later writes,
+   * and is retried on the next map or dropped on interval change.
    */
   struct Op {
     hobject_t hoid;
@@ -368,6 +390,16 @@ public:
     set<pg_shard_t> pending_apply;
 
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> unstable_hash_infos;
+
+    bool rmw_planned;     ///< overwrite reads have been planned
+    bool rmw_started;     ///< overwrite reads have been sent
+    bool rmw_blocked;     ///< overwrite reads failed, retry on next map
+    map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator> rmw_reads;
+    set<hobject_t, hobject_t::BitwiseComparator> rmw_in_flight; ///< sent, no reply yet
+    map<hobject_t, ECTransaction::read_chunks_t, hobject_t::BitwiseComparator> read_chunks;
+
+    Op() : on_local_applied_sync(0), on_all_applied(0), on_all_commit(0),
+	   rmw_planned(false), rmw_started(false), rmw_blocked(false) {}
     ~Op() {
       delete on_local_applied_sync;
       delete on_all_applied;
@@ -396,8 +428,19 @@ public:
     RecoveryMessages *m);
 
   map<ceph_tid_t, Op> tid_to_op_map; /// lists below point into here
+  list<Op*> waiting_reads;
   list<Op*> writing;
 
+  void check_waiting();
+  bool rmw_must_wait(Op *op);
+  void start_rmw_reads(Op *op);
+  void block_rmw(Op *op, const hobject_t &hoid, int r);
+  friend struct OnRMWReadComplete;
+  void handle_rmw_read(
+    ceph_tid_t tid,
+    const hobject_t &hoid,
+    read_result_t &res);
+
   CephContext *cct;
   ErasureCodeInterfaceRef ec_impl;
 
@@ -477,7 +520,9 @@ public:
     const set<int> &want,      ///< [in] desired shards
     bool for_recovery,         ///< [in] true if we may use non-acting replicas
     bool do_redundant_reads,   ///< [in] true if we want to issue redundant reads to reduce latency
-    set<pg_shard_t> *to_read   ///< [out] shards to read
+    set<pg_shard_t> *to_read,  ///< [out] shards to read
+    map<pg_shard_t, vector<pair<int, int> > > *subchunks = 0
+                               ///< [out] sub-chunks to read to repair want
     ); ///< @return error code, 0 on success
 
   int get_remaining_shards(
@@ -494,6 +539,14 @@ public:
     uint64_t old_size,
     ObjectStore::Transaction *t);
 
+  void rollback_extents(
+    const hobject_t &hoid,
+    version_t gen,
+    uint64_t old_size,
+    uint64_t off,
+    uint64_t len,
+    ObjectStore::Transaction *t);
+
   bool scrub_supported() { return true; }
   bool auto_repair_supported() const { return true; }
 
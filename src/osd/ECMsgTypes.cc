@@ -175,17 +175,18 @@ void ECSubRead::encode(bufferlist &bl, uint64_t features) const
     return;
   }
 
-  ENCODE_START(2, 2, bl);
+  ENCODE_START(3, 2, bl);
   ::encode(from, bl);
   ::encode(tid, bl);
   ::encode(to_read, bl);
   ::encode(attrs_to_read, bl);
+  ::encode(subchunks, bl);
   ENCODE_FINISH(bl);
 }
 
 void ECSubRead::decode(bufferlist::iterator &bl)
 {
-  DECODE_START(2, bl);
+  DECODE_START(3, bl);
   ::decode(from, bl);
   ::decode(tid, bl);
   if (struct_v == 1) {
@@ -204,6 +205,8 @@ void ECSubRead::decode(bufferlist::iterator &bl)
     ::decode(to_read, bl);
   }
   ::decode(attrs_to_read, bl);
+  if (struct_v >= 3)
+    ::decode(subchunks, bl);
   DECODE_FINISH(bl);
 }
 
@@ -213,6 +216,7 @@ std::ostream &operator<<(
   return lhs
     << "ECSubRead(tid=" << rhs.tid
     << ", to_read=" << rhs.to_read
+    << ", subchunks=" << rhs.subchunks
     << ", attrs_to_read=" << rhs.attrs_to_read << ")";
 }
 
@@ -239,6 +243,20 @@ void ECSubRead::dump(Formatter *f) const
       f->close_section();
     }
     f->close_section();
+    map<hobject_t, vector<pair<int, int> >, hobject_t::BitwiseComparator>::const_iterator s =
+      subchunks.find(i->first);
+    if (s != subchunks.end()) {
+      f->open_array_section("subchunks");
+      for (vector<pair<int, int> >::const_iterator j = s->second.begin();
+	   j != s->second.end();
+	   ++j) {
+	f->open_object_section("range");
+	f->dump_int("index", j->first);
+	f->dump_int("count", j->second);
+	f->close_section();
+      }
+      f->close_section();
+    }
     f->close_section();
   }
   f->close_section();
@@ -272,6 +290,8 @@ void ECSubRead::generate_test_instances(list<ECSubRead*>& o)
   o.back()->to_read[hoid2].push_back(boost::make_tuple(400, 600, 0));
   o.back()->to_read[hoid2].push_back(boost::make_tuple(2000, 600, 0));
   o.back()->attrs_to_read.insert(hoid2);
+  o.back()->subchunks[hoid1].push_back(make_pair(1, 2));
+  o.back()->subchunks[hoid1].push_back(make_pair(5, 2));
 }
 
 void ECSubReadReply::encode(bufferlist &bl) const
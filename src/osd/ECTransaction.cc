@@ -26,6 +26,9 @@ struct AppendObjectsGenerator: public boost::static_visitor<void> {
   void operator()(const ECTransaction::AppendOp &op) {
     out->insert(op.oid);
   }
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    out->insert(op.oid);
+  }
   void operator()(const ECTransaction::TouchOp &op) {
     out->insert(op.oid);
   }
@@ -55,8 +58,166 @@ void ECTransaction::get_append_objects(
   reverse_visit(gen);
 }
 
+struct OverwriteReadPlanner : public boost::static_visitor<void> {
+  const map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos;
+  ErasureCodeInterfaceRef &ecimpl;
+  const ECUtil::stripe_info_t &sinfo;
+  map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator> *out;
+  /// objects whose on disk content is gone earlier in the transaction
+  set<hobject_t, hobject_t::BitwiseComparator> fresh;
+  /// objects given the content of another earlier in the transaction
+  set<hobject_t, hobject_t::BitwiseComparator> replaced;
+  OverwriteReadPlanner(
+    const map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    ErasureCodeInterfaceRef &ecimpl,
+    const ECUtil::stripe_info_t &sinfo,
+    map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator> *out)
+    : hash_infos(hash_infos), ecimpl(ecimpl), sinfo(sinfo), out(out) {}
+
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    // the chunks of a cloned or renamed object are not read from its
+    // source, ReplicatedPG never overwrites such an object in the same
+    // transaction
+    assert(!replaced.count(op.oid));
+    if (fresh.count(op.oid))
+      return;
+    map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator>::const_iterator hinfo =
+      hash_infos.find(op.oid);
+    assert(hinfo != hash_infos.end());
+    uint64_t on_disk = sinfo.aligned_chunk_offset_to_logical_offset(
+      hinfo->second->get_total_chunk_size());
+    pair<uint64_t, uint64_t> bounds = sinfo.offset_len_to_stripe_bounds(
+      make_pair(op.off, (uint64_t)op.bl.length()));
+    if (bounds.first >= on_disk)
+      return; // past the end of the object, the old chunks are zeros
+    ECTransaction::overwrite_read_t &r = (*out)[op.oid];
+    interval_set<uint64_t> extent;
+    extent.insert(bounds.first, MIN(bounds.second, on_disk - bounds.first));
+    r.extents.union_of(extent);
+    ECUtil::get_overwrite_shards(sinfo, ecimpl, op.off, op.bl.length(),
+				 &r.shards);
+  }
+  void operator()(const ECTransaction::CloneOp &op) {
+    replaced.insert(op.target);
+  }
+  void operator()(const ECTransaction::RenameOp &op) {
+    fresh.insert(op.source);
+    replaced.insert(op.destination);
+  }
+  void operator()(const ECTransaction::StashOp &op) {
+    fresh.insert(op.oid);
+  }
+  void operator()(const ECTransaction::RemoveOp &op) {
+    fresh.insert(op.oid);
+  }
+  void operator()(const ECTransaction::AppendOp &op) {}
+  void operator()(const ECTransaction::TouchOp &op) {}
+  void operator()(const ECTransaction::SetAttrsOp &op) {}
+  void operator()(const ECTransaction::RmAttrOp &op) {}
+  void operator()(const ECTransaction::AllocHintOp &op) {}
+  void operator()(const ECTransaction::NoOp &op) {}
+};
+void ECTransaction::get_overwrite_reads(
+  const map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+  ErasureCodeInterfaceRef &ecimpl,
+  const ECUtil::stripe_info_t &sinfo,
+  map<hobject_t, overwrite_read_t, hobject_t::BitwiseComparator> *out) const
+{
+  OverwriteReadPlanner planner(hash_infos, ecimpl, sinfo, out);
+  visit(planner);
+}
+
+/**
+ * Chunks of an overwritten object known to the transaction: those read
+ * ahead for the overwrites, overlaid with those written so far.  Chunk
+ * data the transaction neither read nor wrote lies past the end of the
+ * object as it was on disk and is zeros.
+ */
+struct ChunkCache {
+  uint64_t disk_size;  ///< chunk size on disk not yet gone
+  map<int, map<uint64_t, bufferlist> > extents;
+  ChunkCache() : disk_size(0) {}
+
+  void insert(int shard, uint64_t off, const bufferlist &bl) {
+    map<uint64_t, bufferlist> &m = extents[shard];
+    uint64_t end = off + bl.length();
+    map<uint64_t, bufferlist>::iterator i = m.lower_bound(off);
+    if (i != m.begin()) {
+      --i;
+      if (i->first + i->second.length() <= off)
+	++i;
+    }
+    while (i != m.end() && i->first < end) {
+      uint64_t start = i->first;
+      bufferlist old;
+      old.swap(i->second);
+      m.erase(i++);
+      if (start < off) {
+	m[start].substr_of(old, 0, off - start);
+      }
+      if (start + old.length() > end) {
+	m[end].substr_of(old, end - start, start + old.length() - end);
+      }
+    }
+    m[off] = bl;
+  }
+  bufferlist get(int shard, uint64_t off, uint64_t len) const {
+    bufferlist out;
+    map<int, map<uint64_t, bufferlist> >::const_iterator s =
+      extents.find(shard);
+    uint64_t pos = off;
+    uint64_t end = off + len;
+    while (pos < end) {
+      uint64_t next = end;
+      if (s != extents.end()) {
+	map<uint64_t, bufferlist>::const_iterator i =
+	  s->second.upper_bound(pos);
+	if (i != s->second.begin()) {
+	  map<uint64_t, bufferlist>::const_iterator p = i;
+	  --p;
+	  if (p->first + p->second.length() > pos) {
+	    uint64_t l = MIN(end, p->first + p->second.length()) - pos;
+	    bufferlist bl;
+	    bl.substr_of(p->second, pos - p->first, l);
+	    out.claim_append(bl);
+	    pos += l;
+	    continue;
+	  }
+	}
+	if (i != s->second.end())
+	  next = MIN(end, i->first);
+      }
+      assert(pos >= disk_size); // on disk chunks must have been read
+      out.append_zero(next - pos);
+      pos = next;
+    }
+    return out;
+  }
+  void clear() {
+    disk_size = 0;
+    extents.clear();
+  }
+};
+
+/// finds the generation the overwritten extents of an object are
+/// stashed at, if its log entry can roll them back
+struct RollbackExtentsFinder : public ObjectModDesc::Visitor {
+  bool found;
+  version_t gen;
+  RollbackExtentsFinder() : found(false), gen(0) {}
+  void rollback_extents(
+    version_t _gen, uint64_t old_size, uint64_t off, uint64_t len) {
+    found = true;
+    gen = _gen;
+  }
+};
+
 struct TransGenerator : public boost::static_visitor<void> {
   map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos;
+  map<hobject_t, ChunkCache, hobject_t::BitwiseComparator> chunks;
+  map<hobject_t, version_t, hobject_t::BitwiseComparator> stash_gens;
+  /// chunk ranges already saved at the stash generation, by shard
+  map<hobject_t, map<int, interval_set<uint64_t> >, hobject_t::BitwiseComparator> stashed;
 
   ErasureCodeInterfaceRef &ecimpl;
   const pg_t pgid;
@@ -68,6 +229,9 @@ struct TransGenerator : public boost::static_visitor<void> {
   stringstream *out;
   TransGenerator(
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const set<hobject_t, hobject_t::BitwiseComparator> &overwritten,
+    const map<hobject_t, ECTransaction::read_chunks_t, hobject_t::BitwiseComparator> &read_chunks,
+    const vector<pg_log_entry_t> &entries,
     ErasureCodeInterfaceRef &ecimpl,
     pg_t pgid,
     const ECUtil::stripe_info_t &sinfo,
@@ -84,6 +248,35 @@ struct TransGenerator : public boost::static_visitor<void> {
     for (unsigned i = 0; i < ecimpl->get_chunk_count(); ++i) {
       want.insert(i);
     }
+    for (set<hobject_t, hobject_t::BitwiseComparator>::const_iterator i =
+	   overwritten.begin();
+	 i != overwritten.end();
+	 ++i) {
+      assert(hash_infos.count(*i));
+      ChunkCache &cache = chunks[*i];
+      cache.disk_size = hash_infos[*i]->get_total_chunk_size();
+      map<hobject_t, ECTransaction::read_chunks_t, hobject_t::BitwiseComparator>::const_iterator r =
+	read_chunks.find(*i);
+      if (r == read_chunks.end())
+	continue;
+      for (ECTransaction::read_chunks_t::const_iterator j = r->second.begin();
+	   j != r->second.end();
+	   ++j) {
+	for (map<uint64_t, bufferlist>::const_iterator k = j->second.begin();
+	     k != j->second.end();
+	     ++k) {
+	  cache.insert(j->first, k->first, k->second);
+	}
+      }
+    }
+    for (vector<pg_log_entry_t>::const_iterator i = entries.begin();
+	 i != entries.end();
+	 ++i) {
+      RollbackExtentsFinder finder;
+      i->mod_desc.visit(&finder);
+      if (finder.found)
+	stash_gens[i->soid] = finder.gen;
+    }
   }
 
   coll_t get_coll_ct(shard_id_t shard, const hobject_t &hoid) {
@@ -155,6 +348,19 @@ struct TransGenerator : public boost::static_visitor<void> {
       hbuf);
 
     assert(r == 0);
+    map<hobject_t, ChunkCache, hobject_t::BitwiseComparator>::iterator cache =
+      chunks.find(op.oid);
+    if (cache != chunks.end()) {
+      // overwritten later in the transaction
+      for (map<int, bufferlist>::iterator i = buffers.begin();
+	   i != buffers.end();
+	   ++i) {
+	cache->second.insert(
+	  i->first,
+	  sinfo.logical_to_prev_chunk_offset(offset),
+	  i->second);
+      }
+    }
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -181,10 +387,149 @@ struct TransGenerator : public boost::static_visitor<void> {
 	hbuf);
     }
   }
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    assert(hash_infos.count(op.oid));
+    ECUtil::HashInfoRef hinfo = hash_infos[op.oid];
+    assert(chunks.count(op.oid));
+    ChunkCache &cache = chunks[op.oid];
+
+    uint64_t len = op.bl.length();
+    uint64_t stripe_width = sinfo.get_stripe_width();
+    uint64_t chunk_size = sinfo.get_chunk_size();
+    pair<uint64_t, uint64_t> bounds =
+      sinfo.offset_len_to_stripe_bounds(make_pair(op.off, len));
+    uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+      bounds.first);
+    uint64_t chunk_len = sinfo.aligned_logical_offset_to_chunk_offset(
+      bounds.second);
+    uint64_t old_chunk_size = hinfo->get_total_chunk_size();
+    uint64_t new_chunk_size = MAX(old_chunk_size, chunk_off + chunk_len);
+
+    set<int> shards;
+    ECUtil::get_overwrite_shards(sinfo, ecimpl, op.off, len, &shards);
+
+    // new content of the data chunks the write covers, and its delta
+    // against the old one
+    const vector<int> &chunk_mapping = ecimpl->get_chunk_mapping();
+    unsigned int k = ecimpl->get_data_chunk_count();
+    map<int, bufferlist> deltas;
+    map<int, bufferlist> updated;
+    for (unsigned int i = 0; i < k; ++i) {
+      int shard = chunk_mapping.size() > i ? chunk_mapping[i] : i;
+      if (!shards.count(shard))
+	continue;
+      bufferlist old_data = cache.get(shard, chunk_off, chunk_len);
+      bufferptr new_data(buffer::create_page_aligned(chunk_len));
+      old_data.copy(0, chunk_len, new_data.c_str());
+      for (uint64_t stripe = 0; stripe < bounds.second;
+	   stripe += stripe_width) {
+	uint64_t start = bounds.first + stripe + i * chunk_size;
+	uint64_t from = MAX(op.off, start);
+	uint64_t to = MIN(op.off + len, start + chunk_size);
+	if (from >= to)
+	  continue;
+	op.bl.copy(
+	  from - op.off,
+	  to - from,
+	  new_data.c_str() + (stripe / stripe_width) * chunk_size +
+	  (from - start));
+      }
+      updated[shard].push_back(new_data);
+      int r = ecimpl->encode_delta(old_data, updated[shard], &deltas[shard]);
+      assert(r == 0);
+    }
+    map<int, bufferlist> coding;
+    for (unsigned int i = k; i < ecimpl->get_chunk_count(); ++i) {
+      int shard = chunk_mapping.size() > i ? chunk_mapping[i] : i;
+      coding[shard] = cache.get(shard, chunk_off, chunk_len);
+    }
+    int r = ecimpl->apply_delta(deltas, chunk_size, &coding);
+    assert(r == 0);
+    for (map<int, bufferlist>::iterator i = coding.begin();
+	 i != coding.end();
+	 ++i) {
+      updated[i->first].swap(i->second);
+    }
+    for (map<int, bufferlist>::iterator i = updated.begin();
+	 i != updated.end();
+	 ++i) {
+      cache.insert(i->first, chunk_off, i->second);
+    }
+
+    bool hinfo_changed =
+      hinfo->has_chunk_hash() || new_chunk_size != old_chunk_size;
+    hinfo->set_total_chunk_size_clear_hash(new_chunk_size);
+    bufferlist hbuf;
+    if (hinfo_changed)
+      ::encode(*hinfo, hbuf);
+
+    map<hobject_t, version_t, hobject_t::BitwiseComparator>::iterator gen =
+      stash_gens.find(op.oid);
+    for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
+	 i != trans->end();
+	 ++i) {
+      ghobject_t goid(op.oid, ghobject_t::NO_GEN, i->first);
+      map<int, bufferlist>::iterator bl = updated.find(i->first);
+      if (gen != stash_gens.end() && !stashed[op.oid].count(i->first)) {
+	// every shard gets the stash object, the log entry trims it
+	i->second.touch(
+	  get_coll_ct(i->first, op.oid),
+	  ghobject_t(op.oid, gen->second, i->first));
+	stashed[op.oid][i->first];
+      }
+      if (bl != updated.end() && gen != stash_gens.end() &&
+	  chunk_off < old_chunk_size) {
+	// save the chunks replaced for the first time so that the log
+	// entry can roll them back
+	interval_set<uint64_t> to_stash;
+	to_stash.insert(chunk_off, MIN(chunk_len, old_chunk_size - chunk_off));
+	interval_set<uint64_t> &done = stashed[op.oid][i->first];
+	interval_set<uint64_t> already;
+	already.intersection_of(to_stash, done);
+	to_stash.subtract(already);
+	for (interval_set<uint64_t>::iterator j = to_stash.begin();
+	     j != to_stash.end();
+	     ++j) {
+	  i->second.clone_range(
+	    get_coll_ct(i->first, op.oid),
+	    goid,
+	    ghobject_t(op.oid, gen->second, i->first),
+	    j.get_start(),
+	    j.get_len(),
+	    j.get_start());
+	}
+	done.union_of(to_stash);
+      }
+      if (new_chunk_size > old_chunk_size) {
+	i->second.truncate(
+	  get_coll_ct(i->first, op.oid),
+	  goid,
+	  new_chunk_size);
+      }
+      if (bl != updated.end()) {
+	i->second.write(
+	  get_coll_ct(i->first, op.oid),
+	  goid,
+	  chunk_off,
+	  chunk_len,
+	  bl->second,
+	  op.fadvise_flags);
+      }
+      if (hinfo_changed) {
+	i->second.setattr(
+	  get_coll_ct(i->first, op.oid),
+	  goid,
+	  ECUtil::get_hinfo_key(),
+	  hbuf);
+      }
+    }
+  }
   void operator()(const ECTransaction::CloneOp &op) {
     assert(hash_infos.count(op.source));
     assert(hash_infos.count(op.target));
     *(hash_infos[op.target]) = *(hash_infos[op.source]);
+    if (chunks.count(op.target))
+      chunks[op.target].clear();
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -199,6 +544,10 @@ struct TransGenerator : public boost::static_visitor<void> {
     assert(hash_infos.count(op.destination));
     *(hash_infos[op.destination]) = *(hash_infos[op.source]);
     hash_infos[op.source]->clear();
+    if (chunks.count(op.source))
+      chunks[op.source].clear();
+    if (chunks.count(op.destination))
+      chunks[op.destination].clear();
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -212,6 +561,8 @@ struct TransGenerator : public boost::static_visitor<void> {
   void operator()(const ECTransaction::StashOp &op) {
     assert(hash_infos.count(op.oid));
     hash_infos[op.oid]->clear();
+    if (chunks.count(op.oid))
+      chunks[op.oid].clear();
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -226,6 +577,8 @@ struct TransGenerator : public boost::static_visitor<void> {
   void operator()(const ECTransaction::RemoveOp &op) {
     assert(hash_infos.count(op.oid));
     hash_infos[op.oid]->clear();
+    if (chunks.count(op.oid))
+      chunks[op.oid].clear();
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -276,8 +629,19 @@ struct TransGenerator : public boost::static_visitor<void> {
 };
 
 
+struct OverwrittenObjects : public boost::static_visitor<void> {
+  set<hobject_t, hobject_t::BitwiseComparator> out;
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    out.insert(op.oid);
+  }
+  template <typename T>
+  void operator()(const T &op) {}
+};
+
 void ECTransaction::generate_transactions(
   map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+  const map<hobject_t, read_chunks_t, hobject_t::BitwiseComparator> &read_chunks,
+  const vector<pg_log_entry_t> &entries,
   ErasureCodeInterfaceRef &ecimpl,
   pg_t pgid,
   const ECUtil::stripe_info_t &sinfo,
@@ -286,8 +650,13 @@ void ECTransaction::generate_transactions(
   set<hobject_t, hobject_t::BitwiseComparator> *temp_removed,
   stringstream *out) const
 {
+  OverwrittenObjects overwritten;
+  visit(overwritten);
   TransGenerator gen(
     hash_infos,
+    overwritten.out,
+    read_chunks,
+    entries,
     ecimpl,
     pgid,
     sinfo,
@@ -297,3 +666,40 @@ void ECTransaction::generate_transactions(
     out);
   visit(gen);
 }
+
+void ECTransaction::generate_rollback_extents(
+  const hobject_t &hoid,
+  version_t gen,
+  uint64_t old_size,
+  uint64_t off,
+  uint64_t len,
+  ErasureCodeInterfaceRef &ecimpl,
+  const ECUtil::stripe_info_t &sinfo,
+  const coll_t &coll,
+  shard_id_t shard,
+  ObjectStore::Transaction *t)
+{
+  ghobject_t goid(hoid, ghobject_t::NO_GEN, shard);
+  uint64_t old_chunk_size = sinfo.logical_to_next_chunk_offset(old_size);
+  set<int> shards;
+  ECUtil::get_overwrite_shards(sinfo, ecimpl, off, len, &shards);
+  ghobject_t stash(hoid, gen, shard);
+  if (shards.count(shard)) {
+    pair<uint64_t, uint64_t> bounds =
+      sinfo.offset_len_to_stripe_bounds(make_pair(off, len));
+    uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+      bounds.first);
+    uint64_t chunk_end = chunk_off +
+      sinfo.aligned_logical_offset_to_chunk_offset(bounds.second);
+    if (chunk_off < old_chunk_size) {
+      t->clone_range(
+	coll,
+	stash,
+	goid,
+	chunk_off,
+	MIN(chunk_end, old_chunk_size) - chunk_off,
+	chunk_off);
+    }
+  }
+  t->truncate(coll, goid, old_chunk_size);
+}
@@ -30,6 +30,15 @@ public:
     AppendOp(const hobject_t &oid, uint64_t off, bufferlist &bl, uint32_t flags)
       : oid(oid), off(off), bl(bl), fadvise_flags(flags) {}
   };
+  struct OverwriteOp {
+    hobject_t oid;
+    uint64_t off;
+    bufferlist bl;
+    uint32_t fadvise_flags;
+    OverwriteOp(const hobject_t &oid, uint64_t off, bufferlist &bl,
+		uint32_t flags)
+      : oid(oid), off(off), bl(bl), fadvise_flags(flags) {}
+  };
   struct CloneOp {
     hobject_t source;
     hobject_t target;
@@ -90,6 +99,7 @@ public:
   struct NoOp {};
   typedef boost::variant<
     AppendOp,
+    OverwriteOp,
     CloneOp,
     RenameOp,
     StashOp,
@@ -122,6 +132,21 @@ public:
     assert(len == bl.length());
     ops.push_back(AppendOp(hoid, off, bl, fadvise_flags));
   }
+  /// partial-stripe overwrite, only on pools allowing ec overwrites
+  void write(
+    const hobject_t &hoid,
+    uint64_t off,
+    uint64_t len,
+    bufferlist &bl,
+    uint32_t fadvise_flags) {
+    if (len == 0) {
+      touch(hoid);
+      return;
+    }
+    written += len;
+    assert(len == bl.length());
+    ops.push_back(OverwriteOp(hoid, off, bl, fadvise_flags));
+  }
   void stash(
     const hobject_t &hoid,
     version_t former_version) {
@@ -198,8 +223,31 @@ public:
   }
   void get_append_objects(
      set<hobject_t, hobject_t::BitwiseComparator> *out) const;
+
+  /// on disk chunks of an object the overwrites need to read: the
+  /// shards they rewrite over stripe aligned logical extents
+  struct overwrite_read_t {
+    set<int> shards;
+    interval_set<uint64_t> extents;
+  };
+  /// chunks read for the overwrites, shard -> chunk offset -> data
+  typedef map<int, map<uint64_t, bufferlist> > read_chunks_t;
+
+  /**
+   * Computes the reads required before the overwrites of the
+   * transaction can compute their parity deltas.  hash_infos must
+   * describe the objects as they are on disk before the transaction.
+   */
+  void get_overwrite_reads(
+    const map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    ErasureCodeInterfaceRef &ecimpl,
+    const ECUtil::stripe_info_t &sinfo,
+    map<hobject_t, overwrite_read_t, hobject_t::BitwiseComparator> *out) const;
+
   void generate_transactions(
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const map<hobject_t, read_chunks_t, hobject_t::BitwiseComparator> &read_chunks,
+    const vector<pg_log_entry_t> &entries,
     ErasureCodeInterfaceRef &ecimpl,
     pg_t pgid,
     const ECUtil::stripe_info_t &sinfo,
@@ -207,6 +255,23 @@ public:
     set<hobject_t, hobject_t::BitwiseComparator> *temp_added,
     set<hobject_t, hobject_t::BitwiseComparator> *temp_removed,
     stringstream *out = 0) const;
+
+  /**
+   * Generates the transaction restoring the chunks of one shard that
+   * an overwrite of [off, off + len) stashed at generation gen, and
+   * the shard's size before it.  The caller removes the stash.
+   */
+  static void generate_rollback_extents(
+    const hobject_t &hoid,
+    version_t gen,
+    uint64_t old_size,
+    uint64_t off,
+    uint64_t len,
+    ErasureCodeInterfaceRef &ecimpl,
+    const ECUtil::stripe_info_t &sinfo,
+    const coll_t &coll,
+    shard_id_t shard,
+    ObjectStore::Transaction *t);
 };
 
 #endif
@@ -2,8 +2,20 @@
 
 #include <errno.h>
 #include "include/encoding.h"
+#include "common/config.h"
+#include "global/global_context.h"
 #include "ECUtil.h"
 
+/// length of the slice of each chunk handed to the plugin in one call
+static uint64_t batch_chunk_length(const ECUtil::stripe_info_t &sinfo,
+				   uint64_t total_chunk_size)
+{
+  uint64_t batch = g_conf->osd_ec_batch_stripes;
+  if (batch == 0)
+    return total_chunk_size;
+  return MIN(batch * sinfo.get_chunk_size(), total_chunk_size);
+}
+
 int ECUtil::decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
@@ -26,19 +38,40 @@ int ECUtil::decode(
   if (total_data_size == 0)
     return 0;
 
-  for (uint64_t i = 0; i < total_data_size; i += sinfo.get_chunk_size()) {
+  set<int> want;
+  const vector<int> &mapping = ec_impl->get_chunk_mapping();
+  unsigned int k = ec_impl->get_data_chunk_count();
+  for (unsigned int i = 0; i < k; i++)
+    want.insert(mapping.size() > i ? mapping[i] : i);
+
+  uint64_t batch = batch_chunk_length(sinfo, total_data_size);
+  for (uint64_t i = 0; i < total_data_size; i += batch) {
+    uint64_t len = MIN(batch, total_data_size - i);
     map<int, bufferlist> chunks;
     for (map<int, bufferlist>::iterator j = to_decode.begin();
 	 j != to_decode.end();
 	 ++j) {
-      chunks[j->first].substr_of(j->second, i, sinfo.get_chunk_size());
+      chunks[j->first].substr_of(j->second, i, len);
     }
-    bufferlist bl;
-    int r = ec_impl->decode_concat(chunks, &bl);
-    assert(bl.length() == sinfo.get_stripe_width());
+    map<int, bufferlist> decoded;
+    int r = ec_impl->decode_stripes(want, chunks, sinfo.get_chunk_size(),
+				    &decoded);
     assert(r == 0);
-    out->claim_append(bl);
+    for (set<int>::iterator j = want.begin(); j != want.end(); ++j) {
+      assert(decoded[*j].length() == len);
+    }
+    // interleave the data chunks back into stripes
+    for (uint64_t off = 0; off < len; off += sinfo.get_chunk_size()) {
+      for (unsigned int j = 0; j < k; j++) {
+	bufferlist bl;
+	bl.substr_of(decoded[mapping.size() > j ? mapping[j] : j],
+		     off, sinfo.get_chunk_size());
+	out->claim_append(bl);
+      }
+    }
   }
+  assert(out->length() ==
+	 sinfo.aligned_chunk_offset_to_logical_offset(total_data_size));
   return 0;
 }
 
@@ -70,21 +103,24 @@ int ECUtil::decode(
     need.insert(i->first);
   }
 
-  for (uint64_t i = 0; i < total_data_size; i += sinfo.get_chunk_size()) {
+  uint64_t batch = batch_chunk_length(sinfo, total_data_size);
+  for (uint64_t i = 0; i < total_data_size; i += batch) {
+    uint64_t len = MIN(batch, total_data_size - i);
     map<int, bufferlist> chunks;
     for (map<int, bufferlist>::iterator j = to_decode.begin();
 	 j != to_decode.end();
 	 ++j) {
-      chunks[j->first].substr_of(j->second, i, sinfo.get_chunk_size());
+      chunks[j->first].substr_of(j->second, i, len);
     }
     map<int, bufferlist> out_bls;
-    int r = ec_impl->decode(need, chunks, &out_bls);
+    int r = ec_impl->decode_stripes(need, chunks, sinfo.get_chunk_size(),
+				    &out_bls);
     assert(r == 0);
     for (map<int, bufferlist*>::iterator j = out.begin();
 	 j != out.end();
 	 ++j) {
       assert(out_bls.count(j->first));
-      assert(out_bls[j->first].length() == sinfo.get_chunk_size());
+      assert(out_bls[j->first].length() == len);
       j->second->claim_append(out_bls[j->first]);
     }
   }
@@ -96,6 +132,86 @@ int ECUtil::decode(
   return 0;
 }
 
+int ECUtil::repair(
+  const stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ec_impl,
+  const map<int, vector<pair<int, int> > > &subchunks,
+  map<int, bufferlist> &to_repair,
+  uint64_t chunk_length,
+  map<int, bufferlist*> &out) {
+  assert(to_repair.size());
+  assert(chunk_length % sinfo.get_chunk_size() == 0);
+
+  if (chunk_length == 0)
+    return 0;
+
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t sub_chunk_size = chunk_size / ec_impl->get_sub_chunk_count();
+  uint64_t stripes = chunk_length / chunk_size;
+  map<int, uint64_t> repair_size;
+  for (map<int, bufferlist>::iterator i = to_repair.begin();
+       i != to_repair.end();
+       ++i) {
+    map<int, vector<pair<int, int> > >::const_iterator s =
+      subchunks.find(i->first);
+    assert(s != subchunks.end());
+    uint64_t size = 0;
+    for (vector<pair<int, int> >::const_iterator j = s->second.begin();
+	 j != s->second.end();
+	 ++j)
+      size += j->second * sub_chunk_size;
+    repair_size[i->first] = size;
+    if (size != chunk_size && i->second.length() == chunk_length) {
+      bufferlist trimmed;
+      for (uint64_t off = 0; off < chunk_length; off += chunk_size) {
+	for (vector<pair<int, int> >::const_iterator j = s->second.begin();
+	     j != s->second.end();
+	     ++j) {
+	  bufferlist bl;
+	  bl.substr_of(i->second, off + j->first * sub_chunk_size,
+		       j->second * sub_chunk_size);
+	  trimmed.claim_append(bl);
+	}
+      }
+      i->second.swap(trimmed);
+    }
+    assert(i->second.length() == stripes * size);
+  }
+
+  set<int> need;
+  for (map<int, bufferlist*>::iterator i = out.begin();
+       i != out.end();
+       ++i) {
+    assert(i->second);
+    assert(i->second->length() == 0);
+    need.insert(i->first);
+  }
+
+  uint64_t batch = batch_chunk_length(sinfo, chunk_length) / chunk_size;
+  for (uint64_t i = 0; i < stripes; i += batch) {
+    uint64_t count = MIN(batch, stripes - i);
+    map<int, bufferlist> helpers;
+    for (map<int, bufferlist>::iterator j = to_repair.begin();
+	 j != to_repair.end();
+	 ++j) {
+      helpers[j->first].substr_of(j->second, i * repair_size[j->first],
+				  count * repair_size[j->first]);
+    }
+    map<int, bufferlist> out_bls;
+    int r = ec_impl->repair(need, helpers, chunk_size, &out_bls);
+    if (r)
+      return r;
+    for (map<int, bufferlist*>::iterator j = out.begin();
+	 j != out.end();
+	 ++j) {
+      assert(out_bls.count(j->first));
+      assert(out_bls[j->first].length() == count * chunk_size);
+      j->second->claim_append(out_bls[j->first]);
+    }
+  }
+  return 0;
+}
+
 int ECUtil::encode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
@@ -112,16 +228,21 @@ int ECUtil::encode(
   if (logical_size == 0)
     return 0;
 
-  for (uint64_t i = 0; i < logical_size; i += sinfo.get_stripe_width()) {
+  uint64_t batch = sinfo.aligned_chunk_offset_to_logical_offset(
+    batch_chunk_length(
+      sinfo, sinfo.aligned_logical_offset_to_chunk_offset(logical_size)));
+  for (uint64_t i = 0; i < logical_size; i += batch) {
     map<int, bufferlist> encoded;
     bufferlist buf;
-    buf.substr_of(in, i, sinfo.get_stripe_width());
-    int r = ec_impl->encode(want, buf, &encoded);
+    buf.substr_of(in, i, MIN(batch, logical_size - i));
+    int r = ec_impl->encode_stripes(want, buf, sinfo.get_stripe_width(),
+				    &encoded);
     assert(r == 0);
     for (map<int, bufferlist>::iterator i = encoded.begin();
 	 i != encoded.end();
 	 ++i) {
-      assert(i->second.length() == sinfo.get_chunk_size());
+      assert(i->second.length() ==
+	     sinfo.aligned_logical_offset_to_chunk_offset(buf.length()));
       (*out)[i->first].claim_append(i->second);
     }
   }
@@ -137,11 +258,41 @@ int ECUtil::encode(
   return 0;
 }
 
+void ECUtil::get_overwrite_shards(
+  const stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ec_impl,
+  uint64_t off,
+  uint64_t len,
+  set<int> *shards)
+{
+  const vector<int> &chunk_mapping = ec_impl->get_chunk_mapping();
+  unsigned int k = ec_impl->get_data_chunk_count();
+  uint64_t stripe_width = sinfo.get_stripe_width();
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t end = off + len;
+  set<int> data;
+  for (uint64_t stripe = sinfo.logical_to_prev_stripe_offset(off);
+       stripe < end && data.size() < k;
+       stripe += stripe_width) {
+    uint64_t first = (MAX(off, stripe) - stripe) / chunk_size;
+    uint64_t last = (MIN(end, stripe + stripe_width) - 1 - stripe) / chunk_size;
+    for (uint64_t i = first; i <= last; ++i)
+      data.insert(chunk_mapping.size() > i ? chunk_mapping[i] : i);
+  }
+  shards->insert(data.begin(), data.end());
+  for (unsigned int i = k; i < ec_impl->get_chunk_count(); ++i)
+    shards->insert(chunk_mapping.size() > i ? chunk_mapping[i] : i);
+}
+
 void ECUtil::HashInfo::append(uint64_t old_size,
 			      map<int, bufferlist> &to_append) {
-  assert(to_append.size() == cumulative_shard_hashes.size());
   assert(old_size == total_chunk_size);
   uint64_t size_to_append = to_append.begin()->second.length();
+  if (!has_chunk_hash()) {
+    total_chunk_size += size_to_append;
+    return;
+  }
+  assert(to_append.size() == cumulative_shard_hashes.size());
   for (map<int, bufferlist>::iterator i = to_append.begin();
        i != to_append.end();
        ++i) {
@@ -96,6 +96,20 @@ int decode(
   map<int, bufferlist> &to_decode,
   map<int, bufferlist*> &out);
 
+/**
+ * Rebuild the out chunks of chunk_length bytes from the sub-chunks
+ * of each helper selected by minimum_to_repair.  A helper that sent
+ * its whole chunk, as a peer ignoring the sub-chunk ranges does, is
+ * trimmed to its sub-chunks first.
+ */
+int repair(
+  const stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ec_impl,
+  const map<int, vector<pair<int, int> > > &subchunks,
+  map<int, bufferlist> &to_repair,
+  uint64_t chunk_length,
+  map<int, bufferlist*> &out);
+
 int encode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
@@ -103,6 +117,15 @@ int encode(
   const set<int> &want,
   map<int, bufferlist> *out);
 
+/// shards rewritten by a partial-stripe overwrite of [off, off + len):
+/// those holding a data chunk it covers and every coding shard
+void get_overwrite_shards(
+  const stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ec_impl,
+  uint64_t off,
+  uint64_t len,
+  set<int> *shards);
+
 class HashInfo {
   uint64_t total_chunk_size;
   vector<uint32_t> cumulative_shard_hashes;
@@ -112,6 +135,15 @@ public:
   : total_chunk_size(0),
     cumulative_shard_hashes(num_chunks, -1) {}
   void append(uint64_t old_size, map<int, bufferlist> &to_append);
+  /// record a size change from an overwrite; the shard hashes can no
+  /// longer be maintained and are dropped for good
+  void set_total_chunk_size_clear_hash(uint64_t new_chunk_size) {
+    cumulative_shard_hashes.clear();
+    total_chunk_size = new_chunk_size;
+  }
+  bool has_chunk_hash() const {
+    return !cumulative_shard_hashes.empty();
+  }
   void clear() {
     total_chunk_size = 0;
     cumulative_shard_hashes = vector<uint32_t>(
@@ -1713,6 +1713,7 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
                                          cct->_conf->osd_op_log_threshold);
   op_tracker.set_history_size_and_duration(cct->_conf->osd_op_history_size,
                                            cct->_conf->osd_op_history_duration);
+  op_tracker.set_sample_rate(cct->_conf->osd_op_tracker_sample_rate);
 }
 
 OSD::~OSD()
@@ -1802,6 +1803,12 @@ bool OSD::asok_command(string command, cmdmap_t& cmdmap, string format,
       ss << "op_tracker tracking is not enabled now, so no ops are tracked currently, even those get stuck. \
 	Please enable \"osd_enable_op_tracker\", and the tracker will start to track new ops received afterwards.";
     }
+  } else if (command == "dump_op_stage_latency") {
+    f->open_object_section("op_stage_latency");
+    op_tracker.dump_stage_latencies(f);
+    f->close_section();
+  } else if (command == "reset_op_stage_latency") {
+    op_tracker.reset_stage_latencies();
   } else if (command == "dump_op_pq_state") {
     f->open_object_section("pq");
     op_shardedwq.dump(f);
@@ -2299,6 +2306,15 @@ void OSD::final_init()
 				     asok_hook,
 				     "show slowest recent ops");
   assert(r == 0);
+  r = admin_socket->register_command("dump_op_stage_latency",
+				     "dump_op_stage_latency", asok_hook,
+				     "show latency histograms of the stages of "
+				     "sampled ops");
+  assert(r == 0);
+  r = admin_socket->register_command("reset_op_stage_latency",
+				     "reset_op_stage_latency", asok_hook,
+				     "clear the op stage latency histograms");
+  assert(r == 0);
   r = admin_socket->register_command("dump_op_pq_state", "dump_op_pq_state",
 				     asok_hook,
 				     "dump op priority queue state");
@@ -2438,12 +2454,32 @@ void OSD::create_logger()
   osd_plb.add_time_avg(l_osd_op_prepare_lat, "op_prepare_latency",
       "Latency of client operations (excluding queue time and wait for finished)"); // client op prepare latency
 
+  // latency in nanoseconds vs. op size, for "perf histogram dump"
+  PerfHistogram::axis_config_d op_hist_x_axis_config = {
+    "Latency (nsec)",
+    PerfHistogram::SCALE_LOG2,
+    0,		///< Latency start
+    100000,	///< Quantization unit is 100usec
+    32,		///< Enough to cover much longer than slow requests
+  };
+  PerfHistogram::axis_config_d op_hist_y_axis_config = {
+    "Request size (bytes)",
+    PerfHistogram::SCALE_LOG2,
+    0,		///< Request size start
+    512,	///< Quantization unit is 512 bytes
+    32,		///< Enough to cover requests larger than GB
+  };
+
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r",
       "Client read operations");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes",
       "Client data read");   // client read out bytes
   osd_plb.add_time_avg(l_osd_op_r_lat,  "op_r_latency",
       "Latency of read operation (including queue time)");    // client read latency
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_r_lat_outb_hist, "op_r_latency_out_bytes_histogram",
+    op_hist_x_axis_config, op_hist_y_axis_config,
+    "Histogram of operation latency (including queue time) + data read");
   osd_plb.add_time_avg(l_osd_op_r_process_lat, "op_r_process_latency",
       "Latency of read operation (excluding queue time)");   // client read process latency
   osd_plb.add_time_avg(l_osd_op_r_prepare_lat, "op_r_prepare_latency",
@@ -2456,6 +2492,10 @@ void OSD::create_logger()
       "Client write operation readable/applied latency");   // client write readable/applied latency
   osd_plb.add_time_avg(l_osd_op_w_lat,  "op_w_latency",
       "Latency of write operation (including queue time)");    // client write latency
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_w_lat_inb_hist, "op_w_latency_in_bytes_histogram",
+    op_hist_x_axis_config, op_hist_y_axis_config,
+    "Histogram of operation latency (including queue time) + data written");
   osd_plb.add_time_avg(l_osd_op_w_process_lat, "op_w_process_latency",
       "Latency of write operation (excluding queue time)");   // client write process latency
   osd_plb.add_time_avg(l_osd_op_w_prepare_lat, "op_w_prepare_latency",
@@ -2470,10 +2510,22 @@ void OSD::create_logger()
       "Client read-modify-write operation readable/applied latency");  // client rmw readable/applied latency
   osd_plb.add_time_avg(l_osd_op_rw_lat, "op_rw_latency",
       "Latency of read-modify-write operation (including queue time)");   // client rmw latency
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_rw_lat_inb_hist, "op_rw_latency_in_bytes_histogram",
+    op_hist_x_axis_config, op_hist_y_axis_config,
+    "Histogram of rw operation latency (including queue time) + data written");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_rw_lat_outb_hist, "op_rw_latency_out_bytes_histogram",
+    op_hist_x_axis_config, op_hist_y_axis_config,
+    "Histogram of rw operation latency (including queue time) + data read");
   osd_plb.add_time_avg(l_osd_op_rw_process_lat, "op_rw_process_latency",
       "Latency of read-modify-write operation (excluding queue time)");   // client rmw process latency
   osd_plb.add_time_avg(l_osd_op_rw_prepare_lat, "op_rw_prepare_latency",
       "Latency of read-modify-write operations (excluding queue time and wait for finished)"); // client rmw prepare latency
+  osd_plb.add_u64_counter(l_osd_op_inline, "op_inline",
+      "Client operations run by the messenger thread that received them");
+  osd_plb.add_u64_counter(l_osd_op_inline_busy, "op_inline_busy",
+      "Client operations queued as their PG was busy");
 
   osd_plb.add_u64_counter(l_osd_sop,       "subop", "Suboperations");         // subops
   osd_plb.add_u64_counter(l_osd_sop_inb,   "subop_in_bytes", "Suboperations total size");     // subop in bytes
@@ -2644,6 +2696,8 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("ops");
   cct->get_admin_socket()->unregister_command("dump_blocked_ops");
   cct->get_admin_socket()->unregister_command("dump_historic_ops");
+  cct->get_admin_socket()->unregister_command("dump_op_stage_latency");
+  cct->get_admin_socket()->unregister_command("reset_op_stage_latency");
   cct->get_admin_socket()->unregister_command("dump_op_pq_state");
   cct->get_admin_socket()->unregister_command("dump_blacklist");
   cct->get_admin_socket()->unregister_command("dump_watchers");
@@ -5942,11 +5996,27 @@ void OSD::ms_fast_dispatch(Message *m)
   OSDMapRef nextmap = service.get_nextmap_reserved();
   Session *session = static_cast<Session*>(m->get_connection()->get_priv());
   if (session) {
+    list<pair<PGRef, OpRequestRef> > ops_to_run;
     {
       Mutex::Locker l(session->session_dispatch_lock);
       update_waiting_for_pg(session, nextmap);
       session->waiting_on_map.push_back(op);
+      session->fast_dispatching = cct->_conf->osd_op_run_to_completion;
       dispatch_session_waiting(session, nextmap);
+      session->fast_dispatching = false;
+      ops_to_run.swap(session->ops_to_run);
+    }
+    /*
+     * ops of a connection are all dispatched by the thread of the
+     * messenger worker of the connection, one message after the other,
+     * so nothing of this session is queued after these before we are
+     * done with them
+     */
+    for (list<pair<PGRef, OpRequestRef> >::iterator i = ops_to_run.begin();
+	 i != ops_to_run.end();
+	 ++i) {
+      if (!run_op_inline(i->first.get(), i->second))
+	enqueue_op(i->first.get(), i->second);
     }
     session->put();
   }
@@ -6716,6 +6786,8 @@ void OSD::handle_osd_map(MOSDMap *m)
       bufferlist& bl = p->second;
 
       o->decode(bl);
+      if (e == last && cct->_conf->osd_map_pg_mapping_threads > 0)
+	o->build_pg_mapping(cct->_conf->osd_map_pg_mapping_threads);
 
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, bl.length(), bl);
@@ -6774,6 +6846,8 @@ void OSD::handle_osd_map(MOSDMap *m)
 	break;
       }
       got_full_map(e);
+      if (e == last && cct->_conf->osd_map_pg_mapping_threads > 0)
+	o->build_pg_mapping(cct->_conf->osd_map_pg_mapping_threads);
 
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, fbl.length(), fbl);
@@ -6885,6 +6959,9 @@ void OSD::_committed_osd_maps(epoch_t first, epoch_t last, MOSDMap *m)
       }
     }
 
+    // only the newest map keeps its pgs mapped up front
+    if (osdmap != newmap)
+      osdmap->clear_pg_mapping();
     osdmap = newmap;
     epoch_t up_epoch;
     epoch_t boot_epoch;
@@ -8530,7 +8607,11 @@ void OSD::handle_op(OpRequestRef& op, OSDMapRef& osdmap)
   share_map.should_send = service.should_share_map(
       m->get_source(), m->get_connection().get(), m->get_map_epoch(),
       osdmap, client_session ? &last_sent_epoch : NULL);
+  // ms_fast_dispatch() holds a reference of the session while it is set
+  Session *run_session = NULL;
   if (client_session) {
+    if (client_session->fast_dispatching && op_can_run_inline(m))
+      run_session = client_session;
     client_session->put();
   }
 
@@ -8560,7 +8641,10 @@ void OSD::handle_op(OpRequestRef& op, OSDMapRef& osdmap)
   if (pg) {
     op->send_map_update = share_map.should_send;
     op->sent_epoch = m->get_map_epoch();
-    enqueue_op(pg, op);
+    if (run_session)
+      run_session->ops_to_run.push_back(make_pair(PGRef(pg), op));
+    else
+      enqueue_op(pg, op);
     share_map.should_send = false;
     return;
   }
@@ -8681,6 +8765,11 @@ void OSD::enqueue_op(PG *pg, OpRequestRef& op)
 
 void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb ) {
 
+  if (ws_queue) {
+    _process_stealing(thread_index, hb);
+    return;
+  }
+
   uint32_t shard_index = thread_index % num_shards;
 
   ShardData* sdata = shard_list[shard_index];
@@ -8703,6 +8792,8 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   pair<PGRef, PGQueueable> item = sdata->pqueue->dequeue();
   sdata->pg_for_processing[&*(item.first)].push_back(item.second);
   sdata->sdata_op_ordering_lock.Unlock();
+  if (boost::optional<OpRequestRef> _op = item.second.maybe_get_op())
+    (*_op)->mark_stage(TRACKED_OP_STAGE_DEQUEUED);
   ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval,
     suicide_interval);
 
@@ -8745,6 +8836,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   *_dout << dendl;
 
   op->run(osd, item.first, tp_handle);
+  --item.first->op_wq_items;
 
   {
 #ifdef WITH_LTTNG
@@ -8760,7 +8852,67 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   (item.first)->unlock();
 }
 
+void OSD::ShardedOpWQ::_process_stealing(uint32_t thread_index,
+					 heartbeat_handle_d *hb)
+{
+  uint32_t shard_index = thread_index % num_shards;
+  PGRef pg;
+  unsigned owner;
+  if (!ws_queue->claim(shard_index, &pg, &owner)) {
+    osd->cct->get_heartbeat_map()->reset_timeout(hb,
+      osd->cct->_conf->threadpool_default_timeout, 0);
+    ws_queue->wait(osd->cct, shard_index,
+      utime_t(osd->cct->_conf->threadpool_empty_queue_max_wait, 0));
+    if (!ws_queue->claim(shard_index, &pg, &owner))
+      return;
+  }
+  ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval,
+    suicide_interval);
+
+  pg->lock_suspend_timeout(tp_handle);
+
+  // the PG is ours until released: run a batch of its ops under one
+  // PG lock.  ops dequeued by dequeue_and_get_ops() are simply gone.
+  uint32_t max_batch = MAX(1, osd->cct->_conf->osd_op_queue_ws_max_batch);
+  boost::optional<PGQueueable> op;
+  for (uint32_t n = 0; n < max_batch && (op = ws_queue->pop(owner, pg)); ++n) {
+    {
+#ifdef WITH_LTTNG
+      osd_reqid_t reqid;
+      if (boost::optional<OpRequestRef> _op = op->maybe_get_op()) {
+	reqid = (*_op)->get_reqid();
+      }
+#endif
+      tracepoint(osd, opwq_process_start, reqid.name._type,
+	  reqid.name._num, reqid.tid, reqid.inc);
+    }
+
+    op->run(osd, pg, tp_handle);
+    --pg->op_wq_items;
+
+    {
+#ifdef WITH_LTTNG
+      osd_reqid_t reqid;
+      if (boost::optional<OpRequestRef> _op = op->maybe_get_op()) {
+	reqid = (*_op)->get_reqid();
+      }
+#endif
+      tracepoint(osd, opwq_process_finish, reqid.name._type,
+	  reqid.name._num, reqid.tid, reqid.inc);
+    }
+    tp_handle.reset_tp_timeout();
+  }
+
+  pg->unlock();
+  ws_queue->release(owner, pg);
+}
+
 void OSD::ShardedOpWQ::_enqueue(pair<PGRef, PGQueueable> item) {
+  ++item.first->op_wq_items;
+  if (ws_queue) {
+    ws_queue->enqueue(shard_of(&*(item.first)), item.first, item.second);
+    return;
+  }
   uint32_t shard_index =
     (item.first)->get_pgid().hash_to_shard(shard_list.size());
 
@@ -8786,6 +8938,11 @@ void OSD::ShardedOpWQ::_enqueue(pair<PGRef, PGQueueable> item) {
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, PGQueueable> item) {
+  ++item.first->op_wq_items;
+  if (ws_queue) {
+    ws_queue->enqueue_front(shard_of(&*(item.first)), item.first, item.second);
+    return;
+  }
 
   uint32_t shard_index = (((item.first)->get_pgid().ps())% shard_list.size());
 
@@ -8816,6 +8973,73 @@ void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, PGQueueable> item) {
 }
 
 
+/*
+ * With osd_op_run_to_completion, a client write of at most
+ * osd_op_run_to_completion_max_bytes, without class methods, watches and
+ * the like, is run by the messenger thread that received it instead of
+ * an op thread, saving the handoff to the op queue and the op thread
+ * and the cache misses that come with it.  Only ops that end up queueing
+ * a transaction qualify: reads, stats and xattr gets may wait on the
+ * disk, which would stall every other connection of the messenger
+ * thread.  The PG turns down writes that would have to load their
+ * object context first (PG::can_run_op_now).
+ */
+bool OSD::op_can_run_inline(MOSDOp *m)
+{
+  if (m->get_flags() & CEPH_OSD_FLAG_PGOP)
+    return false;
+  // the ops are only decoded by partial decoding with old encodings
+  m->finish_decode();
+  if (m->ops.empty())
+    return false;
+  uint64_t bytes = 0;
+  for (vector<OSDOp>::iterator i = m->ops.begin(); i != m->ops.end(); ++i) {
+    switch (i->op.op) {
+    case CEPH_OSD_OP_WRITE:
+    case CEPH_OSD_OP_WRITEFULL:
+      bytes += i->op.extent.length;
+      break;
+    case CEPH_OSD_OP_SETALLOCHINT:
+      break;
+    default:
+      return false;
+    }
+  }
+  return bytes <= cct->_conf->osd_op_run_to_completion_max_bytes;
+}
+
+/*
+ * run op right away on this thread, unless the PG is locked by someone
+ * else, ops queued before it have not run yet, or the store would make
+ * us wait for throttle.  the messenger workers are shared by every
+ * connection, so blocking here would stall replication traffic too.
+ */
+bool OSD::run_op_inline(PG *pg, OpRequestRef& op)
+{
+  if (store->throttle_would_block(op->get_req()->get_data_len())) {
+    logger->inc(l_osd_op_inline_busy);
+    return false;
+  }
+  if (!pg->try_lock()) {
+    logger->inc(l_osd_op_inline_busy);
+    return false;
+  }
+  if (!pg->can_run_op_now(op)) {
+    pg->unlock();
+    logger->inc(l_osd_op_inline_busy);
+    return false;
+  }
+  dout(15) << "run_op_inline " << op << " " << *(op->get_req()) << dendl;
+  op->mark_queued_for_pg();
+  op->mark_stage(TRACKED_OP_STAGE_DEQUEUED);
+  logger->inc(l_osd_op_inline);
+  // no thread pool, no heartbeat to keep
+  ThreadPool::TPHandle handle(cct, NULL, 0, 0);
+  dequeue_op(pg, op, handle);
+  pg->unlock();
+  return true;
+}
+
 /*
  * NOTE: dequeue called in worker thread, with pg lock
  */
@@ -8962,6 +9186,7 @@ const char** OSD::get_tracked_conf_keys() const
     "osd_op_complaint_time", "osd_op_log_threshold",
     "osd_op_history_size", "osd_op_history_duration",
     "osd_enable_op_tracker",
+    "osd_op_tracker_sample_rate",
     "osd_map_cache_size",
     "osd_map_max_advance",
     "osd_pg_epoch_persisted_max_stale",
@@ -9008,6 +9233,9 @@ void OSD::handle_conf_change(const struct md_config_t *conf,
   if (changed.count("osd_enable_op_tracker")) {
       op_tracker.set_tracking(cct->_conf->osd_enable_op_tracker);
   }
+  if (changed.count("osd_op_tracker_sample_rate")) {
+    op_tracker.set_sample_rate(cct->_conf->osd_op_tracker_sample_rate);
+  }
   if (changed.count("osd_disk_thread_ioprio_class") ||
       changed.count("osd_disk_thread_ioprio_priority")) {
     set_disk_tp_priority();
@@ -47,6 +47,8 @@ using namespace std;
 #include "common/sharedptr_registry.hpp"
 #include "common/WeightedPriorityQueue.h"
 #include "common/PrioritizedQueue.h"
+#include "common/WorkStealingQueue.h"
+#include "common/mClockQueue.h"
 #include "messages/MOSDOp.h"
 #include "include/Spinlock.h"
 
@@ -65,12 +67,14 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_lat_outb_hist,
   l_osd_op_r_process_lat,
   l_osd_op_r_prepare_lat,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
   l_osd_op_w_lat,
+  l_osd_op_w_lat_inb_hist,
   l_osd_op_w_process_lat,
   l_osd_op_w_prepare_lat,
   l_osd_op_rw,
@@ -78,8 +82,12 @@ enum {
   l_osd_op_rw_outb,
   l_osd_op_rw_rlat,
   l_osd_op_rw_lat,
+  l_osd_op_rw_lat_inb_hist,
+  l_osd_op_rw_lat_outb_hist,
   l_osd_op_rw_process_lat,
   l_osd_op_rw_prepare_lat,
+  l_osd_op_inline,
+  l_osd_op_inline_busy,
 
   l_osd_sop,
   l_osd_sop_inb,
@@ -375,6 +383,15 @@ class PGQueueable {
     void operator()(const PGRecovery &op);
   };
 public:
+  /// op classes of the mclock op queue
+  enum op_type_t {
+    client_op,
+    osd_subop,
+    bg_snaptrim,
+    bg_recovery,
+    bg_scrub
+  };
+
   // cppcheck-suppress noExplicitConstructor
   PGQueueable(OpRequestRef op)
     : qvariant(op), cost(op->get_req()->get_cost()),
@@ -409,12 +426,62 @@ public:
     RunVis v(osd, pg, handle);
     boost::apply_visitor(v, qvariant);
   }
+  op_type_t get_op_type() const {
+    if (const OpRequestRef *op = boost::get<OpRequestRef>(&qvariant)) {
+      switch ((*op)->get_req()->get_type()) {
+      case CEPH_MSG_OSD_OP:
+	return client_op;
+      case MSG_OSD_PG_PUSH:
+      case MSG_OSD_PG_PULL:
+      case MSG_OSD_PG_PUSH_REPLY:
+      case MSG_OSD_PG_SCAN:
+      case MSG_OSD_PG_BACKFILL:
+	return bg_recovery;
+      case MSG_OSD_REP_SCRUB:
+	return bg_scrub;
+      default:
+	return osd_subop;
+      }
+    }
+    if (boost::get<PGSnapTrim>(&qvariant))
+      return bg_snaptrim;
+    if (boost::get<PGScrub>(&qvariant))
+      return bg_scrub;
+    return bg_recovery;
+  }
   unsigned get_priority() const { return priority; }
   int get_cost() const { return cost; }
   utime_t get_start_time() const { return start_time; }
   entity_inst_t get_owner() const { return owner; }
 };
 
+/**
+ * Scheduling client of an op in the mclock op queue: every client of
+ * the client ops, and every other op class as a whole.
+ */
+struct mClockOpClient {
+  PGQueueable::op_type_t type;
+  entity_inst_t owner;
+  mClockOpClient(PGQueueable::op_type_t type, const entity_inst_t &owner)
+    : type(type), owner(owner) {}
+};
+
+inline bool operator<(const mClockOpClient &a, const mClockOpClient &b) {
+  if (a.type != b.type)
+    return a.type < b.type;
+  return a.owner < b.owner;
+}
+
+inline ostream& operator<<(ostream &out, const mClockOpClient &c) {
+  static const char *types[] = {
+    "client_op", "osd_subop", "snaptrim", "recovery", "scrub"
+  };
+  out << types[c.type];
+  if (c.type == PGQueueable::client_op)
+    out << "(" << c.owner << ")";
+  return out;
+}
+
 class OSDService {
 public:
   OSD *osd;
@@ -1424,11 +1491,17 @@ public:
     Spinlock received_map_lock;
     epoch_t received_map_epoch; // largest epoch seen in MOSDMap from here
 
+    /// with osd_op_run_to_completion, set by ms_fast_dispatch() while it
+    /// dispatches, and the ops handle_op() left it to run on its thread
+    /// once it drops session_dispatch_lock
+    bool fast_dispatching;
+    list<pair<PGRef, OpRequestRef> > ops_to_run;
+
     explicit Session(CephContext *cct) :
       RefCountedObject(cct),
       auid(-1), con(0),
       session_dispatch_lock("Session::session_dispatch_lock"), 
-      last_sent_epoch(0), received_map_epoch(0)
+      last_sent_epoch(0), received_map_epoch(0), fast_dispatching(false)
     {}
     void maybe_reset_osdmap() {
       if (waiting_for_pg.empty()) {
@@ -1731,11 +1804,52 @@ private:
   // -- op queue --
   enum io_queue {
     prioritized,
-    weightedpriority};
+    weightedpriority,
+    workstealing,
+    mclock};
   const io_queue op_queue;
   const unsigned int op_prio_cutoff;
 
   friend class PGQueueable;
+  /// mclock settings of an op class, as configured for the whole OSD
+  static mClockClientInfo get_mclock_info(CephContext *cct,
+					  PGQueueable::op_type_t type) {
+    md_config_t *conf = cct->_conf;
+    switch (type) {
+    case PGQueueable::client_op:
+      return mClockClientInfo(conf->osd_op_queue_mclock_client_op_res,
+			      conf->osd_op_queue_mclock_client_op_wgt,
+			      conf->osd_op_queue_mclock_client_op_lim);
+    case PGQueueable::osd_subop:
+      return mClockClientInfo(conf->osd_op_queue_mclock_osd_subop_res,
+			      conf->osd_op_queue_mclock_osd_subop_wgt,
+			      conf->osd_op_queue_mclock_osd_subop_lim);
+    case PGQueueable::bg_snaptrim:
+      return mClockClientInfo(conf->osd_op_queue_mclock_snap_res,
+			      conf->osd_op_queue_mclock_snap_wgt,
+			      conf->osd_op_queue_mclock_snap_lim);
+    case PGQueueable::bg_recovery:
+      return mClockClientInfo(conf->osd_op_queue_mclock_recov_res,
+			      conf->osd_op_queue_mclock_recov_wgt,
+			      conf->osd_op_queue_mclock_recov_lim);
+    case PGQueueable::bg_scrub:
+      return mClockClientInfo(conf->osd_op_queue_mclock_scrub_res,
+			      conf->osd_op_queue_mclock_scrub_wgt,
+			      conf->osd_op_queue_mclock_scrub_lim);
+    }
+    assert(0 == "unknown op type");
+    return mClockClientInfo();
+  }
+  /// the share of one of num_shards mclock queues, each serving its own ops
+  static mClockClientInfo get_mclock_shard_info(CephContext *cct,
+						PGQueueable::op_type_t type,
+						unsigned num_shards) {
+    mClockClientInfo info = get_mclock_info(cct, type);
+    info.reservation /= num_shards;
+    info.limit /= num_shards;
+    return info;
+  }
+
   class ShardedOpWQ: public ShardedThreadPool::ShardedWQ < pair <PGRef, PGQueueable> > {
 
     struct ShardData {
@@ -1747,7 +1861,7 @@ private:
       ShardData(
 	string lock_name, string ordering_lock,
 	uint64_t max_tok_per_prio, uint64_t min_cost, CephContext *cct,
-	io_queue opqueue)
+	io_queue opqueue, unsigned num_shards)
 	: sdata_lock(lock_name.c_str(), false, true, false, cct),
 	  sdata_op_ordering_lock(ordering_lock.c_str(), false, true, false, cct) {
 	    if (opqueue == weightedpriority) {
@@ -1760,6 +1874,23 @@ private:
 		<PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t>>(
 		  new PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t>(
 		    max_tok_per_prio, min_cost));
+	    } else if (opqueue == mclock) {
+	      pqueue = std::unique_ptr
+		<mClockQueue< pair<PGRef, PGQueueable>, entity_inst_t,
+			      mClockOpClient>>(
+		  new mClockQueue< pair<PGRef, PGQueueable>, entity_inst_t,
+				   mClockOpClient>(
+		    [cct, num_shards](const mClockOpClient &c) {
+		      return get_mclock_shard_info(cct, c.type, num_shards);
+		    },
+		    [](const entity_inst_t &owner,
+		       const pair<PGRef, PGQueueable> &op) {
+		      PGQueueable::op_type_t type = op.second.get_op_type();
+		      return mClockOpClient(
+			type,
+			type == PGQueueable::client_op ?
+			  owner : entity_inst_t());
+		    }));
 	    }
 	  }
     };
@@ -1768,10 +1899,26 @@ private:
     OSD *osd;
     uint32_t num_shards;
 
+    /**
+     * with osd_op_queue = work_stealing, the ops are queued here rather
+     * than in the ShardData pqueues: an idle shard thread takes a batch
+     * of ops of a PG queued on another shard instead of waiting.  Ops
+     * of a PG are run in order, but priority and cost are ignored.
+     */
+    std::unique_ptr<WorkStealingQueue<PGRef, PGQueueable>> ws_queue;
+    void _process_stealing(uint32_t thread_index, heartbeat_handle_d *hb);
+
+    uint32_t shard_of(PG *pg) const {
+      return pg->get_pgid().hash_to_shard(num_shards);
+    }
+
   public:
     ShardedOpWQ(uint32_t pnum_shards, OSD *o, time_t ti, time_t si, ShardedThreadPool* tp):
       ShardedThreadPool::ShardedWQ < pair <PGRef, PGQueueable> >(ti, si, tp),
       osd(o), num_shards(pnum_shards) {
+      if (osd->op_queue == workstealing)
+	ws_queue.reset(new WorkStealingQueue<PGRef, PGQueueable>(
+			 num_shards, "OSD:ShardedOpWQ:ws:"));
       for(uint32_t i = 0; i < num_shards; i++) {
 	char lock_name[32] = {0};
 	snprintf(lock_name, sizeof(lock_name), "%s.%d", "OSD:ShardedOpWQ:", i);
@@ -1782,7 +1929,8 @@ private:
 	ShardData* one_shard = new ShardData(
 	  lock_name, order_lock,
 	  osd->cct->_conf->osd_op_pq_max_tokens_per_priority, 
-	  osd->cct->_conf->osd_op_pq_min_cost, osd->cct, osd->op_queue);
+	  osd->cct->_conf->osd_op_pq_min_cost, osd->cct, osd->op_queue,
+	  num_shards);
 	shard_list.push_back(one_shard);
       }
     }
@@ -1799,6 +1947,8 @@ private:
     void _enqueue_front(pair <PGRef, PGQueueable> item);
       
     void return_waiting_threads() {
+      if (ws_queue)
+	ws_queue->wake_all();
       for(uint32_t i = 0; i < num_shards; i++) {
 	ShardData* sdata = shard_list[i];
 	assert (NULL != sdata); 
@@ -1816,7 +1966,10 @@ private:
 	assert (NULL != sdata);
 	sdata->sdata_op_ordering_lock.Lock();
 	f->open_object_section(lock_name);
-	sdata->pqueue->dump(f);
+	if (ws_queue)
+	  ws_queue->dump(i, f);
+	else
+	  sdata->pqueue->dump(f);
 	f->close_section();
 	sdata->sdata_op_ordering_lock.Unlock();
       }
@@ -1827,10 +1980,15 @@ private:
       PG *pg;
       list<OpRequestRef> *out_ops;
       uint64_t reserved_pushes_to_free;
+      unsigned removed;
       Pred(PG *pg, list<OpRequestRef> *out_ops = 0)
-	: pg(pg), out_ops(out_ops), reserved_pushes_to_free(0) {}
+	: pg(pg), out_ops(out_ops), reserved_pushes_to_free(0), removed(0) {}
+      void operator()(const PGQueueable &op) {
+	accumulate(op);
+      }
       void accumulate(const PGQueueable &op) {
 	reserved_pushes_to_free += op.get_reserved_pushes();
+	++removed;
 	if (out_ops) {
 	  boost::optional<OpRequestRef> mop = op.maybe_get_op();
 	  if (mop)
@@ -1857,6 +2015,13 @@ private:
     void dequeue_and_get_ops(PG *pg, list<OpRequestRef> *dequeued) {
       ShardData* sdata = NULL;
       assert(pg != NULL);
+      if (ws_queue) {
+	Pred f(pg, dequeued);
+	ws_queue->remove(shard_of(pg), pg, f);
+	pg->op_wq_items -= f.removed;
+	osd->service.release_reserved_pushes(f.get_reserved_pushes_to_free());
+	return;
+      }
       uint32_t shard_index = pg->get_pgid().ps()% shard_list.size();
       sdata = shard_list[shard_index];
       assert(sdata != NULL);
@@ -1864,8 +2029,9 @@ private:
 
       Pred f(pg, dequeued);
 
-      // items in pqueue are behind items in pg_for_processing
-      sdata->pqueue->remove_by_filter(f);
+      // items in pqueue are behind items in pg_for_processing.  by
+      // reference, std::function would count into a copy
+      sdata->pqueue->remove_by_filter(std::ref(f));
 
       map<PG *, list<PGQueueable> >::const_iterator iter =
 	sdata->pg_for_processing.find(pg);
@@ -1878,12 +2044,15 @@ private:
 	sdata->pg_for_processing.erase(iter);
       }
 
+      pg->op_wq_items -= f.removed;
       sdata->sdata_op_ordering_lock.Unlock();
       osd->service.release_reserved_pushes(f.get_reserved_pushes_to_free());
     }
  
     bool is_shard_empty(uint32_t thread_index) {
       uint32_t shard_index = thread_index % num_shards; 
+      if (ws_queue)
+	return ws_queue->empty(shard_index);
       ShardData* sdata = shard_list[shard_index];
       assert(NULL != sdata);
       Mutex::Locker l(sdata->sdata_op_ordering_lock);
@@ -1896,6 +2065,8 @@ private:
   void dequeue_op(
     PGRef pg, OpRequestRef op,
     ThreadPool::TPHandle &handle);
+  bool op_can_run_inline(MOSDOp *m);
+  bool run_op_inline(PG *pg, OpRequestRef& op);
 
   // -- peering queue --
   struct PeeringWQ : public ThreadPool::BatchWorkQueue<PG> {
@@ -2402,6 +2573,10 @@ protected:
       return (rand() % 2 < 1) ? prioritized : weightedpriority;
     } else if (cct->_conf->osd_op_queue == "wpq") {
       return weightedpriority;
+    } else if (cct->_conf->osd_op_queue == "work_stealing") {
+      return workstealing;
+    } else if (cct->_conf->osd_op_queue == "mclock") {
+      return mclock;
     } else {
       return prioritized;
     }
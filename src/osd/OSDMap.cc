@@ -1041,6 +1041,10 @@ uint64_t OSDMap::get_features(int entity_type, uint64_t *pmask) const
 	entity_type != CEPH_ENTITY_TYPE_CLIENT) { // not for clients
       features |= CEPH_FEATURE_OSD_ERASURE_CODES;
     }
+    if (p->second.allows_ecoverwrites() &&
+	entity_type == CEPH_ENTITY_TYPE_OSD) {
+      features |= CEPH_FEATURE_OSD_EC_OVERWRITES;
+    }
     if (!p->second.tiers.empty() ||
 	p->second.is_tier()) {
       features |= CEPH_FEATURE_OSD_CACHEPOOL;
@@ -1074,6 +1078,8 @@ uint64_t OSDMap::get_features(int entity_type, uint64_t *pmask) const
   mask |= CEPH_FEATURE_OSDHASHPSPOOL | CEPH_FEATURE_OSD_CACHEPOOL;
   if (entity_type != CEPH_ENTITY_TYPE_CLIENT)
     mask |= CEPH_FEATURE_OSD_ERASURE_CODES;
+  if (entity_type == CEPH_ENTITY_TYPE_OSD)
+    mask |= CEPH_FEATURE_OSD_EC_OVERWRITES;
 
   if (osd_primary_affinity) {
     for (int i = 0; i < max_osd; ++i) {
@@ -1250,8 +1256,23 @@ void OSDMap::clean_temps(CephContext *cct,
   }
 }
 
+void OSDMap::build_pg_mapping(unsigned threads)
+{
+  // map with CRUSH, not with the old mapping
+  clear_pg_mapping();
+  OSDMapMapping *m = new OSDMapMapping;
+  m->build(*this, threads);
+  pg_mapping.set(m);
+}
+
+void OSDMap::clear_pg_mapping() const
+{
+  pg_mapping.reset();
+}
+
 int OSDMap::apply_incremental(const Incremental &inc)
 {
+  clear_pg_mapping();
   new_blacklist_entries = false;
   if (inc.epoch == 1)
     fsid = inc.fsid;
@@ -1703,6 +1724,9 @@ void OSDMap::_pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_prim
       *acting_primary = -1;
     return;
   }
+  if (pg_mapping.get(epoch, pool->raw_pg_to_pg(pg), up, up_primary,
+		     acting, acting_primary))
+    return;
   vector<int> raw;
   vector<int> _up;
   vector<int> _acting;
@@ -2093,6 +2117,8 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
 
 void OSDMap::decode(bufferlist::iterator& bl)
 {
+  clear_pg_mapping();
+
   /**
    * Older encodings of the OSDMap had a single struct_v which
    * covered the whole encoding, and was prior to our modern
@@ -29,6 +29,7 @@
 
 //#include "include/ceph_features.h"
 #include "crush/CrushWrapper.h"
+#include "OSDMapMapping.h"
 #include <vector>
 #include <list>
 #include <set>
@@ -246,6 +247,9 @@ private:
   mutable bool crc_defined;
   mutable uint32_t crc;
 
+  /// every pg mapped up front, if built
+  mutable OSDMapMappingSlot pg_mapping;
+
   void _calc_up_osd_features();
 
  public:
@@ -256,6 +260,7 @@ private:
 
   friend class OSDMonitor;
   friend class PGMonitor;
+  friend class OSDMapMapping;
 
  public:
   OSDMap() : epoch(0), 
@@ -297,6 +302,9 @@ public:
 
     // NOTE: we do not copy crush.  note that apply_incremental will
     // allocate a new CrushWrapper, though.
+
+    // the copy is about to change
+    pg_mapping.reset();
   }
 
   // map info
@@ -565,6 +573,18 @@ public:
 
   int apply_incremental(const Incremental &inc);
 
+  /**
+   * Map every pg of this epoch with up to threads threads, so that
+   * pg_to_up_acting_osds() and friends look them up instead of running
+   * CRUSH.  Kept until apply_incremental() or decode().
+   */
+  void build_pg_mapping(unsigned threads);
+  /// drop the mapping built above; safe while others map with this map
+  void clear_pg_mapping() const;
+  bool have_pg_mapping() const {
+    return !pg_mapping.empty();
+  }
+
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
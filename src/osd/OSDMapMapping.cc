@@ -0,0 +1,136 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "OSDMapMapping.h"
+#include "OSDMap.h"
+
+#include <atomic>
+#include <thread>
+
+// pgs mapped by one thread at a time
+static const unsigned PGS_PER_JOB = 1024;
+
+void OSDMapMapping::PoolMapping::set(
+  unsigned ps,
+  const std::vector<int>& up, int up_primary,
+  const std::vector<int>& acting, int acting_primary)
+{
+  int32_t *row = &table[ps * (4 + 2 * size)];
+  if (up.size() > size || acting.size() > size) {
+    // e.g. a pg_temp longer than the pool; leave it to the OSDMap
+    row[3] = -1;
+    return;
+  }
+  row[0] = acting_primary;
+  row[1] = up_primary;
+  row[2] = acting.size();
+  row[3] = up.size();
+  for (unsigned i = 0; i < acting.size(); ++i)
+    row[4 + i] = acting[i];
+  for (unsigned i = 0; i < up.size(); ++i)
+    row[4 + size + i] = up[i];
+}
+
+bool OSDMapMapping::PoolMapping::get(
+  unsigned ps,
+  std::vector<int> *up, int *up_primary,
+  std::vector<int> *acting, int *acting_primary) const
+{
+  if (ps >= pg_num)
+    return false;
+  const int32_t *row = &table[ps * (4 + 2 * size)];
+  if (row[3] < 0)
+    return false;
+  if (acting_primary)
+    *acting_primary = row[0];
+  if (up_primary)
+    *up_primary = row[1];
+  if (acting)
+    acting->assign(row + 4, row + 4 + row[2]);
+  if (up)
+    up->assign(row + 4 + size, row + 4 + size + row[3]);
+  return true;
+}
+
+void OSDMapMapping::_build_range(const OSDMap& osdmap, int64_t pool,
+				 PoolMapping *pm,
+				 unsigned begin, unsigned end)
+{
+  std::vector<int> up, acting;
+  int up_primary, acting_primary;
+  for (unsigned ps = begin; ps < end; ++ps) {
+    osdmap._pg_to_up_acting_osds(pg_t(ps, pool), &up, &up_primary,
+				 &acting, &acting_primary);
+    pm->set(ps, up, up_primary, acting, acting_primary);
+  }
+}
+
+void OSDMapMapping::build(const OSDMap& osdmap, unsigned threads)
+{
+  struct job_t {
+    int64_t pool;
+    PoolMapping *pm;
+    unsigned begin, end;
+  };
+
+  epoch = osdmap.get_epoch();
+  pools.clear();
+  std::vector<job_t> jobs;
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p) {
+    PoolMapping *pm = &pools.insert(
+      make_pair(p->first,
+		PoolMapping(p->second.get_size(),
+			    p->second.get_pg_num()))).first->second;
+    for (unsigned begin = 0; begin < pm->pg_num; begin += PGS_PER_JOB) {
+      job_t job = { p->first, pm, begin,
+		    MIN(begin + PGS_PER_JOB, pm->pg_num) };
+      jobs.push_back(job);
+    }
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++)
+      _build_range(osdmap, jobs[i].pool, jobs[i].pm, jobs[i].begin, jobs[i].end);
+  };
+  threads = MIN(threads, jobs.size());
+  if (threads <= 1) {
+    worker();
+    return;
+  }
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(std::thread(worker));
+  for (unsigned i = 0; i < workers.size(); ++i)
+    workers[i].join();
+}
+
+bool OSDMapMapping::get(pg_t pgid, std::vector<int> *up, int *up_primary,
+			std::vector<int> *acting, int *acting_primary) const
+{
+  std::map<int64_t, PoolMapping>::const_iterator p = pools.find(pgid.pool());
+  if (p == pools.end())
+    return false;
+  return p->second.get(pgid.ps(), up, up_primary, acting, acting_primary);
+}
+
+uint64_t OSDMapMapping::get_num_pgs() const
+{
+  uint64_t num = 0;
+  for (std::map<int64_t, PoolMapping>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p)
+    num += p->second.pg_num;
+  return num;
+}
@@ -0,0 +1,126 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDMAPMAPPING_H
+#define CEPH_OSDMAPMAPPING_H
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "osd_types.h"
+
+class OSDMap;
+
+/**
+ * The up and acting sets of every pg of one OSDMap epoch, worked out
+ * up front (on several threads) so that looking one up does not run
+ * CRUSH.  An OSDMap built one keeps it until the map changes; see
+ * OSDMap::build_pg_mapping().
+ */
+class OSDMapMapping {
+  struct PoolMapping {
+    unsigned size;    ///< osds kept per set
+    unsigned pg_num;
+    /// per pg: acting_primary, up_primary, num_acting, num_up,
+    /// acting[size], up[size]; num_up is -1 for a pg not kept here
+    std::vector<int32_t> table;
+
+    PoolMapping(unsigned s, unsigned n)
+      : size(s), pg_num(n), table(n * (4 + 2 * s)) {}
+
+    void set(unsigned ps, const std::vector<int>& up, int up_primary,
+	     const std::vector<int>& acting, int acting_primary);
+    bool get(unsigned ps, std::vector<int> *up, int *up_primary,
+	     std::vector<int> *acting, int *acting_primary) const;
+  };
+
+  epoch_t epoch;
+  std::map<int64_t, PoolMapping> pools;
+
+  void _build_range(const OSDMap& osdmap, int64_t pool, PoolMapping *pm,
+		    unsigned begin, unsigned end);
+
+public:
+  OSDMapMapping() : epoch(0) {}
+
+  /// map every pg of osdmap, splitting the work over up to threads threads
+  void build(const OSDMap& osdmap, unsigned threads);
+
+  /**
+   * Fill in whichever fields are non-NULL for pgid, which must be
+   * normalized with pg_pool_t::raw_pg_to_pg().
+   *
+   * @return false if pgid is not kept here; ask the OSDMap instead
+   */
+  bool get(pg_t pgid, std::vector<int> *up, int *up_primary,
+	   std::vector<int> *acting, int *acting_primary) const;
+
+  epoch_t get_epoch() const { return epoch; }
+  uint64_t get_num_pgs() const;
+};
+
+/**
+ * Where an OSDMap keeps its OSDMapMapping.  A lookup with no mapping
+ * built costs one relaxed load; with one, it counts itself in readers
+ * for the duration, and reset() waits for readers to drain before it
+ * frees the table, so a map shared with other threads can drop it.
+ * Copies start out empty.
+ */
+class OSDMapMappingSlot {
+  std::atomic<const OSDMapMapping*> mapping;
+  mutable std::atomic<unsigned> readers;
+
+public:
+  OSDMapMappingSlot() : mapping(nullptr), readers(0) {}
+  OSDMapMappingSlot(const OSDMapMappingSlot&) : mapping(nullptr), readers(0) {}
+  OSDMapMappingSlot& operator=(const OSDMapMappingSlot&) {
+    reset();
+    return *this;
+  }
+  ~OSDMapMappingSlot() {
+    reset();
+  }
+
+  bool empty() const {
+    return !mapping.load(std::memory_order_relaxed);
+  }
+  /// take ownership of m, dropping the mapping held so far
+  void set(const OSDMapMapping *m) {
+    reset();
+    mapping.store(m);
+  }
+  void reset() {
+    const OSDMapMapping *m = mapping.exchange(nullptr);
+    if (!m)
+      return;
+    while (readers.load())
+      std::this_thread::yield();
+    delete m;
+  }
+
+  /// OSDMapMapping::get() if a mapping of epoch e is held
+  bool get(epoch_t e, pg_t pgid, std::vector<int> *up, int *up_primary,
+	   std::vector<int> *acting, int *acting_primary) const {
+    if (empty())
+      return false;
+    ++readers;
+    const OSDMapMapping *m = mapping.load();
+    bool found = m && m->get_epoch() == e &&
+      m->get(pgid, up, up_primary, acting, acting_primary);
+    --readers;
+    return found;
+  }
+};
+
+#endif
@@ -156,21 +156,26 @@ public:
   }
 
   void mark_queued_for_pg() {
+    mark_stage(TRACKED_OP_STAGE_QUEUED_FOR_PG);
     mark_flag_point(flag_queued_for_pg, "queued_for_pg");
   }
   void mark_reached_pg() {
+    mark_stage(TRACKED_OP_STAGE_REACHED_PG);
     mark_flag_point(flag_reached_pg, "reached_pg");
   }
   void mark_delayed(const string& s) {
     mark_flag_point(flag_delayed, s);
   }
   void mark_started() {
+    mark_stage(TRACKED_OP_STAGE_STARTED);
     mark_flag_point(flag_started, "started");
   }
   void mark_sub_op_sent(const string& s) {
+    mark_stage(TRACKED_OP_STAGE_SUB_OP_SENT);
     mark_flag_point(flag_sub_op_sent, s);
   }
   void mark_commit_sent() {
+    mark_stage(TRACKED_OP_STAGE_COMMIT_SENT);
     mark_flag_point(flag_commit_sent, "commit_sent");
   }
 
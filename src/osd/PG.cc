@@ -275,6 +275,16 @@ void PG::lock(bool no_lockdep) const
   dout(30) << "lock" << dendl;
 }
 
+bool PG::try_lock() const
+{
+  if (!_lock.TryLock())
+    return false;
+  assert(!dirty_info);
+  assert(!dirty_big_info);
+  dout(30) << "try_lock" << dendl;
+  return true;
+}
+
 std::string PG::gen_prefix() const
 {
   stringstream out;
@@ -1923,6 +1933,23 @@ void PG::queue_op(OpRequestRef& op)
   }
 }
 
+/*
+ * whether op can be run right away instead of queued: nothing queued
+ * before it could run after it.  with pg lock.
+ */
+bool PG::can_run_op_now(OpRequestRef& op)
+{
+  assert(is_locked());
+  {
+    Mutex::Locker l(map_lock);
+    if (!waiting_for_map.empty() ||
+	op_must_wait_for_map(get_osdmap_with_maplock()->get_epoch(), op) ||
+	op_wq_items != 0)
+      return false;
+  }
+  return op_context_cached(op);
+}
+
 void PG::replay_queued_ops()
 {
   assert(is_replay());
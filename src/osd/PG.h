@@ -221,6 +221,7 @@ protected:
   PGPool pool;
 
   void queue_op(OpRequestRef& op);
+  bool can_run_op_now(OpRequestRef& op);
   void take_op_map_waiters();
 
   void update_osdmap_ref(OSDMapRef newmap) {
@@ -263,9 +264,12 @@ protected:
 public:
   bool deleting;  // true while in removing or OSD is shutting down
 
+  /// items of this PG in the OSD op queue, queued or being run
+  std::atomic_uint op_wq_items{0};
 
   void lock_suspend_timeout(ThreadPool::TPHandle &handle);
   void lock(bool no_lockdep = false) const;
+  bool try_lock() const;
   void unlock() const {
     //generic_dout(0) << this << " " << info.pgid << " unlock" << dendl;
     assert(!dirty_info);
@@ -1013,6 +1017,13 @@ public:
 	   ++i) {
 	LogEntryTrimmer trimmer(i->soid, pg, t);
 	i->mod_desc.visit(&trimmer);
+	set<version_t> extent_gens;
+	i->mod_desc.get_rollback_extents_gens(&extent_gens);
+	for (set<version_t>::iterator j = extent_gens.begin();
+	     j != extent_gens.end();
+	     ++j) {
+	  pg->get_pgbackend()->trim_stashed_object(i->soid, *j, t);
+	}
       }
     }
   };
@@ -2371,6 +2382,8 @@ public:
   ) = 0;
 
   virtual void do_op(OpRequestRef& op) = 0;
+  /// true if do_op() will not have to read op's object context from disk
+  virtual bool op_context_cached(OpRequestRef& op) = 0;
   virtual void do_sub_op(OpRequestRef op) = 0;
   virtual void do_sub_op_reply(OpRequestRef op) = 0;
   virtual void do_scan(
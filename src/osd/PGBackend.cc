@@ -50,6 +50,13 @@ struct RollbackVisitor : public ObjectModDesc::Visitor {
     temp.append(t);
     temp.swap(t);
   }
+  void rollback_extents(
+    version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {
+    ObjectStore::Transaction temp;
+    pg->rollback_extents(hoid, gen, old_size, off, len, &temp);
+    temp.append(t);
+    temp.swap(t);
+  }
   void setattrs(map<string, boost::optional<bufferlist> > &attrs) {
     ObjectStore::Transaction temp;
     pg->rollback_setattrs(hoid, attrs, &temp);
@@ -88,6 +95,13 @@ void PGBackend::rollback(
   RollbackVisitor vis(hoid, this);
   desc.visit(&vis);
   t->append(vis.t);
+  set<version_t> extent_gens;
+  desc.get_rollback_extents_gens(&extent_gens);
+  for (set<version_t>::iterator i = extent_gens.begin();
+       i != extent_gens.end();
+       ++i) {
+    trim_stashed_object(hoid, *i, t);
+  }
 }
 
 
@@ -407,7 +407,7 @@ typedef ceph::shared_ptr<const OSDMap> OSDMapRef;
        uint32_t flags
        ) = 0;
 
-     /// Optional, not supported on ec-pool
+     /// Optional, on ec-pools only if the pool allows overwrites
      virtual void write(
        const hobject_t &hoid, ///< [in] object to write
        uint64_t off,          ///< [in] off at which to write
@@ -521,6 +521,15 @@ typedef ceph::shared_ptr<const OSDMap> OSDMapRef;
      uint64_t old_size,
      ObjectStore::Transaction *t);
 
+   /// Restore the extents stashed at gen to rollback an overwrite
+   virtual void rollback_extents(
+     const hobject_t &hoid,
+     version_t gen,
+     uint64_t old_size,
+     uint64_t off,
+     uint64_t len,
+     ObjectStore::Transaction *t) { assert(0); }
+
    /// Unstash object to rollback stash
    void rollback_stash(
      const hobject_t &hoid,
@@ -621,6 +621,8 @@ void ReplicatedBackend::submit_transaction(
   vector<ObjectStore::Transaction> tls;
   tls.push_back(std::move(op_t));
 
+  if (op.op)
+    op.op->mark_stage(TRACKED_OP_STAGE_TXN_SUBMITTED);
   parent->queue_transactions(tls, op.op);
 }
 
@@ -648,8 +650,10 @@ void ReplicatedBackend::op_commit(
   InProgressOp *op)
 {
   dout(10) << __func__ << ": " << op->tid << dendl;
-  if (op->op)
+  if (op->op) {
+    op->op->mark_stage(TRACKED_OP_STAGE_LOCAL_COMMIT);
     op->op->mark_event("op_commit");
+  }
 
   op->waiting_for_commit.erase(get_parent()->whoami_shard());
 
@@ -700,6 +704,7 @@ void ReplicatedBackend::sub_op_modify_reply(OpRequestRef op)
       assert(ip_op.waiting_for_commit.count(from));
       ip_op.waiting_for_commit.erase(from);
       if (ip_op.op) {
+	ip_op.op->mark_stage(TRACKED_OP_STAGE_REPLICA_COMMIT);
         ostringstream ss;
         ss << "sub_op_commit_rec from " << from;
 	ip_op.op->mark_event(ss.str());
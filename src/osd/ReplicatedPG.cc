@@ -1560,6 +1560,26 @@ bool ReplicatedPG::check_src_targ(const hobject_t& soid, const hobject_t& toid)
   return false;
 }
 
+/*
+ * A write whose object context is cached only queues a transaction;
+ * any other has to read the object info (or find it missing) first.
+ * Cache tiering may proxy or promote, so tier pools always say no.
+ */
+bool ReplicatedPG::op_context_cached(OpRequestRef& op)
+{
+  if (op->get_req()->get_type() != CEPH_MSG_OSD_OP)
+    return false;
+  if (pool.info.is_tier() || pool.info.has_tiers())
+    return false;
+  MOSDOp *m = static_cast<MOSDOp*>(op->get_req());
+  m->finish_decode();
+  hobject_t head(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(),
+		 info.pgid.pool(), m->get_object_locator().nspace);
+  ObjectContextRef obc = object_contexts.lookup(head);
+  return obc && obc->obs.exists && obc->ssc;
+}
+
 /** do_op - do an op
  * pg lock will be held (if multithreaded)
  * osd_lock NOT held.
@@ -3186,6 +3206,8 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
     osd->logger->inc(l_osd_op_rw_inb, inb);
     osd->logger->inc(l_osd_op_rw_outb, outb);
     osd->logger->tinc(l_osd_op_rw_lat, latency);
+    osd->logger->hinc(l_osd_op_rw_lat_inb_hist, latency.to_nsec(), inb);
+    osd->logger->hinc(l_osd_op_rw_lat_outb_hist, latency.to_nsec(), outb);
     osd->logger->tinc(l_osd_op_rw_process_lat, process_latency);
     if (rlatency != utime_t())
       osd->logger->tinc(l_osd_op_rw_rlat, rlatency);
@@ -3193,11 +3215,13 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->tinc(l_osd_op_r_lat, latency);
+    osd->logger->hinc(l_osd_op_r_lat_outb_hist, latency.to_nsec(), outb);
     osd->logger->tinc(l_osd_op_r_process_lat, process_latency);
   } else if (op->may_write() || op->may_cache()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
     osd->logger->tinc(l_osd_op_w_lat, latency);
+    osd->logger->hinc(l_osd_op_w_lat_inb_hist, latency.to_nsec(), inb);
     osd->logger->tinc(l_osd_op_w_process_lat, process_latency);
     if (rlatency != utime_t())
       osd->logger->tinc(l_osd_op_w_rlat, rlatency);
@@ -5041,14 +5065,26 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  break;
 	}
 
+	bool overwrite = false;
 	if (!obs.exists) {
 	  if (pool.info.require_rollback() && op.extent.offset) {
-	    result = -EOPNOTSUPP;
-	    break;
+	    if (!pool.info.allows_ecoverwrites()) {
+	      result = -EOPNOTSUPP;
+	      break;
+	    }
+	    overwrite = true;
 	  }
 	  ctx->mod_desc.create();
-	} else if (op.extent.offset == oi.size) {
+	} else if (op.extent.offset == oi.size &&
+		   (!pool.info.allows_ecoverwrites() ||
+		    oi.size % pool.info.stripe_width == 0)) {
 	  ctx->mod_desc.append(oi.size);
+	} else if (pool.info.allows_ecoverwrites()) {
+	  // the chunks replaced are stashed at the entry's version
+	  ctx->mod_desc.rollback_extents(
+	    ctx->at_version.version, oi.size,
+	    op.extent.offset, op.extent.length);
+	  overwrite = true;
 	} else {
 	  ctx->mod_desc.mark_unrollbackable();
 	  if (pool.info.require_rollback()) {
@@ -5090,7 +5126,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	result = check_offset_and_length(op.extent.offset, op.extent.length, cct->_conf->osd_max_object_size);
 	if (result < 0)
 	  break;
-	if (pool.info.require_rollback()) {
+	if (pool.info.require_rollback() && !overwrite) {
 	  t->append(soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags);
 	} else {
 	  t->write(soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags);
@@ -5126,6 +5162,11 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  op.flags = op.flags | CEPH_OSD_OP_FLAG_FADVISE_DONTNEED;
 
 	if (pool.info.require_rollback()) {
+	  if (ctx->mod_desc.has_rollback_extents()) {
+	    // the stash generation holds the overwritten extents
+	    result = -EOPNOTSUPP;
+	    break;
+	  }
 	  if (obs.exists) {
 	    if (ctx->mod_desc.rmobject(ctx->at_version.version)) {
 	      t->stash(soid, ctx->at_version.version);
@@ -6110,6 +6151,10 @@ inline int ReplicatedPG::_delete_oid(OpContext *ctx, bool no_whiteout)
     return -ENOENT;
 
   if (pool.info.require_rollback()) {
+    if (ctx->mod_desc.has_rollback_extents()) {
+      // the stash generation holds the overwritten extents
+      return -EOPNOTSUPP;
+    }
     if (ctx->mod_desc.rmobject(ctx->at_version.version)) {
       t->stash(soid, ctx->at_version.version);
     } else {
@@ -6236,8 +6281,9 @@ int ReplicatedPG::_rollback_to(OpContext *ctx, ceph_osd_op& op)
       // Cannot delete an object with watchers
       ret = -EBUSY;
     } else {
-      _delete_oid(ctx, false);
-      ret = 0;
+      ret = _delete_oid(ctx, false);
+      if (ret == -ENOENT)
+	ret = 0;
     }
   } else if (ret) {
     // ummm....huh? It *can't* return anything else at time of writing.
@@ -7505,7 +7551,7 @@ void ReplicatedPG::_write_copy_chunk(CopyOpRef cop, PGBackend::PGTransaction *t)
   if (!cop->temp_cursor.data_complete) {
     assert(cop->data.length() + cop->temp_cursor.data_offset ==
 	   cop->cursor.data_offset);
-    if (pool.info.requires_aligned_append() &&
+    if (pool.info.require_rollback() &&
 	!cop->cursor.data_complete) {
       /**
        * Trim off the unaligned bit at the end, we'll adjust cursor.data_offset
@@ -3301,6 +3301,16 @@ void ObjectModDesc::visit(Visitor *visitor) const
 	visitor->try_rmobject(old_version);
 	break;
       }
+      case ROLLBACK_EXTENTS: {
+	version_t gen;
+	uint64_t old_size, off, len;
+	::decode(gen, bp);
+	::decode(old_size, bp);
+	::decode(off, bp);
+	::decode(len, bp);
+	visitor->rollback_extents(gen, old_size, off, len);
+	break;
+      }
       default:
 	assert(0 == "Invalid rollback code");
       }
@@ -3349,8 +3359,40 @@ struct DumpVisitor : public ObjectModDesc::Visitor {
     f->dump_stream("snaps") << snaps;
     f->close_section();
   }
+  void rollback_extents(
+    version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {
+    f->open_object_section("op");
+    f->dump_string("code", "ROLLBACK_EXTENTS");
+    f->dump_unsigned("gen", gen);
+    f->dump_unsigned("old_size", old_size);
+    f->dump_unsigned("offset", off);
+    f->dump_unsigned("length", len);
+    f->close_section();
+  }
+};
+
+struct RollbackExtentsGens : public ObjectModDesc::Visitor {
+  set<version_t> *gens;
+  explicit RollbackExtentsGens(set<version_t> *gens) : gens(gens) {}
+  void rollback_extents(
+    version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {
+    gens->insert(gen);
+  }
 };
 
+void ObjectModDesc::get_rollback_extents_gens(set<version_t> *gens) const
+{
+  RollbackExtentsGens vis(gens);
+  visit(&vis);
+}
+
+bool ObjectModDesc::has_rollback_extents() const
+{
+  set<version_t> gens;
+  get_rollback_extents_gens(&gens);
+  return !gens.empty();
+}
+
 void ObjectModDesc::dump(Formatter *f) const
 {
   f->open_object_section("object_mod_desc");
@@ -3377,6 +3419,9 @@ void ObjectModDesc::generate_test_instances(list<ObjectModDesc*>& o)
   o.push_back(new ObjectModDesc());
   o.back()->rmobject(1001);
   o.push_back(new ObjectModDesc());
+  o.back()->rollback_extents(1002, 8192, 4096, 100);
+  o.back()->setattrs(attrs);
+  o.push_back(new ObjectModDesc());
   o.back()->create();
   o.back()->setattrs(attrs);
   o.push_back(new ObjectModDesc());
@@ -1076,6 +1076,7 @@ struct pg_pool_t {
     FLAG_WRITE_FADVISE_DONTNEED = 1<<7, // write mode with LIBRADOS_OP_FLAG_FADVISE_DONTNEED
     FLAG_NOSCRUB = 1<<8, // block periodic scrub
     FLAG_NODEEP_SCRUB = 1<<9, // block periodic deep-scrub
+    FLAG_EC_OVERWRITES = 1<<10, // erasure pool allows partial-stripe overwrites
   };
 
   static const char *get_flag_name(int f) {
@@ -1090,6 +1091,7 @@ struct pg_pool_t {
     case FLAG_WRITE_FADVISE_DONTNEED: return "write_fadvise_dontneed";
     case FLAG_NOSCRUB: return "noscrub";
     case FLAG_NODEEP_SCRUB: return "nodeep-scrub";
+    case FLAG_EC_OVERWRITES: return "ec_overwrites";
     default: return "???";
     }
   }
@@ -1128,6 +1130,8 @@ struct pg_pool_t {
       return FLAG_NOSCRUB;
     if (name == "nodeep-scrub")
       return FLAG_NODEEP_SCRUB;
+    if (name == "ec_overwrites")
+      return FLAG_EC_OVERWRITES;
     return 0;
   }
 
@@ -1394,7 +1398,14 @@ public:
     return !(get_type() == TYPE_ERASURE || has_flag(FLAG_DEBUG_FAKE_EC_POOL));
   }
 
-  bool requires_aligned_append() const { return is_erasure(); }
+  /// true if an erasure pool accepts partial-stripe overwrites
+  bool allows_ecoverwrites() const {
+    return is_erasure() && has_flag(FLAG_EC_OVERWRITES);
+  }
+
+  bool requires_aligned_append() const {
+    return is_erasure() && !has_flag(FLAG_EC_OVERWRITES);
+  }
   uint64_t required_alignment() const { return stripe_width; }
 
   bool can_shift_osds() const {
@@ -2400,6 +2411,13 @@ public:
     }
     virtual void create() {}
     virtual void update_snaps(set<snapid_t> &old_snaps) {}
+    /**
+     * Undo a partial-stripe overwrite of [off, off+len) on an ec pool:
+     * the chunk ranges it replaced were cloned into the object at
+     * generation gen, and the object was old_size bytes long.
+     */
+    virtual void rollback_extents(
+      version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {}
     virtual ~Visitor() {}
   };
   void visit(Visitor *visitor) const;
@@ -2410,7 +2428,8 @@ public:
     DELETE = 3,
     CREATE = 4,
     UPDATE_SNAPS = 5,
-    TRY_DELETE = 6
+    TRY_DELETE = 6,
+    ROLLBACK_EXTENTS = 7
   };
   ObjectModDesc() : can_local_rollback(true), rollback_info_completed(false) {}
   void claim(ObjectModDesc &other) {
@@ -2496,6 +2515,19 @@ public:
     ::encode(old_snaps, bl);
     ENCODE_FINISH(bl);
   }
+  bool rollback_extents(
+    version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {
+    if (!can_local_rollback || rollback_info_completed)
+      return false;
+    ENCODE_START(1, 1, bl);
+    append_id(ROLLBACK_EXTENTS);
+    ::encode(gen, bl);
+    ::encode(old_size, bl);
+    ::encode(off, bl);
+    ::encode(len, bl);
+    ENCODE_FINISH(bl);
+    return true;
+  }
 
   // cannot be rolled back
   void mark_unrollbackable() {
@@ -2508,6 +2540,10 @@ public:
   bool empty() const {
     return can_local_rollback && (bl.length() == 0);
   }
+  /// true if an overwrite has stashed extents at the entry's version
+  bool has_rollback_extents() const;
+  /// the generations overwritten extents are stashed at, each only once
+  void get_rollback_extents_gens(set<version_t> *gens) const;
 
   /**
    * Create fresh copy of bl bytes to avoid keeping large buffers around
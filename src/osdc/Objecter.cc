@@ -1194,6 +1194,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  continue;
 	}
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
+	if (e == m->get_last() && cct->_conf->objecter_pg_mapping)
+	  osdmap->build_pg_mapping(cct->_conf->osd_map_pg_mapping_threads);
 
 	cluster_full = cluster_full || _osdmap_full_flag();
 	update_pool_full_map(pool_full_map);
@@ -1231,6 +1233,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	ldout(cct, 3) << "handle_osd_map decoding full epoch "
 		      << m->get_last() << dendl;
 	osdmap->decode(m->maps[m->get_last()]);
+	if (cct->_conf->objecter_pg_mapping)
+	  osdmap->build_pg_mapping(cct->_conf->osd_map_pg_mapping_threads);
 
 	_scan_requests(homeless_session, false, false, NULL,
 		       need_resend, need_resend_linger,
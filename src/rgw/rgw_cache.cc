@@ -9,41 +9,182 @@
 
 using namespace std;
 
-int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cache_entry_info *cache_info)
+static const uint64_t sketch_seeds[] = {
+  0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull,
+  0x9ae16a3b2f90404full, 0xcbf29ce484222325ull
+};
+
+void RGWCacheFrequencySketch::resize(uint64_t entries)
+{
+  uint64_t words = 16;
+  while (words < entries)
+    words <<= 1;
+  table.reset(new std::atomic<uint64_t>[words]);
+  for (uint64_t i = 0; i < words; ++i)
+    table[i] = 0;
+  table_mask = words - 1;
+  additions = 0;
+  sample = 10 * (entries ? entries : 1);
+}
+
+void RGWCacheFrequencySketch::get_counter(uint64_t hash, int i,
+					  uint64_t *index, int *offset) const
 {
-  RWLock::RLocker l(lock);
+  uint64_t h = (hash + sketch_seeds[i]) * sketch_seeds[i];
+  h += h >> 32;
+  *index = h & table_mask;
+  // the hash picks 4 of the 16 counters of a word, one for each row.
+  // the low bits are the same for every key of a shard (see
+  // ObjectCache::get_shard()), so use high ones
+  *offset = (((int)((hash >> 32) & 3) << 2) + i) << 2;
+}
 
+void RGWCacheFrequencySketch::increment(uint64_t hash)
+{
+  if (!table)
+    return;
+  bool added = false;
+  for (int i = 0; i < 4; ++i) {
+    uint64_t index;
+    int offset;
+    get_counter(hash, i, &index, &offset);
+    uint64_t mask = 0xfull << offset;
+    uint64_t old = table[index].load(std::memory_order_relaxed);
+    while ((old & mask) != mask) {
+      if (table[index].compare_exchange_weak(old, old + (1ull << offset),
+					     std::memory_order_relaxed)) {
+	added = true;
+	break;
+      }
+    }
+  }
+  if (added && ++additions == sample)
+    reset();
+}
+
+void RGWCacheFrequencySketch::reset()
+{
+  for (uint64_t i = 0; i <= table_mask; ++i) {
+    uint64_t old = table[i].load(std::memory_order_relaxed);
+    while (!table[i].compare_exchange_weak(old,
+					   (old >> 1) & 0x7777777777777777ull,
+					   std::memory_order_relaxed)) ;
+  }
+  additions -= sample / 2;
+}
+
+unsigned RGWCacheFrequencySketch::estimate(uint64_t hash) const
+{
+  if (!table)
+    return 0;
+  unsigned freq = 15;
+  for (int i = 0; i < 4; ++i) {
+    uint64_t index;
+    int offset;
+    get_counter(hash, i, &index, &offset);
+    unsigned f = (table[index].load(std::memory_order_relaxed) >> offset) & 0xf;
+    if (f < freq)
+      freq = f;
+  }
+  return freq;
+}
+
+ObjectCache::~ObjectCache()
+{
+  for (vector<ObjectCacheShard*>::iterator i = shards.begin();
+       i != shards.end();
+       ++i) {
+    cct->get_perfcounters_collection()->remove((*i)->logger);
+    delete (*i)->logger;
+    delete *i;
+  }
+}
+
+void ObjectCache::set_ctx(CephContext *_cct)
+{
+  cct = _cct;
+  assert(shards.empty());
+  unsigned num_shards = MAX(1, cct->_conf->rgw_cache_shards);
+  uint64_t max_entries = MAX(1, cct->_conf->rgw_cache_lru_size);
+  shard_max_entries = (max_entries + num_shards - 1) / num_shards;
+  shard_max_bytes = (cct->_conf->rgw_cache_max_bytes + num_shards - 1) /
+    num_shards;
+  for (unsigned i = 0; i < num_shards; ++i) {
+    ObjectCacheShard *shard = new ObjectCacheShard;
+    shard->lru_window = shard_max_entries / 2;
+    shard->sketch.resize(shard_max_entries);
+
+    char name[32];
+    snprintf(name, sizeof(name), "rgw_cache-%u", i);
+    PerfCountersBuilder plb(cct, name, l_rgw_cache_shard_first,
+			    l_rgw_cache_shard_last);
+    plb.add_u64_counter(l_rgw_cache_shard_hit, "hit", "Cache hits");
+    plb.add_u64_counter(l_rgw_cache_shard_miss, "miss", "Cache misses");
+    plb.add_u64_counter(l_rgw_cache_shard_insert, "insert", "Entries added");
+    plb.add_u64_counter(l_rgw_cache_shard_evict, "evict", "Entries evicted");
+    plb.add_u64_counter(l_rgw_cache_shard_reject, "reject",
+			"Entries not admitted, less popular than the LRU entry");
+    plb.add_u64(l_rgw_cache_shard_entries, "entries", "Entries");
+    plb.add_u64(l_rgw_cache_shard_bytes, "bytes", "Size of the entries");
+    shard->logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(shard->logger);
+    shards.push_back(shard);
+  }
+}
+
+uint64_t ObjectCache::entry_size(const string& name, const ObjectCacheInfo& info)
+{
+  // the name is kept by the map and the lru
+  uint64_t size = sizeof(ObjectCacheEntry) + 2 * name.size() +
+    info.data.length();
+  for (map<string, bufferlist>::const_iterator i = info.xattrs.begin();
+       i != info.xattrs.end();
+       ++i)
+    size += i->first.size() + i->second.length();
+  return size;
+}
+
+int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cache_entry_info *cache_info)
+{
   if (!enabled) {
     return -ENOENT;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  uint64_t hash = hash_name(name);
+  ObjectCacheShard& shard = get_shard(hash);
+  shard.sketch.increment(hash);
+
+  RWLock::RLocker l(shard.lock);
+
+  std::unordered_map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
     ldout(cct, 10) << "cache get: name=" << name << " : miss" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
+    shard.logger->inc(l_rgw_cache_shard_miss);
     return -ENOENT;
   }
 
   ObjectCacheEntry *entry = &iter->second;
 
-  if (lru_counter - entry->lru_promotion_ts > lru_window) {
-    ldout(cct, 20) << "cache get: touching lru, lru_counter=" << lru_counter
+  if (shard.lru_counter - entry->lru_promotion_ts > shard.lru_window) {
+    ldout(cct, 20) << "cache get: touching lru, lru_counter=" << shard.lru_counter
                    << " promotion_ts=" << entry->lru_promotion_ts << dendl;
-    lock.unlock();
-    lock.get_write(); /* promote lock to writer */
+    shard.lock.unlock();
+    shard.lock.get_write(); /* promote lock to writer */
 
     /* need to redo this because entry might have dropped off the cache */
-    iter = cache_map.find(name);
-    if (iter == cache_map.end()) {
+    iter = shard.cache_map.find(name);
+    if (iter == shard.cache_map.end()) {
       ldout(cct, 10) << "lost race! cache get: name=" << name << " : miss" << dendl;
       if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
+      shard.logger->inc(l_rgw_cache_shard_miss);
       return -ENOENT;
     }
 
     entry = &iter->second;
     /* check again, we might have lost a race here */
-    if (lru_counter - entry->lru_promotion_ts > lru_window) {
-      touch_lru(name, *entry, iter->second.lru_iter);
+    if (shard.lru_counter - entry->lru_promotion_ts > shard.lru_window) {
+      touch_lru(shard, name, *entry, iter->second.lru_iter);
     }
   }
 
@@ -53,6 +194,7 @@ int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cac
                    << std::hex << mask << ", cached=0x" << src.flags
                    << std::dec << ")" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
+    shard.logger->inc(l_rgw_cache_shard_miss);
     return -ENOENT;
   }
   ldout(cct, 10) << "cache get: name=" << name << " : hit (requested=0x"
@@ -65,14 +207,37 @@ int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cac
     cache_info->gen = entry->gen;
   }
   if(perfcounter) perfcounter->inc(l_rgw_cache_hit);
+  shard.logger->inc(l_rgw_cache_shard_hit);
 
   return 0;
 }
 
 bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry)
 {
-  RWLock::WLocker l(lock);
+  if (!enabled) {
+    return false;
+  }
+
+  /* the entries may live in different shards, lock them all in order */
+  set<size_t> shard_ids;
+  list<rgw_cache_entry_info *>::iterator citer;
+  for (citer = cache_info_entries.begin(); citer != cache_info_entries.end(); ++citer) {
+    shard_ids.insert(hash_name((*citer)->cache_locator) % shards.size());
+  }
+  for (set<size_t>::iterator i = shard_ids.begin(); i != shard_ids.end(); ++i) {
+    shards[*i]->lock.get_write();
+  }
+
+  bool ret = _chain_cache_entry(cache_info_entries, chained_entry);
+
+  for (set<size_t>::reverse_iterator i = shard_ids.rbegin(); i != shard_ids.rend(); ++i) {
+    shards[*i]->lock.unlock();
+  }
+  return ret;
+}
 
+bool ObjectCache::_chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry)
+{
   if (!enabled) {
     return false;
   }
@@ -86,8 +251,9 @@ bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_ent
     rgw_cache_entry_info *cache_info = *citer;
 
     ldout(cct, 10) << "chain_cache_entry: cache_locator=" << cache_info->cache_locator << dendl;
-    map<string, ObjectCacheEntry>::iterator iter = cache_map.find(cache_info->cache_locator);
-    if (iter == cache_map.end()) {
+    ObjectCacheShard& shard = get_shard(hash_name(cache_info->cache_locator));
+    std::unordered_map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(cache_info->cache_locator);
+    if (iter == shard.cache_map.end()) {
       ldout(cct, 20) << "chain_cache_entry: couldn't find cachce locator" << dendl;
       return false;
     }
@@ -118,34 +284,40 @@ bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_ent
 
 void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info *cache_info)
 {
-  RWLock::WLocker l(lock);
+  if (!enabled) {
+    return;
+  }
+
+  uint64_t hash = hash_name(name);
+  ObjectCacheShard& shard = get_shard(hash);
+  RWLock::WLocker l(shard.lock);
 
+  /* set_enabled(false) may have emptied the shard since */
   if (!enabled) {
     return;
   }
 
   ldout(cct, 10) << "cache put: name=" << name << " info.flags=0x"
                  << std::hex << info.flags << std::dec << dendl;
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  std::unordered_map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
+    if (!admit(shard, hash, entry_size(name, info))) {
+      ldout(cct, 10) << "cache put: name=" << name << " : not admitted" << dendl;
+      shard.logger->inc(l_rgw_cache_shard_reject);
+      return;
+    }
     ObjectCacheEntry entry;
-    entry.lru_iter = lru.end();
-    cache_map.insert(pair<string, ObjectCacheEntry>(name, entry));
-    iter = cache_map.find(name);
+    entry.lru_iter = shard.lru.end();
+    iter = shard.cache_map.insert(make_pair(name, entry)).first;
+    shard.logger->inc(l_rgw_cache_shard_insert);
   }
   ObjectCacheEntry& entry = iter->second;
   ObjectCacheInfo& target = entry.info;
 
-  for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
-       iiter != entry.chained_entries.end(); ++iiter) {
-    RGWChainedCache *chained_cache = iiter->first;
-    chained_cache->invalidate(iiter->second);
-  }
-
-  entry.chained_entries.clear();
+  invalidate_chained(entry);
   entry.gen++;
 
-  touch_lru(name, entry, entry.lru_iter);
+  touch_lru(shard, name, entry, entry.lru_iter);
 
   target.status = info.status;
 
@@ -153,6 +325,7 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info
     target.flags = 0;
     target.xattrs.clear();
     target.data.clear();
+    charge(shard, name, entry);
     return;
   }
 
@@ -191,83 +364,120 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info
 
   if (info.flags & CACHE_FLAG_OBJV)
     target.version = info.version;
+
+  charge(shard, name, entry);
 }
 
 void ObjectCache::remove(string& name)
 {
-  RWLock::WLocker l(lock);
-
   if (!enabled) {
     return;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end())
+  ObjectCacheShard& shard = get_shard(hash_name(name));
+  RWLock::WLocker l(shard.lock);
+
+  std::unordered_map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end())
     return;
 
   ldout(cct, 10) << "removing " << name << " from cache" << dendl;
   ObjectCacheEntry& entry = iter->second;
 
+  invalidate_chained(entry);
+
+  remove_lru(shard, entry.lru_iter);
+  shard.bytes -= entry.size;
+  shard.cache_map.erase(iter);
+  shard.logger->set(l_rgw_cache_shard_entries, shard.lru_size);
+  shard.logger->set(l_rgw_cache_shard_bytes, shard.bytes);
+}
+
+void ObjectCache::invalidate_chained(ObjectCacheEntry& entry)
+{
   for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
        iiter != entry.chained_entries.end(); ++iiter) {
     RGWChainedCache *chained_cache = iiter->first;
     chained_cache->invalidate(iiter->second);
   }
 
-  remove_lru(name, iter->second.lru_iter);
-  cache_map.erase(iter);
+  entry.chained_entries.clear();
+}
+
+bool ObjectCache::admit(ObjectCacheShard& shard, uint64_t hash, uint64_t size)
+{
+  bool full = shard.lru_size + 1 > shard_max_entries ||
+    (shard_max_bytes && shard.bytes + size > shard_max_bytes);
+  if (!full || shard.lru.empty())
+    return true;
+  /* only if it is more popular than the entry it would evict */
+  uint64_t victim = hash_name(shard.lru.front());
+  return shard.sketch.estimate(hash) > shard.sketch.estimate(victim);
+}
+
+void ObjectCache::charge(ObjectCacheShard& shard, const string& name, ObjectCacheEntry& entry)
+{
+  uint64_t size = entry_size(name, entry.info);
+  shard.bytes = shard.bytes - entry.size + size;
+  entry.size = size;
+  trim(shard, name);
+  shard.logger->set(l_rgw_cache_shard_entries, shard.lru_size);
+  shard.logger->set(l_rgw_cache_shard_bytes, shard.bytes);
 }
 
-void ObjectCache::touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter)
+void ObjectCache::trim(ObjectCacheShard& shard, const string& keep)
 {
-  while (lru_size > (size_t)cct->_conf->rgw_cache_lru_size) {
-    list<string>::iterator iter = lru.begin();
-    if ((*iter).compare(name) == 0) {
+  while (shard.lru_size > shard_max_entries ||
+         (shard_max_bytes && shard.bytes > shard_max_bytes)) {
+    list<string>::iterator iter = shard.lru.begin();
+    if (iter == shard.lru.end() || *iter == keep) {
       /*
        * if the entry we're touching happens to be at the lru end, don't remove it,
        * lru shrinking can wait for next time
        */
       break;
     }
-    map<string, ObjectCacheEntry>::iterator map_iter = cache_map.find(*iter);
+    std::unordered_map<string, ObjectCacheEntry>::iterator map_iter = shard.cache_map.find(*iter);
     ldout(cct, 10) << "removing entry: name=" << *iter << " from cache LRU" << dendl;
-    if (map_iter != cache_map.end())
-      cache_map.erase(map_iter);
-    lru.pop_front();
-    lru_size--;
+    if (map_iter != shard.cache_map.end()) {
+      invalidate_chained(map_iter->second);
+      shard.bytes -= map_iter->second.size;
+      shard.cache_map.erase(map_iter);
+    }
+    shard.lru.pop_front();
+    shard.lru_size--;
+    shard.logger->inc(l_rgw_cache_shard_evict);
   }
+}
 
-  if (lru_iter == lru.end()) {
-    lru.push_back(name);
-    lru_size++;
+void ObjectCache::touch_lru(ObjectCacheShard& shard, const string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter)
+{
+  if (lru_iter == shard.lru.end()) {
+    shard.lru.push_back(name);
+    shard.lru_size++;
     lru_iter--;
     ldout(cct, 10) << "adding " << name << " to cache LRU end" << dendl;
   } else {
     ldout(cct, 10) << "moving " << name << " to cache LRU end" << dendl;
-    lru.erase(lru_iter);
-    lru.push_back(name);
-    lru_iter = lru.end();
-    --lru_iter;
+    shard.lru.splice(shard.lru.end(), shard.lru, lru_iter);
   }
 
-  lru_counter++;
-  entry.lru_promotion_ts = lru_counter;
+  shard.lru_counter++;
+  entry.lru_promotion_ts = shard.lru_counter;
 }
 
-void ObjectCache::remove_lru(string& name, std::list<string>::iterator& lru_iter)
+void ObjectCache::remove_lru(ObjectCacheShard& shard, std::list<string>::iterator& lru_iter)
 {
-  if (lru_iter == lru.end())
+  if (lru_iter == shard.lru.end())
     return;
 
-  lru.erase(lru_iter);
-  lru_size--;
-  lru_iter = lru.end();
+  shard.lru.erase(lru_iter);
+  shard.lru_size--;
+  lru_iter = shard.lru.end();
 }
 
 void ObjectCache::set_enabled(bool status)
 {
-  RWLock::WLocker l(lock);
-
   enabled = status;
 
   if (!enabled) {
@@ -277,27 +487,33 @@ void ObjectCache::set_enabled(bool status)
 
 void ObjectCache::invalidate_all()
 {
-  RWLock::WLocker l(lock);
-
   do_invalidate_all();
 }
 
 void ObjectCache::do_invalidate_all()
 {
-  cache_map.clear();
-  lru.clear();
-
-  lru_size = 0;
-  lru_counter = 0;
-  lru_window = 0;
+  for (vector<ObjectCacheShard*>::iterator i = shards.begin();
+       i != shards.end();
+       ++i) {
+    ObjectCacheShard& shard = **i;
+    RWLock::WLocker l(shard.lock);
+    shard.cache_map.clear();
+    shard.lru.clear();
+
+    shard.lru_size = 0;
+    shard.lru_counter = 0;
+    shard.bytes = 0;
+    shard.logger->set(l_rgw_cache_shard_entries, 0);
+    shard.logger->set(l_rgw_cache_shard_bytes, 0);
+  }
 
+  Mutex::Locker l(chained_lock);
   for (list<RGWChainedCache *>::iterator iter = chained_cache.begin(); iter != chained_cache.end(); ++iter) {
     (*iter)->invalidate_all();
   }
 }
 
 void ObjectCache::chain_cache(RGWChainedCache *cache) {
-  RWLock::WLocker l(lock);
+  Mutex::Locker l(chained_lock);
   chained_cache.push_back(cache);
 }
-
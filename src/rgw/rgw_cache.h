@@ -5,12 +5,17 @@
 #define CEPH_RGWCACHE_H
 
 #include "rgw_rados.h"
+#include <atomic>
 #include <string>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include "include/types.h"
 #include "include/utime.h"
 #include "include/assert.h"
 #include "common/RWLock.h"
+#include "common/Mutex.h"
+#include "common/perf_counters.h"
 
 enum {
   UPDATE_OBJ,
@@ -124,42 +129,110 @@ struct RGWCacheNotifyInfo {
 };
 WRITE_CLASS_ENCODER(RGWCacheNotifyInfo)
 
+enum {
+  l_rgw_cache_shard_first = 15100,
+  l_rgw_cache_shard_hit,
+  l_rgw_cache_shard_miss,
+  l_rgw_cache_shard_insert,
+  l_rgw_cache_shard_evict,
+  l_rgw_cache_shard_reject,
+  l_rgw_cache_shard_entries,
+  l_rgw_cache_shard_bytes,
+  l_rgw_cache_shard_last,
+};
+
 struct ObjectCacheEntry {
   ObjectCacheInfo info;
   std::list<string>::iterator lru_iter;
   uint64_t lru_promotion_ts;
   uint64_t gen;
+  uint64_t size;  // bytes charged to the shard
   std::list<pair<RGWChainedCache *, string> > chained_entries;
 
-  ObjectCacheEntry() : lru_promotion_ts(0), gen(0) {}
+  ObjectCacheEntry() : lru_promotion_ts(0), gen(0), size(0) {}
 };
 
-class ObjectCache {
-  std::map<string, ObjectCacheEntry> cache_map;
+/*
+ * TinyLFU frequency sketch: a count-min sketch of 4 bit counters, 16 to
+ * a word, which are all halved once the increments reach the sample
+ * size so that it keeps track of recent popularity.  Lock free.
+ */
+class RGWCacheFrequencySketch {
+  std::unique_ptr<std::atomic<uint64_t>[]> table;
+  uint64_t table_mask;
+  std::atomic<uint64_t> additions;
+  uint64_t sample;
+
+  void get_counter(uint64_t hash, int i, uint64_t *index, int *offset) const;
+  void reset();
+public:
+  RGWCacheFrequencySketch() : table_mask(0), additions(0), sample(0) {}
+  /// size it for that many entries, forgetting all counts
+  void resize(uint64_t entries);
+  void increment(uint64_t hash);
+  unsigned estimate(uint64_t hash) const;
+};
+
+struct ObjectCacheShard {
+  RWLock lock;
+  std::unordered_map<string, ObjectCacheEntry> cache_map;
   std::list<string> lru;
   unsigned long lru_size;
   unsigned long lru_counter;
   unsigned long lru_window;
-  RWLock lock;
+  uint64_t bytes;
+  RGWCacheFrequencySketch sketch;
+  PerfCounters *logger;
+
+  ObjectCacheShard()
+    : lock("ObjectCacheShard::lock"), lru_size(0), lru_counter(0),
+      lru_window(0), bytes(0), logger(NULL) {}
+};
+
+/*
+ * Objects are spread over rgw_cache_shards shards by the hash of their
+ * name, each with its own lock, hash map and LRU, and
+ * 1/rgw_cache_shards of the rgw_cache_lru_size entries and
+ * rgw_cache_max_bytes budgets.  When a shard is full a new object is
+ * only let in if the frequency sketch of the shard says it is more
+ * popular than the LRU victim it would evict (TinyLFU admission).
+ */
+class ObjectCache {
+  vector<ObjectCacheShard*> shards;
+  uint64_t shard_max_entries;
+  uint64_t shard_max_bytes;
   CephContext *cct;
 
+  Mutex chained_lock;
   list<RGWChainedCache *> chained_cache;
 
-  bool enabled;
+  std::atomic<bool> enabled;
 
-  void touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter);
-  void remove_lru(string& name, std::list<string>::iterator& lru_iter);
+  uint64_t hash_name(const string& name) const {
+    return std::hash<string>()(name);
+  }
+  ObjectCacheShard& get_shard(uint64_t hash) {
+    return *shards[hash % shards.size()];
+  }
+  static uint64_t entry_size(const string& name, const ObjectCacheInfo& info);
+  void invalidate_chained(ObjectCacheEntry& entry);
+  bool admit(ObjectCacheShard& shard, uint64_t hash, uint64_t size);
+  void charge(ObjectCacheShard& shard, const string& name, ObjectCacheEntry& entry);
+  void trim(ObjectCacheShard& shard, const string& keep);
+  bool _chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry);
+  void touch_lru(ObjectCacheShard& shard, const string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter);
+  void remove_lru(ObjectCacheShard& shard, std::list<string>::iterator& lru_iter);
 
   void do_invalidate_all();
 public:
-  ObjectCache() : lru_size(0), lru_counter(0), lru_window(0), lock("ObjectCache"), cct(NULL), enabled(false) { }
+  ObjectCache()
+    : shard_max_entries(0), shard_max_bytes(0), cct(NULL),
+      chained_lock("ObjectCache::chained_lock"), enabled(false) { }
+  ~ObjectCache();
   int get(std::string& name, ObjectCacheInfo& bl, uint32_t mask, rgw_cache_entry_info *cache_info);
   void put(std::string& name, ObjectCacheInfo& bl, rgw_cache_entry_info *cache_info);
   void remove(std::string& name);
-  void set_ctx(CephContext *_cct) {
-    cct = _cct;
-    lru_window = cct->_conf->rgw_cache_lru_size / 2;
-  }
+  void set_ctx(CephContext *_cct);
   bool chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry);
 
   void set_enabled(bool status);
@@ -39,6 +39,8 @@ int rgw_perf_start(CephContext *cct)
   plb.add_u64_counter(l_rgw_get, "get", "Gets");
   plb.add_u64_counter(l_rgw_get_b, "get_b", "Size of gets");
   plb.add_time_avg(l_rgw_get_lat, "get_initial_lat", "Get latency");
+  plb.add_time_avg(l_rgw_get_obj_read_lat, "get_obj_read_lat", "Latency of the rados reads of gets");
+  plb.add_u64_avg(l_rgw_get_obj_window, "get_obj_window", "Read-ahead window gets ended with");
   plb.add_u64_counter(l_rgw_put, "put", "Puts");
   plb.add_u64_counter(l_rgw_put_b, "put_b", "Size of puts");
   plb.add_time_avg(l_rgw_put_lat, "put_initial_lat", "Put latency");
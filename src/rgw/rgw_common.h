@@ -213,6 +213,8 @@ enum {
   l_rgw_get,
   l_rgw_get_b,
   l_rgw_get_lat,
+  l_rgw_get_obj_read_lat,
+  l_rgw_get_obj_window,
 
   l_rgw_put,
   l_rgw_put_b,
@@ -0,0 +1,74 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_RGW_GET_OBJ_WINDOW_H
+#define CEPH_RGW_GET_OBJ_WINDOW_H
+
+#include <stdint.h>
+#include <algorithm>
+
+/*
+ * Read-ahead window of a get obj request, in bytes.  It starts at the
+ * min and then tracks factor times what the client reads during one
+ * rados read, i.e. the moving averages of the rate the data is sent
+ * to the client at and of the rados read latency, up to the max.  It
+ * at most doubles per update.  Not thread safe.
+ */
+class RGWGetObjWindow {
+  uint64_t window;
+  uint64_t min_window;
+  uint64_t max_window;
+  double factor;
+  double read_lat;    // seconds
+  double drain_rate;  // bytes per second
+
+  bool update() {
+    if (max_window == min_window || !read_lat || !drain_rate)
+      return false;
+    double target = drain_rate * read_lat * factor;
+    double w = std::min(std::max(target, (double)min_window),
+			(double)max_window);
+    uint64_t next = std::min((uint64_t)w, window * 2);
+    if (next == window)
+      return false;
+    window = next;
+    return true;
+  }
+
+public:
+  RGWGetObjWindow(uint64_t min_window, uint64_t max_window, double factor)
+    : window(min_window),
+      min_window(min_window),
+      max_window(std::max(min_window, max_window)),
+      factor(factor),
+      read_lat(0), drain_rate(0) {}
+
+  /// the first sample sets the average, each next one moves it 1/8 of the way
+  static void update_avg(double *avg, double sample) {
+    *avg = *avg ? *avg + (sample - *avg) / 8 : sample;
+  }
+
+  /// a rados read took lat seconds; true if the window changed
+  bool read_complete(double lat) {
+    update_avg(&read_lat, lat);
+    return update();
+  }
+
+  /// the client took len bytes in secs; true if the window changed
+  bool data_drained(uint64_t len, double secs) {
+    update_avg(&drain_rate, len / std::max(secs, 0.000001));
+    return update();
+  }
+
+  uint64_t get() const {
+    return window;
+  }
+  double get_read_lat() const {
+    return read_lat;
+  }
+  double get_drain_rate() const {
+    return drain_rate;
+  }
+};
+
+#endif
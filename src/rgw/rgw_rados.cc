@@ -44,6 +44,7 @@
 #include "rgw_tools.h"
 
 #include "rgw_coroutine.h"
+#include "rgw_get_obj_window.h"
 
 #include "common/Clock.h"
 
@@ -9132,6 +9133,7 @@ struct get_obj_aio_data {
   struct get_obj_data *op_data;
   off_t ofs;
   off_t len;
+  utime_t issued;
 };
 
 struct get_obj_io {
@@ -9158,13 +9160,54 @@ struct get_obj_data : public RefCountedObject {
   Throttle throttle;
   list<bufferlist> read_list;
 
+  /*
+   * The throttle holds the bytes of a rados read from when it is issued
+   * until the data is sent to the client, so its max, the read-ahead
+   * window, bounds the memory of the request.
+   */
+  RGWGetObjWindow window;
+  uint64_t read_list_len;  // bytes of read_list, protected by data_lock
+
   explicit get_obj_data(CephContext *_cct)
     : cct(_cct),
       rados(NULL), ctx(NULL),
       total_read(0), lock("get_obj_data"), data_lock("get_obj_data::data_lock"),
       client_cb(NULL),
-      throttle(cct, "get_obj_data", cct->_conf->rgw_get_obj_window_size, false) {}
+      throttle(cct, "get_obj_data", cct->_conf->rgw_get_obj_window_size, false),
+      window(cct->_conf->rgw_get_obj_window_size,
+	     cct->_conf->rgw_get_obj_max_window_size,
+	     cct->_conf->rgw_get_obj_window_factor),
+      read_list_len(0) {}
   virtual ~get_obj_data() { } 
+
+  void window_changed() {
+    assert(lock.is_locked());
+    ldout(cct, 20) << "get_obj_data::window_changed() read_lat="
+		   << window.get_read_lat() << " drain_rate="
+		   << window.get_drain_rate() << " window=" << window.get()
+		   << dendl;
+    throttle.reset_max(window.get());
+  }
+
+  void read_complete(const utime_t& issued) {
+    utime_t lat = ceph_clock_now(cct) - issued;
+    if (perfcounter)
+      perfcounter->tinc(l_rgw_get_obj_read_lat, lat);
+    Mutex::Locker l(lock);
+    if (window.read_complete((double)lat))
+      window_changed();
+  }
+
+  void data_drained(uint64_t len, const utime_t& elapsed) {
+    Mutex::Locker l(lock);
+    if (window.data_drained(len, (double)elapsed))
+      window_changed();
+  }
+
+  uint64_t get_window() {
+    Mutex::Locker l(lock);
+    return window.get();
+  }
   void set_cancelled(int r) {
     cancelled.set(1);
     err_code.set(r);
@@ -9210,12 +9253,14 @@ struct get_obj_data : public RefCountedObject {
     Mutex::Locker l(lock);
 
     get_obj_io& io = io_map[ofs];
+    io.len = len;
     *pbl = &io.bl;
 
     struct get_obj_aio_data aio;
     aio.ofs = ofs;
     aio.len = len;
     aio.op_data = this;
+    aio.issued = ceph_clock_now(cct);
 
     aio_data.push_back(aio);
 
@@ -9259,7 +9304,8 @@ struct get_obj_data : public RefCountedObject {
     }
   }
 
-  int get_complete_ios(off_t ofs, list<bufferlist>& bl_list) {
+  /// move the completed ios from ofs on to bl_list, adding their lengths to len
+  int get_complete_ios(off_t ofs, list<bufferlist>& bl_list, uint64_t *len) {
     Mutex::Locker l(lock);
 
     map<off_t, get_obj_io>::iterator liter = io_map.begin();
@@ -9298,6 +9344,7 @@ struct get_obj_data : public RefCountedObject {
 
       map<off_t, get_obj_io>::iterator old_liter = liter++;
       bl_list.push_back(old_liter->second.bl);
+      *len += old_liter->second.len;
       io_map.erase(old_liter);
     }
 
@@ -9333,14 +9380,15 @@ void RGWRados::get_obj_aio_completion_cb(completion_t c, void *arg)
   int r;
 
   ldout(cct, 20) << "get_obj_aio_completion_cb: io completion ofs=" << ofs << " len=" << len << dendl;
-  d->throttle.put(len);
 
   r = rados_aio_get_return_value(c);
   if (r < 0) {
     ldout(cct, 0) << "ERROR: got unexpected error when trying to read object: " << r << dendl;
+    d->throttle.put(len);
     d->set_cancelled(r);
     goto done;
   }
+  d->read_complete(aio_data->issued);
 
   if (d->is_cancelled()) {
     goto done;
@@ -9348,7 +9396,7 @@ void RGWRados::get_obj_aio_completion_cb(completion_t c, void *arg)
 
   d->data_lock.Lock();
 
-  r = d->get_complete_ios(ofs, bl_list);
+  r = d->get_complete_ios(ofs, bl_list, &d->read_list_len);
   if (r < 0) {
     goto done_unlock;
   }
@@ -9367,12 +9415,16 @@ int RGWRados::flush_read_list(struct get_obj_data *d)
   d->data_lock.Lock();
   list<bufferlist> l;
   l.swap(d->read_list);
+  uint64_t len = d->read_list_len;
+  d->read_list_len = 0;
   d->get();
   d->read_list.clear();
 
   d->data_lock.Unlock();
 
   int r = 0;
+  uint64_t drained = 0;
+  utime_t start = ceph_clock_now(cct);
 
   list<bufferlist>::iterator iter;
   for (iter = l.begin(); iter != l.end(); ++iter) {
@@ -9382,7 +9434,12 @@ int RGWRados::flush_read_list(struct get_obj_data *d)
       dout(0) << "ERROR: flush_read_list(): d->client_c->handle_data() returned " << r << dendl;
       break;
     }
+    drained += bl.length();
   }
+  if (drained) {
+    d->data_drained(drained, ceph_clock_now(cct) - start);
+  }
+  d->throttle.put(len);
 
   d->data_lock.Lock();
   d->put();
@@ -9439,10 +9496,23 @@ int RGWRados::get_obj_iterate_cb(RGWObjectCtx *ctx, RGWObjState *astate,
 
   get_obj_bucket_and_oid_loc(obj, bucket, oid, key);
 
-  d->throttle.get(len);
+  /* the throttle is only put once the data is sent to the client, and we
+   * are the ones sending it: make room by waiting for the oldest read */
+  while (d->throttle.should_wait(len) && !d->is_cancelled()) {
+    bool done = false;
+    r = d->wait_next_io(&done);
+    if (r < 0)
+      return r;
+    r = flush_read_list(d);
+    if (r < 0)
+      return r;
+    if (done)
+      break;
+  }
   if (d->is_cancelled()) {
     return d->get_err_code();
   }
+  d->throttle.take(len);
 
   /* add io after we check that we're not cancelled, otherwise we're going to have trouble
    * cleaning up
@@ -9511,6 +9581,9 @@ int RGWRados::Object::Read::iterate(int64_t ofs, int64_t end, RGWGetDataCB *cb)
   }
 
 done:
+  if (perfcounter) {
+    perfcounter->inc(l_rgw_get_obj_window, data->get_window());
+  }
   data->put();
   return r;
 }
@@ -0,0 +1,306 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+
+/*
+ * Replay a synthetic mix of client and background op streams through
+ * the OSD op queues and report the share of the server every stream
+ * and op class gets.
+ *
+ * Every stream keeps depth ops queued; the server dequeues iops ops per
+ * second of simulated time, so the results only depend on the queue.
+ * The mclock queue takes its reservations, weights and limits, and the
+ * prio and wpq queues their priorities and costs, from the usual osd
+ * options, e.g.
+ *
+ *   ceph_mclock_sim --workload client:8,client:32,recovery:16,scrub:4 \
+ *     --osd_op_queue_mclock_recov_res 100
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/PrioritizedQueue.h"
+#include "common/WeightedPriorityQueue.h"
+#include "common/mClockQueue.h"
+#include "include/str_list.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+enum op_class_t {
+  CLIENT,
+  SUBOP,
+  SNAPTRIM,
+  RECOVERY,
+  SCRUB,
+  NUM_CLASSES
+};
+
+static const char *class_names[] = {
+  "client", "subop", "snaptrim", "recovery", "scrub"
+};
+
+struct SimOp {
+  unsigned stream;
+  double issued;
+  SimOp(unsigned stream, double issued) : stream(stream), issued(issued) {}
+};
+
+struct SimClient {
+  op_class_t type;
+  unsigned owner;
+  SimClient(op_class_t type, unsigned owner) : type(type), owner(owner) {}
+};
+
+static bool operator<(const SimClient &a, const SimClient &b) {
+  if (a.type != b.type)
+    return a.type < b.type;
+  return a.owner < b.owner;
+}
+
+static ostream& operator<<(ostream &out, const SimClient &c) {
+  return out << class_names[c.type] << "." << c.owner;
+}
+
+struct Stream {
+  op_class_t type;
+  unsigned depth;
+  uint64_t ops;
+  vector<double> latencies;
+  Stream(op_class_t type, unsigned depth) : type(type), depth(depth), ops(0) {}
+};
+
+static mClockClientInfo get_info(md_config_t *conf, op_class_t type)
+{
+  switch (type) {
+  case CLIENT:
+    return mClockClientInfo(conf->osd_op_queue_mclock_client_op_res,
+			    conf->osd_op_queue_mclock_client_op_wgt,
+			    conf->osd_op_queue_mclock_client_op_lim);
+  case SUBOP:
+    return mClockClientInfo(conf->osd_op_queue_mclock_osd_subop_res,
+			    conf->osd_op_queue_mclock_osd_subop_wgt,
+			    conf->osd_op_queue_mclock_osd_subop_lim);
+  case SNAPTRIM:
+    return mClockClientInfo(conf->osd_op_queue_mclock_snap_res,
+			    conf->osd_op_queue_mclock_snap_wgt,
+			    conf->osd_op_queue_mclock_snap_lim);
+  case RECOVERY:
+    return mClockClientInfo(conf->osd_op_queue_mclock_recov_res,
+			    conf->osd_op_queue_mclock_recov_wgt,
+			    conf->osd_op_queue_mclock_recov_lim);
+  default:
+    return mClockClientInfo(conf->osd_op_queue_mclock_scrub_res,
+			    conf->osd_op_queue_mclock_scrub_wgt,
+			    conf->osd_op_queue_mclock_scrub_lim);
+  }
+}
+
+/// priority and cost the OSD gives the ops of a class
+static void get_prio_cost(md_config_t *conf, op_class_t type,
+			  unsigned *priority, unsigned *cost)
+{
+  switch (type) {
+  case CLIENT:
+    *priority = conf->osd_client_op_priority;
+    *cost = 4096;
+    break;
+  case SUBOP:
+    *priority = conf->osd_client_op_priority;
+    *cost = 4096;
+    break;
+  case SNAPTRIM:
+    *priority = conf->osd_snap_trim_priority;
+    *cost = conf->osd_snap_trim_cost;
+    break;
+  case RECOVERY:
+    *priority = conf->osd_recovery_op_priority;
+    *cost = conf->osd_recovery_cost;
+    break;
+  default:
+    *priority = conf->osd_scrub_priority;
+    *cost = conf->osd_scrub_cost;
+    break;
+  }
+}
+
+static int parse_workload(const string &spec, vector<Stream> *streams)
+{
+  list<string> entries;
+  get_str_list(spec, ",", entries);
+  for (list<string>::iterator i = entries.begin(); i != entries.end(); ++i) {
+    size_t colon = i->find(':');
+    string name = i->substr(0, colon);
+    unsigned depth = colon == string::npos ? 1 : atoi(i->c_str() + colon + 1);
+    int type = 0;
+    while (type < NUM_CLASSES && name != class_names[type])
+      ++type;
+    if (type == NUM_CLASSES || depth == 0) {
+      cerr << "bad stream '" << *i << "', expected <class>:<depth> with"
+	   << " class one of client, subop, snaptrim, recovery, scrub"
+	   << std::endl;
+      return -EINVAL;
+    }
+    streams->push_back(Stream((op_class_t)type, depth));
+  }
+  return streams->empty() ? -EINVAL : 0;
+}
+
+static void simulate(const string &queue, vector<Stream> streams,
+		     double iops, double duration)
+{
+  md_config_t *conf = g_ceph_context->_conf;
+  double now = 0;
+  typedef OpQueue<SimOp, unsigned> SimQueue;
+  unique_ptr<SimQueue> q;
+  if (queue == "prio") {
+    q.reset(new PrioritizedQueue<SimOp, unsigned>(
+	      conf->osd_op_pq_max_tokens_per_priority,
+	      conf->osd_op_pq_min_cost));
+  } else if (queue == "wpq") {
+    q.reset(new WeightedPriorityQueue<SimOp, unsigned>(
+	      conf->osd_op_pq_max_tokens_per_priority,
+	      conf->osd_op_pq_min_cost));
+  } else {
+    q.reset(new mClockQueue<SimOp, unsigned, SimClient>(
+	      [conf](const SimClient &c) { return get_info(conf, c.type); },
+	      [&streams](const unsigned &owner, const SimOp &op) {
+		op_class_t type = streams[op.stream].type;
+		return SimClient(type, type == CLIENT ? owner : 0);
+	      },
+	      [&now]() { return now; }));
+  }
+
+  auto issue = [&](unsigned s) {
+    unsigned priority, cost;
+    get_prio_cost(conf, streams[s].type, &priority, &cost);
+    q->enqueue(s, priority, cost, SimOp(s, now));
+  };
+  for (unsigned s = 0; s < streams.size(); ++s)
+    for (unsigned d = 0; d < streams[s].depth; ++d)
+      issue(s);
+
+  uint64_t total = 0;
+  while (now < duration) {
+    now += 1.0 / iops;
+    SimOp op = q->dequeue();
+    Stream &stream = streams[op.stream];
+    ++stream.ops;
+    stream.latencies.push_back(now - op.issued);
+    ++total;
+    issue(op.stream);
+  }
+
+  cout << queue << std::endl;
+  cout << "  stream\tclass\tdepth\tops/s\tshare\tlat_ms\tp99_ms" << std::endl;
+  vector<uint64_t> class_ops(NUM_CLASSES);
+  cout << std::fixed << std::setprecision(1);
+  for (unsigned s = 0; s < streams.size(); ++s) {
+    Stream &stream = streams[s];
+    class_ops[stream.type] += stream.ops;
+    double sum = 0;
+    for (unsigned i = 0; i < stream.latencies.size(); ++i)
+      sum += stream.latencies[i];
+    sort(stream.latencies.begin(), stream.latencies.end());
+    double mean = stream.ops ? sum / stream.ops : 0;
+    double p99 = stream.ops ?
+      stream.latencies[stream.latencies.size() * 99 / 100] : 0;
+    cout << "  " << s << "\t" << class_names[stream.type]
+	 << "\t" << stream.depth
+	 << "\t" << stream.ops / duration
+	 << "\t" << 100.0 * stream.ops / total << "%"
+	 << "\t" << mean * 1000
+	 << "\t" << p99 * 1000 << std::endl;
+  }
+  for (unsigned c = 0; c < NUM_CLASSES; ++c) {
+    if (!class_ops[c])
+      continue;
+    cout << "  all\t" << class_names[c]
+	 << "\t-\t" << class_ops[c] / duration
+	 << "\t" << 100.0 * class_ops[c] / total << "%" << std::endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("workload",
+     po::value<string>()->default_value(
+       "client:4,client:4,client:32,recovery:16,scrub:4,snaptrim:2"),
+     "streams, as class:depth, class one of client, subop, snaptrim, "
+     "recovery, scrub")
+    ("queue", po::value<string>()->default_value("all"),
+     "prio, wpq, mclock or all")
+    ("iops", po::value<double>()->default_value(1000),
+     "ops per second the server completes")
+    ("duration", po::value<double>()->default_value(60),
+     "simulated seconds")
+    ;
+
+  vector<string> ceph_option_strings;
+  po::variables_map vm;
+  try {
+    po::parsed_options parsed =
+      po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+    po::store(parsed, vm);
+    po::notify(vm);
+    ceph_option_strings = po::collect_unrecognized(parsed.options,
+						   po::include_positional);
+  } catch(po::error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  vector<const char *> ceph_options, def_args;
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  vector<Stream> streams;
+  if (parse_workload(vm["workload"].as<string>(), &streams) < 0)
+    return 1;
+  double iops = vm["iops"].as<double>();
+  double duration = vm["duration"].as<double>();
+  if (iops <= 0 || duration <= 0) {
+    cerr << "iops and duration must be positive" << std::endl;
+    return 1;
+  }
+
+  string queue = vm["queue"].as<string>();
+  if (queue == "all") {
+    simulate("prio", streams, iops, duration);
+    simulate("wpq", streams, iops, duration);
+    simulate("mclock", streams, iops, duration);
+  } else if (queue == "prio" || queue == "wpq" || queue == "mclock") {
+    simulate(queue, streams, iops, duration);
+  } else {
+    cerr << "unknown queue " << queue << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,233 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+
+/*
+ * Small random reads through librados at a fixed queue depth, reporting
+ * the IOPS and, given the pids of the OSDs (running on this host, e.g.
+ * with vstart.sh), the CPU time they used and so the IOPS per core, e.g.
+ *
+ *   ceph_read_iops_bench --pool rbd --osd-pid $(pidof ceph-osd)
+ *
+ * With --write it overwrites the same extents instead; run that once
+ * with osd_op_run_to_completion off and once with it on
+ * (ceph tell osd.* injectargs --osd_op_run_to_completion=true) to see
+ * what running the writes on the messenger threads saves.  Reads are
+ * never run there, so the read numbers are a baseline.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <stdio.h>
+#include <unistd.h>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "include/rados/librados.hpp"
+
+namespace po = boost::program_options;
+using namespace std;
+
+/// user plus system CPU seconds of a process, negative if it is gone
+static double get_cpu_seconds(int pid)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+  unsigned long utime = 0, stime = 0;
+  // skip pid, comm, state and the 10 fields up to utime
+  int n = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		 &utime, &stime);
+  fclose(f);
+  if (n != 2)
+    return -1;
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double get_cpu_seconds(const vector<int> &pids)
+{
+  double total = 0;
+  for (vector<int>::const_iterator i = pids.begin(); i != pids.end(); ++i) {
+    double s = get_cpu_seconds(*i);
+    if (s < 0) {
+      cerr << "unable to read the cpu time of pid " << *i << std::endl;
+      return -1;
+    }
+    total += s;
+  }
+  return total;
+}
+
+static string object_name(unsigned i)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "read_iops_bench_%u", i);
+  return name;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("id", po::value<string>()->default_value("admin"),
+     "ceph client id")
+    ("pool", po::value<string>()->default_value("rbd"),
+     "pool to read from")
+    ("objects", po::value<unsigned>()->default_value(256),
+     "number of objects")
+    ("object-size", po::value<unsigned>()->default_value(4 << 20),
+     "object size")
+    ("io-size", po::value<unsigned>()->default_value(4 << 10),
+     "bytes per read")
+    ("queue-depth", po::value<unsigned>()->default_value(64),
+     "reads in flight")
+    ("duration", po::value<double>()->default_value(30),
+     "seconds to read for")
+    ("no-prepare", "read the objects of an earlier run")
+    ("write", "overwrite io-size extents rather than read them")
+    ("osd-pid", po::value<vector<int> >()->multitoken(),
+     "pids of the OSDs, to report their cpu time")
+    ;
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  } catch(po::error &e) {
+    cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  unsigned objects = vm["objects"].as<unsigned>();
+  unsigned object_size = vm["object-size"].as<unsigned>();
+  unsigned io_size = vm["io-size"].as<unsigned>();
+  unsigned depth = vm["queue-depth"].as<unsigned>();
+  double duration = vm["duration"].as<double>();
+  if (!objects || !io_size || io_size > object_size || !depth) {
+    cerr << "objects, io-size and queue-depth must be positive, and io-size"
+	 << " at most object-size" << std::endl;
+    return 1;
+  }
+  vector<int> pids;
+  if (vm.count("osd-pid"))
+    pids = vm["osd-pid"].as<vector<int> >();
+
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  int r = rados.init(vm["id"].as<string>().c_str());
+  if (r == 0)
+    r = rados.conf_read_file(NULL);
+  if (r == 0)
+    r = rados.conf_parse_env(NULL);
+  if (r == 0)
+    r = rados.connect();
+  if (r < 0) {
+    cerr << "unable to connect to the cluster: " << cpp_strerror(r)
+	 << std::endl;
+    return 1;
+  }
+  r = rados.ioctx_create(vm["pool"].as<string>().c_str(), ioctx);
+  if (r < 0) {
+    cerr << "unable to open pool " << vm["pool"].as<string>() << ": "
+	 << cpp_strerror(r) << std::endl;
+    rados.shutdown();
+    return 1;
+  }
+
+  if (!vm.count("no-prepare")) {
+    bufferptr bp(object_size);
+    for (unsigned i = 0; i < object_size; ++i)
+      bp[i] = rand();
+    bufferlist bl;
+    bl.append(bp);
+    for (unsigned i = 0; i < objects; ++i) {
+      r = ioctx.write_full(object_name(i), bl);
+      if (r < 0) {
+	cerr << "unable to write " << object_name(i) << ": "
+	     << cpp_strerror(r) << std::endl;
+	rados.shutdown();
+	return 1;
+      }
+    }
+  }
+
+  bool write = vm.count("write");
+  bufferlist wbl;
+  if (write) {
+    bufferptr bp(io_size);
+    for (unsigned i = 0; i < io_size; ++i)
+      bp[i] = rand();
+    wbl.append(bp);
+  }
+  vector<librados::AioCompletion*> slots(depth);
+  vector<bufferlist> bls(depth);
+  unsigned positions = object_size / io_size;
+  auto issue = [&](unsigned s) {
+    bls[s].clear();
+    slots[s] = librados::Rados::aio_create_completion();
+    uint64_t off = (uint64_t)(rand() % positions) * io_size;
+    if (write)
+      ioctx.aio_write(object_name(rand() % objects), slots[s], wbl, io_size,
+		      off);
+    else
+      ioctx.aio_read(object_name(rand() % objects), slots[s], &bls[s],
+		     io_size, off);
+  };
+
+  double cpu_start = get_cpu_seconds(pids);
+  utime_t start = ceph_clock_now(NULL);
+  utime_t end = start;
+  end += duration;
+  for (unsigned s = 0; s < depth; ++s)
+    issue(s);
+  uint64_t reads = 0, errors = 0;
+  utime_t now = start;
+  for (unsigned s = 0; ; s = (s + 1) % depth) {
+    slots[s]->wait_for_complete();
+    if (slots[s]->get_return_value() < 0)
+      ++errors;
+    else
+      ++reads;
+    slots[s]->release();
+    slots[s] = NULL;
+    now = ceph_clock_now(NULL);
+    if (now >= end)
+      break;
+    issue(s);
+  }
+  for (unsigned s = 0; s < depth; ++s) {
+    if (slots[s]) {
+      slots[s]->wait_for_complete();
+      slots[s]->release();
+    }
+  }
+  double elapsed = now - start;
+  double cpu = get_cpu_seconds(pids);
+
+  cout << std::fixed << std::setprecision(0);
+  cout << reads << (write ? " writes of " : " reads of ") << io_size << " bytes in " << elapsed
+       << "s at queue depth " << depth << ", " << reads / elapsed << " IOPS";
+  if (errors)
+    cout << ", " << errors << " errors";
+  cout << std::endl;
+  if (cpu_start >= 0 && cpu >= 0 && cpu > cpu_start) {
+    double cores = (cpu - cpu_start) / elapsed;
+    cout << std::setprecision(2) << "osd cpu " << cores << " cores, "
+	 << std::setprecision(0) << reads / elapsed / cores
+	 << " IOPS per core" << std::endl;
+  }
+
+  rados.shutdown();
+  return 0;
+}
@@ -0,0 +1,302 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+
+/*
+ * Compare the OSD op queue shapes under a skewed PG load: ops of a few
+ * hot PGs, all hashing to the same shard, against a uniform background.
+ *
+ *  sharded:  one locked FIFO per shard served only by its own threads,
+ *            as ShardedOpWQ does with the prio/wpq queues
+ *  stealing: WorkStealingQueue, idle threads take hot PGs of busy shards
+ *
+ * Every op busy-waits work-us under the lock of its PG and is timed
+ * from enqueue to completion; queue-size ops are kept in flight.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Cycles.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/Semaphore.h"
+#include "common/WorkStealingQueue.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+struct Op {
+  unsigned pg;
+  uint64_t start;
+  Op(unsigned pg) : pg(pg), start(Cycles::rdtsc()) {}
+};
+
+struct Bench {
+  unsigned num_shards;
+  unsigned num_threads;
+  uint64_t work_cycles;
+  vector<std::mutex> pg_locks;
+  Semaphore sem;
+  vector<vector<uint64_t> > latencies;  ///< per worker thread
+  std::atomic<bool> stopping;
+
+  Bench(unsigned shards, unsigned threads, unsigned pgs, uint64_t work_ns)
+    : num_shards(shards), num_threads(threads),
+      work_cycles(Cycles::from_nanoseconds(work_ns)),
+      pg_locks(pgs), latencies(threads), stopping(false) {}
+  virtual ~Bench() {}
+
+  /// run op under its PG lock, the caller holds it
+  void run(unsigned thread, Op *op) {
+    uint64_t s = Cycles::rdtsc();
+    while (Cycles::rdtsc() - s < work_cycles)
+      ;
+    latencies[thread].push_back(Cycles::rdtsc() - op->start);
+    delete op;
+    sem.Put();
+  }
+
+  virtual void queue(Op *op) = 0;
+  virtual void worker(unsigned thread) = 0;
+  virtual void wake_all() = 0;
+  virtual uint64_t get_stolen() { return 0; }
+};
+
+class ShardedBench : public Bench {
+  struct Shard {
+    Mutex lock;
+    Cond cond;
+    list<Op*> q;
+    Shard() : lock("ShardedBench::lock") {}
+  };
+  vector<Shard*> shards;
+
+public:
+  ShardedBench(unsigned shards, unsigned threads, unsigned pgs,
+	       uint64_t work_ns)
+    : Bench(shards, threads, pgs, work_ns) {
+    for (unsigned i = 0; i < shards; ++i)
+      this->shards.push_back(new Shard);
+  }
+  ~ShardedBench() {
+    for (unsigned i = 0; i < shards.size(); ++i)
+      delete shards[i];
+  }
+
+  void queue(Op *op) {
+    Shard *s = shards[op->pg % num_shards];
+    Mutex::Locker l(s->lock);
+    s->q.push_back(op);
+    s->cond.SignalOne();
+  }
+
+  void worker(unsigned thread) {
+    Shard *s = shards[thread % num_shards];
+    while (true) {
+      s->lock.Lock();
+      while (s->q.empty() && !stopping)
+	s->cond.Wait(s->lock);
+      if (s->q.empty()) {
+	s->lock.Unlock();
+	return;
+      }
+      Op *op = s->q.front();
+      s->q.pop_front();
+      s->lock.Unlock();
+      std::lock_guard<std::mutex> l(pg_locks[op->pg]);
+      run(thread, op);
+    }
+  }
+
+  void wake_all() {
+    for (unsigned i = 0; i < shards.size(); ++i) {
+      Mutex::Locker l(shards[i]->lock);
+      shards[i]->cond.Signal();
+    }
+  }
+};
+
+class StealingBench : public Bench {
+  WorkStealingQueue<unsigned, Op*> q;
+  unsigned max_batch;
+
+public:
+  StealingBench(unsigned shards, unsigned threads, unsigned pgs,
+		uint64_t work_ns, unsigned max_batch)
+    : Bench(shards, threads, pgs, work_ns), q(shards, "StealingBench"),
+      max_batch(max_batch) {}
+
+  void queue(Op *op) {
+    q.enqueue(op->pg % num_shards, op->pg, op);
+  }
+
+  void worker(unsigned thread) {
+    unsigned home = thread % num_shards;
+    while (true) {
+      unsigned pg, owner;
+      if (!q.claim(home, &pg, &owner)) {
+	if (stopping)
+	  return;
+	q.wait(g_ceph_context, home, utime_t(0, 100000000));
+	continue;
+      }
+      std::lock_guard<std::mutex> l(pg_locks[pg]);
+      boost::optional<Op*> op;
+      for (unsigned n = 0; n < max_batch && (op = q.pop(owner, pg)); ++n)
+	run(thread, *op);
+      q.release(owner, pg);
+    }
+  }
+
+  void wake_all() {
+    q.wake_all();
+  }
+
+  uint64_t get_stolen() {
+    uint64_t stolen = 0;
+    for (unsigned i = 0; i < num_shards; ++i)
+      stolen += q.get_stolen(i);
+    return stolen;
+  }
+};
+
+static void run_bench(const string &name, Bench *b, unsigned num_pgs,
+		      unsigned hot_pgs, double hot_fraction,
+		      unsigned queue_size, uint64_t num_ops)
+{
+  for (unsigned i = 0; i < queue_size; ++i)
+    b->sem.Put();
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < b->num_threads; ++i)
+    threads.push_back(std::thread([b, i]() { b->worker(i); }));
+
+  // the hot PGs all map to shard 0
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> coin(0, 1);
+  uint64_t start = Cycles::rdtsc();
+  for (uint64_t i = 0; i < num_ops; ++i) {
+    b->sem.Get();
+    unsigned pg;
+    if (coin(rng) < hot_fraction)
+      pg = (rng() % hot_pgs) * b->num_shards;
+    else
+      pg = rng() % num_pgs;
+    b->queue(new Op(pg));
+  }
+  for (unsigned i = 0; i < queue_size; ++i)
+    b->sem.Get();
+  uint64_t elapsed = Cycles::rdtsc() - start;
+  b->stopping = true;
+  b->wake_all();
+  for (unsigned i = 0; i < threads.size(); ++i)
+    threads[i].join();
+
+  vector<uint64_t> all;
+  for (unsigned i = 0; i < b->latencies.size(); ++i)
+    all.insert(all.end(), b->latencies[i].begin(), b->latencies[i].end());
+  std::sort(all.begin(), all.end());
+  cout << name << "\t"
+       << (uint64_t)(num_ops / Cycles::to_seconds(elapsed)) << "\t"
+       << Cycles::to_microseconds(all[all.size() / 2]) << "\t"
+       << Cycles::to_microseconds(all[all.size() * 99 / 100]) << "\t"
+       << Cycles::to_microseconds(all[all.size() * 999 / 1000]) << "\t"
+       << Cycles::to_microseconds(all.back()) << "\t"
+       << b->get_stolen() << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("num-shards", po::value<unsigned>()->default_value(5),
+     "number of shards")
+    ("threads-per-shard", po::value<unsigned>()->default_value(2),
+     "worker threads per shard")
+    ("num-pgs", po::value<unsigned>()->default_value(128),
+     "number of PGs")
+    ("hot-pgs", po::value<unsigned>()->default_value(4),
+     "number of hot PGs, all on the same shard")
+    ("hot-fraction", po::value<double>()->default_value(0.5),
+     "fraction of the ops going to the hot PGs")
+    ("work-us", po::value<unsigned>()->default_value(20),
+     "time spent per op under the PG lock")
+    ("queue-size", po::value<unsigned>()->default_value(64),
+     "ops in flight")
+    ("num-ops", po::value<unsigned>()->default_value(200000),
+     "ops per run")
+    ("max-batch", po::value<unsigned>()->default_value(8),
+     "ops of a PG run per claim when stealing")
+    ;
+
+  vector<string> ceph_option_strings;
+  po::variables_map vm;
+  try {
+    po::parsed_options parsed =
+      po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+    po::store(parsed, vm);
+    po::notify(vm);
+    ceph_option_strings = po::collect_unrecognized(parsed.options,
+						   po::include_positional);
+  } catch(po::error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  vector<const char *> ceph_options, def_args;
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  Cycles::init();
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  unsigned shards = vm["num-shards"].as<unsigned>();
+  unsigned threads = shards * vm["threads-per-shard"].as<unsigned>();
+  unsigned pgs = vm["num-pgs"].as<unsigned>();
+  unsigned hot_pgs = vm["hot-pgs"].as<unsigned>();
+  uint64_t work_ns = vm["work-us"].as<unsigned>() * 1000ull;
+  if (shards == 0 || threads == 0 || hot_pgs == 0 ||
+      hot_pgs * shards > pgs) {
+    cerr << "need shards, threads and hot-pgs * num-shards <= num-pgs"
+	 << std::endl;
+    return 1;
+  }
+
+  cout << "queue\tops/s\tp50_us\tp99_us\tp999_us\tmax_us\tstolen"
+       << std::endl;
+  {
+    ShardedBench b(shards, threads, pgs, work_ns);
+    run_bench("sharded", &b, pgs, hot_pgs, vm["hot-fraction"].as<double>(),
+	      vm["queue-size"].as<unsigned>(), vm["num-ops"].as<unsigned>());
+  }
+  {
+    StealingBench b(shards, threads, pgs, work_ns,
+		    vm["max-batch"].as<unsigned>());
+    run_bench("stealing", &b, pgs, hot_pgs, vm["hot-fraction"].as<double>(),
+	      vm["queue-size"].as<unsigned>(), vm["num-ops"].as<unsigned>());
+  }
+  return 0;
+}
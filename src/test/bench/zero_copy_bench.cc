@@ -0,0 +1,318 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+
+/*
+ * Read an object from an ObjectStore over and over, send every read to
+ * a second messenger over loopback the way the OSD sends a read reply,
+ * and report per read where the bytes of the read went:
+ *
+ *   private  in a buffer only the read result references: the store
+ *            copied them there, or the device DMA'd them there
+ *   shared   in a buffer the store still references, e.g. its cache
+ *   pipe     spliced into a pipe, still in the page cache
+ *
+ * and how the async messenger got them into the socket: copied by
+ * sendmsg(), spliced from a pipe, or with MSG_ZEROCOPY, less what the
+ * kernel reported it copied anyway (it always does over loopback), e.g.
+ *
+ *   ceph_zero_copy_bench --store bluestore --ms_crc_data false \
+ *     --ms_async_zerocopy_min 65536
+ *
+ * No store hands out pipes, since a write applied before the reply is
+ * sent would show through them; the category is kept for the buffers
+ * bufferlist::read_fd_zero_copy() makes.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <sys/stat.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/ceph_argparse.h"
+#include "common/ceph_json.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/errno.h"
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "common/perf_counters.h"
+#include "messages/MDataPing.h"
+#include "msg/Messenger.h"
+#include "os/ObjectStore.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+class Receiver : public Dispatcher {
+  Mutex lock;
+  Cond cond;
+  uint64_t received;
+
+public:
+  Receiver() : Dispatcher(g_ceph_context), lock("Receiver::lock"),
+	       received(0) {}
+
+  bool ms_can_fast_dispatch_any() const { return true; }
+  bool ms_can_fast_dispatch(Message *m) const {
+    return m->get_type() == MSG_DATA_PING;
+  }
+  void ms_fast_dispatch(Message *m) {
+    Mutex::Locker l(lock);
+    ++received;
+    cond.Signal();
+    m->put();
+  }
+  bool ms_dispatch(Message *m) {
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return true; }
+  void ms_handle_remote_reset(Connection *con) {}
+  bool ms_verify_authorizer(Connection *con, int peer_type, int protocol,
+			    bufferlist& authorizer, bufferlist& authorizer_reply,
+			    bool& isvalid, CryptoKey& session_key) {
+    isvalid = true;
+    return true;
+  }
+
+  void wait_for(uint64_t n) {
+    Mutex::Locker l(lock);
+    while (received < n)
+      cond.Wait(lock);
+  }
+};
+
+struct ReadUsage {
+  uint64_t priv, shared, pipe;
+  ReadUsage() : priv(0), shared(0), pipe(0) {}
+
+  void add(const bufferlist &bl) {
+    // references to a raw buffer from the result itself do not share it
+    map<buffer::raw*, int> own;
+    for (list<bufferptr>::const_iterator p = bl.buffers().begin();
+	 p != bl.buffers().end();
+	 ++p)
+      ++own[p->get_raw()];
+    for (list<bufferptr>::const_iterator p = bl.buffers().begin();
+	 p != bl.buffers().end();
+	 ++p) {
+      if (p->can_zero_copy())
+	pipe += p->length();
+      else if (p->raw_nref() > own[p->get_raw()])
+	shared += p->length();
+      else
+	priv += p->length();
+    }
+  }
+};
+
+/// the counters of all the async messenger workers, summed
+static map<string, uint64_t> get_msgr_counters()
+{
+  map<string, uint64_t> counters;
+  JSONFormatter f;
+  g_ceph_context->get_perfcounters_collection()->dump_formatted(&f, false);
+  stringstream ss;
+  f.flush(ss);
+  string s = ss.str();
+  JSONParser parser;
+  if (!parser.parse(s.c_str(), s.length()))
+    return counters;
+  for (JSONObjIter i = parser.find_first(); !i.end(); ++i) {
+    if ((*i)->get_name().find("AsyncMessenger::Worker") != 0)
+      continue;
+    for (JSONObjIter c = (*i)->find_first(); !c.end(); ++c)
+      counters[(*c)->get_name()] += strtoull((*c)->get_data().c_str(), 0, 10);
+  }
+  return counters;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("store", po::value<string>()->default_value("filestore"),
+     "objectstore type")
+    ("path", po::value<string>()->default_value("zero_copy_bench_dir"),
+     "objectstore path")
+    ("journal", po::value<string>()->default_value("zero_copy_bench_journal"),
+     "journal path")
+    ("object-size", po::value<unsigned>()->default_value(4 << 20),
+     "object size")
+    ("read-size", po::value<unsigned>()->default_value(1 << 20),
+     "bytes per read")
+    ("reads", po::value<unsigned>()->default_value(1000),
+     "number of reads")
+    ("bind", po::value<string>()->default_value("127.0.0.1"),
+     "address of the receiving messenger")
+    ;
+
+  vector<string> ceph_option_strings;
+  po::variables_map vm;
+  try {
+    po::parsed_options parsed =
+      po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+    po::store(parsed, vm);
+    po::notify(vm);
+    ceph_option_strings = po::collect_unrecognized(parsed.options,
+						   po::include_positional);
+  } catch(po::error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  vector<const char *> ceph_options, def_args;
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+  def_args.push_back("--auth_cluster_required=none");
+  def_args.push_back("--auth_service_required=none");
+  def_args.push_back("--auth_client_required=none");
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  unsigned object_size = vm["object-size"].as<unsigned>();
+  unsigned read_size = vm["read-size"].as<unsigned>();
+  unsigned reads = vm["reads"].as<unsigned>();
+  if (!read_size || read_size > object_size) {
+    cerr << "read-size must be positive and at most object-size" << std::endl;
+    return 1;
+  }
+
+  string path = vm["path"].as<string>();
+  if (::mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+    cerr << "unable to create " << path << ": " << cpp_strerror(errno)
+	 << std::endl;
+    return 1;
+  }
+  unique_ptr<ObjectStore> store(
+    ObjectStore::create(g_ceph_context, vm["store"].as<string>(), path,
+			vm["journal"].as<string>()));
+  if (!store) {
+    cerr << "unknown objectstore " << vm["store"].as<string>() << std::endl;
+    return 1;
+  }
+  int r = store->mkfs();
+  if (r < 0 || (r = store->mount()) < 0) {
+    cerr << "unable to create the objectstore: " << cpp_strerror(r)
+	 << std::endl;
+    return 1;
+  }
+
+  ObjectStore::Sequencer osr("zero_copy_bench");
+  coll_t cid;
+  ghobject_t oid(hobject_t(sobject_t("zero_copy_bench", CEPH_NOSNAP)));
+  {
+    bufferlist bl;
+    bufferptr bp(object_size);
+    for (unsigned i = 0; i < object_size; ++i)
+      bp[i] = rand();
+    bl.append(bp);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, oid, 0, bl.length(), bl);
+    r = store->apply_transaction(&osr, std::move(t));
+    assert(r == 0);
+  }
+
+  Receiver receiver;
+  Messenger *server = Messenger::create(g_ceph_context, "async",
+					entity_name_t::OSD(0), "server", 0);
+  server->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  entity_addr_t bind_addr;
+  bind_addr.parse(vm["bind"].as<string>().c_str());
+  r = server->bind(bind_addr);
+  if (r < 0) {
+    cerr << "unable to bind " << bind_addr << ": " << cpp_strerror(r)
+	 << std::endl;
+    return 1;
+  }
+  server->add_dispatcher_head(&receiver);
+  server->start();
+
+  Messenger *client = Messenger::create(g_ceph_context, "async",
+					entity_name_t::CLIENT(0), "client",
+					getpid());
+  client->set_default_policy(Messenger::Policy::lossy_client(0, 0));
+  client->start();
+  ConnectionRef conn = client->get_connection(server->get_myinst());
+
+  map<string, uint64_t> before = get_msgr_counters();
+  ReadUsage usage;
+  unsigned positions = object_size / read_size;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (unsigned i = 0; i < reads; ++i) {
+    bufferlist bl;
+    r = store->read(cid, oid, (uint64_t)(i % positions) * read_size,
+		    read_size, bl);
+    assert(r == (int)read_size);
+    usage.add(bl);
+    MDataPing *m = new MDataPing;
+    m->set_data(bl);
+    conn->send_message(m);
+    receiver.wait_for(i + 1);
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+  map<string, uint64_t> after = get_msgr_counters();
+
+  uint64_t sent = after["msgr_send_bytes"] - before["msgr_send_bytes"];
+  uint64_t spliced = after["msgr_send_splice_bytes"] -
+    before["msgr_send_splice_bytes"];
+  uint64_t zerocopy = after["msgr_send_zerocopy_bytes"] -
+    before["msgr_send_zerocopy_bytes"];
+  uint64_t zerocopy_copied = after["msgr_send_zerocopy_copied_bytes"] -
+    before["msgr_send_zerocopy_copied_bytes"];
+  uint64_t copied = sent > spliced + zerocopy ?
+    sent - spliced - zerocopy + zerocopy_copied : zerocopy_copied;
+
+  cout << std::fixed << std::setprecision(0);
+  cout << "store " << vm["store"].as<string>()
+       << ", " << reads << " reads of " << read_size << " bytes in "
+       << (double)elapsed << "s, "
+       << (double)reads * read_size / (1 << 20) / (double)elapsed << " MB/s"
+       << std::endl;
+  cout << "bytes per read" << std::endl;
+  cout << "  read private\t" << (double)usage.priv / reads << std::endl;
+  cout << "  read shared\t" << (double)usage.shared / reads << std::endl;
+  cout << "  read pipe\t" << (double)usage.pipe / reads << std::endl;
+  cout << "  sent\t\t" << (double)sent / reads << std::endl;
+  cout << "  sent copied\t" << (double)copied / reads << std::endl;
+  cout << "  sent spliced\t" << (double)spliced / reads << std::endl;
+  cout << "  sent zerocopy\t" << (double)(zerocopy - zerocopy_copied) / reads
+       << std::endl;
+
+  conn->mark_down();
+  client->shutdown();
+  client->wait();
+  server->shutdown();
+  server->wait();
+  delete client;
+  delete server;
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, oid);
+    t.remove_collection(cid);
+    store->apply_transaction(&osr, std::move(t));
+  }
+  store->umount();
+  return 0;
+}
@@ -35,6 +35,7 @@
 #include "stdlib.h"
 #include "fcntl.h"
 #include "sys/stat.h"
+#include "sys/socket.h"
 
 #define MAX_TEST 1000000
 #define FILENAME "bufferlist"
@@ -385,6 +386,34 @@ TEST_F(TestRawPipe, buffer_list_write_fd_zero_copy) {
   ::close(out_fd);
   ::unlink(FILENAME);
 }
+
+TEST_F(TestRawPipe, zero_copy_to_socket) {
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  bufferptr ptr(buffer::create_zero_copy(len, fd, NULL));
+  char buf[len];
+  // only the tail of the buffer, from where the last call left off
+  bufferptr tail(ptr, 1, len - 1);
+  EXPECT_EQ(-ENOTSUP, tail.zero_copy_to_socket(sv[0], false));
+  EXPECT_EQ((ssize_t)len, ptr.zero_copy_to_socket(sv[0], false));
+  EXPECT_EQ((int)len, safe_read(sv[1], buf, len));
+  EXPECT_EQ(0, memcmp(buf, "ABC\n", len));
+  // the source is kept for resending, from the start
+  EXPECT_EQ((ssize_t)len, ptr.zero_copy_to_socket(sv[0], false));
+  EXPECT_EQ((int)len, safe_read(sv[1], buf, len));
+  EXPECT_EQ(0, memcmp(buf, "ABC\n", len));
+  EXPECT_EQ(0, memcmp(ptr.c_str(), "ABC\n", len));
+  // once it is all sent, another socket may splice it
+  int sv2[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv2));
+  EXPECT_EQ((ssize_t)len, ptr.zero_copy_to_socket(sv2[0], false));
+  EXPECT_EQ((int)len, safe_read(sv2[1], buf, len));
+  EXPECT_EQ(0, memcmp(buf, "ABC\n", len));
+  ::close(sv2[0]);
+  ::close(sv2[1]);
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
 #endif // CEPH_HAVE_SPLICE
 
 //                                     
@@ -2509,6 +2538,33 @@ TEST(BufferList, crc32c_append) {
   ASSERT_EQ(bl1.crc32c(0), bl2.crc32c(0));
 }
 
+TEST(BufferList, crc32c_batch) {
+  vector<bufferlist> bls(6);
+  for (unsigned i = 0; i < 4; ++i) {
+    bufferptr bp(4096);
+    for (unsigned j = 0; j < bp.length(); ++j)
+      bp[j] = rand();
+    bls[i].append(bp);
+  }
+  bls[4].append("short");                      // alone at its length
+  bls[5].append(bufferptr("more than ", 10));  // more than one buffer
+  bls[5].append(bufferptr("one buffer", 10));
+  bls[3].crc32c(0);                            // already has a cached crc
+
+  vector<const bufferlist*> ptrs;
+  for (unsigned i = 0; i < bls.size(); ++i)
+    ptrs.push_back(&bls[i]);
+  vector<uint32_t> crcs;
+  bufferlist::crc32c_batch(ptrs, &crcs);
+  ASSERT_EQ(bls.size(), crcs.size());
+  for (unsigned i = 0; i < bls.size(); ++i) {
+    bufferlist copy;
+    copy.append(bls[i].c_str(), bls[i].length());
+    EXPECT_EQ(copy.crc32c(0), crcs[i]);
+    EXPECT_EQ(bls[i].crc32c(0), crcs[i]);       // from the cached value
+  }
+}
+
 TEST(BufferList, crc32c_append_perf) {
   int len = 256 * 1024 * 1024;
   bufferptr a(len);
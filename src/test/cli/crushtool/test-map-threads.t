@@ -0,0 +1,10 @@
+#
+# --threads changes nothing but the time it takes
+#
+  $ for map in test-map-big-1 test-map-indep; do
+  >   crushtool -i "$TESTDIR/$map.crushmap" --test --show-mappings --show-statistics --show-bad-mappings --show-utilization --threads 1 > "$map.1" 2>&1
+  >   crushtool -i "$TESTDIR/$map.crushmap" --test --show-mappings --show-statistics --show-bad-mappings --show-utilization --threads 4 > "$map.4" 2>&1
+  >   test -s "$map.1" || echo "$map: no mappings"
+  >   cmp -s "$map.1" "$map.4" || echo "$map: --threads 4 differs"
+  > done
+  $ rm -f test-map-big-1.1 test-map-big-1.4 test-map-indep.1 test-map-indep.4
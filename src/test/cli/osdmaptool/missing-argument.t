@@ -5,6 +5,9 @@
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pgs [--pool <poolid>] [--pg_num <pg_num>] map all pgs
      --test-map-pgs-dump [--pool <poolid>] map all pgs
+     --test-map-pgs-diff <mapfile> [--pool <poolid>] show the pgs that move
+                             going from the osdmap in <mapfile> to this one
+     --threads <n>           map pgs with n threads (default: one per cpu)
      --mark-up-in            mark osds up and in (but do not persist)
      --clear-temp            clear pg_temp and primary_temp
      --test-random           do random placements
@@ -41,6 +41,50 @@
 # if they are, it most probably means something went wrong somewhere
   $ test "$STATS_CRUSH" != "$STATS_RANDOM"
 #
+# --threads changes nothing but the time it takes
+#
+  $ osdmaptool --mark-up-in --test-map-pgs-dump --threads 1 "$OSD_MAP" > "$OUT.1"
+  osdmaptool: osdmap file 'osdmap'
+  $ osdmaptool --mark-up-in --test-map-pgs-dump --threads 8 "$OSD_MAP" > "$OUT.8"
+  osdmaptool: osdmap file 'osdmap'
+  $ cmp "$OUT.1" "$OUT.8"
+  $ rm -f "$OUT.1" "$OUT.8"
+#
+# --test-map-pgs-diff of a map with itself moves nothing
+#
+  $ osdmaptool --test-map-pgs-diff "$OSD_MAP" "$OSD_MAP"
+  osdmaptool: osdmap file 'osdmap'
+  pool 0 pg_num 8000: 0 pgs move, 0/0 shards
+  #osd\tbefore\tafter\tin\tout (esc)
+   0/8000 pgs move, 0/0 shards
+#
+# --mark-up-in marks the map diffed against up and in as well
+#
+  $ osdmaptool --mark-up-in --test-map-pgs-diff "$OSD_MAP" "$OSD_MAP"
+  osdmaptool: osdmap file 'osdmap'
+  marking all OSDs up and in
+  pool 0 pg_num 8000: 0 pgs move, 0/24000 shards (0% of the data)
+  #osd\tbefore\tafter\tin\tout (esc)
+   0/8000 pgs move, 0/24000 shards (0% of the data)
+#
+# halving the weight of a rack moves shards out of it, and every
+# shard that moves out of an osd moves into another one
+#
+  $ CEPH_ARGS="--debug-crush 0" crushtool --outfn "$CRUSH_MAP.before" --build --num_osds $NUM_OSDS node straw2 10 rack straw2 10 root straw2 0
+  $ crushtool -i "$CRUSH_MAP.before" --reweight-item rack0 50 -o "$CRUSH_MAP.after" > /dev/null
+  $ cp "$OSD_MAP" "$OSD_MAP.before"
+  $ osdmaptool --import-crush "$CRUSH_MAP.before" "$OSD_MAP.before" > /dev/null
+  osdmaptool: osdmap file 'osdmap.before'
+  $ cp "$OSD_MAP" "$OSD_MAP.after"
+  $ osdmaptool --import-crush "$CRUSH_MAP.after" "$OSD_MAP.after" > /dev/null
+  osdmaptool: osdmap file 'osdmap.after'
+  $ osdmaptool --mark-up-in --test-map-pgs-diff "$OSD_MAP.before" "$OSD_MAP.after" > "$OUT"
+  osdmaptool: osdmap file 'osdmap.after'
+  $ MOVED=$(sed -n 's/^pool 0 pg_num 8000: \([0-9]*\) pgs move.*/\1/p' "$OUT")
+  $ test "$MOVED" -gt 0 || cat "$OUT"
+  $ awk '/^osd\./ { split($1, id, "."); if (id[2] < 100) rack0 += $3 - $2; sin += $4; sout += $5 } END { if (rack0 >= 0 || sin != sout) print rack0, sin, sout }' "$OUT"
+  $ rm -f "$CRUSH_MAP.before" "$CRUSH_MAP.after" "$OSD_MAP.before" "$OSD_MAP.after"
+#
 # cleanup
 #
   $ rm -f "$CRUSH_MAP" "$OSD_MAP" "$OUT"
@@ -424,6 +424,21 @@ TEST(BackoffThrottle, oversaturated)
   ASSERT_GT(results.second.count(), 0.0005);
 }
 
+TEST(BackoffThrottle, should_wait)
+{
+  BackoffThrottle throttle(1);
+  ASSERT_TRUE(throttle.set_params(0.4, 0.6, 1000, 2, 10, 100, 0));
+  ASSERT_FALSE(throttle.should_wait(1));
+  throttle.take(30);
+  ASSERT_FALSE(throttle.should_wait(1));
+  // above the low threshhold get() backs off
+  throttle.take(20);
+  ASSERT_TRUE(throttle.should_wait(1));
+  throttle.put(50);
+  ASSERT_FALSE(throttle.should_wait(1));
+  ASSERT_EQ(0u, throttle.get_current());
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
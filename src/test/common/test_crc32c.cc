@@ -265,3 +265,23 @@ TEST(Crc32c, RangeNull) {
     ASSERT_EQ(crc, *check);
   }
 }
+
+TEST(Crc32c, Multi) {
+  const unsigned n = 7;
+  unsigned len = 4096 + 5;
+  unsigned char *b = (unsigned char *)malloc(n * len);
+  for (unsigned i = 0; i < n * len; i++)
+    b[i] = rand();
+  const unsigned char *bufs[n];
+  for (unsigned i = 0; i < n; i++)
+    bufs[i] = b + i * len;
+  bufs[4] = NULL;
+  for (unsigned l = 0; l < len; l += 97) {
+    uint32_t out[n];
+    ceph_crc32c_multi(-1, bufs, n, l, out);
+    for (unsigned i = 0; i < n; i++) {
+      ASSERT_EQ(ceph_crc32c(-1, bufs[i], l), out[i]);
+    }
+  }
+  free(b);
+}
@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/mClockQueue.h"
+
+#include <map>
+#include <memory>
+
+// items are (client, sequence), the client is the scheduling client
+typedef std::pair<unsigned, unsigned> Item;
+typedef mClockQueue<Item, unsigned, unsigned> MQ;
+
+class mClockQueueTest : public testing::Test {
+protected:
+  double t;
+  std::map<unsigned, mClockClientInfo> info;
+
+  mClockQueueTest() : t(1000) {}
+
+  MQ *create() {
+    return new MQ(
+      [this](const unsigned &c) { return info[c]; },
+      [](const unsigned &cl, const Item &item) { return item.first; },
+      [this]() { return t; });
+  }
+
+  /// keep depth ops of every client queued and serve iops for secs
+  std::map<unsigned, unsigned> serve(MQ *q, unsigned depth, double iops,
+				     double secs) {
+    std::map<unsigned, unsigned> seq, served;
+    for (unsigned i = 0; i < depth; ++i)
+      for (auto &c : info)
+	q->enqueue(c.first, 0, 0, Item(c.first, seq[c.first]++));
+    for (unsigned n = 0; n < iops * secs; ++n) {
+      t += 1.0 / iops;
+      Item item = q->dequeue();
+      ++served[item.first];
+      q->enqueue(item.first, 0, 0, Item(item.first, seq[item.first]++));
+    }
+    return served;
+  }
+};
+
+TEST_F(mClockQueueTest, fifo_per_client)
+{
+  info[0] = mClockClientInfo(0, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  for (unsigned i = 0; i < 10; ++i)
+    q->enqueue(0, 0, 0, Item(0, i));
+  q->enqueue_front(0, 0, 0, Item(0, 100));
+  EXPECT_EQ(11u, q->length());
+  EXPECT_EQ(100u, q->dequeue().second);
+  for (unsigned i = 0; i < 10; ++i)
+    EXPECT_EQ(i, q->dequeue().second);
+  EXPECT_TRUE(q->empty());
+}
+
+TEST_F(mClockQueueTest, strict_first)
+{
+  info[0] = mClockClientInfo(1000, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  q->enqueue(0, 0, 0, Item(0, 0));
+  q->enqueue_strict(1, 10, Item(1, 0));
+  q->enqueue_strict(1, 20, Item(1, 1));
+  q->enqueue_strict_front(1, 10, Item(1, 2));
+  EXPECT_EQ(Item(1, 1), q->dequeue());
+  EXPECT_EQ(Item(1, 2), q->dequeue());
+  EXPECT_EQ(Item(1, 0), q->dequeue());
+  EXPECT_EQ(Item(0, 0), q->dequeue());
+}
+
+TEST_F(mClockQueueTest, weight)
+{
+  info[0] = mClockClientInfo(0, 1, 0);
+  info[1] = mClockClientInfo(0, 3, 0);
+  std::unique_ptr<MQ> q(create());
+  std::map<unsigned, unsigned> served = serve(q.get(), 4, 1000, 4);
+  EXPECT_NEAR(1000u, served[0], 10);
+  EXPECT_NEAR(3000u, served[1], 10);
+}
+
+TEST_F(mClockQueueTest, reservation)
+{
+  // 0 is owed 300 ops/s even though its weight is negligible
+  info[0] = mClockClientInfo(300, 1, 0);
+  info[1] = mClockClientInfo(0, 1000, 0);
+  std::unique_ptr<MQ> q(create());
+  std::map<unsigned, unsigned> served = serve(q.get(), 4, 1000, 4);
+  EXPECT_NEAR(1200u, served[0], 10);
+  EXPECT_NEAR(2800u, served[1], 10);
+  EXPECT_NEAR(1200u, q->get_reservation_served(), 10);
+}
+
+TEST_F(mClockQueueTest, limit)
+{
+  info[0] = mClockClientInfo(0, 10, 100);
+  info[1] = mClockClientInfo(0, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  std::map<unsigned, unsigned> served = serve(q.get(), 4, 1000, 4);
+  EXPECT_NEAR(400u, served[0], 10);
+  EXPECT_NEAR(3600u, served[1], 10);
+
+  // alone, a client over its limit is still served
+  info.erase(1);
+  std::unique_ptr<MQ> alone(create());
+  served = serve(alone.get(), 4, 1000, 1);
+  EXPECT_EQ(1000u, served[0]);
+}
+
+TEST_F(mClockQueueTest, idle_client)
+{
+  info[0] = mClockClientInfo(0, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  serve(q.get(), 4, 1000, 2);
+
+  // 1 gets its share from now on, not the two idle seconds of it
+  info[1] = mClockClientInfo(0, 1, 0);
+  for (unsigned i = 0; i < 4; ++i)
+    q->enqueue(1, 0, 0, Item(1, i));
+  std::map<unsigned, unsigned> served;
+  for (unsigned n = 0; n < 100; ++n) {
+    t += 0.001;
+    Item item = q->dequeue();
+    ++served[item.first];
+    q->enqueue(item.first, 0, 0, Item(item.first, 1000 + n));
+  }
+  EXPECT_NEAR(50u, served[0], 2);
+  EXPECT_NEAR(50u, served[1], 2);
+}
+
+TEST_F(mClockQueueTest, remove)
+{
+  info[0] = mClockClientInfo(0, 1, 0);
+  info[1] = mClockClientInfo(0, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  for (unsigned i = 0; i < 6; ++i) {
+    q->enqueue(0, 0, 0, Item(0, i));
+    q->enqueue(1, 0, 0, Item(1, i));
+  }
+  q->enqueue_strict(1, 10, Item(1, 100));
+
+  std::list<Item> removed;
+  q->remove_by_class(1, &removed);
+  ASSERT_EQ(7u, removed.size());
+  EXPECT_EQ(Item(1, 0), removed.front());
+  EXPECT_EQ(Item(1, 100), removed.back());
+  EXPECT_EQ(6u, q->length());
+
+  // filtered back to front
+  std::list<unsigned> seen;
+  q->remove_by_filter([&seen](Item item) {
+      seen.push_back(item.second);
+      return item.second % 2 == 0;
+    });
+  ASSERT_EQ(6u, seen.size());
+  EXPECT_EQ(5u, seen.front());
+  EXPECT_EQ(3u, q->length());
+  for (unsigned i = 1; i < 6; i += 2)
+    EXPECT_EQ(Item(0, i), q->dequeue());
+  EXPECT_TRUE(q->empty());
+}
+
+TEST_F(mClockQueueTest, many_clients)
+{
+  // weights 1..4, and a limited and a reserved client
+  for (unsigned c = 0; c < 48; ++c)
+    info[c] = mClockClientInfo(0, 1 + c % 4, 0);
+  info[48] = mClockClientInfo(0, 100, 10);
+  info[49] = mClockClientInfo(100, 1, 0);
+  std::unique_ptr<MQ> q(create());
+  std::map<unsigned, unsigned> served = serve(q.get(), 2, 10000, 10);
+  EXPECT_NEAR(100u, served[48], 2);
+  EXPECT_NEAR(1000u, served[49], 20);
+  // the rest is shared by weight: 120 weight units in all
+  double unit = (100000.0 - served[48] - served[49]) / 120;
+  for (unsigned c = 0; c < 48; ++c)
+    EXPECT_NEAR(unit * (1 + c % 4), served[c], unit * 0.05) << "client " << c;
+
+  // drop the clients in the middle, the others keep their order
+  q->remove_by_filter([](Item item) {
+      return item.first >= 10 && item.first < 40;
+    });
+  EXPECT_EQ(40u, q->length());
+  std::map<unsigned, unsigned> last;
+  while (!q->empty()) {
+    Item item = q->dequeue();
+    EXPECT_TRUE(item.first < 10 || item.first >= 40);
+    if (last.count(item.first))
+      EXPECT_LT(last[item.first], item.second);
+    last[item.first] = item.second;
+  }
+  EXPECT_EQ(20u, last.size());
+}
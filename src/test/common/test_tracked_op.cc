@@ -0,0 +1,169 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/TrackedOp.h"
+#include "common/ceph_json.h"
+#include "global/global_context.h"
+#include "test/unit.h"
+
+#include <map>
+#include <thread>
+#include <vector>
+
+class TestOp : public TrackedOp {
+public:
+  typedef ceph::shared_ptr<TestOp> Ref;
+  TestOp(int, OpTracker *tracker)
+    : TrackedOp(tracker, ceph_clock_now(g_ceph_context)) {}
+  void _dump_op_descriptor_unlocked(ostream& stream) const override {
+    stream << "test";
+  }
+};
+
+struct StageStats {
+  uint64_t count;
+  uint64_t avg_ns;
+};
+
+static void dump(OpTracker& tracker, JSONParser *parser)
+{
+  JSONFormatter f;
+  f.open_object_section("latencies");
+  tracker.dump_stage_latencies(&f);
+  f.close_section();
+  stringstream ss;
+  f.flush(ss);
+  ASSERT_TRUE(parser->parse(ss.str().c_str(), ss.str().length()));
+}
+
+/// the sampled op count and the stats by stage name, from the dump
+static uint64_t get_stats(OpTracker& tracker,
+			  std::map<string, StageStats> *stages)
+{
+  JSONParser parser;
+  dump(tracker, &parser);
+  JSONObj *o = parser.find_obj("stages");
+  EXPECT_TRUE(o != NULL);
+  for (const string& s : o->get_array_elements()) {
+    JSONParser stage;
+    EXPECT_TRUE(stage.parse(s.c_str(), s.length()));
+    (*stages)[stage.find_obj("stage")->get_data()] = StageStats{
+      strtoull(stage.find_obj("count")->get_data().c_str(), NULL, 10),
+      strtoull(stage.find_obj("avg_ns")->get_data().c_str(), NULL, 10)};
+  }
+  return strtoull(parser.find_obj("sampled_ops")->get_data().c_str(),
+		  NULL, 10);
+}
+
+static const char *name(tracked_op_stage_t stage)
+{
+  return OpTracker::get_stage_name(stage);
+}
+
+class TrackedOpTest : public ::testing::Test {
+protected:
+  OpTracker tracker;
+
+  TrackedOpTest() : tracker(g_ceph_context, false, 1) {}
+
+  /// false if there is no cycle counter to sample with
+  bool sample(uint32_t rate) {
+    tracker.set_sample_rate(rate);
+    JSONParser parser;
+    dump(tracker, &parser);
+    return parser.find_obj("sample_rate")->get_data() != "0";
+  }
+
+  TestOp::Ref create() {
+    return tracker.create_request<TestOp, int>(0);
+  }
+};
+
+TEST_F(TrackedOpTest, SampleRate)
+{
+  if (!sample(3))
+    return;
+  for (int i = 0; i < 9; ++i)
+    create()->mark_stage(TRACKED_OP_STAGE_STARTED);
+  std::map<string, StageStats> stages;
+  ASSERT_EQ(3u, get_stats(tracker, &stages));
+  ASSERT_EQ(3u, stages[name(TRACKED_OP_STAGE_STARTED)].count);
+  ASSERT_EQ(3u, stages[name(TRACKED_OP_STAGE_DONE)].count);
+}
+
+TEST_F(TrackedOpTest, NotSampled)
+{
+  tracker.set_sample_rate(0);
+  for (int i = 0; i < 10; ++i)
+    create()->mark_stage(TRACKED_OP_STAGE_STARTED);
+  std::map<string, StageStats> stages;
+  ASSERT_EQ(0u, get_stats(tracker, &stages));
+  ASSERT_EQ(0u, stages[name(TRACKED_OP_STAGE_STARTED)].count);
+}
+
+TEST_F(TrackedOpTest, Stages)
+{
+  if (!sample(1))
+    return;
+  {
+    TestOp::Ref op = create();
+    op->mark_stage(TRACKED_OP_STAGE_STARTED);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    op->mark_stage(TRACKED_OP_STAGE_COMMIT_SENT);
+  }
+  std::map<string, StageStats> stages;
+  ASSERT_EQ(1u, get_stats(tracker, &stages));
+  ASSERT_EQ(1u, stages[name(TRACKED_OP_STAGE_STARTED)].count);
+  ASSERT_EQ(1u, stages[name(TRACKED_OP_STAGE_COMMIT_SENT)].count);
+  ASSERT_EQ(1u, stages[name(TRACKED_OP_STAGE_DONE)].count);
+  ASSERT_EQ(0u, stages[name(TRACKED_OP_STAGE_DEQUEUED)].count);
+  // a stage is charged the time since the previous one
+  ASSERT_GE(stages[name(TRACKED_OP_STAGE_COMMIT_SENT)].avg_ns, 10000000u);
+  ASSERT_LT(stages[name(TRACKED_OP_STAGE_STARTED)].avg_ns, 10000000u);
+
+  tracker.reset_stage_latencies();
+  stages.clear();
+  ASSERT_EQ(0u, get_stats(tracker, &stages));
+  ASSERT_EQ(0u, stages[name(TRACKED_OP_STAGE_COMMIT_SENT)].count);
+}
+
+TEST_F(TrackedOpTest, TooManyEvents)
+{
+  if (!sample(1))
+    return;
+  // the events past the slots of an op are dropped, done included
+  for (int i = 0; i < 30; ++i)
+    create()->mark_stage(TRACKED_OP_STAGE_STARTED);
+  {
+    TestOp::Ref op = create();
+    for (int i = 0; i < 30; ++i)
+      op->mark_stage(TRACKED_OP_STAGE_REPLICA_COMMIT);
+  }
+  std::map<string, StageStats> stages;
+  ASSERT_EQ(31u, get_stats(tracker, &stages));
+  ASSERT_EQ(24u, stages[name(TRACKED_OP_STAGE_REPLICA_COMMIT)].count);
+  ASSERT_EQ(30u, stages[name(TRACKED_OP_STAGE_DONE)].count);
+}
+
+TEST_F(TrackedOpTest, ConcurrentMarks)
+{
+  if (!sample(1))
+    return;
+  {
+    TestOp::Ref op = create();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.push_back(std::thread([op]() {
+	    for (int i = 0; i < 5; ++i)
+	      op->mark_stage(TRACKED_OP_STAGE_REPLICA_COMMIT);
+	  }));
+    }
+    for (auto& t : threads)
+      t.join();
+  }
+  std::map<string, StageStats> stages;
+  ASSERT_EQ(1u, get_stats(tracker, &stages));
+  ASSERT_EQ(20u, stages[name(TRACKED_OP_STAGE_REPLICA_COMMIT)].count);
+  ASSERT_EQ(1u, stages[name(TRACKED_OP_STAGE_DONE)].count);
+}
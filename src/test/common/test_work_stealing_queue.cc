@@ -0,0 +1,244 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/WorkStealingQueue.h"
+#include "common/Clock.h"
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <thread>
+#include <vector>
+
+typedef WorkStealingQueue<unsigned, unsigned> WSQ;
+
+static std::vector<unsigned> drain_key(WSQ &q, unsigned owner, unsigned key)
+{
+  std::vector<unsigned> out;
+  boost::optional<unsigned> item;
+  while ((item = q.pop(owner, key)))
+    out.push_back(*item);
+  return out;
+}
+
+TEST(WorkStealingQueue, fifo_per_key)
+{
+  WSQ q(2);
+  for (unsigned i = 0; i < 10; ++i)
+    q.enqueue(0, i % 2, i);
+  EXPECT_FALSE(q.empty(0));
+  EXPECT_TRUE(q.empty(1));
+
+  // keys come out in the order they were first queued
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  EXPECT_EQ(0u, key);
+  EXPECT_EQ(0u, owner);
+  std::vector<unsigned> items = drain_key(q, owner, key);
+  ASSERT_EQ(5u, items.size());
+  for (unsigned i = 0; i < items.size(); ++i)
+    EXPECT_EQ(2 * i, items[i]);
+  q.release(owner, key);
+
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  EXPECT_EQ(1u, key);
+  items = drain_key(q, owner, key);
+  ASSERT_EQ(5u, items.size());
+  for (unsigned i = 0; i < items.size(); ++i)
+    EXPECT_EQ(2 * i + 1, items[i]);
+  q.release(owner, key);
+
+  EXPECT_FALSE(q.claim(0, &key, &owner));
+  EXPECT_TRUE(q.empty(0));
+}
+
+TEST(WorkStealingQueue, steal)
+{
+  WSQ q(3);
+  q.enqueue(2, 7, 1);
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  EXPECT_EQ(7u, key);
+  EXPECT_EQ(2u, owner);
+  EXPECT_EQ(1u, q.get_stolen(2));
+  EXPECT_EQ(0u, q.get_stolen(0));
+  boost::optional<unsigned> item = q.pop(owner, key);
+  ASSERT_TRUE(item);
+  EXPECT_EQ(1u, *item);
+  q.release(owner, key);
+  EXPECT_TRUE(q.empty(2));
+}
+
+TEST(WorkStealingQueue, busy_key)
+{
+  WSQ q(2);
+  q.enqueue(0, 1, 1);
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  EXPECT_EQ(1u, key);
+
+  // a claimed key is not handed out again, even to a thief
+  q.enqueue(0, 1, 2);
+  unsigned other, other_owner;
+  EXPECT_FALSE(q.claim(0, &other, &other_owner));
+  EXPECT_FALSE(q.claim(1, &other, &other_owner));
+
+  boost::optional<unsigned> item = q.pop(owner, key);
+  ASSERT_TRUE(item);
+  EXPECT_EQ(1u, *item);
+  q.release(owner, key);
+
+  // the item queued meanwhile makes it ready again
+  ASSERT_TRUE(q.claim(1, &key, &owner));
+  EXPECT_EQ(1u, key);
+  EXPECT_EQ(0u, owner);
+  std::vector<unsigned> items = drain_key(q, owner, key);
+  ASSERT_EQ(1u, items.size());
+  EXPECT_EQ(2u, items[0]);
+  q.release(owner, key);
+}
+
+TEST(WorkStealingQueue, enqueue_front)
+{
+  WSQ q(1);
+  q.enqueue(0, 3, 2);
+  q.enqueue(0, 3, 3);
+  q.enqueue_front(0, 3, 1);
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  std::vector<unsigned> items = drain_key(q, owner, key);
+  ASSERT_EQ(3u, items.size());
+  EXPECT_EQ(1u, items[0]);
+  EXPECT_EQ(2u, items[1]);
+  EXPECT_EQ(3u, items[2]);
+  q.release(owner, key);
+}
+
+struct Collect {
+  std::list<unsigned> items;
+  void operator()(unsigned i) {
+    items.push_front(i);
+  }
+};
+
+TEST(WorkStealingQueue, remove)
+{
+  WSQ q(2);
+  for (unsigned i = 0; i < 4; ++i) {
+    q.enqueue(1, 5, i);
+    q.enqueue(1, 6, 10 + i);
+  }
+  {
+    Collect c;
+    q.remove(1, 5, c);
+    ASSERT_EQ(4u, c.items.size());
+    unsigned expected = 0;
+    for (std::list<unsigned>::iterator i = c.items.begin();
+	 i != c.items.end();
+	 ++i)
+      EXPECT_EQ(expected++, *i);
+  }
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(1, &key, &owner));
+  EXPECT_EQ(6u, key);
+  EXPECT_TRUE(q.pop(owner, key));
+
+  // removing the items of a claimed key leaves it claimed
+  {
+    Collect c;
+    q.remove(1, 6, c);
+    EXPECT_EQ(3u, c.items.size());
+  }
+  EXPECT_FALSE(q.pop(owner, key));
+  q.release(owner, key);
+  EXPECT_FALSE(q.claim(1, &key, &owner));
+  EXPECT_TRUE(q.empty(1));
+}
+
+TEST(WorkStealingQueue, wait_sees_other_shards)
+{
+  WSQ q(2);
+  // queued while shard 0 had no sleeper: wake() found no one to signal
+  q.enqueue(1, 5, 0);
+  utime_t start = ceph_clock_now(NULL);
+  q.wait(NULL, 0, utime_t(10, 0));
+  EXPECT_GT(utime_t(5, 0), ceph_clock_now(NULL) - start);
+  unsigned key, owner;
+  ASSERT_TRUE(q.claim(0, &key, &owner));
+  EXPECT_EQ(1u, owner);
+  drain_key(q, owner, key);
+  q.release(owner, key);
+}
+
+TEST(WorkStealingQueue, concurrent)
+{
+  const unsigned shards = 4;
+  const unsigned keys = 16;
+  const unsigned producers = 4;
+  const unsigned per_producer = 20000;
+  WSQ q(shards);
+
+  std::vector<std::atomic<unsigned>*> in_use;
+  for (unsigned k = 0; k < keys; ++k)
+    in_use.push_back(new std::atomic<unsigned>(0));
+  // last sequence seen per (key, producer)
+  std::vector<std::vector<int> > last(keys, std::vector<int>(producers, -1));
+  std::atomic<unsigned> done(0);
+  std::atomic<bool> failed(false);
+  std::atomic<bool> stop(false);
+
+  std::vector<std::thread> consumers;
+  for (unsigned c = 0; c < shards * 2; ++c) {
+    consumers.push_back(std::thread([&, c]() {
+	  while (!stop) {
+	    unsigned key, owner;
+	    if (!q.claim(c % shards, &key, &owner)) {
+	      q.wait(NULL, c % shards, utime_t(0, 1000000));
+	      continue;
+	    }
+	    if ((*in_use[key])++ != 0)
+	      failed = true;
+	    boost::optional<unsigned> item;
+	    for (unsigned n = 0; n < 4 && (item = q.pop(owner, key)); ++n) {
+	      unsigned p = *item / per_producer;
+	      int seq = *item % per_producer;
+	      if (seq != last[key][p] + 1)
+		failed = true;
+	      last[key][p] = seq;
+	      ++done;
+	    }
+	    --(*in_use[key]);
+	    q.release(owner, key);
+	  }
+	}));
+  }
+
+  // every producer loads key 0 as much as all the others together
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < producers; ++p) {
+    threads.push_back(std::thread([&, p]() {
+	  std::vector<unsigned> seq(keys, 0);
+	  for (unsigned i = 0; i < per_producer; ++i) {
+	    unsigned key = (i % 2) ? 0 : 1 + (i / 2) % (keys - 1);
+	    // items encode the producer and its sequence for the key
+	    q.enqueue(key % shards, key, p * per_producer + seq[key]++);
+	  }
+	}));
+  }
+  for (unsigned p = 0; p < producers; ++p)
+    threads[p].join();
+  while (done < producers * per_producer && !failed)
+    std::this_thread::yield();
+  stop = true;
+  q.wake_all();
+  for (unsigned c = 0; c < consumers.size(); ++c)
+    consumers[c].join();
+
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(producers * per_producer, done);
+  for (unsigned s = 0; s < shards; ++s)
+    EXPECT_TRUE(q.empty(s));
+  for (unsigned k = 0; k < keys; ++k)
+    delete in_use[k];
+}
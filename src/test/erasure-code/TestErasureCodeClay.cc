@@ -0,0 +1,287 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph distributed storage system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "crush/CrushWrapper.h"
+#include "include/stringify.h"
+#include "global/global_init.h"
+#include "erasure-code/clay/ErasureCodeClay.h"
+#include "common/ceph_argparse.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "gtest/gtest.h"
+
+static void init_clay(ErasureCodeClay *clay, int k, int m, int d)
+{
+  ErasureCodeProfile profile;
+  profile["k"] = stringify(k);
+  profile["m"] = stringify(m);
+  profile["d"] = stringify(d);
+  ASSERT_EQ(0, clay->init(profile, &cerr));
+}
+
+static void encode_payload(ErasureCodeClay *clay, unsigned stripes,
+			   unsigned *chunk_size, map<int, bufferlist> *encoded)
+{
+  unsigned stripe_width = clay->get_chunk_size(1) *
+    clay->get_data_chunk_count();
+  *chunk_size = stripe_width / clay->get_data_chunk_count();
+  bufferlist in;
+  for (unsigned i = 0; i < stripes * stripe_width; i++)
+    in.append((char)(rand() % 256));
+  set<int> want_to_encode;
+  for (unsigned i = 0; i < clay->get_chunk_count(); i++)
+    want_to_encode.insert(i);
+  ASSERT_EQ(0, clay->encode_stripes(want_to_encode, in, stripe_width,
+				    encoded));
+}
+
+// the sub-chunks of chunk asked by minimum_to_repair, stripe by stripe
+static void extract_subchunks(const bufferlist &chunk, unsigned chunk_size,
+			      unsigned sub_chunk_count,
+			      const vector<pair<int, int> > &subchunks,
+			      bufferlist *out)
+{
+  unsigned sc_size = chunk_size / sub_chunk_count;
+  for (unsigned off = 0; off < chunk.length(); off += chunk_size) {
+    for (vector<pair<int, int> >::const_iterator i = subchunks.begin();
+	 i != subchunks.end();
+	 ++i) {
+      bufferlist bl;
+      bl.substr_of(chunk, off + i->first * sc_size, i->second * sc_size);
+      out->append(bl);
+    }
+  }
+}
+
+TEST(ErasureCodeClay, parse)
+{
+  {
+    ErasureCodeClay clay(g_conf->erasure_code_dir);
+    ErasureCodeProfile profile;
+    EXPECT_EQ(0, clay.init(profile, &cerr));
+    EXPECT_EQ(4, clay.k);
+    EXPECT_EQ(2, clay.m);
+    EXPECT_EQ(5, clay.d);
+    EXPECT_EQ("5", profile["d"]);
+    EXPECT_EQ(2, clay.q);
+    EXPECT_EQ(3, clay.t);
+    EXPECT_EQ(0, clay.nu);
+    EXPECT_EQ(8u, clay.get_sub_chunk_count());
+  }
+  {
+    ErasureCodeClay clay(g_conf->erasure_code_dir);
+    init_clay(&clay, 4, 3, 5);
+    EXPECT_EQ(2, clay.q);
+    EXPECT_EQ(1, clay.nu);
+    EXPECT_EQ(4, clay.t);
+    EXPECT_EQ(16u, clay.get_sub_chunk_count());
+    EXPECT_EQ(0u, clay.get_chunk_size(1) % clay.get_sub_chunk_count());
+  }
+  {
+    ErasureCodeClay clay(g_conf->erasure_code_dir);
+    ErasureCodeProfile profile;
+    profile["k"] = "4";
+    profile["m"] = "2";
+    profile["d"] = "4";
+    EXPECT_EQ(-EINVAL, clay.init(profile, &cerr));
+    profile["d"] = "6";
+    EXPECT_EQ(-EINVAL, clay.init(profile, &cerr));
+  }
+  {
+    ErasureCodeClay clay(g_conf->erasure_code_dir);
+    ErasureCodeProfile profile;
+    profile["scalar_mds"] = "shec";
+    EXPECT_EQ(-EINVAL, clay.init(profile, &cerr));
+  }
+}
+
+TEST(ErasureCodeClay, minimum_to_repair)
+{
+  ErasureCodeClay clay(g_conf->erasure_code_dir);
+  init_clay(&clay, 4, 2, 5);
+
+  // chunk 5 is node (1, 2): the repair planes are the odd ones
+  vector<pair<int, int> > subchunks;
+  clay.get_repair_subchunks(5, &subchunks);
+  ASSERT_EQ(4u, subchunks.size());
+  for (unsigned i = 0; i < subchunks.size(); i++) {
+    EXPECT_EQ((int)(2 * i + 1), subchunks[i].first);
+    EXPECT_EQ(1, subchunks[i].second);
+  }
+  // chunk 0 is node (0, 0): the first half of the planes
+  subchunks.clear();
+  clay.get_repair_subchunks(0, &subchunks);
+  ASSERT_EQ(1u, subchunks.size());
+  EXPECT_EQ(0, subchunks[0].first);
+  EXPECT_EQ(4, subchunks[0].second);
+
+  set<int> want_to_read;
+  want_to_read.insert(5);
+  set<int> available;
+  for (int i = 0; i < 5; i++)
+    available.insert(i);
+  {
+    map<int, vector<pair<int, int> > > minimum;
+    EXPECT_EQ(0, clay.minimum_to_repair(want_to_read, available, &minimum));
+    EXPECT_EQ(5u, minimum.size());
+    subchunks.clear();
+    clay.get_repair_subchunks(5, &subchunks);
+    for (map<int, vector<pair<int, int> > >::iterator i = minimum.begin();
+	 i != minimum.end();
+	 ++i)
+      EXPECT_TRUE(subchunks == i->second);
+  }
+  // the other node of the column is missing: decode from k chunks
+  available.erase(4);
+  {
+    map<int, vector<pair<int, int> > > minimum;
+    EXPECT_EQ(0, clay.minimum_to_repair(want_to_read, available, &minimum));
+    EXPECT_EQ(4u, minimum.size());
+    for (map<int, vector<pair<int, int> > >::iterator i = minimum.begin();
+	 i != minimum.end();
+	 ++i) {
+      ASSERT_EQ(1u, i->second.size());
+      EXPECT_EQ(0, i->second[0].first);
+      EXPECT_EQ(8, i->second[0].second);
+    }
+  }
+  available.erase(3);
+  {
+    map<int, vector<pair<int, int> > > minimum;
+    EXPECT_EQ(-EIO, clay.minimum_to_repair(want_to_read, available, &minimum));
+  }
+}
+
+TEST(ErasureCodeClay, encode_decode)
+{
+  ErasureCodeClay clay(g_conf->erasure_code_dir);
+  init_clay(&clay, 4, 3, 5);
+  unsigned chunk_size;
+  map<int, bufferlist> encoded;
+  encode_payload(&clay, 1, &chunk_size, &encoded);
+  int n = clay.get_chunk_count();
+  ASSERT_EQ(n, (int)encoded.size());
+
+  // every combination of up to m erasures
+  for (int mask = 1; mask < (1 << n); mask++) {
+    set<int> erased;
+    for (int i = 0; i < n; i++)
+      if (mask & (1 << i))
+	erased.insert(i);
+    if (erased.size() > (unsigned)clay.m)
+      continue;
+    map<int, bufferlist> chunks;
+    for (int i = 0; i < n; i++)
+      if (!erased.count(i))
+	chunks[i] = encoded[i];
+    map<int, bufferlist> decoded;
+    EXPECT_EQ(0, clay.decode(erased, chunks, &decoded));
+    for (set<int>::iterator i = erased.begin(); i != erased.end(); ++i)
+      EXPECT_TRUE(decoded[*i].contents_equal(encoded[*i]));
+  }
+}
+
+TEST(ErasureCodeClay, repair)
+{
+  const int params[][3] = { { 4, 2, 5 }, { 4, 3, 5 }, { 6, 3, 8 } };
+  for (unsigned p = 0; p < sizeof(params) / sizeof(params[0]); p++) {
+    ErasureCodeClay clay(g_conf->erasure_code_dir);
+    init_clay(&clay, params[p][0], params[p][1], params[p][2]);
+    unsigned chunk_size;
+    map<int, bufferlist> encoded;
+    const unsigned stripes = 3;
+    encode_payload(&clay, stripes, &chunk_size, &encoded);
+    for (unsigned lost = 0; lost < clay.get_chunk_count(); lost++) {
+      set<int> want_to_read;
+      want_to_read.insert(lost);
+      set<int> available;
+      for (unsigned i = 0; i < clay.get_chunk_count(); i++)
+	if (i != lost)
+	  available.insert(i);
+      map<int, vector<pair<int, int> > > minimum;
+      ASSERT_EQ(0, clay.minimum_to_repair(want_to_read, available, &minimum));
+      ASSERT_EQ((unsigned)clay.d, minimum.size());
+      map<int, bufferlist> helpers;
+      unsigned read = 0;
+      for (map<int, vector<pair<int, int> > >::iterator i = minimum.begin();
+	   i != minimum.end();
+	   ++i) {
+	extract_subchunks(encoded[i->first], chunk_size,
+			  clay.get_sub_chunk_count(), i->second,
+			  &helpers[i->first]);
+	read += helpers[i->first].length();
+      }
+      // d chunks of 1/q instead of k whole chunks
+      EXPECT_EQ(stripes * clay.d * chunk_size / clay.q, read);
+      EXPECT_GT(stripes * clay.k * chunk_size, read);
+      map<int, bufferlist> repaired;
+      ASSERT_EQ(0, clay.repair(want_to_read, helpers, chunk_size, &repaired));
+      EXPECT_TRUE(repaired[lost].contents_equal(encoded[lost]));
+    }
+  }
+}
+
+TEST(ErasureCodeClay, repair_fallback)
+{
+  ErasureCodeClay clay(g_conf->erasure_code_dir);
+  init_clay(&clay, 4, 2, 5);
+  unsigned chunk_size;
+  map<int, bufferlist> encoded;
+  encode_payload(&clay, 2, &chunk_size, &encoded);
+
+  // chunk 4 shares the column of chunk 5 and is not available
+  set<int> want_to_read;
+  want_to_read.insert(5);
+  set<int> available;
+  for (int i = 0; i < 4; i++)
+    available.insert(i);
+  map<int, vector<pair<int, int> > > minimum;
+  ASSERT_EQ(0, clay.minimum_to_repair(want_to_read, available, &minimum));
+  map<int, bufferlist> helpers;
+  for (map<int, vector<pair<int, int> > >::iterator i = minimum.begin();
+       i != minimum.end();
+       ++i)
+    extract_subchunks(encoded[i->first], chunk_size,
+		      clay.get_sub_chunk_count(), i->second,
+		      &helpers[i->first]);
+  map<int, bufferlist> repaired;
+  ASSERT_EQ(0, clay.repair(want_to_read, helpers, chunk_size, &repaired));
+  EXPECT_TRUE(repaired[5].contents_equal(encoded[5]));
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  const char* env = getenv("CEPH_LIB");
+  string directory(env ? env : ".libs");
+  g_conf->set_val("erasure_code_dir", directory, false, false);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ;
+ *   make -j4 unittest_erasure_code_clay && valgrind --tool=memcheck \
+ *      ./unittest_erasure_code_clay \
+ *      --gtest_filter=*.* --log-to-stderr=true --debug-osd=20"
+ * End:
+ */
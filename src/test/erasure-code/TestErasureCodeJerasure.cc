@@ -130,6 +130,109 @@ TYPED_TEST(ErasureCodeTest, encode_decode)
   }
 }
 
+TYPED_TEST(ErasureCodeTest, encode_decode_stripes)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "2";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  jerasure.init(profile, &cerr);
+
+  unsigned stripe_width = 2 * jerasure.get_chunk_size(1);
+  unsigned chunk_size = jerasure.get_chunk_size(stripe_width);
+  EXPECT_EQ(stripe_width, 2 * chunk_size);
+  const unsigned stripes = 7;
+  bufferptr in_ptr(buffer::create_page_aligned(stripes * stripe_width));
+  for (unsigned i = 0; i < in_ptr.length(); i++)
+    in_ptr[i] = rand();
+  bufferlist in;
+  in.push_back(in_ptr);
+
+  int want_to_encode[] = { 0, 1, 2, 3 };
+  set<int> want(want_to_encode, want_to_encode+4);
+  map<int, bufferlist> encoded;
+  EXPECT_EQ(0, jerasure.encode_stripes(want, in, stripe_width, &encoded));
+  EXPECT_EQ(4u, encoded.size());
+
+  // the batch is the concatenation of the stripes encoded one by one
+  for (unsigned s = 0; s < stripes; s++) {
+    bufferlist stripe;
+    stripe.substr_of(in, s * stripe_width, stripe_width);
+    map<int, bufferlist> one;
+    EXPECT_EQ(0, jerasure.encode(want, stripe, &one));
+    for (int c = 0; c < 4; c++) {
+      bufferlist batched;
+      batched.substr_of(encoded[c], s * chunk_size, chunk_size);
+      EXPECT_TRUE(batched.contents_equal(one[c]));
+    }
+  }
+
+  // a data chunk and a coding chunk are missing
+  {
+    map<int, bufferlist> degraded = encoded;
+    degraded.erase(0);
+    degraded.erase(2);
+    int want_to_decode[] = { 0, 2 };
+    map<int, bufferlist> decoded;
+    EXPECT_EQ(0, jerasure.decode_stripes(set<int>(want_to_decode,
+						  want_to_decode+2),
+					 degraded, chunk_size, &decoded));
+    EXPECT_TRUE(decoded[0].contents_equal(encoded[0]));
+    EXPECT_TRUE(decoded[2].contents_equal(encoded[2]));
+  }
+}
+
+TYPED_TEST(ErasureCodeTest, apply_delta)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "2";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  jerasure.init(profile, &cerr);
+
+  unsigned stripe_width = 2 * jerasure.get_chunk_size(1);
+  unsigned chunk_size = jerasure.get_chunk_size(stripe_width);
+  const unsigned stripes = 3;
+  bufferptr in_ptr(buffer::create_page_aligned(stripes * stripe_width));
+  for (unsigned i = 0; i < in_ptr.length(); i++)
+    in_ptr[i] = rand();
+  bufferlist in;
+  in.push_back(in_ptr);
+
+  int want_to_encode[] = { 0, 1, 2, 3 };
+  set<int> want(want_to_encode, want_to_encode+4);
+  map<int, bufferlist> encoded;
+  EXPECT_EQ(0, jerasure.encode_stripes(want, in, stripe_width, &encoded));
+
+  // overwrite part of the second data chunk of the last two stripes
+  bufferptr out_ptr(buffer::create_page_aligned(in_ptr.length()));
+  memcpy(out_ptr.c_str(), in_ptr.c_str(), in_ptr.length());
+  for (unsigned s = 1; s < stripes; s++)
+    memset(out_ptr.c_str() + s * stripe_width + chunk_size + 3, 'X', 100);
+  bufferlist out;
+  out.push_back(out_ptr);
+  map<int, bufferlist> reencoded;
+  EXPECT_EQ(0, jerasure.encode_stripes(want, out, stripe_width, &reencoded));
+
+  // the coding chunks updated with the delta of the data chunk are
+  // those of the whole stripes encoded again
+  map<int, bufferlist> deltas;
+  EXPECT_EQ(0, jerasure.encode_delta(encoded[1], reencoded[1], &deltas[1]));
+  map<int, bufferlist> coding;
+  coding[2] = encoded[2];
+  coding[3] = encoded[3];
+  EXPECT_EQ(0, jerasure.apply_delta(deltas, chunk_size, &coding));
+  EXPECT_TRUE(coding[2].contents_equal(reencoded[2]));
+  EXPECT_TRUE(coding[3].contents_equal(reencoded[3]));
+
+  bufferlist short_data;
+  short_data.append_zero(chunk_size);
+  bufferlist delta;
+  EXPECT_EQ(-EINVAL, jerasure.encode_delta(encoded[1], short_data, &delta));
+}
+
 TYPED_TEST(ErasureCodeTest, minimum_to_decode)
 {
   TypeParam jerasure;
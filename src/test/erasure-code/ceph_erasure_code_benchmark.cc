@@ -49,7 +49,9 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     ("plugin,p", po::value<string>()->default_value("jerasure"),
      "erasure code plugin name")
     ("workload,w", po::value<string>()->default_value("encode"),
-     "run either encode or decode")
+     "run either encode, decode or repair, which rebuilds one lost chunk "
+     " with minimum_to_repair/repair and reports the bytes read from the "
+     " helper chunks")
     ("erasures,e", po::value<int>()->default_value(1),
      "number of erasures when decoding")
     ("erased", po::value<vector<int> >(),
@@ -61,6 +63,12 @@ int ErasureCodeBench::setup(int argc, char** argv) {
      " the first chunk, then the second etc.)")
     ("parameter,P", po::value<vector<string> >(),
      "add a parameter to the erasure code profile")
+    ("batch,b", po::value<vector<int> >(),
+     "encode or decode the buffer in batches of this many stripes with "
+     " encode_stripes/decode_stripes and report the throughput of each "
+     " (repeat to compare batch sizes)")
+    ("stripe-width", po::value<unsigned>()->default_value(0),
+     "stripe width in bytes when --batch is set, defaults to k * 4096")
     ;
 
   po::variables_map vm;
@@ -120,6 +128,9 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     exhaustive_erasures = false;
   if (vm.count("erased") > 0)
     erased = vm["erased"].as<vector<int> >();
+  if (vm.count("batch") > 0)
+    batches = vm["batch"].as<vector<int> >();
+  stripe_width = vm["stripe-width"].as<unsigned>();
 
   k = atoi(profile["k"].c_str());
   m = atoi(profile["m"].c_str());
@@ -132,6 +143,20 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     return -EINVAL;
   } 
 
+  if (stripe_width == 0)
+    stripe_width = k * 4096;
+  for (vector<int>::iterator i = batches.begin(); i != batches.end(); ++i) {
+    if (*i <= 0) {
+      cout << "batch is " << *i << ". But batch needs to be > 0." << endl;
+      return -EINVAL;
+    }
+  }
+  if (!batches.empty() && (unsigned)in_size < stripe_width) {
+    cout << "size is " << in_size << ". But it needs to hold at least one "
+	 << "stripe of " << stripe_width << " bytes." << endl;
+    return -EINVAL;
+  }
+
   verbose = vm.count("verbose") > 0 ? true : false;
 
   return 0;
@@ -143,6 +168,8 @@ int ErasureCodeBench::run() {
 
   if (workload == "encode")
     return encode();
+  else if (workload == "repair")
+    return repair();
   else
     return decode();
 }
@@ -176,6 +203,8 @@ int ErasureCodeBench::encode()
   for (int i = 0; i < k + m; i++) {
     want_to_encode.insert(i);
   }
+  if (!batches.empty())
+    return encode_batched(erasure_code, in, want_to_encode);
   utime_t begin_time = ceph_clock_now(g_ceph_context);
   for (int i = 0; i < max_iterations; i++) {
     map<int,bufferlist> encoded;
@@ -188,6 +217,42 @@ int ErasureCodeBench::encode()
   return 0;
 }
 
+static void display_batch(int batch, utime_t elapsed, uint64_t bytes)
+{
+  double secs = (double)elapsed;
+  cout << batch << "\t" << elapsed << "\t" << (bytes / 1024) << "\t"
+       << (secs > 0 ? (uint64_t)(bytes / secs / (1024 * 1024)) : 0) << endl;
+}
+
+int ErasureCodeBench::encode_batched(ErasureCodeInterfaceRef erasure_code,
+				     const bufferlist &in,
+				     const set<int> &want_to_encode)
+{
+  unsigned stripes = in_size / stripe_width;
+  if (verbose)
+    cout << "batch\tseconds\tKB\tMB/s" << endl;
+  for (vector<int>::iterator b = batches.begin(); b != batches.end(); ++b) {
+    unsigned batch = *b;
+    utime_t begin_time = ceph_clock_now(g_ceph_context);
+    for (int i = 0; i < max_iterations; i++) {
+      for (unsigned s = 0; s < stripes; s += batch) {
+	bufferlist stripe;
+	stripe.substr_of(in, s * stripe_width,
+			 MIN(batch, stripes - s) * stripe_width);
+	map<int,bufferlist> encoded;
+	int code = erasure_code->encode_stripes(want_to_encode, stripe,
+						stripe_width, &encoded);
+	if (code)
+	  return code;
+      }
+    }
+    utime_t end_time = ceph_clock_now(g_ceph_context);
+    display_batch(batch, end_time - begin_time,
+		  (uint64_t)max_iterations * stripes * stripe_width);
+  }
+  return 0;
+}
+
 static void display_chunks(const map<int,bufferlist> &chunks,
 			   unsigned int chunk_count) {
   cout << "chunks ";
@@ -280,6 +345,9 @@ int ErasureCodeBench::decode()
     want_to_encode.insert(i);
   }
 
+  if (!batches.empty())
+    return decode_batched(erasure_code, in, want_to_encode);
+
   map<int,bufferlist> encoded;
   code = erasure_code->encode(want_to_encode, in, &encoded);
   if (code)
@@ -326,6 +394,153 @@ int ErasureCodeBench::decode()
   return 0;
 }
 
+int ErasureCodeBench::decode_batched(ErasureCodeInterfaceRef erasure_code,
+				     const bufferlist &in,
+				     const set<int> &want_to_encode)
+{
+  unsigned stripes = in_size / stripe_width;
+  unsigned chunk_size = erasure_code->get_chunk_size(stripe_width);
+  bufferlist stripes_in;
+  stripes_in.substr_of(in, 0, stripes * stripe_width);
+  map<int,bufferlist> encoded;
+  int code = erasure_code->encode_stripes(want_to_encode, stripes_in,
+					  stripe_width, &encoded);
+  if (code)
+    return code;
+
+  if (verbose)
+    cout << "batch\tseconds\tKB\tMB/s" << endl;
+  for (vector<int>::iterator b = batches.begin(); b != batches.end(); ++b) {
+    unsigned batch = *b;
+    utime_t begin_time = ceph_clock_now(g_ceph_context);
+    for (int i = 0; i < max_iterations; i++) {
+      map<int,bufferlist> chunks = encoded;
+      set<int> want_to_read;
+      if (erased.size() > 0) {
+	for (vector<int>::const_iterator j = erased.begin();
+	     j != erased.end();
+	     ++j) {
+	  chunks.erase(*j);
+	  want_to_read.insert(*j);
+	}
+      } else {
+	for (int j = 0; j < erasures; j++) {
+	  int erasure;
+	  do {
+	    erasure = rand() % ( k + m );
+	  } while(chunks.count(erasure) == 0);
+	  chunks.erase(erasure);
+	  want_to_read.insert(erasure);
+	}
+      }
+      for (unsigned s = 0; s < stripes; s += batch) {
+	unsigned length = MIN(batch, stripes - s) * chunk_size;
+	map<int,bufferlist> slice;
+	for (map<int,bufferlist>::iterator j = chunks.begin();
+	     j != chunks.end();
+	     ++j)
+	  slice[j->first].substr_of(j->second, s * chunk_size, length);
+	map<int,bufferlist> decoded;
+	code = erasure_code->decode_stripes(want_to_read, slice, chunk_size,
+					    &decoded);
+	if (code)
+	  return code;
+      }
+    }
+    utime_t end_time = ceph_clock_now(g_ceph_context);
+    display_batch(batch, end_time - begin_time,
+		  (uint64_t)max_iterations * stripes * stripe_width);
+  }
+  return 0;
+}
+
+int ErasureCodeBench::repair()
+{
+  ErasureCodePluginRegistry &instance = ErasureCodePluginRegistry::instance();
+  ErasureCodeInterfaceRef erasure_code;
+  stringstream messages;
+  int code = instance.factory(plugin,
+			      g_conf->erasure_code_dir,
+			      profile, &erasure_code, &messages);
+  if (code) {
+    cerr << messages.str() << endl;
+    return code;
+  }
+  unsigned chunk_size = erasure_code->get_chunk_size(stripe_width);
+  unsigned width = chunk_size * k;
+  unsigned stripes = in_size / width;
+  if (stripes == 0) {
+    cout << "size is " << in_size << ". But it needs to hold at least one "
+	 << "stripe of " << width << " bytes." << endl;
+    return -EINVAL;
+  }
+  bufferlist in;
+  in.append(string(stripes * width, 'X'));
+  in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+
+  set<int> want_to_encode;
+  for (int i = 0; i < k + m; i++) {
+    want_to_encode.insert(i);
+  }
+  map<int,bufferlist> encoded;
+  code = erasure_code->encode_stripes(want_to_encode, in, width, &encoded);
+  if (code)
+    return code;
+
+  unsigned sub_chunk_size = chunk_size / erasure_code->get_sub_chunk_count();
+  uint64_t read = 0;
+  utime_t elapsed;
+  for (int i = 0; i < max_iterations; i++) {
+    int lost = erased.size() > 0 ? erased[i % erased.size()] : rand() % (k + m);
+    set<int> want_to_read;
+    want_to_read.insert(lost);
+    set<int> available;
+    for (int j = 0; j < k + m; j++)
+      if (j != lost)
+	available.insert(j);
+    map<int, vector<pair<int, int> > > minimum;
+    code = erasure_code->minimum_to_repair(want_to_read, available, &minimum);
+    if (code)
+      return code;
+    // what the helper OSDs would send
+    map<int,bufferlist> helpers;
+    for (map<int, vector<pair<int, int> > >::iterator j = minimum.begin();
+	 j != minimum.end();
+	 ++j) {
+      bufferlist &helper = helpers[j->first];
+      for (unsigned s = 0; s < stripes; s++) {
+	for (vector<pair<int, int> >::iterator r = j->second.begin();
+	     r != j->second.end();
+	     ++r) {
+	  bufferlist bl;
+	  bl.substr_of(encoded[j->first],
+		       s * chunk_size + r->first * sub_chunk_size,
+		       r->second * sub_chunk_size);
+	  helper.append(bl);
+	}
+      }
+      read += helper.length();
+    }
+    utime_t begin_time = ceph_clock_now(g_ceph_context);
+    map<int,bufferlist> repaired;
+    code = erasure_code->repair(want_to_read, helpers, chunk_size, &repaired);
+    if (code)
+      return code;
+    elapsed += ceph_clock_now(g_ceph_context) - begin_time;
+    if (!repaired[lost].contents_equal(encoded[lost])) {
+      cerr << "chunk " << lost
+	   << " content and repaired content are different" << endl;
+      return -1;
+    }
+  }
+  if (verbose)
+    cout << "seconds\tKB\tread KB\tdecode read KB" << endl;
+  cout << elapsed << "\t" << (max_iterations * (stripes * chunk_size / 1024))
+       << "\t" << (read / 1024)
+       << "\t" << (max_iterations * (stripes * width / 1024)) << endl;
+  return 0;
+}
+
 int main(int argc, char** argv) {
   ErasureCodeBench ecbench;
   try {
@@ -34,6 +34,8 @@ class ErasureCodeBench {
   bool exhaustive_erasures;
   vector<int> erased;
   string workload;
+  unsigned stripe_width;
+  vector<int> batches;
 
   ErasureCodeProfile profile;
 
@@ -48,6 +50,13 @@ public:
 		      ErasureCodeInterfaceRef erasure_code);
   int decode();
   int encode();
+  int repair();
+  int decode_batched(ErasureCodeInterfaceRef erasure_code,
+		     const bufferlist &in,
+		     const set<int> &want_to_encode);
+  int encode_batched(ErasureCodeInterfaceRef erasure_code,
+		     const bufferlist &in,
+		     const set<int> &want_to_encode);
 };
 
 #endif
@@ -250,6 +250,31 @@ function TEST_rados_put_get_shec() {
     ceph osd erasure-code-profile rm $profile
 }
 
+function TEST_rados_ec_overwrites() {
+    local dir=$1
+    local poolname=pool-overwrites
+
+    ceph osd pool create $poolname 12 12 erasure myprofile || return 1
+    ceph osd pool set $poolname allow_ec_overwrites true || return 1
+    ceph osd pool get $poolname allow_ec_overwrites | \
+        grep 'allow_ec_overwrites: true' || return 1
+    wait_for_clean || return 1
+    #
+    # partial stripe writes, appends and deletes of the same objects
+    # with the data verified by reads along the way
+    #
+    ceph_test_rados --ec-overwrites --pool $poolname \
+        --max-ops 400 --objects 50 --max-in-flight 16 \
+        --size 4000000 --min-stride-size 400000 --max-stride-size 800000 \
+        --op read 100 --op write 50 --op write_excl 50 \
+        --op append 50 --op delete 10 --op snap_create 10 \
+        --op snap_remove 10 --op rollback 10 || return 1
+    # overwrites cannot be turned off again
+    ! ceph osd pool set $poolname allow_ec_overwrites false || return 1
+
+    delete_pool $poolname
+}
+
 function TEST_alignment_constraints() {
     local payload=ABC
     echo "$payload" > $dir/ORIGINAL
@@ -116,6 +116,78 @@ TEST(pgmap, calc_stats)
   }
 }
 
+TEST(pgmap, stuck)
+{
+  PGMap pg_map;
+  PGMap::Incremental inc;
+  pg_stat_t ps;
+
+  inc.version = 1;
+  ps.state = 0;
+  ps.last_active = utime_t(100, 0);
+  inc.pg_stat_updates[pg_t(0,1)] = ps;
+  ps = pg_stat_t();
+  ps.state = PG_STATE_ACTIVE;
+  ps.last_clean = utime_t(200, 0);
+  inc.pg_stat_updates[pg_t(1,1)] = ps;
+  ps = pg_stat_t();
+  ps.state = PG_STATE_ACTIVE | PG_STATE_CLEAN | PG_STATE_DEGRADED;
+  ps.last_undegraded = utime_t(300, 0);
+  inc.pg_stat_updates[pg_t(2,1)] = ps;
+  ps = pg_stat_t();
+  ps.state = PG_STATE_ACTIVE | PG_STATE_CLEAN;
+  inc.pg_stat_updates[pg_t(3,1)] = ps;
+  ps = pg_stat_t();
+  ps.state = PG_STATE_STALE;
+  ps.last_active = utime_t(500, 0);
+  ps.last_unstale = utime_t(100, 0);
+  inc.pg_stat_updates[pg_t(4,1)] = ps;
+  pg_map.apply_incremental(g_ceph_context, inc);
+
+  // a pg is only counted under the first state it is in
+  map<string, int> note;
+  ASSERT_TRUE(pg_map.get_stuck_counts(utime_t(250, 0), note));
+  ASSERT_EQ(2u, note.size());
+  ASSERT_EQ(1, note["stuck inactive"]);
+  ASSERT_EQ(1, note["stuck unclean"]);
+
+  ceph::unordered_map<pg_t, pg_stat_t> stuck;
+  pg_map.get_stuck_stats(PGMap::STUCK_INACTIVE, utime_t(250, 0), stuck);
+  ASSERT_EQ(1u, stuck.size());
+  ASSERT_EQ(1u, stuck.count(pg_t(0,1)));
+  stuck.clear();
+  pg_map.get_stuck_stats(PGMap::STUCK_UNCLEAN, utime_t(250, 0), stuck);
+  ASSERT_EQ(3u, stuck.size());
+  stuck.clear();
+  pg_map.get_stuck_stats(PGMap::STUCK_DEGRADED | PGMap::STUCK_STALE,
+			 utime_t(350, 0), stuck);
+  ASSERT_EQ(2u, stuck.size());
+  ASSERT_EQ(1u, stuck.count(pg_t(2,1)));
+  ASSERT_EQ(1u, stuck.count(pg_t(4,1)));
+
+  // pgs leave the stuck states as they are updated and removed
+  inc = PGMap::Incremental();
+  inc.version = 2;
+  ps = pg_stat_t();
+  ps.state = PG_STATE_ACTIVE | PG_STATE_CLEAN;
+  inc.pg_stat_updates[pg_t(0,1)] = ps;
+  inc.pg_remove.insert(pg_t(2,1));
+  pg_map.apply_incremental(g_ceph_context, inc);
+
+  stuck.clear();
+  pg_map.get_stuck_stats(PGMap::STUCK_INACTIVE | PGMap::STUCK_DEGRADED,
+			 utime_t(1000, 0), stuck);
+  ASSERT_EQ(1u, stuck.size());
+  ASSERT_EQ(1u, stuck.count(pg_t(4,1)));
+  note.clear();
+  ASSERT_TRUE(pg_map.get_stuck_counts(utime_t(1000, 0), note));
+  ASSERT_EQ(2u, note.size());
+  ASSERT_EQ(1, note["stuck inactive"]);
+  ASSERT_EQ(1, note["stuck unclean"]);
+  note.clear();
+  ASSERT_FALSE(pg_map.get_stuck_counts(utime_t(50, 0), note));
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
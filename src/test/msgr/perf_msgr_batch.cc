@@ -0,0 +1,197 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * A client and a server messenger in one process, talking over loopback:
+ * the client keeps [concurrency] MOSDOp writes of [msg length] bytes in
+ * flight and the server answers each one with an MOSDOpReply.  Reports
+ * the messages per second and the CPU time per message, e.g.
+ *
+ *   ceph_perf_msgr_batch 64 200000 4096 --ms_type async
+ *   ceph_perf_msgr_batch 64 200000 4096 --ms_type async --ms_async_send_batch 1
+ *
+ * to compare sending the queued messages together with one at a time.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <iostream>
+
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/Cond.h"
+#include "common/Cycles.h"
+#include "common/Mutex.h"
+#include "global/global_init.h"
+#include "msg/Messenger.h"
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+
+class BatchDispatcher : public Dispatcher {
+  bool server;
+
+ public:
+  Mutex lock;
+  Cond cond;
+  uint64_t inflight;
+  uint64_t replies;
+
+  explicit BatchDispatcher(bool s)
+    : Dispatcher(g_ceph_context), server(s),
+      lock("BatchDispatcher::lock"), inflight(0), replies(0) {}
+
+  bool ms_can_fast_dispatch_any() const { return true; }
+  bool ms_can_fast_dispatch(Message *m) const {
+    switch (m->get_type()) {
+    case CEPH_MSG_OSD_OP:
+    case CEPH_MSG_OSD_OPREPLY:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  void ms_handle_fast_connect(Connection *con) {}
+  void ms_handle_fast_accept(Connection *con) {}
+  bool ms_dispatch(Message *m) { return true; }
+  bool ms_handle_reset(Connection *con) { return true; }
+  void ms_handle_remote_reset(Connection *con) {}
+  void ms_fast_dispatch(Message *m) {
+    if (server) {
+      MOSDOp *osd_op = static_cast<MOSDOp*>(m);
+      MOSDOpReply *reply = new MOSDOpReply(osd_op, 0, 0, 0, false);
+      m->get_connection()->send_message(reply);
+      m->put();
+      return;
+    }
+    m->put();
+    Mutex::Locker l(lock);
+    --inflight;
+    ++replies;
+    cond.Signal();
+  }
+  bool ms_verify_authorizer(Connection *con, int peer_type, int protocol,
+                            bufferlist& authorizer, bufferlist& authorizer_reply,
+                            bool& isvalid, CryptoKey& session_key) {
+    isvalid = true;
+    return true;
+  }
+};
+
+static double get_cpu_seconds()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+void usage(const string &name) {
+  cerr << "Usage: " << name << " [concurrency] [ios] [msg length]" << std::endl;
+  cerr << "       [concurrency]: the max inflight messages(like iodepth in fio)" << std::endl;
+  cerr << "       [ios]: how much messages sent" << std::endl;
+  cerr << "       [msg length]: message data bytes" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (args.size() < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint64_t concurrent = atoi(args[0]);
+  int ios = atoi(args[1]);
+  int len = atoi(args[2]);
+  if (!concurrent || ios <= 0 || len < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const string &type = g_ceph_context->_conf->ms_type;
+  cerr << " using ms-type " << type << std::endl;
+  cerr << "       ms_async_send_batch "
+       << g_ceph_context->_conf->ms_async_send_batch << std::endl;
+  cerr << "       concurrency " << concurrent << std::endl;
+  cerr << "       ios " << ios << std::endl;
+  cerr << "       message data bytes " << len << std::endl;
+
+  BatchDispatcher server_dispatcher(true), client_dispatcher(false);
+  Messenger *server_msgr = Messenger::create(g_ceph_context, type,
+					     entity_name_t::OSD(0), "server",
+					     getpid());
+  server_msgr->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&server_dispatcher);
+  server_msgr->start();
+
+  Messenger *client_msgr = Messenger::create(g_ceph_context, type,
+					     entity_name_t::CLIENT(0), "client",
+					     getpid() + 1);
+  client_msgr->set_default_policy(Messenger::Policy::lossless_client(0, 0));
+  client_msgr->add_dispatcher_head(&client_dispatcher);
+  client_msgr->start();
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+
+  bufferptr ptr(len);
+  memset(ptr.c_str(), 0, len);
+  bufferlist data;
+  data.append(ptr);
+  object_t oid("object-name");
+  object_locator_t oloc(1, 1);
+  pg_t pgid;
+
+  Cycles::init();
+  double cpu_start = get_cpu_seconds();
+  uint64_t start = Cycles::rdtsc();
+  client_dispatcher.lock.Lock();
+  for (int i = 0; i < ios; ++i) {
+    while (client_dispatcher.inflight >= concurrent)
+      client_dispatcher.cond.Wait(client_dispatcher.lock);
+    MOSDOp *m = new MOSDOp(0, 0, oid, oloc, pgid, 0, 0, 0);
+    m->write(0, len, data);
+    ++client_dispatcher.inflight;
+    conn->send_message(m);
+  }
+  while (client_dispatcher.replies < (uint64_t)ios)
+    client_dispatcher.cond.Wait(client_dispatcher.lock);
+  client_dispatcher.lock.Unlock();
+  uint64_t stop = Cycles::rdtsc();
+  double cpu = get_cpu_seconds() - cpu_start;
+
+  double us = Cycles::to_microseconds(stop - start);
+  cerr << " Total op " << ios << " run time " << us << "us, "
+       << ios * 1000000.0 / us << " messages/sec, "
+       << cpu * 1000000.0 / ios << " cpu us/message" << std::endl;
+
+  client_msgr->shutdown();
+  client_msgr->wait();
+  server_msgr->shutdown();
+  server_msgr->wait();
+  delete client_msgr;
+  delete server_msgr;
+  return 0;
+}
@@ -13,6 +13,8 @@
 #include <assert.h>
 #include <math.h>
 #include <sstream>
+#include <random>
+#include "common/Clock.h"
 #include <gtest/gtest.h>
 
 #define bmap_test_assert(x) ASSERT_EQ(true, (x))
@@ -346,6 +348,38 @@ TEST(BitAllocator, test_zone_alloc)
   bmap_test_assert(allocated == zone->size() / 2);
 }
 
+TEST(BitAllocator, test_zone_max_free_run)
+{
+  int total_blocks = 1024;
+  int64_t start_blk = 0;
+
+  BitMapZone *zone = new BitMapZone(total_blocks, 0);
+  bool lock = zone->lock_excl_try();
+  bmap_test_assert(lock);
+  bmap_test_assert(zone->get_max_free_run() == total_blocks);
+
+  for (int i = 0; i < total_blocks; i++) {
+    zone->alloc_blocks(1, &start_blk);
+  }
+  bmap_test_assert(zone->get_max_free_run() == 0);
+
+  // runs inside a word, at word edges and across words
+  zone->free_blocks(3, 5);
+  bmap_test_assert(zone->get_max_free_run() == 5);
+  zone->free_blocks(BmapEntry::size() - 7, 7);
+  bmap_test_assert(zone->get_max_free_run() == 7);
+  zone->free_blocks(BmapEntry::size(), 9);
+  bmap_test_assert(zone->get_max_free_run() == 16);
+  zone->free_blocks(BmapEntry::size() * 4, BmapEntry::size() * 2 + 1);
+  bmap_test_assert(zone->get_max_free_run() == BmapEntry::size() * 2 + 1);
+
+  zone->alloc_blocks(BmapEntry::size() * 2, &start_blk);
+  bmap_test_assert(start_blk == BmapEntry::size() * 4);
+  bmap_test_assert(zone->get_max_free_run() == 16);
+  zone->unlock();
+  delete zone;
+}
+
 TEST(BitAllocator, test_bmap_alloc)
 {
   const int max_iter = 2;
@@ -667,6 +701,56 @@ TEST(BitAllocator, test_bmap_alloc_concurrent)
 
 }
 
+/*
+ * Fill the allocator with single blocks, punching random holes
+ * between rounds, and time contiguous allocations at each fill
+ * level. The summaries must keep every request that fits in some
+ * zone satisfiable, however fragmented the rest is.
+ */
+TEST(BitAllocator, test_bmap_alloc_frag_bench)
+{
+  int64_t total_blocks = MAX_BLOCKS;
+  int64_t zone_size = 1024;
+  int64_t cont = 64;
+  int num_allocs = 2000;
+  std::mt19937 rng(0);
+
+  BitAllocator *alloc = new BitAllocator(total_blocks, zone_size, CONCURRENT);
+  std::vector<int64_t> singles;
+
+  for (int fill = 10; fill <= 90; fill += 20) {
+    while (alloc->get_used_blocks() < total_blocks * fill / 100) {
+      int64_t start_block = 0;
+      bmap_test_assert(alloc->reserve_blocks(1));
+      bmap_test_assert(alloc->alloc_blocks_res(1, &start_block) == 1);
+      singles.push_back(start_block);
+    }
+
+    std::vector<int64_t> allocated;
+    utime_t start = ceph_clock_now(NULL);
+    for (int i = 0; i < num_allocs; i++) {
+      int64_t start_block = 0;
+      bmap_test_assert(alloc->reserve_blocks(cont));
+      bmap_test_assert(alloc->alloc_blocks_res(cont, &start_block) == cont);
+      allocated.push_back(start_block);
+    }
+    utime_t lat = ceph_clock_now(NULL) - start;
+    printf("fill %d%%: %d x %ld block allocations, %.2f us each\n",
+           fill, num_allocs, cont, lat.to_nsec() / 1000.0 / num_allocs);
+
+    for (auto b : allocated) {
+      alloc->free_blocks(b, cont);
+    }
+    for (size_t i = 0; i < singles.size() / 8; i++) {
+      size_t k = rng() % singles.size();
+      alloc->free_blocks(singles[k], 1);
+      singles[k] = singles.back();
+      singles.pop_back();
+    }
+  }
+  delete alloc;
+}
+
 int main(int argc, char **argv)
 {
   vector<const char*> args;
@@ -0,0 +1,227 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * fio-style write benchmark for the bluestore BlockDevice backends.
+ *
+ * For each backend (kernel/libaio and, when built, uring) and each
+ * pattern (random, sequential) keep qd writes in flight for qd in
+ * 1, 2, 4, .. max-qd and report iops and mean/max completion latency.
+ *
+ *   ceph_perf_bdev <path> [--size 1G] [--bs 4096] [--ios 20000] [--max-qd 128]
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/Cycles.h"
+#include "common/errno.h"
+#include "common/strtol.h"
+#include "global/global_init.h"
+#include "os/bluestore/BlockDevice.h"
+
+struct Slot {
+  IOContext ioc;
+  uint64_t start = 0;
+  Slot() : ioc(this) {}
+};
+
+struct Run {
+  std::mutex lock;
+  std::condition_variable cond;
+  vector<Slot*> done;
+  uint64_t lat_sum = 0, lat_max = 0;
+
+  void finish(Slot *s) {
+    uint64_t lat = Cycles::rdtsc() - s->start;
+    std::lock_guard<std::mutex> l(lock);
+    lat_sum += lat;
+    if (lat > lat_max)
+      lat_max = lat;
+    done.push_back(s);
+    cond.notify_one();
+  }
+};
+
+static void aio_cb(void *priv, void *priv2)
+{
+  Run *r = static_cast<Run*>(priv);
+  r->finish(static_cast<Slot*>(priv2));
+}
+
+static void usage(const char *name)
+{
+  cout << "usage: " << name << " <path> [--size bytes] [--bs bytes]"
+       << " [--ios count] [--max-qd depth]" << std::endl;
+}
+
+static int run_one(const string& backend, const string& path,
+		   bool random, unsigned qd, uint64_t size, uint64_t bs,
+		   uint64_t ios)
+{
+  g_ceph_context->_conf->set_val("bdev_uring",
+				 backend == "uring" ? "true" : "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  Run run;
+  BlockDevice *bdev = BlockDevice::create(path, aio_cb, &run);
+  int r = bdev->open(path);
+  if (r < 0) {
+    cerr << "failed to open " << path << ": " << cpp_strerror(r) << std::endl;
+    delete bdev;
+    return r;
+  }
+  size = std::min(size, bdev->get_size());
+  uint64_t blocks = size / bs;
+
+  bufferlist data;
+  {
+    bufferptr bp = buffer::create_page_aligned(bs);
+    memset(bp.c_str(), 0xa5, bs);
+    data.append(bp);
+  }
+
+  std::mt19937_64 rng(qd);
+  uint64_t next = 0;
+  auto next_off = [&]() {
+    uint64_t b = random ? rng() % blocks : next++ % blocks;
+    return b * bs;
+  };
+
+  vector<Slot> slots(qd);
+  uint64_t submitted = 0, completed = 0;
+  uint64_t start = Cycles::rdtsc();
+  auto submit = [&](Slot *s) {
+    bufferlist bl = data;
+    s->ioc.running_aios.clear();  // previous io on this slot has completed
+    s->start = Cycles::rdtsc();
+    bdev->aio_write(next_off(), bl, &s->ioc, false);
+    bdev->aio_submit(&s->ioc);
+    ++submitted;
+  };
+  for (auto& s : slots) {
+    if (submitted < ios)
+      submit(&s);
+  }
+  vector<Slot*> done;
+  while (completed < ios) {
+    {
+      std::unique_lock<std::mutex> l(run.lock);
+      while (run.done.empty())
+	run.cond.wait(l);
+      done.swap(run.done);
+    }
+    for (auto s : done) {
+      ++completed;
+      if (submitted < ios)
+	submit(s);
+    }
+    done.clear();
+  }
+  uint64_t elapsed = Cycles::rdtsc() - start;
+  bdev->flush();
+  bdev->close();
+  delete bdev;
+
+  double secs = Cycles::to_seconds(elapsed);
+  cout << backend << "\t" << (random ? "randwrite" : "write") << "\t"
+       << qd << "\t" << (uint64_t)(ios / secs) << "\t"
+       << Cycles::to_microseconds(run.lat_sum / ios) << "\t"
+       << Cycles::to_microseconds(run.lat_max) << std::endl;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+  Cycles::init();
+
+  uint64_t size = 1ull << 30;
+  uint64_t bs = 4096;
+  uint64_t ios = 20000;
+  unsigned max_qd = 128;
+  string val, err;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = strict_sistrtoll(val.c_str(), &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--bs", (char*)NULL)) {
+      bs = strict_sistrtoll(val.c_str(), &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--ios", (char*)NULL)) {
+      ios = strict_strtoll(val.c_str(), 10, &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--max-qd", (char*)NULL)) {
+      max_qd = strict_strtol(val.c_str(), 10, &err);
+    } else {
+      ++i;
+    }
+    if (!err.empty()) {
+      cerr << err << std::endl;
+      return 1;
+    }
+  }
+  if (args.size() != 1 || bs == 0 || bs % CEPH_PAGE_SIZE || size < bs) {
+    usage(argv[0]);
+    return 1;
+  }
+  string path = args[0];
+
+  // a regular file is grown to size; a block device is used as is
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    cerr << "failed to open " << path << ": " << cpp_strerror(errno)
+	 << std::endl;
+    return 1;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      (uint64_t)st.st_size < size) {
+    if (::ftruncate(fd, size) < 0) {
+      cerr << "failed to size " << path << ": " << cpp_strerror(errno)
+	   << std::endl;
+      ::close(fd);
+      return 1;
+    }
+  }
+  ::close(fd);
+
+  vector<string> backends = { "kernel" };
+#if defined(HAVE_IO_URING)
+  backends.push_back("uring");
+#endif
+
+  cout << "backend\tpattern\tqd\tiops\tlat_us\tmax_lat_us" << std::endl;
+  for (auto& b : backends) {
+    for (bool random : { true, false }) {
+      for (unsigned qd = 1; qd <= max_qd; qd *= 2) {
+	if (run_one(b, path, random, qd, size, bs, ios) < 0)
+	  return 1;
+      }
+    }
+  }
+  return 0;
+}
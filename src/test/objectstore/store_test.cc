@@ -26,6 +26,7 @@
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/errno.h"
+#include "common/ceph_json.h"
 #include "include/stringify.h"
 #include <boost/scoped_ptr.hpp>
 #include <boost/random/mersenne_twister.hpp>
@@ -3905,6 +3906,22 @@ TEST_P(StoreTest, SyntheticMatrixCompressionAlgorithm) {
   do_matrix(m, store);
 }
 
+TEST_P(StoreTest, SyntheticMatrixDecompressedCache) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  const char *m[][10] = {
+    { "max_write", "1048576", 0 },
+    { "max_size", "4194304", 0 },
+    { "alignment", "65536", 0 },
+    { "bluestore_compression", "force", 0 },
+    { "bluestore_decompressed_cache_size", "0", "262144", "67108864", 0 },
+    { "bluestore_default_buffered_read", "true", "false", 0 },
+    { 0 },
+  };
+  do_matrix(m, store);
+}
+
 TEST_P(StoreTest, SyntheticMatrixNoCsum) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -3922,6 +3939,183 @@ TEST_P(StoreTest, SyntheticMatrixNoCsum) {
   do_matrix(m, store);
 }
 
+TEST_P(StoreTest, SyntheticMatrixCacheAutotune) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  const char *m[][10] = {
+    { "max_write", "65536", 0 },
+    { "max_size", "1048576", 0 },
+    { "alignment", "512", 0 },
+    { "bluestore_cache_autotune", "true", 0 },
+    { "bluestore_cache_autotune_interval", ".1", 0 },
+    { "bluestore_cache_size", "4000000", 0 },
+    { 0 },
+  };
+  do_matrix(m, store);
+}
+
+TEST_P(StoreTest, SyntheticMatrixWalElevator) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  const char *m[][10] = {
+    { "max_write", "65536", 0 },
+    { "max_size", "1048576", 0 },
+    { "alignment", "512", 0 },
+    { "bluestore_min_alloc_size", "65536", 0 },
+    { "bluestore_wal_elevator", "true", 0 },
+    { "bluestore_wal_elevator_max_io", "131072", "4194304", 0 },
+    { 0 },
+  };
+  do_matrix(m, store);
+}
+
+TEST_P(StoreTest, BluestoreKVSyncLanes) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_kv_sync_lanes", "4");
+  g_ceph_context->_conf->apply_changes(NULL);
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+
+  const unsigned num_colls = 8, num_objs = 32;
+  vector<ObjectStore::Sequencer*> osrs;
+  vector<coll_t> cids;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    osrs.push_back(new ObjectStore::Sequencer("test"));
+    cids.push_back(coll_t(spg_t(pg_t(i, 0), shard_id_t::NO_SHARD)));
+    ObjectStore::Transaction t;
+    t.create_collection(cids[i], 0);
+    int r = apply_transaction(store, osrs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // interleave writes across sequencers; each one overwrites the same
+  // object so the final contents show per-sequencer ordering held
+  for (unsigned j = 0; j < num_objs; ++j) {
+    for (unsigned i = 0; i < num_colls; ++i) {
+      ObjectStore::Transaction t;
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(j % 4),
+					  CEPH_NOSNAP)));
+      bufferlist bl;
+      bl.append(stringify(i) + "." + stringify(j));
+      t.write(cids[i], hoid, 0, bl.length(), bl);
+      t.truncate(cids[i], hoid, bl.length());
+      int r = store->queue_transaction(osrs[i], std::move(t), nullptr);
+      ASSERT_EQ(r, 0);
+    }
+  }
+  for (auto osr : osrs) {
+    osr->flush();
+  }
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    for (unsigned j = num_objs - 4; j < num_objs; ++j) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(j % 4),
+					  CEPH_NOSNAP)));
+      bufferlist bl;
+      int r = store->read(cids[i], hoid, 0, 100, bl);
+      ASSERT_EQ((int)bl.length(), r);
+      ASSERT_EQ(stringify(i) + "." + stringify(j), bl.to_str());
+    }
+    ObjectStore::Transaction t;
+    for (unsigned j = 0; j < 4; ++j) {
+      t.remove(cids[i], ghobject_t(hobject_t(sobject_t("Object " + stringify(j),
+						       CEPH_NOSNAP))));
+    }
+    t.remove_collection(cids[i]);
+    int r = apply_transaction(store, osrs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+    delete osrs[i];
+  }
+
+  g_conf->set_val("bluestore_kv_sync_lanes", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+static uint64_t get_perf_counter(const string& logger, const string& counter)
+{
+  JSONFormatter f;
+  g_ceph_context->get_perfcounters_collection()->dump_formatted(
+    &f, false, logger, counter);
+  stringstream ss;
+  f.flush(ss);
+  JSONParser parser;
+  if (!parser.parse(ss.str().c_str(), ss.str().length()))
+    return 0;
+  JSONObj *l = parser.find_obj(logger);
+  JSONObj *c = l ? l->find_obj(counter) : NULL;
+  return c ? strtoull(c->get_data().c_str(), NULL, 10) : 0;
+}
+
+TEST_P(StoreTest, BluestoreDefrag) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // interleave writes to two objects so that neither is contiguous
+  const unsigned chunk = 65536, chunks = 16;
+  ghobject_t a(hobject_t(sobject_t("Object a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("Object b", CEPH_NOSNAP)));
+  bufferlist expected[2];
+  for (unsigned i = 0; i < chunks; ++i) {
+    for (unsigned j = 0; j < 2; ++j) {
+      bufferlist bl;
+      bl.append(string(chunk, 'a' + (i + j) % 26));
+      expected[j].append(bl);
+      ObjectStore::Transaction t;
+      t.write(cid, j ? b : a, i * chunk, bl.length(), bl);
+      int r = apply_transaction(store, &osr, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+
+  g_conf->set_val("bluestore_defrag", "true");
+  g_conf->set_val("bluestore_defrag_interval", "1");
+  g_conf->set_val("bluestore_defrag_threshold", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  // both objects get rewritten by the first scan
+  uint64_t rewritten = 0;
+  for (unsigned i = 0; i < 30 && rewritten < 2; ++i) {
+    sleep(1);
+    rewritten = get_perf_counter("BlueStore", "defrag_objects");
+  }
+  ASSERT_GE(rewritten, 2u);
+  ASSERT_GT(get_perf_counter("BlueStore", "defrag_bytes"), 0u);
+  g_conf->set_val("bluestore_defrag", "false");
+  g_conf->set_val("bluestore_defrag_interval", "300");
+  g_conf->set_val("bluestore_defrag_threshold", ".3");
+  g_ceph_context->_conf->apply_changes(NULL);
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+
+  for (unsigned j = 0; j < 2; ++j) {
+    bufferlist bl;
+    int r = store->read(cid, j ? b : a, 0, chunk * chunks, bl);
+    ASSERT_EQ((int)(chunk * chunks), r);
+    ASSERT_TRUE(bl_eq(expected[j], bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    int r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, AttrSynthetic) {
   ObjectStore::Sequencer osr("test");
   MixedGenerator gen(447);
@@ -7,6 +7,7 @@
 #include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <atomic>
 #include <thread>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
@@ -357,6 +358,83 @@ TEST(BlueFS, test_flush_3) {
   rm_temp_bdev(fn);
 }
 
+TEST(BlueFS, test_compact_log_async) {
+  uint64_t size = 1048476 * 128;
+  string fn_db = get_temp_bdev(size);
+  string fn_wal = get_temp_bdev(size);
+  g_ceph_context->_conf->set_val("bluefs_alloc_size", "65536");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_size", "262144");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_ratio", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  BlueFS fs;
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_WAL, fn_wal));
+  fs.add_block_extent(BlueFS::BDEV_WAL, 1048576, size - 1048576);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn_db));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+
+  // each writer keeps creating, syncing and removing files so the log
+  // grows and is compacted while other threads keep logging
+  const int num_writers = 4, num_files = 200;
+  std::atomic<bool> done(false);
+  auto writer = [&](int w) {
+    string dir = "dir." + stringify(w);
+    ASSERT_EQ(0, fs.mkdir(dir));
+    for (int i = 0; i < num_files; ++i) {
+      string file = "file." + stringify(i);
+      BlueFS::FileWriter *h;
+      ASSERT_EQ(0, fs.open_for_write(dir, file, &h, false));
+      bufferlist bl;
+      bl.append(dir + "/" + file);
+      h->append(bl);
+      ASSERT_EQ(0, fs.fsync(h));
+      fs.close_writer(h);
+      if (i % 2)
+	ASSERT_EQ(0, fs.unlink(dir, "file." + stringify(i - 1)));
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int w = 0; w < num_writers; ++w)
+    threads.push_back(std::thread(writer, w));
+  std::thread syncer([&]() {
+      while (!done) {
+	fs.sync_metadata();
+	usleep(1000);
+      }
+    });
+  join_all(threads);
+  done = true;
+  syncer.join();
+  fs.umount();
+
+  ASSERT_EQ(0, fs.mount());
+  for (int w = 0; w < num_writers; ++w) {
+    string dir = "dir." + stringify(w);
+    vector<string> ls;
+    ASSERT_EQ(0, fs.readdir(dir, &ls));
+    for (int i = 1; i < num_files; i += 2) {
+      string file = "file." + stringify(i);
+      BlueFS::FileReader *h;
+      ASSERT_EQ(0, fs.open_for_read(dir, file, &h));
+      bufferlist bl;
+      BlueFS::FileReaderBuffer buf(4096);
+      string expected = dir + "/" + file;
+      ASSERT_EQ((int)expected.size(), fs.read(h, &buf, 0, 1024, &bl, NULL));
+      ASSERT_EQ(expected, bl.to_str());
+      delete h;
+    }
+  }
+  fs.umount();
+
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_size", "16777216");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_ratio", "5");
+  g_ceph_context->_conf->apply_changes(NULL);
+  rm_temp_bdev(fn_db);
+  rm_temp_bdev(fn_wal);
+}
 
 int main(int argc, char **argv) {
   vector<const char*> args;
@@ -3,9 +3,13 @@
 
 #include "include/types.h"
 #include "os/bluestore/bluestore_types.h"
+#include "os/bluestore/BlueStore.h"
+#include "common/Checksummer.h"
+#include "common/perf_counters.h"
 #include "gtest/gtest.h"
 #include "include/stringify.h"
 #include "common/ceph_time.h"
+#include "test/unit.h"
 
 #include <sstream>
 
@@ -592,6 +596,101 @@ TEST(bluestore_blob_t, csum_bench)
   }
 }
 
+template<class Alg>
+void check_csum_batch(size_t csum_block_size, const bufferlist& bl)
+{
+  size_t blocks = bl.length() / csum_block_size;
+  size_t vsize = sizeof(typename Alg::value_t);
+  bufferptr serial(blocks * vsize), batch(blocks * vsize);
+  serial.zero();
+  batch.zero();
+  Checksummer::calculate<Alg>(csum_block_size, 0, bl.length(), bl, &serial);
+  Checksummer::calculate_batch<Alg>(csum_block_size, 0, bl.length(), bl,
+				    &batch);
+  ASSERT_EQ(0, memcmp(serial.c_str(), batch.c_str(), blocks * vsize));
+  ASSERT_EQ(-1, Checksummer::verify_batch<Alg>(csum_block_size, 0,
+					       bl.length(), bl, serial));
+
+  // corrupt the value for one block
+  size_t bad = blocks * 2 / 3;
+  serial.c_str()[bad * vsize] ^= 1;
+  ASSERT_EQ((int)(bad * csum_block_size),
+	    Checksummer::verify_batch<Alg>(csum_block_size, 0,
+					   bl.length(), bl, serial));
+}
+
+TEST(Checksummer, batch)
+{
+  const size_t csum_block_size = 4096;
+  // one large buffer, plus a fragmented list whose pieces do not line
+  // up with csum blocks
+  bufferptr bp(csum_block_size * 40);
+  for (unsigned i = 0; i < bp.length(); ++i)
+    bp.c_str()[i] = rand();
+  bufferlist whole;
+  whole.append(bp);
+  bufferlist frag;
+  unsigned off = 0;
+  unsigned step = 1;
+  while (off < bp.length()) {
+    unsigned l = MIN(step * 1000, bp.length() - off);
+    frag.append(bufferptr(bp, off, l));
+    off += l;
+    ++step;
+  }
+  ASSERT_TRUE(whole.contents_equal(frag));
+
+  for (const bufferlist* bl : {&whole, &frag}) {
+    check_csum_batch<Checksummer::crc32c>(csum_block_size, *bl);
+    check_csum_batch<Checksummer::crc32c_16>(csum_block_size, *bl);
+    check_csum_batch<Checksummer::crc32c_8>(csum_block_size, *bl);
+    check_csum_batch<Checksummer::xxhash32>(csum_block_size, *bl);
+    check_csum_batch<Checksummer::xxhash64>(csum_block_size, *bl);
+  }
+}
+
+template<class Alg>
+void bench_csum_batch(const char *name, size_t csum_block_size,
+		      const bufferlist& bl, int count)
+{
+  bufferptr csum(bl.length() / csum_block_size *
+		 sizeof(typename Alg::value_t));
+  ceph::mono_clock::time_point start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    Checksummer::calculate<Alg>(csum_block_size, 0, bl.length(), bl, &csum);
+  }
+  ceph::mono_clock::time_point mid = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    Checksummer::calculate_batch<Alg>(csum_block_size, 0, bl.length(), bl,
+				      &csum);
+  }
+  ceph::mono_clock::time_point end = ceph::mono_clock::now();
+  auto serial = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    mid - start);
+  auto batch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    end - mid);
+  double bytes = (double)count * (double)bl.length() / 1000000.0;
+  cout << name << " block " << csum_block_size
+       << ", per-chunk " << bytes / (double)serial.count() * 1000000000.0
+       << " MB/sec, batch " << bytes / (double)batch.count() * 1000000000.0
+       << " MB/sec" << std::endl;
+}
+
+TEST(Checksummer, batch_bench)
+{
+  bufferlist bl;
+  bufferptr bp(10485760);
+  for (char *a = bp.c_str(); a < bp.c_str() + bp.length(); ++a)
+    *a = (unsigned long)a & 0xff;
+  bl.append(bp);
+  int count = 64;
+  for (size_t block : {512, 4096, 65536}) {
+    bench_csum_batch<Checksummer::crc32c>("crc32c", block, bl, count);
+    bench_csum_batch<Checksummer::xxhash32>("xxhash32", block, bl, count);
+    bench_csum_batch<Checksummer::xxhash64>("xxhash64", block, bl, count);
+  }
+}
+
 TEST(bluestore_onode_t, get_preferred_csum_order)
 {
   bluestore_onode_t on;
@@ -1048,3 +1147,139 @@ TEST(bluestore_onode_t, insert_remove_lextent)
   r.clear();
   rp.clear();
 }
+
+class TwoQCacheTest : public ::testing::Test {
+protected:
+  PerfCounters *logger;
+  BlueStore::Cache *cache;
+
+  TwoQCacheTest() {
+    g_ceph_context->_conf->set_val("bluestore_2q_onode_kin_ratio", ".5");
+    g_ceph_context->_conf->set_val("bluestore_2q_onode_kout_ratio", ".5");
+    g_ceph_context->_conf->apply_changes(NULL);
+    PerfCountersBuilder b(g_ceph_context, "test_2q", l_bluestore_first,
+			  l_bluestore_last);
+    for (int i = l_bluestore_first + 1; i < l_bluestore_last; ++i)
+      b.add_u64_counter(i, "counter");
+    logger = b.create_perf_counters();
+    cache = BlueStore::Cache::create("2q", logger);
+  }
+  ~TwoQCacheTest() {
+    delete cache;
+    delete logger;
+  }
+
+  static ghobject_t oid(int i) {
+    return ghobject_t(hobject_t(sobject_t("obj" + stringify(i),
+					  CEPH_NOSNAP)));
+  }
+  void add(BlueStore::OnodeSpace& space, int i, int level = 1) {
+    BlueStore::OnodeRef o(new BlueStore::Onode(&space, oid(i), ""));
+    space.add(oid(i), o, level);
+  }
+  static bool cached(BlueStore::OnodeSpace& space, int i) {
+    return space.onode_map.count(oid(i));
+  }
+
+  /// leaves 0 and 1 hot, and 4 and 5 warm
+  void make_hot(BlueStore::OnodeSpace& space) {
+    for (int i = 0; i < 6; ++i)
+      add(space, i);
+    cache->trim(4, 0);
+    ASSERT_FALSE(cached(space, 0));
+    ASSERT_FALSE(cached(space, 1));
+    add(space, 0);
+    add(space, 1);
+    ASSERT_EQ(2u, logger->get(l_bluestore_onode_ghost_hits));
+    cache->trim(4, 0);
+    ASSERT_EQ(4u, space.onode_map.size());
+    ASSERT_FALSE(cached(space, 2));
+    ASSERT_FALSE(cached(space, 3));
+  }
+};
+
+TEST_F(TwoQCacheTest, GhostHitPromotes)
+{
+  BlueStore::OnodeSpace a(cache), b(cache);
+  for (int i = 0; i < 6; ++i)
+    add(a, i);
+  cache->trim(4, 0);
+  ASSERT_EQ(2u, logger->get(l_bluestore_onode_warm_trims));
+  ASSERT_FALSE(cached(a, 0));
+  ASSERT_FALSE(cached(a, 1));
+  ASSERT_TRUE(cached(a, 2));
+
+  // the ghost belongs to a, not to another collection with the same oid
+  add(b, 0);
+  ASSERT_EQ(0u, logger->get(l_bluestore_onode_ghost_hits));
+  add(a, 0);
+  ASSERT_EQ(1u, logger->get(l_bluestore_onode_ghost_hits));
+
+  // a hot onode outlives the warm ones
+  for (int i = 6; i < 10; ++i)
+    add(a, i);
+  cache->trim(4, 0);
+  cache->trim(4, 0);
+  ASSERT_TRUE(cached(a, 0));
+  ASSERT_EQ(0u, logger->get(l_bluestore_onode_hot_trims));
+
+  // clearing a space forgets its ghosts
+  ASSERT_FALSE(cached(a, 6));
+  a.clear();
+  add(a, 6);
+  ASSERT_EQ(1u, logger->get(l_bluestore_onode_ghost_hits));
+}
+
+TEST_F(TwoQCacheTest, ScanResistance)
+{
+  BlueStore::OnodeSpace a(cache);
+  make_hot(a);
+  for (int i = 100; i < 200; ++i) {
+    add(a, i, 0);
+    cache->trim(4, 0);
+  }
+  ASSERT_TRUE(cached(a, 0));
+  ASSERT_TRUE(cached(a, 1));
+  ASSERT_TRUE(cached(a, 4));
+  ASSERT_TRUE(cached(a, 5));
+  ASSERT_EQ(0u, logger->get(l_bluestore_onode_hot_trims));
+
+  // scanned onodes leave no ghosts behind
+  ASSERT_FALSE(cached(a, 100));
+  add(a, 100);
+  ASSERT_EQ(2u, logger->get(l_bluestore_onode_ghost_hits));
+}
+
+TEST_F(TwoQCacheTest, TrimAccounting)
+{
+  BlueStore::OnodeSpace a(cache);
+  make_hot(a);
+  uint64_t warm_trims = logger->get(l_bluestore_onode_warm_trims);
+
+  // the tail of warm_in is in use; hot does not pay for it
+  BlueStore::OnodeRef pinned = a.lookup(oid(4));
+  add(a, 6);
+  add(a, 7);
+  cache->trim(4, 0);
+  ASSERT_EQ(6u, a.onode_map.size());
+  ASSERT_EQ(warm_trims, logger->get(l_bluestore_onode_warm_trims));
+  ASSERT_EQ(0u, logger->get(l_bluestore_onode_hot_trims));
+
+  // the shortfall is made up once it is released
+  pinned.reset();
+  cache->trim(4, 0);
+  ASSERT_EQ(4u, a.onode_map.size());
+  ASSERT_EQ(warm_trims + 2, logger->get(l_bluestore_onode_warm_trims));
+  ASSERT_TRUE(cached(a, 0));
+  ASSERT_TRUE(cached(a, 1));
+  ASSERT_FALSE(cached(a, 4));
+  ASSERT_FALSE(cached(a, 5));
+
+  // with warm_in at its share, the excess comes out of hot
+  add(a, 10);
+  add(a, 11);
+  cache->trim(2, 0);
+  ASSERT_EQ(2u, a.onode_map.size());
+  ASSERT_EQ(warm_trims + 5, logger->get(l_bluestore_onode_warm_trims));
+  ASSERT_EQ(1u, logger->get(l_bluestore_onode_hot_trims));
+}
@@ -233,6 +233,25 @@ public:
   }
 };
 
+/// VarLenGenerator writes over an object without truncating it
+class OverwriteGenerator : public RandGenerator {
+  uint64_t prev_length;
+  VarLenGenerator gen;
+public:
+  OverwriteGenerator(
+    uint64_t prev_length,
+    uint64_t length, uint64_t min_stride_size, uint64_t max_stride_size) :
+    prev_length(prev_length),
+    gen(length, min_stride_size, max_stride_size) {}
+  void get_ranges_map(
+    const ContDesc &cont, std::map<uint64_t, uint64_t> &out) {
+    gen.get_ranges_map(cont, out);
+  }
+  uint64_t get_length(const ContDesc &in) {
+    return std::max(prev_length, gen.get_length(in));
+  }
+};
+
 class AttrGenerator : public RandGenerator {
   uint64_t max_len;
   uint64_t big_max_len;
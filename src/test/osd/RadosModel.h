@@ -725,17 +725,19 @@ public:
 
   bool do_append;
   bool do_excl;
+  bool do_truncate;
 
   WriteOp(int n,
 	  RadosTestContext *context,
 	  const string &oid,
 	  bool do_append,
 	  bool do_excl,
-	  TestOpStat *stat = 0)
+	  TestOpStat *stat = 0,
+	  bool do_truncate = true)
     : TestOp(n, context, stat),
       oid(oid), rcompletion(NULL), waiting_on(0), 
       last_acked_tid(0), do_append(do_append),
-      do_excl(do_excl)
+      do_excl(do_excl), do_truncate(do_truncate)
   {}
 		
   void _begin()
@@ -749,12 +751,12 @@ public:
     cont = ContDesc(context->seq_num, context->current_snap, context->seq_num, prefix);
 
     ContentsGenerator *cont_gen;
+    ObjectDesc old_value;
+    bool found = context->find_object(oid, &old_value);
+    uint64_t prev_length = found && old_value.has_contents() ?
+      old_value.most_recent_gen()->get_length(old_value.most_recent()) :
+      0;
     if (do_append) {
-      ObjectDesc old_value;
-      bool found = context->find_object(oid, &old_value);
-      uint64_t prev_length = found && old_value.has_contents() ?
-	old_value.most_recent_gen()->get_length(old_value.most_recent()) :
-	0;
       bool requires;
       int r = context->io_ctx.pool_requires_alignment2(&requires);
       assert(r == 0);
@@ -770,6 +772,11 @@ public:
 	context->min_stride_size,
 	context->max_stride_size,
 	3);
+    } else if (!do_truncate) {
+      // the old contents past our ranges are left in place
+      cont_gen = new OverwriteGenerator(
+	prev_length,
+	context->max_size, context->min_stride_size, context->max_stride_size);
     } else {
       cont_gen = new VarLenGenerator(
 	context->max_size, context->min_stride_size, context->max_stride_size);
@@ -830,7 +837,7 @@ public:
     waiting.insert(completion);
     waiting_on++;
     write_op.setxattr("_header", contbl);
-    if (!do_append) {
+    if (!do_append && do_truncate) {
       write_op.truncate(cont_gen->get_length(cont));
     }
     context->io_ctx.aio_operate(
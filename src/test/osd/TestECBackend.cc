@@ -17,6 +17,12 @@
 #include <errno.h>
 #include <signal.h>
 #include "osd/ECBackend.h"
+#include "osd/ECTransaction.h"
+#include "os/ObjectStore.h"
+#include "erasure-code/ErasureCode.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
 #include "gtest/gtest.h"
 
 TEST(ECUtil, stripe_info_t)
@@ -58,3 +64,408 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+/// k=2 m=1 parity code, chunk 2 is chunk 0 xor chunk 1
+class ErasureCodeXor : public ErasureCode {
+public:
+  virtual int create_ruleset(const string &name,
+			     CrushWrapper &crush,
+			     ostream *ss) const {
+    return 0;
+  }
+  virtual unsigned int get_chunk_count() const {
+    return 3;
+  }
+  virtual unsigned int get_data_chunk_count() const {
+    return 2;
+  }
+  virtual unsigned int get_chunk_size(unsigned int object_size) const {
+    return (object_size + 1) / 2;
+  }
+  static void region_xor(const bufferlist &a, const bufferlist &b,
+			 bufferlist *out) {
+    bufferptr p(a.length());
+    for (unsigned i = 0; i < a.length(); ++i)
+      p[i] = a[i] ^ b[i];
+    out->clear();
+    out->push_back(p);
+  }
+  virtual int encode_chunks(const set<int> &want_to_encode,
+			    map<int, bufferlist> *encoded) {
+    region_xor((*encoded)[0], (*encoded)[1], &(*encoded)[2]);
+    return 0;
+  }
+  virtual int decode_chunks(const set<int> &want_to_read,
+			    const map<int, bufferlist> &chunks,
+			    map<int, bufferlist> *decoded) {
+    for (int i = 0; i < 3; ++i) {
+      if (chunks.count(i))
+	continue;
+      region_xor((*decoded)[(i + 1) % 3], (*decoded)[(i + 2) % 3],
+		 &(*decoded)[i]);
+    }
+    return 0;
+  }
+};
+
+class ECOverwriteTest : public ::testing::Test {
+public:
+  static const uint64_t stripe_width = 4096;
+  ObjectStore *store;
+  ObjectStore::Sequencer osr;
+  ErasureCodeInterfaceRef ec_impl;
+  ECUtil::stripe_info_t sinfo;
+  pg_t pgid;
+  hobject_t hoid;
+
+  ECOverwriteTest()
+    : store(NULL),
+      osr("ECOverwriteTest"),
+      ec_impl(new ErasureCodeXor),
+      sinfo(ec_impl->get_data_chunk_count(), stripe_width),
+      pgid(0, 1),
+      hoid(object_t("overwritten"), "", CEPH_NOSNAP, 0, 1, "") {}
+
+  virtual void SetUp() {
+    ::system("rm -rf ec_overwrite_temp_dir");
+    ASSERT_EQ(0, ::mkdir("ec_overwrite_temp_dir", 0777));
+    store = ObjectStore::create(g_ceph_context, "memstore",
+				"ec_overwrite_temp_dir", "");
+    ASSERT_TRUE(store);
+    ASSERT_EQ(0, store->mkfs());
+    ASSERT_EQ(0, store->mount());
+    ObjectStore::Transaction t;
+    for (int i = 0; i < 3; ++i)
+      t.create_collection(coll(i), 0);
+    ASSERT_EQ(0u, store->apply_transaction(&osr, std::move(t)));
+  }
+  virtual void TearDown() {
+    if (store) {
+      store->umount();
+      delete store;
+    }
+    ::system("rm -rf ec_overwrite_temp_dir");
+  }
+
+  coll_t coll(int shard) {
+    return coll_t(spg_t(pgid, shard_id_t(shard)));
+  }
+  ghobject_t shard_oid(int shard, version_t gen = ghobject_t::NO_GEN) {
+    return ghobject_t(hoid, gen, shard_id_t(shard));
+  }
+  bufferlist read_shard(int shard, version_t gen = ghobject_t::NO_GEN) {
+    bufferlist bl;
+    struct stat st;
+    if (store->stat(coll(shard), shard_oid(shard, gen), &st) == 0 &&
+	st.st_size > 0)
+      store->read(coll(shard), shard_oid(shard, gen), 0, st.st_size, bl);
+    return bl;
+  }
+  ECUtil::HashInfoRef get_hinfo() {
+    ECUtil::HashInfoRef hinfo(new ECUtil::HashInfo(3));
+    bufferlist bl;
+    if (store->getattr(coll(0), shard_oid(0), ECUtil::get_hinfo_key(),
+		       bl) >= 0) {
+      bufferlist::iterator p = bl.begin();
+      ::decode(*hinfo, p);
+    }
+    return hinfo;
+  }
+  bufferlist read_object() {
+    map<int, bufferlist> to_decode;
+    to_decode[0] = read_shard(0);
+    to_decode[1] = read_shard(1);
+    bufferlist out;
+    EXPECT_EQ(0, ECUtil::decode(sinfo, ec_impl, to_decode, &out));
+    return out;
+  }
+  bool parity_consistent() {
+    bufferlist parity;
+    ErasureCodeXor::region_xor(read_shard(0), read_shard(1), &parity);
+    return parity.contents_equal(read_shard(2));
+  }
+
+  /// generates the shard transactions for t the way ECBackend does,
+  /// reading what the overwrites need first, and applies them
+  void apply(ECTransaction &t, const vector<pg_log_entry_t> &entries) {
+    map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> hash_infos;
+    hash_infos[hoid] = get_hinfo();
+    map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator> reads;
+    t.get_overwrite_reads(hash_infos, ec_impl, sinfo, &reads);
+    map<hobject_t, ECTransaction::read_chunks_t, hobject_t::BitwiseComparator> read_chunks;
+    for (map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator>::iterator i =
+	   reads.begin();
+	 i != reads.end();
+	 ++i) {
+      for (interval_set<uint64_t>::iterator j = i->second.extents.begin();
+	   j != i->second.extents.end();
+	   ++j) {
+	uint64_t off = sinfo.aligned_logical_offset_to_chunk_offset(
+	  j.get_start());
+	uint64_t len = sinfo.aligned_logical_offset_to_chunk_offset(
+	  j.get_len());
+	for (set<int>::iterator k = i->second.shards.begin();
+	     k != i->second.shards.end();
+	     ++k) {
+	  bufferlist bl;
+	  store->read(coll(*k), shard_oid(*k), off, len, bl);
+	  read_chunks[i->first][*k][off] = bl;
+	}
+      }
+    }
+    map<shard_id_t, ObjectStore::Transaction> trans;
+    for (int i = 0; i < 3; ++i)
+      trans[shard_id_t(i)];
+    set<hobject_t, hobject_t::BitwiseComparator> temp_added, temp_removed;
+    t.generate_transactions(hash_infos, read_chunks, entries, ec_impl, pgid,
+			    sinfo, &trans, &temp_added, &temp_removed);
+    for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans.begin();
+	 i != trans.end();
+	 ++i) {
+      ASSERT_EQ(0u, store->apply_transaction(&osr, std::move(i->second)));
+    }
+  }
+  /// rolls entry back on every shard the way PGBackend::rollback does
+  void rollback(const pg_log_entry_t &entry) {
+    struct Rollback : public ObjectModDesc::Visitor {
+      ECOverwriteTest *test;
+      int shard;
+      ObjectStore::Transaction t;
+      Rollback(ECOverwriteTest *test, int shard) : test(test), shard(shard) {}
+      void rollback_extents(
+	version_t gen, uint64_t old_size, uint64_t off, uint64_t len) {
+	ObjectStore::Transaction temp;
+	ECTransaction::generate_rollback_extents(
+	  test->hoid, gen, old_size, off, len, test->ec_impl, test->sinfo,
+	  test->coll(shard), shard_id_t(shard), &temp);
+	temp.append(t);
+	temp.swap(t);
+      }
+    };
+    for (int i = 0; i < 3; ++i) {
+      Rollback vis(this, i);
+      entry.mod_desc.visit(&vis);
+      trim(entry, i, &vis.t);
+      ASSERT_EQ(0u, store->apply_transaction(&osr, std::move(vis.t)));
+    }
+  }
+  /// removes the stashes of entry the way log trimming does
+  void trim(const pg_log_entry_t &entry, int shard,
+	    ObjectStore::Transaction *t) {
+    set<version_t> gens;
+    entry.mod_desc.get_rollback_extents_gens(&gens);
+    for (set<version_t>::iterator i = gens.begin(); i != gens.end(); ++i)
+      t->remove(coll(shard), shard_oid(shard, *i));
+  }
+  void trim(const pg_log_entry_t &entry) {
+    for (int i = 0; i < 3; ++i) {
+      ObjectStore::Transaction t;
+      trim(entry, i, &t);
+      ASSERT_EQ(0u, store->apply_transaction(&osr, std::move(t)));
+    }
+  }
+
+  bufferlist pattern(uint64_t len, char seed) {
+    bufferptr p(len);
+    for (uint64_t i = 0; i < len; ++i)
+      p[i] = seed + (i % 251);
+    bufferlist bl;
+    bl.push_back(p);
+    return bl;
+  }
+  /// creates the object with two full stripes
+  bufferlist create() {
+    bufferlist bl = pattern(2 * stripe_width, 'a');
+    bufferlist data(bl);
+    ECTransaction t;
+    t.append(hoid, 0, bl.length(), bl, 0);
+    apply(t, vector<pg_log_entry_t>());
+    return data;
+  }
+  /// log entry for an overwrite at version v
+  pg_log_entry_t overwrite_entry(version_t v) {
+    pg_log_entry_t entry;
+    entry.op = pg_log_entry_t::MODIFY;
+    entry.soid = hoid;
+    entry.version = eversion_t(1, v);
+    return entry;
+  }
+  /// overwrite of [off, off + bl.length()) recorded in entry
+  void overwrite(ECTransaction *t, pg_log_entry_t *entry, uint64_t old_size,
+		 uint64_t off, bufferlist &bl, bufferlist *expected) {
+    entry->mod_desc.rollback_extents(
+      entry->version.version, old_size, off, bl.length());
+    bufferlist head, tail;
+    head.substr_of(*expected, 0, off);
+    if (off + bl.length() < expected->length())
+      tail.substr_of(*expected, off + bl.length(),
+		     expected->length() - off - bl.length());
+    expected->clear();
+    expected->append(head);
+    expected->append(bl);
+    expected->append(tail);
+    t->write(hoid, off, bl.length(), bl, 0);
+  }
+};
+
+TEST_F(ECOverwriteTest, rollback_extents)
+{
+  bufferlist original = create();
+  ASSERT_TRUE(original.contents_equal(read_object()));
+  ASSERT_TRUE(parity_consistent());
+  bufferlist shards[3];
+  for (int i = 0; i < 3; ++i)
+    shards[i] = read_shard(i);
+
+  // within the first chunk of the second stripe: only shards 0 and 2
+  // are rewritten and read
+  uint64_t off = stripe_width + 100;
+  bufferlist bl = pattern(500, 'x');
+  bufferlist expected(original);
+  ECTransaction t;
+  pg_log_entry_t entry = overwrite_entry(2);
+  overwrite(&t, &entry, original.length(), off, bl, &expected);
+
+  map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> hash_infos;
+  hash_infos[hoid] = get_hinfo();
+  map<hobject_t, ECTransaction::overwrite_read_t, hobject_t::BitwiseComparator> reads;
+  t.get_overwrite_reads(hash_infos, ec_impl, sinfo, &reads);
+  ASSERT_EQ(1u, reads.size());
+  set<int> want;
+  want.insert(0);
+  want.insert(2);
+  ASSERT_EQ(want, reads[hoid].shards);
+  interval_set<uint64_t> extents;
+  extents.insert(stripe_width, stripe_width);
+  ASSERT_EQ(extents, reads[hoid].extents);
+
+  apply(t, vector<pg_log_entry_t>(1, entry));
+  ASSERT_TRUE(expected.contents_equal(read_object()));
+  ASSERT_TRUE(parity_consistent());
+  ASSERT_FALSE(get_hinfo()->has_chunk_hash());
+  // every shard has the stash, only the rewritten ones have content
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(store->exists(coll(i), shard_oid(i, 2)));
+  ASSERT_EQ(0u, read_shard(1, 2).length());
+  bufferlist stashed, saved;
+  store->read(coll(0), shard_oid(0, 2), sinfo.get_chunk_size(),
+	      sinfo.get_chunk_size(), stashed);
+  saved.substr_of(shards[0], sinfo.get_chunk_size(), sinfo.get_chunk_size());
+  ASSERT_TRUE(saved.contents_equal(stashed));
+
+  rollback(entry);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(shards[i].contents_equal(read_shard(i)));
+    ASSERT_FALSE(store->exists(coll(i), shard_oid(i, 2)));
+  }
+}
+
+TEST_F(ECOverwriteTest, rollback_extents_extending)
+{
+  bufferlist original = create();
+  bufferlist shards[3];
+  for (int i = 0; i < 3; ++i)
+    shards[i] = read_shard(i);
+
+  // two overwrites in one op stash at the same generation: the first
+  // crosses the chunk boundary of the first stripe, the second runs
+  // past the end of the object
+  bufferlist expected(original);
+  ECTransaction t;
+  pg_log_entry_t entry = overwrite_entry(3);
+  bufferlist a = pattern(600, 'y');
+  overwrite(&t, &entry, original.length(), sinfo.get_chunk_size() - 300, a,
+	    &expected);
+  bufferlist b = pattern(stripe_width, 'z');
+  overwrite(&t, &entry, original.length(), original.length() + 10 -
+	    stripe_width, b, &expected);
+  set<version_t> gens;
+  entry.mod_desc.get_rollback_extents_gens(&gens);
+  ASSERT_EQ(1u, gens.size());
+
+  apply(t, vector<pg_log_entry_t>(1, entry));
+  bufferlist object = read_object();
+  ASSERT_EQ(3 * stripe_width, object.length());
+  bufferlist head;
+  head.substr_of(object, 0, expected.length());
+  ASSERT_TRUE(expected.contents_equal(head));
+  ASSERT_TRUE(parity_consistent());
+
+  rollback(entry);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(shards[i].contents_equal(read_shard(i)));
+    ASSERT_FALSE(store->exists(coll(i), shard_oid(i, 3)));
+  }
+}
+
+TEST_F(ECOverwriteTest, rollback_extents_in_order)
+{
+  bufferlist original = create();
+  bufferlist shards[3];
+  for (int i = 0; i < 3; ++i)
+    shards[i] = read_shard(i);
+
+  // the second op reads the stripe the first one rewrote, as the
+  // front of waiting_reads does once the first op has applied
+  bufferlist expected(original);
+  ECTransaction t1;
+  pg_log_entry_t e1 = overwrite_entry(5);
+  bufferlist a = pattern(1000, 'u');
+  overwrite(&t1, &e1, original.length(), 50, a, &expected);
+  apply(t1, vector<pg_log_entry_t>(1, e1));
+  bufferlist after_first[3];
+  for (int i = 0; i < 3; ++i)
+    after_first[i] = read_shard(i);
+
+  ECTransaction t2;
+  pg_log_entry_t e2 = overwrite_entry(6);
+  bufferlist b = pattern(1000, 'v');
+  overwrite(&t2, &e2, original.length(), sinfo.get_chunk_size() + 500, b,
+	    &expected);
+  apply(t2, vector<pg_log_entry_t>(1, e2));
+  ASSERT_TRUE(expected.contents_equal(read_object()));
+  ASSERT_TRUE(parity_consistent());
+
+  // divergent entries are rolled back newest first
+  rollback(e2);
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(after_first[i].contents_equal(read_shard(i)));
+  ASSERT_TRUE(parity_consistent());
+  rollback(e1);
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(shards[i].contents_equal(read_shard(i)));
+}
+
+TEST_F(ECOverwriteTest, trim)
+{
+  bufferlist original = create();
+  bufferlist expected(original);
+  ECTransaction t;
+  pg_log_entry_t entry = overwrite_entry(4);
+  bufferlist bl = pattern(100, 'w');
+  overwrite(&t, &entry, original.length(), 10, bl, &expected);
+  apply(t, vector<pg_log_entry_t>(1, entry));
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(store->exists(coll(i), shard_oid(i, 4)));
+
+  // trimming the entry drops the stash and keeps the new content
+  trim(entry);
+  for (int i = 0; i < 3; ++i)
+    ASSERT_FALSE(store->exists(coll(i), shard_oid(i, 4)));
+  ASSERT_TRUE(expected.contents_equal(read_object()));
+  ASSERT_TRUE(parity_consistent());
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_ecbackend && ./unittest_ecbackend"
+// End:
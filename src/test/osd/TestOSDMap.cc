@@ -7,6 +7,7 @@
 #include "common/common_init.h"
 
 #include <iostream>
+#include <thread>
 
 using namespace std;
 
@@ -330,6 +331,85 @@ TEST_F(OSDMapTest, KeepsNecessaryTemps) {
   EXPECT_FALSE(pending_inc.new_primary_temp.count(pgid));
 }
 
+TEST_F(OSDMapTest, PGMapping) {
+  set_up_map();
+
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, 0));
+  vector<int> up_osds, acting_osds;
+  int up_primary, acting_primary;
+  osdmap.pg_to_up_acting_osds(pgid, &up_osds, &up_primary,
+                              &acting_osds, &acting_primary);
+  OSDMap::Incremental pgtemp_map(osdmap.get_epoch() + 1);
+  pgtemp_map.new_pg_temp[pgid].push_back(acting_osds[1]);
+  pgtemp_map.new_pg_temp[pgid].push_back(acting_osds[0]);
+  osdmap.apply_incremental(pgtemp_map);
+
+  OSDMap crush_only;
+  crush_only.deepish_copy_from(osdmap);
+  osdmap.build_pg_mapping(4);
+  ASSERT_TRUE(osdmap.have_pg_mapping());
+  ASSERT_FALSE(crush_only.have_pg_mapping());
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p) {
+    // raw pgs past pg_num map like the pg they fold into
+    for (unsigned ps = 0; ps < p->second.get_pg_num() * 2; ++ps) {
+      vector<int> up, acting, crush_up, crush_acting;
+      int upp, actingp, crush_upp, crush_actingp;
+      osdmap.pg_to_up_acting_osds(pg_t(ps, p->first), &up, &upp,
+                                  &acting, &actingp);
+      crush_only.pg_to_up_acting_osds(pg_t(ps, p->first), &crush_up,
+                                      &crush_upp, &crush_acting,
+                                      &crush_actingp);
+      ASSERT_EQ(crush_up, up);
+      ASSERT_EQ(crush_upp, upp);
+      ASSERT_EQ(crush_acting, acting);
+      ASSERT_EQ(crush_actingp, actingp);
+    }
+  }
+  osdmap.pg_to_acting_osds(pgid, &acting_osds, &acting_primary);
+  EXPECT_EQ(pgtemp_map.new_pg_temp[pgid], acting_osds);
+
+  OSDMap::Incremental next(osdmap.get_epoch() + 1);
+  osdmap.apply_incremental(next);
+  EXPECT_FALSE(osdmap.have_pg_mapping());
+}
+
+TEST_F(OSDMapTest, PGMappingClearWhileMapping) {
+  set_up_map();
+
+  OSDMap crush_only;
+  crush_only.deepish_copy_from(osdmap);
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, 0));
+  vector<int> crush_up;
+  int crush_upp;
+  crush_only.pg_to_up_acting_osds(pgid, &crush_up, &crush_upp, NULL, NULL);
+
+  // lookups racing with a shared map dropping its table see either it
+  // or crush, and the same answer from both
+  for (unsigned round = 0; round < 20; ++round) {
+    osdmap.build_pg_mapping(2);
+    std::atomic<bool> mismatch(false);
+    vector<std::thread> threads;
+    for (unsigned i = 0; i < 4; ++i) {
+      threads.push_back(std::thread([&]() {
+	for (unsigned j = 0; j < 1000; ++j) {
+	  vector<int> up;
+	  int upp;
+	  osdmap.pg_to_up_acting_osds(pgid, &up, &upp, NULL, NULL);
+	  if (up != crush_up || upp != crush_upp)
+	    mismatch = true;
+	}
+      }));
+    }
+    osdmap.clear_pg_mapping();
+    for (auto& t : threads)
+      t.join();
+    ASSERT_FALSE(mismatch);
+    ASSERT_FALSE(osdmap.have_pg_mapping());
+  }
+}
+
 TEST_F(OSDMapTest, PrimaryAffinity) {
   set_up_map();
 
@@ -29,11 +29,13 @@ public:
 			TestOpStat *stats,
 			int max_seconds,
 			bool ec_pool,
+			bool ec_overwrites,
 			bool balance_reads) :
     m_nextop(NULL), m_op(0), m_ops(ops), m_seconds(max_seconds),
     m_objects(objects), m_stats(stats),
     m_total_weight(0),
     m_ec_pool(ec_pool),
+    m_ec_overwrites(ec_overwrites),
     m_balance_reads(balance_reads)
   {
     m_start = time(0);
@@ -111,14 +113,16 @@ private:
       oid = *(rand_choose(context.oid_not_in_use));
       cout << m_op << ": " << "write oid " << oid << " current snap is "
 	   << context.current_snap << std::endl;
-      return new WriteOp(m_op, &context, oid, false, false, m_stats);
+      return new WriteOp(m_op, &context, oid, false, false, m_stats,
+			 !m_ec_overwrites);
 
     case TEST_OP_WRITE_EXCL:
       oid = *(rand_choose(context.oid_not_in_use));
       cout << m_op << ": " << "write (excl) oid "
 	   << oid << " current snap is "
 	   << context.current_snap << std::endl;
-      return new WriteOp(m_op, &context, oid, false, true, m_stats);
+      return new WriteOp(m_op, &context, oid, false, true, m_stats,
+			 !m_ec_overwrites);
 
     case TEST_OP_WRITESAME:
       oid = *(rand_choose(context.oid_not_in_use));
@@ -251,6 +255,7 @@ private:
   map<TestOpType, unsigned int> m_weight_sums;
   unsigned int m_total_weight;
   bool m_ec_pool;
+  bool m_ec_overwrites;
   bool m_balance_reads;
 };
 
@@ -269,33 +274,35 @@ int main(int argc, char **argv)
     TestOpType op;
     const char *name;
     bool ec_pool_valid;
+    bool ec_overwrites_valid;
   } op_types[] = {
-    { TEST_OP_READ, "read", true },
-    { TEST_OP_WRITE, "write", false },
-    { TEST_OP_WRITE_EXCL, "write_excl", false },
-    { TEST_OP_WRITESAME, "writesame", false },
-    { TEST_OP_DELETE, "delete", true },
-    { TEST_OP_SNAP_CREATE, "snap_create", true },
-    { TEST_OP_SNAP_REMOVE, "snap_remove", true },
-    { TEST_OP_ROLLBACK, "rollback", true },
-    { TEST_OP_SETATTR, "setattr", true },
-    { TEST_OP_RMATTR, "rmattr", true },
-    { TEST_OP_WATCH, "watch", true },
-    { TEST_OP_COPY_FROM, "copy_from", true },
-    { TEST_OP_HIT_SET_LIST, "hit_set_list", true },
-    { TEST_OP_IS_DIRTY, "is_dirty", true },
-    { TEST_OP_UNDIRTY, "undirty", true },
-    { TEST_OP_CACHE_FLUSH, "cache_flush", true },
-    { TEST_OP_CACHE_TRY_FLUSH, "cache_try_flush", true },
-    { TEST_OP_CACHE_EVICT, "cache_evict", true },
-    { TEST_OP_APPEND, "append", true },
-    { TEST_OP_APPEND_EXCL, "append_excl", true },
+    { TEST_OP_READ, "read", true, true },
+    { TEST_OP_WRITE, "write", false, true },
+    { TEST_OP_WRITE_EXCL, "write_excl", false, true },
+    { TEST_OP_WRITESAME, "writesame", false, false },
+    { TEST_OP_DELETE, "delete", true, true },
+    { TEST_OP_SNAP_CREATE, "snap_create", true, true },
+    { TEST_OP_SNAP_REMOVE, "snap_remove", true, true },
+    { TEST_OP_ROLLBACK, "rollback", true, true },
+    { TEST_OP_SETATTR, "setattr", true, true },
+    { TEST_OP_RMATTR, "rmattr", true, true },
+    { TEST_OP_WATCH, "watch", true, true },
+    { TEST_OP_COPY_FROM, "copy_from", true, true },
+    { TEST_OP_HIT_SET_LIST, "hit_set_list", true, true },
+    { TEST_OP_IS_DIRTY, "is_dirty", true, true },
+    { TEST_OP_UNDIRTY, "undirty", true, true },
+    { TEST_OP_CACHE_FLUSH, "cache_flush", true, true },
+    { TEST_OP_CACHE_TRY_FLUSH, "cache_try_flush", true, true },
+    { TEST_OP_CACHE_EVICT, "cache_evict", true, true },
+    { TEST_OP_APPEND, "append", true, true },
+    { TEST_OP_APPEND_EXCL, "append_excl", true, true },
     { TEST_OP_READ /* grr */, NULL },
   };
 
   map<TestOpType, unsigned int> op_weights;
   string pool_name = "rbd";
   bool ec_pool = false;
+  bool ec_overwrites = false;
   bool no_omap = false;
   bool balance_reads = false;
 
@@ -331,6 +338,14 @@ int main(int argc, char **argv)
       }
       ec_pool = true;
       no_omap = true;
+    } else if (strcmp(argv[i], "--ec-overwrites") == 0) {
+      if (!op_weights.empty()) {
+	cerr << "--ec-overwrites must be specified prior to any ops" << std::endl;
+	exit(1);
+      }
+      ec_pool = true;
+      ec_overwrites = true;
+      no_omap = true;
     } else if (strcmp(argv[i], "--op") == 0) {
       i++;
       if (i == argc) {
@@ -357,7 +372,11 @@ int main(int argc, char **argv)
 	cerr << "Weights must be nonnegative." << std::endl;
 	return 1;
       } else if (weight > 0) {
-	if (ec_pool && !op_types[j].ec_pool_valid) {
+	if (ec_overwrites && !op_types[j].ec_overwrites_valid) {
+	  cerr << "Error: cannot use op type " << op_types[j].name
+	       << " with --ec-overwrites" << std::endl;
+	  exit(1);
+	} else if (ec_pool && !ec_overwrites && !op_types[j].ec_pool_valid) {
 	  cerr << "Error: cannot use op type " << op_types[j].name
 	       << " with --ec-pool" << std::endl;
 	  exit(1);
@@ -426,7 +445,7 @@ int main(int argc, char **argv)
   WeightedTestGenerator gen = WeightedTestGenerator(
     ops, objects,
     op_weights, &stats, max_seconds,
-    ec_pool, balance_reads);
+    ec_pool, ec_overwrites, balance_reads);
   int r = context.init();
   if (r < 0) {
     cerr << "Error initializing rados test context: "
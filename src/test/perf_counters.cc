@@ -40,6 +40,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <thread>
 #include <time.h>
 #include <unistd.h>
 
@@ -200,3 +201,133 @@ TEST(PerfCounters, CephContextPerfCounters) {
   // Restore to avoid impact to other test cases
   g_ceph_context->disable_perf_counter();
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_COUNTER,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST2D,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+static PerfCounters* setup_test_perfcounter3(CephContext *cct)
+{
+  PerfCountersBuilder bld(cct, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_COUNTER, "counter");
+  PerfHistogram::axis_config_d linear = {
+    "x", PerfHistogram::SCALE_LINEAR, 0, 10, 4
+  };
+  bld.add_u64_counter_histogram(TEST_PERFCOUNTERS3_ELEMENT_HIST, "hist",
+				linear);
+  PerfHistogram::axis_config_d log2 = {
+    "x", PerfHistogram::SCALE_LOG2, 0, 1, 6
+  };
+  PerfHistogram::axis_config_d size = {
+    "y", PerfHistogram::SCALE_LINEAR, 0, 10, 3
+  };
+  bld.add_u64_counter_histogram(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, "hist2d",
+				log2, size);
+  return bld.create_perf_counters();
+}
+
+TEST(PerfCounters, ShardedCounter) {
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 16; ++t) {
+    threads.push_back(std::thread([fake_pf]() {
+	  for (unsigned i = 0; i < 10000; ++i)
+	    fake_pf->inc(TEST_PERFCOUNTERS3_ELEMENT_COUNTER);
+	}));
+  }
+  for (unsigned t = 0; t < threads.size(); ++t)
+    threads[t].join();
+  ASSERT_EQ(160000u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNTER));
+  fake_pf->dec(TEST_PERFCOUNTERS3_ELEMENT_COUNTER, 60000);
+  ASSERT_EQ(100000u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNTER));
+  fake_pf->set(TEST_PERFCOUNTERS3_ELEMENT_COUNTER, 5);
+  ASSERT_EQ(5u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNTER));
+  fake_pf->reset();
+  ASSERT_EQ(0u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNTER));
+  delete fake_pf;
+}
+
+TEST(PerfCounters, HistogramBuckets) {
+  PerfHistogram::axis_config_d linear = {
+    "x", PerfHistogram::SCALE_LINEAR, -10, 10, 4
+  };
+  ASSERT_EQ(0, PerfHistogram::get_bucket_for_axis(-11, linear));
+  ASSERT_EQ(1, PerfHistogram::get_bucket_for_axis(-10, linear));
+  ASSERT_EQ(1, PerfHistogram::get_bucket_for_axis(-1, linear));
+  ASSERT_EQ(2, PerfHistogram::get_bucket_for_axis(0, linear));
+  ASSERT_EQ(3, PerfHistogram::get_bucket_for_axis(10, linear));
+  ASSERT_EQ(3, PerfHistogram::get_bucket_for_axis(1LL << 62, linear));
+
+  PerfHistogram::axis_config_d log2 = {
+    "x", PerfHistogram::SCALE_LOG2, 0, 100, 6
+  };
+  std::vector<std::pair<int64_t, int64_t> > ranges =
+    PerfHistogram::get_axis_bucket_ranges(log2);
+  ASSERT_EQ(6u, ranges.size());
+  ASSERT_EQ(-1, ranges[0].second);
+  ASSERT_EQ(std::make_pair(0l, 99l), ranges[1]);
+  ASSERT_EQ(std::make_pair(100l, 199l), ranges[2]);
+  ASSERT_EQ(std::make_pair(200l, 399l), ranges[3]);
+  ASSERT_EQ(std::make_pair(400l, 799l), ranges[4]);
+  ASSERT_EQ(800, ranges[5].first);
+  // every value falls in the bucket of its range
+  for (int64_t v = -5; v < 1000; ++v) {
+    int32_t b = PerfHistogram::get_bucket_for_axis(v, log2);
+    ASSERT_LE(ranges[b].first, v);
+    ASSERT_GE(ranges[b].second, v);
+  }
+}
+
+TEST(PerfCounters, Histograms) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  coll->add(fake_pf);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, -1);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 5);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 15);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 100);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 0, 5);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 3, 20);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST2D, 1000, -5);
+
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{\"counter\":0,"
+	    "\"hist\":{\"avgcount\":4,\"sum\":119},"
+	    "\"hist2d\":{\"avgcount\":3,\"sum\":1003}}}"), msg);
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf histogram dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{"
+	    "\"hist\":{\"values\":[1,1,1,1]},"
+	    "\"hist2d\":{\"values\":[[0,0,0],[0,1,0],[0,0,0],[0,0,1],[0,0,0],"
+	    "[1,0,0]]}}}"), msg);
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf histogram schema\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{"
+	    "\"hist\":{\"type\":22,\"description\":\"\",\"nick\":\"\","
+	    "\"axes\":[{\"name\":\"x\",\"scale_type\":\"linear\",\"min\":0,"
+	    "\"quant_size\":10,\"buckets\":4,\"ranges\":[{\"max\":-1},"
+	    "{\"min\":0,\"max\":9},{\"min\":10,\"max\":19},{\"min\":20}]}]},"
+	    "\"hist2d\":{\"type\":22,\"description\":\"\",\"nick\":\"\","
+	    "\"axes\":[{\"name\":\"x\",\"scale_type\":\"log2\",\"min\":0,"
+	    "\"quant_size\":1,\"buckets\":6,\"ranges\":[{\"max\":-1},"
+	    "{\"min\":0,\"max\":0},{\"min\":1,\"max\":1},{\"min\":2,\"max\":3},"
+	    "{\"min\":4,\"max\":7},{\"min\":8}]},"
+	    "{\"name\":\"y\",\"scale_type\":\"linear\",\"min\":0,"
+	    "\"quant_size\":10,\"buckets\":3,\"ranges\":[{\"max\":-1},"
+	    "{\"min\":0,\"max\":9},{\"min\":10}]}]}}}"), msg);
+
+  fake_pf->reset();
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf histogram dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{"
+	    "\"hist\":{\"values\":[0,0,0,0]},"
+	    "\"hist2d\":{\"values\":[[0,0,0],[0,0,0],[0,0,0],[0,0,0],[0,0,0],"
+	    "[0,0,0]]}}}"), msg);
+  coll->clear();
+}
@@ -0,0 +1,144 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "rgw/rgw_cache.h"
+
+#include <memory>
+
+class TestChainedCache : public RGWChainedCache {
+public:
+  set<string> keys;
+  void chain_cb(const string& key, void *data) { keys.insert(key); }
+  void invalidate(const string& key) { keys.erase(key); }
+  void invalidate_all() { keys.clear(); }
+};
+
+class ObjectCacheTest : public ::testing::Test {
+protected:
+  std::unique_ptr<ObjectCache> cache;
+
+  void create(int shards, int entries, uint64_t bytes) {
+    md_config_t *conf = g_ceph_context->_conf;
+    conf->set_val_or_die("rgw_cache_shards", std::to_string(shards).c_str());
+    conf->set_val_or_die("rgw_cache_lru_size", std::to_string(entries).c_str());
+    conf->set_val_or_die("rgw_cache_max_bytes", std::to_string(bytes).c_str());
+    conf->apply_changes(NULL);
+    cache.reset(new ObjectCache);
+    cache->set_ctx(g_ceph_context);
+    cache->set_enabled(true);
+  }
+
+  void put(string name, unsigned len = 1) {
+    ObjectCacheInfo info;
+    info.flags = CACHE_FLAG_DATA;
+    info.data.append(string(len, 'x'));
+    cache->put(name, info, NULL);
+  }
+
+  bool get(string name) {
+    ObjectCacheInfo info;
+    return cache->get(name, info, CACHE_FLAG_DATA, NULL) == 0;
+  }
+};
+
+TEST_F(ObjectCacheTest, get_put_remove)
+{
+  create(4, 100, 0);
+  EXPECT_FALSE(get("a"));
+  put("a", 10);
+  string a("a");
+  ObjectCacheInfo info;
+  ASSERT_EQ(0, cache->get(a, info, CACHE_FLAG_DATA, NULL));
+  EXPECT_EQ(10u, info.data.length());
+  EXPECT_NE(0, cache->get(a, info, CACHE_FLAG_XATTRS, NULL));
+  cache->remove(a);
+  EXPECT_FALSE(get("a"));
+  put("b");
+  cache->set_enabled(false);
+  EXPECT_FALSE(get("b"));
+}
+
+TEST_F(ObjectCacheTest, admission)
+{
+  create(1, 4, 0);
+  for (unsigned i = 0; i < 4; ++i) {
+    string name = "e" + std::to_string(i);
+    EXPECT_FALSE(get(name));
+    put(name);
+  }
+  // full: an object nobody asked for is not let in
+  put("cold");
+  EXPECT_FALSE(get("cold"));
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_TRUE(get("e" + std::to_string(i)));
+
+  // one asked for more often than the LRU entry replaces it
+  for (unsigned i = 0; i < 3; ++i)
+    get("hot");
+  put("hot");
+  EXPECT_TRUE(get("hot"));
+  EXPECT_FALSE(get("e0"));
+  for (unsigned i = 1; i < 4; ++i)
+    EXPECT_TRUE(get("e" + std::to_string(i)));
+}
+
+TEST_F(ObjectCacheTest, max_bytes)
+{
+  create(1, 100, 64 << 10);
+  for (unsigned i = 0; i < 4; ++i) {
+    string name = "e" + std::to_string(i);
+    for (unsigned j = 0; j <= i; ++j)
+      get(name);
+    put(name, 20 << 10);
+  }
+  // the fourth one is more popular and pushed the first one out
+  EXPECT_FALSE(get("e0"));
+  for (unsigned i = 1; i < 4; ++i)
+    EXPECT_TRUE(get("e" + std::to_string(i)));
+}
+
+TEST_F(ObjectCacheTest, evict_invalidates_chained)
+{
+  create(1, 2, 0);
+  TestChainedCache chained;
+  cache->chain_cache(&chained);
+
+  string a("a");
+  ObjectCacheInfo info;
+  info.flags = CACHE_FLAG_DATA;
+  rgw_cache_entry_info cache_info;
+  get("a");
+  cache->put(a, info, &cache_info);
+  list<rgw_cache_entry_info *> entries;
+  entries.push_back(&cache_info);
+  int data = 0;
+  string key("chained");
+  RGWChainedCache::Entry chained_entry(&chained, key, &data);
+  ASSERT_TRUE(cache->chain_cache_entry(entries, &chained_entry));
+  EXPECT_EQ(1u, chained.keys.count("chained"));
+
+  for (unsigned i = 0; i < 2; ++i) {
+    string name = "e" + std::to_string(i);
+    get(name);
+    get(name);
+    put(name);
+  }
+  EXPECT_FALSE(get("a"));
+  EXPECT_EQ(0u, chained.keys.count("chained"));
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+
+#include "rgw/rgw_get_obj_window.h"
+
+#define MB (1 << 20)
+
+TEST(GetObjWindow, MovingAverage)
+{
+  double avg = 0;
+  RGWGetObjWindow::update_avg(&avg, 16);
+  ASSERT_EQ(16, avg);
+  RGWGetObjWindow::update_avg(&avg, 24);
+  ASSERT_EQ(17, avg);
+  RGWGetObjWindow::update_avg(&avg, 9);
+  ASSERT_EQ(16, avg);
+}
+
+TEST(GetObjWindow, NeedsBothAverages)
+{
+  RGWGetObjWindow w(16 * MB, 128 * MB, 2);
+  ASSERT_EQ(16u * MB, w.get());
+  ASSERT_FALSE(w.data_drained(100 * MB, 1));
+  ASSERT_EQ(16u * MB, w.get());
+
+  RGWGetObjWindow w2(16 * MB, 128 * MB, 2);
+  ASSERT_FALSE(w2.read_complete(.1));
+  ASSERT_EQ(16u * MB, w2.get());
+}
+
+TEST(GetObjWindow, Target)
+{
+  // 100 MB/s times 100ms times 2
+  RGWGetObjWindow w(16 * MB, 128 * MB, 2);
+  w.data_drained(100 * MB, 1);
+  ASSERT_TRUE(w.read_complete(.1));
+  ASSERT_EQ(20u * MB, w.get());
+  ASSERT_FALSE(w.read_complete(.1));
+}
+
+TEST(GetObjWindow, GrowthCap)
+{
+  // a target of 400 MB only doubles the window per update
+  RGWGetObjWindow w(16 * MB, 1024 * MB, 2);
+  w.data_drained(1000 * MB, 1);
+  ASSERT_TRUE(w.read_complete(.2));
+  ASSERT_EQ(32u * MB, w.get());
+  ASSERT_TRUE(w.read_complete(.2));
+  ASSERT_EQ(64u * MB, w.get());
+  ASSERT_TRUE(w.read_complete(.2));
+  ASSERT_EQ(128u * MB, w.get());
+  ASSERT_TRUE(w.read_complete(.2));
+  ASSERT_EQ(256u * MB, w.get());
+  ASSERT_TRUE(w.read_complete(.2));
+  ASSERT_EQ(400u * MB, w.get());
+}
+
+TEST(GetObjWindow, Clamp)
+{
+  RGWGetObjWindow w(16 * MB, 32 * MB, 2);
+  w.data_drained(1000 * MB, 1);
+  for (int i = 0; i < 10; ++i)
+    w.read_complete(1);
+  ASSERT_EQ(32u * MB, w.get());
+
+  // a slow client shrinks it, but not below the min
+  for (int i = 0; i < 100; ++i)
+    w.data_drained(MB, 1);
+  ASSERT_EQ(16u * MB, w.get());
+}
+
+TEST(GetObjWindow, Fixed)
+{
+  // a max below the min keeps the window fixed
+  RGWGetObjWindow w(16 * MB, 8 * MB, 2);
+  w.data_drained(1000 * MB, 1);
+  ASSERT_FALSE(w.read_complete(1));
+  ASSERT_EQ(16u * MB, w.get());
+}
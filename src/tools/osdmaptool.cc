@@ -13,6 +13,7 @@
  */
 
 #include <string>
+#include <thread>
 #include <sys/stat.h>
 
 #include "common/ceph_argparse.h"
@@ -30,6 +31,9 @@ void usage()
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pgs [--pool <poolid>] [--pg_num <pg_num>] map all pgs" << std::endl;
   cout << "   --test-map-pgs-dump [--pool <poolid>] map all pgs" << std::endl;
+  cout << "   --test-map-pgs-diff <mapfile> [--pool <poolid>] show the pgs that move" << std::endl;
+  cout << "                           going from the osdmap in <mapfile> to this one" << std::endl;
+  cout << "   --threads <n>           map pgs with n threads (default: one per cpu)" << std::endl;
   cout << "   --mark-up-in            mark osds up and in (but do not persist)" << std::endl;
   cout << "   --clear-temp            clear pg_temp and primary_temp" << std::endl;
   cout << "   --test-random           do random placements" << std::endl;
@@ -39,6 +43,18 @@ void usage()
   exit(1);
 }
 
+/// mark every osd up and in, with a crush weight of 1 if it has none
+static void mark_all_up_in(OSDMap& osdmap)
+{
+  int n = osdmap.get_max_osd();
+  for (int i=0; i<n; i++) {
+    osdmap.set_state(i, osdmap.get_state(i) | CEPH_OSD_UP);
+    osdmap.set_weight(i, CEPH_OSD_IN);
+    if (osdmap.crush->get_item_weight(i) == 0)
+      osdmap.crush->adjust_item_weightf(g_ceph_context, i, 1.0);
+  }
+}
+
 int main(int argc, const char **argv)
 {
   vector<const char*> args;
@@ -64,6 +80,8 @@ int main(int argc, const char **argv)
   bool clobber = false;
   bool modified = false;
   std::string export_crush, import_crush, test_map_pg, test_map_object;
+  std::string test_map_pgs_diff;
+  int threads = MAX(1u, std::thread::hardware_concurrency());
   bool test_crush = false;
   int range_first = -1;
   int range_last = -1;
@@ -132,6 +150,17 @@ int main(int argc, const char **argv)
       test_map_pg = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--test_map_object", (char*)NULL)) {
       test_map_object = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--test-map-pgs-diff", (char*)NULL)) {
+      test_map_pgs_diff = val;
+    } else if (ceph_argparse_witharg(args, i, &threads, err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+        cerr << err.str() << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      if (threads < 1) {
+        cerr << "--threads must be at least 1" << std::endl;
+        exit(EXIT_FAILURE);
+      }
     } else if (ceph_argparse_flag(args, i, "--test_crush", (char*)NULL)) {
       test_crush = true;
     } else if (ceph_argparse_witharg(args, i, &val, err, "--pg_num", (char*)NULL)) {
@@ -232,12 +261,7 @@ int main(int argc, const char **argv)
 
   if (mark_up_in) {
     cout << "marking all OSDs up and in" << std::endl;
-    int n = osdmap.get_max_osd();
-    for (int i=0; i<n; i++) {
-      osdmap.set_state(i, osdmap.get_state(i) | CEPH_OSD_UP);
-      osdmap.set_weight(i, CEPH_OSD_IN);
-      osdmap.crush->adjust_item_weightf(g_ceph_context, i, 1.0);
-    }
+    mark_all_up_in(osdmap);
   }
   if (clear_temp) {
     cout << "clearing pg/primary temp" << std::endl;
@@ -338,13 +362,21 @@ int main(int argc, const char **argv)
     if (test_random)
       srand(getpid());
     map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
+    if (pg_num > 0) {
+      for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
+	   p != pools.end(); ++p) {
+	if (pool == -1 || p->first == pool)
+	  p->second.set_pg_num(pg_num);
+      }
+    }
+    // map them all up front, in parallel
+    if (!test_random)
+      osdmap.build_pg_mapping(threads);
     for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
 	 p != pools.end(); ++p) {
       if (pool != -1 && p->first != pool)
 	continue;
-      if (pg_num > 0) 
-        p->second.set_pg_num(pg_num);
-      
+
       cout << "pool " << p->first
 	   << " pg_num " << p->second.get_pg_num() << std::endl;
       for (unsigned i = 0; i < p->second.get_pg_num(); ++i) {
@@ -436,6 +468,121 @@ int main(int argc, const char **argv)
       cout << "size " << i << "\t" << size[i] << std::endl;
     }
   }
+  if (!test_map_pgs_diff.empty()) {
+    OSDMap before;
+    bufferlist bbl;
+    std::string error;
+    r = bbl.read_file(test_map_pgs_diff.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": couldn't open " << test_map_pgs_diff << ": " << error
+	   << std::endl;
+      exit(1);
+    }
+    try {
+      before.decode(bbl);
+    } catch (const buffer::error &e) {
+      cerr << me << ": error decoding osdmap '" << test_map_pgs_diff << "'"
+	   << std::endl;
+      exit(1);
+    }
+    if (pool != -1 && !osdmap.have_pg_pool(pool)) {
+      cerr << "There is no pool " << pool << std::endl;
+      exit(1);
+    }
+    if (mark_up_in)
+      mark_all_up_in(before);
+    before.build_pg_mapping(threads);
+    osdmap.build_pg_mapping(threads);
+
+    // a pg's data is where the old map puts it (folded into its
+    // parent if it was split since); a shard moves when the new map
+    // puts it on an osd that did not have it
+    int n = MAX(osdmap.get_max_osd(), before.get_max_osd());
+    vector<int> shards_before(n, 0), shards_after(n, 0);
+    vector<int> shards_in(n, 0), shards_out(n, 0);
+    uint64_t total_pgs = 0, total_moved_pgs = 0;
+    uint64_t total_shards = 0, total_moved_shards = 0;
+    const map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
+    for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+	 p != pools.end(); ++p) {
+      if (pool != -1 && p->first != pool)
+	continue;
+      if (!before.have_pg_pool(p->first)) {
+	cout << "pool " << p->first << " is new" << std::endl;
+	continue;
+      }
+      uint64_t moved_pgs = 0, shards = 0, moved_shards = 0;
+      for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps) {
+	pg_t pgid(ps, p->first);
+	vector<int> from, to;
+	int from_primary, to_primary;
+	before.pg_to_acting_osds(pgid, &from, &from_primary);
+	osdmap.pg_to_acting_osds(pgid, &to, &to_primary);
+	unsigned moved = 0;
+	for (unsigned i = 0; i < from.size(); ++i) {
+	  if (from[i] != CRUSH_ITEM_NONE && from[i] < n)
+	    shards_before[from[i]]++;
+	}
+	for (unsigned i = 0; i < to.size(); ++i) {
+	  if (to[i] == CRUSH_ITEM_NONE || to[i] >= n)
+	    continue;
+	  shards_after[to[i]]++;
+	  ++shards;
+	  // erasure coded shards are positional
+	  bool had = p->second.can_shift_osds() ?
+	    std::find(from.begin(), from.end(), to[i]) != from.end() :
+	    (i < from.size() && from[i] == to[i]);
+	  if (!had) {
+	    ++moved;
+	    shards_in[to[i]]++;
+	  }
+	}
+	for (unsigned i = 0; i < from.size(); ++i) {
+	  if (from[i] == CRUSH_ITEM_NONE || from[i] >= n)
+	    continue;
+	  bool kept = p->second.can_shift_osds() ?
+	    std::find(to.begin(), to.end(), from[i]) != to.end() :
+	    (i < to.size() && to[i] == from[i]);
+	  if (!kept)
+	    shards_out[from[i]]++;
+	}
+	if (moved) {
+	  ++moved_pgs;
+	  moved_shards += moved;
+	  cout << pgid << "\t" << from << "\t" << from_primary << "\t->\t"
+	       << to << "\t" << to_primary << std::endl;
+	}
+      }
+      cout << "pool " << p->first << " pg_num " << p->second.get_pg_num()
+	   << ": " << moved_pgs << " pgs move, " << moved_shards << "/"
+	   << shards << " shards";
+      if (shards)
+	cout << " (" << (100.0 * moved_shards / shards) << "% of the data)";
+      cout << std::endl;
+      total_pgs += p->second.get_pg_num();
+      total_moved_pgs += moved_pgs;
+      total_shards += shards;
+      total_moved_shards += moved_shards;
+    }
+
+    cout << "#osd\tbefore\tafter\tin\tout\n";
+    for (int i = 0; i < n; i++) {
+      if (!shards_in[i] && !shards_out[i])
+	continue;
+      cout << "osd." << i
+	   << "\t" << shards_before[i]
+	   << "\t" << shards_after[i]
+	   << "\t" << shards_in[i]
+	   << "\t" << shards_out[i]
+	   << std::endl;
+    }
+    cout << " " << total_moved_pgs << "/" << total_pgs << " pgs move, "
+	 << total_moved_shards << "/" << total_shards << " shards";
+    if (total_shards)
+      cout << " (" << (100.0 * total_moved_shards / total_shards)
+	   << "% of the data)";
+    cout << std::endl;
+  }
   if (test_crush) {
     int pass = 0;
     while (1) {
@@ -470,7 +617,7 @@ int main(int argc, const char **argv)
   if (!print && !tree && !modified &&
       export_crush.empty() && import_crush.empty() && 
       test_map_pg.empty() && test_map_object.empty() &&
-      !test_map_pgs && !test_map_pgs_dump) {
+      !test_map_pgs && !test_map_pgs_dump && test_map_pgs_diff.empty()) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }